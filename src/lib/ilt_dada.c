@@ -4,9 +4,17 @@
 #include "ilt_dada.h"
 #include <limits.h>
 
+// The socket filter keeps passing packets for this many iterations after the end packet, so the final batch can be filled if packets are lost
+#define ILTD_FILTER_END_ITERATIONS 2
+
+// Paced senders sleep until this long before a deadline, then spin, as clock_nanosleep routinely overshoots by tens of microseconds
+#define ILTD_PACE_SPIN_SECONDS 5e-5
+
 // Operations struct defaults
 const ilt_dada_operate_params ilt_dada_operate_params_default = {
 	.packetBuffer = NULL,
+	.packetBufferSize = 0,
+	.packetBufferMapped = 0,
 	.msgvec = NULL,
 	.iovecs = NULL,
 	.timeout = NULL,
@@ -16,7 +24,42 @@ const ilt_dada_operate_params ilt_dada_operate_params_default = {
 	.packetsLastSeen = 0,
 	.packetsLastExpected = 0,
 	.finalPacket = -1,
-	.bytesWritten = 0
+	.bytesWritten = 0,
+
+	.blockBuffer = NULL,
+	.blockSize = 0,
+	.blockOffset = 0,
+	.blockId = 0,
+
+	.blockFirstPacket = -1,
+	.blockSlots = 0,
+	.blockPresent = 0,
+	.packetsDiscarded = 0,
+
+	.queue = NULL,
+
+	.groMsgvec = NULL,
+	.groIovecs = NULL,
+	.groDiscarded = 0,
+
+	.receivers = NULL,
+
+	.packetRing = NULL,
+	.uring = NULL,
+
+	.sequence = { .highestPacket = -1, .duplicates = 0, .late = 0, .longestGap = 0, .kernelDrops = 0, .kernelDropsBase = 0 },
+	.sequenceWindow = NULL,
+
+	.badPackets = NULL,
+	.packetsCorrupted = 0,
+
+	.controlBuffer = NULL,
+	.rxTimestamps = NULL,
+	.latency = NULL,
+
+#ifdef ILTD_PHASE_TIMING
+	.phases = NULL,
+#endif
 };
 
 // Configuration struct defaults
@@ -28,6 +71,10 @@ const ilt_dada_config ilt_dada_config_default = {
 	.packetSize = MAX_UDP_LEN,
 	.portTimeout = 30,
 	.recvflags = 0,
+	.captureBackend = CAPTURE_RECVMMSG,
+	.interfaceName = "",
+	.busyPoll = 0,
+	.udpGro = 0,
 
 
 	// Recorder checks configuration
@@ -36,6 +83,20 @@ const ilt_dada_config ilt_dada_config_default = {
 	.checkInitData = 1,
 	.checkParameters = CHECK_FIRST_LAST,
 	.writesPerStatusLog = 256,
+	.zeroCopy = 0,
+	.captureCore = -1,
+	.pipelineDepth = 0,
+	.sequencePlacement = 0,
+	.fillPattern = 0,
+	.latencyStats = 0,
+	.hugePages = 0,
+	.prefault = 0,
+	.numaNode = -1,
+	.bindDevice = 0,
+	.receiveSockets = 1,
+	.realtimePriority = 0,
+	.helperCores = { { 0 } },
+	.captureCores = { { 0 } },
 
 	// Observation configuration
 	.startPacket = -1,
@@ -54,6 +115,7 @@ const ilt_dada_config ilt_dada_config_default = {
 	.params = NULL,
 	.io = NULL,
 	.state = 0,
+	.metrics = NULL,
 };
 
 
@@ -96,6 +158,96 @@ void ilt_dada_sleep_multilog(double seconds, multilog_t* mlog) {
 	nanosleep(&sleep, NULL);
 }
 
+/**
+ * @brief      Get the seconds between two timespecs
+ *
+ * @param[in]  start  The start time
+ * @param[in]  end    The end time
+ *
+ * @return     Elapsed seconds
+ */
+double ilt_dada_elapsed(const struct timespec *start, const struct timespec *end) {
+	return (double) (end->tv_sec - start->tv_sec) + (double) (end->tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+/**
+ * @brief      Offset a timespec by a number of seconds
+ *
+ * @param[in]  start    The start time
+ * @param[in]  seconds  The (positive) offset
+ *
+ * @return     The offset time
+ */
+struct timespec ilt_dada_time_offset(const struct timespec *start, double seconds) {
+	struct timespec result = { .tv_sec = start->tv_sec + (time_t) seconds, .tv_nsec = start->tv_nsec + (long) ((seconds - (double) (time_t) seconds) * 1e9) };
+	if (result.tv_nsec >= 1000000000l) {
+		result.tv_sec++;
+		result.tv_nsec -= 1000000000l;
+	}
+	return result;
+}
+
+/**
+ * @brief      Wait for a deadline, given in seconds after a CLOCK_MONOTONIC
+ *             start time; sleep until shortly before the deadline, then spin.
+ *             Deadlines are absolute, so a late wake-up does not delay the
+ *             following deadlines.
+ *
+ * @param[in]  start  The start time
+ * @param[in]  due    The deadline, in seconds after the start time
+ *
+ * @return     Seconds between the deadline and the time we returned
+ */
+double ilt_dada_pace(const struct timespec *start, double due) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (due - ilt_dada_elapsed(start, &now) > 2 * ILTD_PACE_SPIN_SECONDS) {
+		const struct timespec deadline = ilt_dada_time_offset(start, due - ILTD_PACE_SPIN_SECONDS);
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+	}
+
+	double elapsed;
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	} while ((elapsed = ilt_dada_elapsed(start, &now)) < due);
+
+	return elapsed - due;
+}
+
+
+// Option parsing
+
+/**
+ * @brief      Parse a comma separated list of integers
+ *
+ * @param[in]  inputStr   The input string
+ * @param      values     The output array
+ * @param[in]  maxValues  The length of the output array
+ *
+ * @return     >0: number of values parsed, -1: failure
+ */
+int ilt_dada_parse_list(const char *inputStr, int *values, int maxValues) {
+	int numValues = 0;
+	char *endPtr = (char*) inputStr;
+
+	do {
+		if (numValues == maxValues) {
+			fprintf(stderr, "ERROR: Too many values provided in %s (limit %d).\n", inputStr, maxValues);
+			return -1;
+		}
+
+		char *startPtr = (*endPtr == ',') ? endPtr + 1 : endPtr;
+		values[numValues] = (int) strtol(startPtr, &endPtr, 10);
+		if (endPtr == startPtr || (*endPtr != ',' && *endPtr != '\0')) {
+			fprintf(stderr, "ERROR: Failed to parse integer list %s.\n", inputStr);
+			return -1;
+		}
+		numValues++;
+	} while (*endPtr != '\0');
+
+	return numValues;
+}
+
 
 // Allocate and initialise the configuration, operations and I/O structs
 /**
@@ -141,6 +293,220 @@ ilt_dada_config* ilt_dada_init() {
 	return config;
 }
 
+/**
+ * @brief      Allocate a new ilt_dada_config struct with the same options as
+ *             an existing one, before the network or ringbuffer have been
+ *             initialised (e.g., for recording multiple ports in one process)
+ *
+ * @param[in]  src   The configuration struct to copy
+ *
+ * @return     ptr (success), NULL (failure)
+ */
+ilt_dada_config* ilt_dada_config_copy(const ilt_dada_config *src) {
+	if (src->state != UNINITIALISED) {
+		fprintf(stderr, "ERROR: Cannot copy a configuration struct after it has been initialised, exiting.\n");
+		return NULL;
+	}
+
+	ilt_dada_config *config = ilt_dada_init();
+	if (config == NULL) {
+		return NULL;
+	}
+
+	// Copy the options, but keep our own operations and I/O structs
+	ilt_dada_operate_params *params = config->params;
+	lofar_udp_io_write_config *io = config->io;
+	*config = *src;
+	config->params = params;
+	config->io = io;
+	// Metrics slots belong to a single port
+	config->metrics = NULL;
+
+	// Copy the ringbuffer options for the first (only) output
+	config->io->readerType = src->io->readerType;
+	config->io->numOutputs = src->io->numOutputs;
+	config->io->outputDadaKeys[0] = src->io->outputDadaKeys[0];
+	config->io->writeBufSize[0] = src->io->writeBufSize[0];
+	config->io->progressWithExisting = src->io->progressWithExisting;
+	config->io->dadaConfig = src->io->dadaConfig;
+
+	return config;
+}
+
+/**
+ * @brief      Build, bind and tune a single UDP socket for the given port
+ *
+ * @param      config      The ilt_dada_config configuration struct
+ * @param      serverInfo  The address to bind to, from getaddrinfo
+ *
+ * @return     >=0: the socket fd, -1: failure
+ */
+static int ilt_dada_initialise_socket(ilt_dada_config *config, struct addrinfo *serverInfo) {
+	// Build our socket from the results of getaddrinfo
+	int sockfd_init = -1;
+	if ((sockfd_init = socket(serverInfo->ai_family, serverInfo->ai_socktype, serverInfo->ai_flags)) == -1) {
+		fprintf(stderr, "ERROR: Failed to build socket on port %d (errno %d: %s).", config->portNum, errno, strerror(errno));
+		cleanup_initialise_port(NULL, sockfd_init);
+		return -1;
+	}
+
+	// Only accept packets from the given interface; requires CAP_NET_RAW on kernels before 5.7
+	if (config->bindDevice) {
+		if (setsockopt(sockfd_init, SOL_SOCKET, SO_BINDTODEVICE, config->interfaceName, strnlen(config->interfaceName, IF_NAMESIZE)) == -1) {
+			fprintf(stderr, "ERROR: Failed to bind port %d to interface %s (errno %d: %s).\n", config->portNum, config->interfaceName, errno, strerror(errno));
+			cleanup_initialise_port(NULL, sockfd_init);
+			return -1;
+		}
+	}
+
+	// Let the other receive sockets join this one on the same port; this must be set before binding
+	if (config->receiveSockets > 1) {
+		const int allowReusePort = 1;
+		if (setsockopt(sockfd_init, SOL_SOCKET, SO_REUSEPORT, &allowReusePort, sizeof(allowReusePort)) == -1) {
+			fprintf(stderr, "ERROR: Failed to set SO_REUSEPORT on port %d (errno %d: %s).\n", config->portNum, errno, strerror(errno));
+			cleanup_initialise_port(NULL, sockfd_init);
+			return -1;
+		}
+	}
+
+	// Attempt to bind to the socket
+	if (config->recvflags != -1) {
+		if (bind(sockfd_init, serverInfo->ai_addr, serverInfo->ai_addrlen) == -1) {
+			fprintf(stderr, "ERROR: Failed to bind to port %d (errno %d: %s).", config->portNum, errno, strerror(errno));
+			cleanup_initialise_port(NULL, sockfd_init);
+			return -1;
+		}
+	}
+
+	// We have successfully built and bound to a socket, let's tweak some of
+	// it's parameters
+
+
+	// Check if the port buffer is larger than the requested buffer size.
+	// We will then increase the buffer size if it is smaller than bufferSize
+	//
+	// getsockopt will return 2x the actual buffer size, as it includes extra
+	// space to account for the kernel overheads, hence the need to double
+	// bufferSize in this comparison
+	//
+	// https://linux.die.net/man/7/socket
+	// https://linux.die.net/man/2/setsockopt
+	long optVal = 0;
+	unsigned int optLen = sizeof(optVal);
+	if (getsockopt(sockfd_init, SOL_SOCKET, SO_RCVBUF, &optVal, &optLen) == -1) {
+		fprintf(stderr, "ERROR: Failed to get buffer size on port %d (errno%d: %s).\n", config->portNum, errno, strerror(errno));
+		cleanup_initialise_port(NULL, sockfd_init);
+		return -1;
+	}
+
+	if (optVal < (2 * config->portBufferSize - 1)) {
+		if (setsockopt(sockfd_init, SOL_SOCKET, SO_RCVBUF, &(config->portBufferSize), sizeof(config->portBufferSize)) == -1) {
+			fprintf(stderr, "ERROR: Failed to adjust buffer size on port %d (errno%d: %s).\n", config->portNum, errno, strerror(errno));
+			cleanup_initialise_port(NULL, sockfd_init);
+			return -1;
+		} else if (getsockopt(sockfd_init, SOL_SOCKET, SO_RCVBUF, &optVal, &optLen) == -1) {
+			fprintf(stderr, "ERROR: Unable to validate socket buffer size on port %d (errno %d: %s).\n", config->portNum, errno, strerror(errno));
+			cleanup_initialise_port(NULL, sockfd_init);
+			return -1;
+		} else if (optVal < (2 * config->portBufferSize - 1)) {
+			fprintf(stderr, "ERROR: Failed to fully adjust buffer size on port %d (attempted to set to %ld, call returned %ld).\n", config->portNum,
+			        config->portBufferSize * 2, optVal);
+			FILE *rmemMax = fopen("/proc/sys/net/core/rmem_max", "r");
+			if (rmemMax != NULL) {
+				long rmemMaxVal;
+				int dummy = fscanf(rmemMax, "%ld", &rmemMaxVal);
+				if (rmemMaxVal < config->portBufferSize) {
+					fprintf(stderr,
+					        "ERROR: This was because your kernel has the maximum UDP buffer size set to a lower value than you requested (%ld).\nERROR: Please increase the value stored in /proc/sys/net/core/rmem_max if you want to use a larger buffer.\n",
+					        rmemMaxVal);
+				} else if (dummy <= 0) {
+					fprintf(stderr,
+					        "ERROR: This may be due to your maximum socket buffer being too low, but we could not read /proc/sys/net/core/rmem_max to verify this.\n");
+				}
+				fprintf(stderr,
+				        "ERROR: You require root access to this machine resolve this issue. Please run the commands `echo 'net.core.rmem_max=%ld' | [sudo] tee -a /etc/sysctl.conf; sudo sysctl -p` to change your kernel properties.\n",
+				        (2 * config->portBufferSize - 1));
+				fprintf(stderr, "See the README.md for more details on this change.\n");
+				fclose(rmemMax);
+			}
+			cleanup_initialise_port(NULL, sockfd_init);
+			return -1;
+		}
+	}
+
+
+	// Without root permissions we can increase the port priority up to 6
+	// If we are below the value set by portPriority, adjust the port priority
+	// to the given value
+	if (getsockopt(sockfd_init, SOL_SOCKET, SO_PRIORITY, &optVal, &optLen) == -1) {
+		fprintf(stderr, "ERROR: Failed to get port priority on port %d (errno%d: %s).\n", config->portNum, errno, strerror(errno));
+		cleanup_initialise_port(NULL, sockfd_init);
+		return -1;
+	}
+
+	if (optVal < config->portPriority) {
+		if (setsockopt(sockfd_init, SOL_SOCKET, SO_PRIORITY, &(config->portPriority), sizeof(config->portPriority)) == -1) {
+			fprintf(stderr, "ERROR: Failed to adjust port priority on port %d (errno%d: %s).\n", config->portNum, errno, strerror(errno));
+			cleanup_initialise_port(NULL, sockfd_init);
+			return -1;
+		}
+	}
+
+
+	// Allow the port to be re-used, encase we are slow to cleanup after the end
+	// of our observation (either on our end or the process consuming the ringbuffer).
+	const int allowReuse = 1;
+	if (setsockopt(sockfd_init, SOL_SOCKET, SO_REUSEADDR, &allowReuse, sizeof(allowReuse)) == -1) {
+		fprintf(stderr, "ERROR: Failed to set port re-use property on port %d (errno%d: %s).\n", config->portNum, errno, strerror(errno));
+		cleanup_initialise_port(NULL, sockfd_init);
+		return -1;
+	}
+
+	// Set a hard cap on the timeout for receiving data from the socket. We can't fully
+	// 	trust recvmmsg here due to a known bug where the N_packs - 1 packet may block
+	// 	infinitely if it is never received
+	// 	https://man7.org/linux/man-pages/man2/recvmmsg.2.html#bugs
+	const struct timeval timeout = { .tv_sec = (time_t) config->portTimeout, .tv_usec = (suseconds_t) ((config->portTimeout - ((long) config->portTimeout)) *
+	                                                                                              1e6) };
+	if (setsockopt(sockfd_init, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == -1) {
+		fprintf(stderr, "ERROR: Failed to set timeout on port %d (errno%d: %s).\n", config->portNum, errno, strerror(errno));
+		cleanup_initialise_port(NULL, sockfd_init);
+		return -1;
+	}
+
+	// Ask the kernel to busy-poll the device queue when we read from an empty socket,
+	// 	rather than waiting for an interrupt. Raising the values above the net.core.busy_read
+	// 	sysctl / the default budget requires CAP_NET_ADMIN, so these are best-effort.
+	// 	https://docs.kernel.org/networking/napi.html#busy-polling
+	if (config->busyPoll) {
+		if (setsockopt(sockfd_init, SOL_SOCKET, SO_BUSY_POLL, &(config->busyPoll), sizeof(config->busyPoll)) == -1) {
+			fprintf(stderr, "WARNING: Failed to set busy-poll time on port %d, packets will still be spin-read (errno %d: %s).\n", config->portNum, errno, strerror(errno));
+		}
+
+		const int preferBusyPoll = 1;
+		if (setsockopt(sockfd_init, SOL_SOCKET, SO_PREFER_BUSY_POLL, &preferBusyPoll, sizeof(preferBusyPoll)) == -1) {
+			fprintf(stderr, "WARNING: Failed to set preferred busy-polling on port %d (errno %d: %s).\n", config->portNum, errno, strerror(errno));
+		}
+
+		const int busyPollBudget = config->packetsPerIteration;
+		if (setsockopt(sockfd_init, SOL_SOCKET, SO_BUSY_POLL_BUDGET, &busyPollBudget, sizeof(busyPollBudget)) == -1) {
+			fprintf(stderr, "WARNING: Failed to set busy-poll budget on port %d (errno %d: %s).\n", config->portNum, errno, strerror(errno));
+		}
+	}
+
+	// Let the kernel coalesce runs of equally sized datagrams into a single receive, which are split up again in ilt_dada_receive_batch
+	// 	https://lwn.net/Articles/768995/
+	if (config->udpGro) {
+		const int enableGro = 1;
+		if (setsockopt(sockfd_init, SOL_UDP, UDP_GRO, &enableGro, sizeof(enableGro)) == -1) {
+			fprintf(stderr, "WARNING: Failed to enable UDP GRO on port %d, packets will be received individually (errno %d: %s).\n", config->portNum, errno, strerror(errno));
+			config->udpGro = 0;
+		}
+	}
+
+	return sockfd_init;
+}
+
 /**
  * @brief      Initialise a UDP network socket following the given configuration struct
  *
@@ -189,116 +555,24 @@ int ilt_dada_initialise_port(ilt_dada_config *config) {
 		}
 
 
-		// Build our socket from the results of getaddrinfo
-		int sockfd_init = -1;
-		if ((sockfd_init = socket(serverInfo->ai_family, serverInfo->ai_socktype, serverInfo->ai_flags)) == -1) {
-			fprintf(stderr, "ERROR: Failed to build socket on port %d (errno %d: %s).", config->portNum, errno, strerror(errno));
-			cleanup_initialise_port(serverInfo, sockfd_init);
-			return -1;
-		}
-
-		// Attempt to bind to the socket
-		if (config->recvflags != -1) {
-			if (bind(sockfd_init, serverInfo->ai_addr, serverInfo->ai_addrlen) == -1) {
-				fprintf(stderr, "ERROR: Failed to bind to port %d (errno %d: %s).", config->portNum, errno, strerror(errno));
-				cleanup_initialise_port(serverInfo, sockfd_init);
-				return -1;
-			}
-		}
-
-		// We have successfully built and bound to a socket, let's tweak some of
-		// it's parameters
-
-
-		// Check if the port buffer is larger than the requested buffer size.
-		// We will then increase the buffer size if it is smaller than bufferSize
-		//
-		// getsockopt will return 2x the actual buffer size, as it includes extra
-		// space to account for the kernel overheads, hence the need to double
-		// bufferSize in this comparison
-		//
-		// https://linux.die.net/man/7/socket
-		// https://linux.die.net/man/2/setsockopt
-		long optVal = 0;
-		unsigned int optLen = sizeof(optVal);
-		if (getsockopt(sockfd_init, SOL_SOCKET, SO_RCVBUF, &optVal, &optLen) == -1) {
-			fprintf(stderr, "ERROR: Failed to get buffer size on port %d (errno%d: %s).\n", config->portNum, errno, strerror(errno));
-			cleanup_initialise_port(serverInfo, sockfd_init);
-			return -1;
-		}
-
-		if (optVal < (2 * config->portBufferSize - 1)) {
-			if (setsockopt(sockfd_init, SOL_SOCKET, SO_RCVBUF, &(config->portBufferSize), sizeof(config->portBufferSize)) == -1) {
-				fprintf(stderr, "ERROR: Failed to adjust buffer size on port %d (errno%d: %s).\n", config->portNum, errno, strerror(errno));
-				cleanup_initialise_port(serverInfo, sockfd_init);
-				return -1;
-			} else if (getsockopt(sockfd_init, SOL_SOCKET, SO_RCVBUF, &optVal, &optLen) == -1) {
-				fprintf(stderr, "ERROR: Unable to validate socket buffer size on port %d (errno %d: %s).\n", config->portNum, errno, strerror(errno));
-				cleanup_initialise_port(serverInfo, sockfd_init);
-				return -1;
-			} else if (optVal < (2 * config->portBufferSize - 1)) {
-				fprintf(stderr, "ERROR: Failed to fully adjust buffer size on port %d (attempted to set to %ld, call returned %ld).\n", config->portNum,
-				        config->portBufferSize * 2, optVal);
-				FILE *rmemMax = fopen("/proc/sys/net/core/rmem_max", "r");
-				if (rmemMax != NULL) {
-					long rmemMaxVal;
-					int dummy = fscanf(rmemMax, "%ld", &rmemMaxVal);
-					if (rmemMaxVal < config->portBufferSize) {
-						fprintf(stderr,
-						        "ERROR: This was because your kernel has the maximum UDP buffer size set to a lower value than you requested (%ld).\nERROR: Please increase the value stored in /proc/sys/net/core/rmem_max if you want to use a larger buffer.\n",
-						        rmemMaxVal);
-					} else if (dummy <= 0) {
-						fprintf(stderr,
-						        "ERROR: This may be due to your maximum socket buffer being too low, but we could not read /proc/sys/net/core/rmem_max to verify this.\n");
-					}
-					fprintf(stderr,
-					        "ERROR: You require root access to this machine resolve this issue. Please run the commands `echo 'net.core.rmem_max=%ld' | [sudo] tee -a /etc/sysctl.conf; sudo sysctl -p` to change your kernel properties.\n",
-					        (2 * config->portBufferSize - 1));
-					fprintf(stderr, "See the README.md for more details on this change.\n");
-					fclose(rmemMax);
+		// Build a socket for every receive thread; when there is more than one, they share the port through SO_REUSEPORT
+		for (int socketIdx = 0; socketIdx < config->receiveSockets; socketIdx++) {
+			if ((config->receiveSockfds[socketIdx] = ilt_dada_initialise_socket(config, serverInfo)) == -1) {
+				for (int closeIdx = 0; closeIdx < socketIdx; closeIdx++) {
+					cleanup_initialise_port(NULL, config->receiveSockfds[closeIdx]);
 				}
-				cleanup_initialise_port(serverInfo, sockfd_init);
+				cleanup_initialise_port(serverInfo, -1);
 				return -1;
 			}
 		}
+		const int sockfd_init = config->receiveSockfds[0];
 
-
-		// Without root permissions we can increase the port priority up to 6
-		// If we are below the value set by portPriority, adjust the port priority
-		// to the given value
-		if (getsockopt(sockfd_init, SOL_SOCKET, SO_PRIORITY, &optVal, &optLen) == -1) {
-			fprintf(stderr, "ERROR: Failed to get port priority on port %d (errno%d: %s).\n", config->portNum, errno, strerror(errno));
-			cleanup_initialise_port(serverInfo, sockfd_init);
-			return -1;
-		}
-
-		if (optVal < config->portPriority) {
-			if (setsockopt(sockfd_init, SOL_SOCKET, SO_PRIORITY, &(config->portPriority), sizeof(config->portPriority)) == -1) {
-				fprintf(stderr, "ERROR: Failed to adjust port priority on port %d (errno%d: %s).\n", config->portNum, errno, strerror(errno));
-				cleanup_initialise_port(serverInfo, sockfd_init);
-				return -1;
+		// Spread the packets across the sockets by their sequence number
+		if (config->receiveSockets > 1 && ilt_dada_reuseport_steer(config) < 0) {
+			for (int closeIdx = 0; closeIdx < config->receiveSockets; closeIdx++) {
+				cleanup_initialise_port(NULL, config->receiveSockfds[closeIdx]);
 			}
-		}
-
-
-		// Allow the port to be re-used, encase we are slow to cleanup after the end
-		// of our observation (either on our end or the process consuming the ringbuffer).
-		const int allowReuse = 1;
-		if (setsockopt(sockfd_init, SOL_SOCKET, SO_REUSEADDR, &allowReuse, sizeof(allowReuse)) == -1) {
-			fprintf(stderr, "ERROR: Failed to set port re-use property on port %d (errno%d: %s).\n", config->portNum, errno, strerror(errno));
-			cleanup_initialise_port(serverInfo, sockfd_init);
-			return -1;
-		}
-
-		// Set a hard cap on the timeout for receiving data from the socket. We can't fully
-		// 	trust recvmmsg here due to a known bug where the N_packs - 1 packet may block
-		// 	infinitely if it is never received
-		// 	https://man7.org/linux/man-pages/man2/recvmmsg.2.html#bugs
-		const struct timeval timeout = { .tv_sec = (time_t) config->portTimeout, .tv_usec = (suseconds_t) ((config->portTimeout - ((long) config->portTimeout)) *
-		                                                                                              1e6) };
-		if (setsockopt(sockfd_init, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == -1) {
-			fprintf(stderr, "ERROR: Failed to set timeout on port %d (errno%d: %s).\n", config->portNum, errno, strerror(errno));
-			cleanup_initialise_port(serverInfo, sockfd_init);
+			cleanup_initialise_port(serverInfo, -1);
 			return -1;
 		}
 
@@ -307,6 +581,11 @@ int ilt_dada_initialise_port(ilt_dada_config *config) {
 		// Return the socket fd and exit
 		config->sockfd = sockfd_init;
 		config->state |= NETWORK_READY;
+
+		// If we already know when the observation is, stop the kernel from queuing packets before it starts
+		if (config->startPacket > 0) {
+			ilt_dada_attach_time_filter(config);
+		}
 	}
 
 	return 0;
@@ -328,7 +607,137 @@ void cleanup_initialise_port(struct addrinfo *serverInfo, int sockfd_init) {
 	// Close the socket if it was successfully created
 	if (sockfd_init != -1) {
 		shutdown(sockfd_init, SHUT_RDWR);
+		close(sockfd_init);
+	}
+}
+
+/**
+ * @brief      Add the instructions to load a little-endian 32-bit word from the
+ *             packet to a socket filter; BPF_W loads are big-endian, so the
+ *             word is built one byte at a time
+ *
+ * @param      code    The filter instructions (13 are added)
+ * @param[in]  offset  The offset of the word in the packet
+ *
+ * @return     The number of instructions added
+ */
+int ilt_dada_filter_load_le32(struct sock_filter *code, unsigned int offset) {
+	int idx = 0;
+	code[idx++] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_B | BPF_ABS, offset + 3);
+	for (int byte = 2; byte >= 0; byte--) {
+		code[idx++] = (struct sock_filter) BPF_STMT(BPF_ALU | BPF_LSH | BPF_K, 8);
+		code[idx++] = (struct sock_filter) BPF_STMT(BPF_MISC | BPF_TAX, 0);
+		code[idx++] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_B | BPF_ABS, offset + byte);
+		code[idx++] = (struct sock_filter) BPF_STMT(BPF_ALU | BPF_OR | BPF_X, 0);
+	}
+	return idx;
+}
+
+/**
+ * @brief      Attach a socket filter that drops packets before the start packet
+ *             and after the end of the observation, so that the kernel
+ *             discards them rather than waking the recorder up to read them.
+ *
+ *             The packet number depends on the clock, so the (timestamp,
+ *             sequence) pairs of the start and end packets are computed for
+ *             both clocks and the filter compares the header against the pair
+ *             for the packet's clock bit. Packets that are too short to hold
+ *             a CEP header are dropped.
+ *
+ * @param      config  The ilt_dada configuration struct
+ *
+ * @return     0: success, -1: failure (packets are not filtered)
+ */
+int ilt_dada_attach_time_filter(ilt_dada_config *config) {
+	if (!(config->state & NETWORK_READY) || config->startPacket < 1) {
+		fprintf(stderr, "ERROR: The socket and start packet must be set before attaching a filter on port %d.\n", config->portNum);
+		return -1;
+	}
+
+	// UDP socket filters see the UDP header before the payload
+	const unsigned int payload = 8;
+	// Each socket only receives a share of the packets after the end, give every receive thread enough to fill a batch
+	const long endPacket = config->endPacket > config->startPacket ? config->endPacket + ILTD_FILTER_END_ITERATIONS * config->packetsPerIteration * config->receiveSockets : -1;
+
+	// Start/end (timestamp, sequence) for the 160MHz and 200MHz clocks; without an end packet, the end is never reached
+	uint32_t startTime[2], startSequence[2], endTime[2] = { UINT32_MAX, UINT32_MAX }, endSequence[2] = { UINT32_MAX, UINT32_MAX };
+	int8_t header[UDPHDRLEN];
+	for (int clockBit = 0; clockBit < 2; clockBit++) {
+		ilt_dada_packno_to_header(header, config->startPacket, clockBit, 0, 0);
+		memcpy(&(startTime[clockBit]), &(header[8]), sizeof(uint32_t));
+		memcpy(&(startSequence[clockBit]), &(header[12]), sizeof(uint32_t));
+
+		if (endPacket > 0) {
+			ilt_dada_packno_to_header(header, endPacket, clockBit, 0, 0);
+			memcpy(&(endTime[clockBit]), &(header[8]), sizeof(uint32_t));
+			memcpy(&(endSequence[clockBit]), &(header[12]), sizeof(uint32_t));
+		}
+	}
+
+	// Load the timestamp to M[0], the sequence to M[1], then pick the comparisons for the clock bit (source byte bit 7)
+	struct sock_filter code[64];
+	int idx = 0;
+	idx += ilt_dada_filter_load_le32(&(code[idx]), payload + 8);
+	code[idx++] = (struct sock_filter) BPF_STMT(BPF_ST, 0);
+	idx += ilt_dada_filter_load_le32(&(code[idx]), payload + 12);
+	code[idx++] = (struct sock_filter) BPF_STMT(BPF_ST, 1);
+	code[idx++] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_B | BPF_ABS, payload + 1);
+
+	// Each comparison section is 10 instructions long, followed by the accept and drop returns
+	const int sectionLength = 10;
+	code[idx] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x80, 0, sectionLength);
+	idx++;
+	const int accept = idx + 2 * sectionLength, drop = accept + 1;
+	for (int section = 0; section < 2; section++) {
+		const int clockBit = 1 - section, base = idx;
+		// Drop if (timestamp, sequence) < start
+		code[idx++] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_MEM, 0);
+		code[idx++] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, startTime[clockBit], 3, 0);
+		code[idx++] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, startTime[clockBit], 0, drop - (base + 3));
+		code[idx++] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_MEM, 1);
+		code[idx++] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, startSequence[clockBit], 0, drop - (base + 5));
+		// Drop if (timestamp, sequence) > end
+		code[idx++] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_MEM, 0);
+		code[idx++] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, endTime[clockBit], drop - (base + 7), 0);
+		code[idx++] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, endTime[clockBit], 0, accept - (base + 8));
+		code[idx++] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_MEM, 1);
+		code[idx++] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, endSequence[clockBit], drop - (base + 10), accept - (base + 10));
+	}
+	code[idx++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, 0xffffffff);
+	code[idx++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, 0);
+
+	const struct sock_fprog filter = { .len = (unsigned short) idx, .filter = code };
+	for (int socketIdx = 0; socketIdx < config->receiveSockets; socketIdx++) {
+		if (setsockopt(config->receiveSockfds[socketIdx], SOL_SOCKET, SO_ATTACH_FILTER, &filter, sizeof(filter)) == -1) {
+			fprintf(stderr, "WARNING: Failed to attach start time filter on port %d, packets before the start will be discarded while warming up (errno %d: %s).\n", config->portNum, errno, strerror(errno));
+			config->state |= NETWORK_FILTERED;
+			ilt_dada_detach_time_filter(config);
+			return -1;
+		}
+	}
+
+	config->state |= NETWORK_FILTERED;
+	return 0;
+}
+
+/**
+ * @brief      Remove the start time filter from the sockets, if it is attached
+ *
+ * @param      config  The ilt_dada configuration struct
+ */
+void ilt_dada_detach_time_filter(ilt_dada_config *config) {
+	if (!(config->state & NETWORK_FILTERED)) {
+		return;
+	}
+
+	// Sockets that never had the filter attached return ENOENT
+	const int dummy = 0;
+	for (int socketIdx = 0; socketIdx < config->receiveSockets; socketIdx++) {
+		if (setsockopt(config->receiveSockfds[socketIdx], SOL_SOCKET, SO_DETACH_FILTER, &dummy, sizeof(dummy)) == -1 && errno != ENOENT) {
+			fprintf(stderr, "WARNING: Failed to detach start time filter on port %d (errno %d: %s).\n", config->portNum, errno, strerror(errno));
+		}
 	}
+	config->state &= ~NETWORK_FILTERED;
 }
 
 
@@ -394,6 +803,49 @@ int ilt_dada_check_config(ilt_dada_config *config, config_states expectedState)
 		return -1;
 	}
 
+	// capture_backend_types captureBackend;
+	if (config->captureBackend != CAPTURE_RECVMMSG && config->captureBackend != CAPTURE_PACKET_MMAP && config->captureBackend != CAPTURE_IO_URING) {
+		fprintf(stderr, "ERROR: Unknown capture backend requested (%d).\n", config->captureBackend);
+		return -1;
+	}
+#ifndef ILTD_HAVE_IO_URING
+	if (config->captureBackend == CAPTURE_IO_URING) {
+		fprintf(stderr, "ERROR: The io_uring capture backend was requested, but ILTDada was compiled without liburing.\n");
+		return -1;
+	}
+#endif
+	if (config->captureBackend == CAPTURE_IO_URING && (config->zeroCopy || config->pipelineDepth)) {
+		fprintf(stderr, "ERROR: The io_uring capture backend manages its own packet buffers and cannot be combined with zero-copy or pipelined capture.\n");
+		return -1;
+	}
+
+	// char interfaceName[IF_NAMESIZE];
+	if (config->captureBackend == CAPTURE_PACKET_MMAP && strnlen(config->interfaceName, IF_NAMESIZE) == 0) {
+		fprintf(stderr, "ERROR: An interface name must be provided to capture packets with AF_PACKET.\n");
+		return -1;
+	}
+
+	// int busyPoll;
+	if (config->busyPoll < 0) {
+		fprintf(stderr, "ERROR: busyPoll is negative (%d).\n", config->busyPoll);
+		return -1;
+	} else if (config->busyPoll && config->captureBackend == CAPTURE_IO_URING) {
+		fprintf(stderr, "ERROR: Busy-polling is not supported by the io_uring capture backend.\n");
+		return -1;
+	}
+
+	// int udpGro;
+	if (config->udpGro < 0 || config->udpGro > 1) {
+		fprintf(stderr, "ERROR: udpGro is not in a boolean state (%d).\n", config->udpGro);
+		return -1;
+	} else if (config->udpGro && config->captureBackend != CAPTURE_RECVMMSG) {
+		fprintf(stderr, "ERROR: UDP GRO is only supported by the recvmmsg capture backend.\n");
+		return -1;
+	} else if (config->udpGro && config->latencyStats) {
+		fprintf(stderr, "ERROR: UDP GRO cannot be combined with latency statistics (coalesced packets share a single receive timestamp).\n");
+		return -1;
+	}
+
 	// ILTDada runtime options
 	// int forceStartup;
 	if (config->forceStartup < 0 || config->forceStartup > 1) {
@@ -404,6 +856,10 @@ int ilt_dada_check_config(ilt_dada_config *config, config_states expectedState)
 	// int checkInitParameters;
 	// int checkInitData;
 	// check_parameter_types checkParameters;
+	if (config->checkParameters != NO_CHECKS && config->checkParameters != CHECK_ALL_PACKETS && config->checkParameters != CHECK_FIRST_LAST) {
+		fprintf(stderr, "ERROR: Unknown packet check mode requested (%d).\n", config->checkParameters);
+		return -1;
+	}
 
 	// int writesPerStatusLog;
 	if (config->writesPerStatusLog < 0) {
@@ -411,44 +867,151 @@ int ilt_dada_check_config(ilt_dada_config *config, config_states expectedState)
 		return -1;
 	}
 
-	// Observation configuration
-
-	// long startPacket;
-	// long endPacket;
-	if (config->state & NETWORK_READY) {
-		if (config->startPacket < LFREPOCH) {
-			fprintf(stderr, "ERROR: Start packet is before 2008 (uninitialised? %ld).", config->startPacket);
-			return -1;
-		}
+	// int zeroCopy;
+	if (config->zeroCopy < 0 || config->zeroCopy > 1) {
+		fprintf(stderr, "ERROR: zeroCopy is not in a boolean state (%d).\n", config->zeroCopy);
+		return -1;
+	}
 
-		if (config->endPacket < LFREPOCH) {
-			fprintf(stderr, "ERROR: End packet is before 2008 (uninitialised? %ld).", config->endPacket);
-			return -1;
-		}
+	// int pipelineDepth;
+	if (config->pipelineDepth < 0 || config->pipelineDepth == 1) {
+		fprintf(stderr, "ERROR: pipelineDepth must be 0 (disabled) or at least 2 batches (%d).\n", config->pipelineDepth);
+		return -1;
+	} else if (config->pipelineDepth && config->zeroCopy) {
+		fprintf(stderr, "ERROR: Pipelined capture and zero-copy capture cannot be used at the same time.\n");
+		return -1;
 	}
 
-	// int packetsPerIteration;
-	if (config->packetsPerIteration < 1) {
-		fprintf(stderr, "ERROR: Requested less than 1 packet per read operation (%d).\n", config->packetsPerIteration);
+	// int sequencePlacement;
+	if (config->sequencePlacement < 0 || config->sequencePlacement > 1) {
+		fprintf(stderr, "ERROR: sequencePlacement is not in a boolean state (%d).\n", config->sequencePlacement);
+		return -1;
+	} else if (config->sequencePlacement && config->zeroCopy) {
+		fprintf(stderr, "ERROR: Sequence-indexed placement and zero-copy capture cannot be used at the same time.\n");
 		return -1;
 	}
 
+	// int fillPattern;
+	if (config->fillPattern < 0 || config->fillPattern > UINT8_MAX) {
+		fprintf(stderr, "ERROR: fillPattern must be a single byte value (%d).\n", config->fillPattern);
+		return -1;
+	} else if (config->sequencePlacement && config->fillPattern == UDPCURVER) {
+		fprintf(stderr, "ERROR: fillPattern cannot match the CEP header version byte (%d), filled packets would look like received packets.\n", UDPCURVER);
+		return -1;
+	}
 
+	// int latencyStats;
+	if (config->latencyStats < 0 || config->latencyStats > 1) {
+		fprintf(stderr, "ERROR: latencyStats is not in a boolean state (%d).\n", config->latencyStats);
+		return -1;
+	} else if (config->latencyStats && config->captureBackend == CAPTURE_IO_URING) {
+		fprintf(stderr, "ERROR: Latency statistics are not supported by the io_uring capture backend.\n");
+		return -1;
+	}
 
-	// unsigned char obsClockBit;
+	// int hugePages;
+	if (config->hugePages != 0 && config->hugePages != 2 && config->hugePages != 1024) {
+		fprintf(stderr, "ERROR: hugePages must be 0 (disabled), 2 or 1024 (MB) (%d).\n", config->hugePages);
+		return -1;
+	}
 
+	// int prefault;
+	if (config->prefault < 0 || config->prefault > 1) {
+		fprintf(stderr, "ERROR: prefault is not in a boolean state (%d).\n", config->prefault);
+		return -1;
+	}
 
-	// Ringbuffer working variables
-	// int sockfd;
-	if (config->state & NETWORK_READY) {
-		if (config->obsClockBit > 2) {
-			fprintf(stderr, "ERROR: obsClockBit does not appear to be correctly set (%d)\n", config->obsClockBit);
-		}
+	// int numaNode;
+	if (config->numaNode < ILTD_NUMA_AUTO || config->numaNode >= ILTD_NUMA_MAX_NODES) {
+		fprintf(stderr, "ERROR: numaNode is outside of the supported range (%d, limit %d).\n", config->numaNode, ILTD_NUMA_MAX_NODES);
+		return -1;
+	} else if (config->numaNode == ILTD_NUMA_AUTO && strnlen(config->interfaceName, IF_NAMESIZE) == 0) {
+		fprintf(stderr, "ERROR: An interface name must be provided to place buffers on its NUMA node.\n");
+		return -1;
+	}
 
-		if (config->sockfd < 0) {
-			fprintf(stderr, "ERROR: state indicates network is ready, but socket is not set.\n");
-			return -1;
-		}
+	// int bindDevice;
+	if (config->bindDevice < 0 || config->bindDevice > 1) {
+		fprintf(stderr, "ERROR: bindDevice is not in a boolean state (%d).\n", config->bindDevice);
+		return -1;
+	} else if (config->bindDevice && strnlen(config->interfaceName, IF_NAMESIZE) == 0) {
+		fprintf(stderr, "ERROR: An interface name must be provided to bind the socket to a device.\n");
+		return -1;
+	}
+
+	// int receiveSockets;
+	if (config->receiveSockets < 1 || config->receiveSockets > ILTD_MAX_RECEIVE_SOCKETS) {
+		fprintf(stderr, "ERROR: receiveSockets is outside of the supported range (%d, limit %d).\n", config->receiveSockets, ILTD_MAX_RECEIVE_SOCKETS);
+		return -1;
+	} else if (config->receiveSockets > 1) {
+		if (config->captureBackend != CAPTURE_RECVMMSG) {
+			fprintf(stderr, "ERROR: Multiple receive sockets are only supported by the recvmmsg capture backend.\n");
+			return -1;
+		} else if (!config->pipelineDepth) {
+			fprintf(stderr, "ERROR: Multiple receive sockets require pipelined capture, to size each socket's batch queue.\n");
+			return -1;
+		} else if (config->latencyStats) {
+			fprintf(stderr, "ERROR: Latency statistics are not supported with multiple receive sockets.\n");
+			return -1;
+		}
+	}
+
+	// int captureCore;
+	if (config->captureCore < -1 || config->captureCore >= CPU_SETSIZE) {
+		fprintf(stderr, "ERROR: captureCore is outside of the supported range (%d, limit %d).\n", config->captureCore, CPU_SETSIZE);
+		return -1;
+	}
+
+	// int realtimePriority;
+	if (config->realtimePriority < 0 || config->realtimePriority > sched_get_priority_max(SCHED_FIFO)) {
+		fprintf(stderr, "ERROR: realtimePriority is outside of the supported range (%d, limit %d).\n", config->realtimePriority, sched_get_priority_max(SCHED_FIFO));
+		return -1;
+	}
+
+	// cpu_set_t helperCores;
+	// cpu_set_t captureCores;
+	if (ilt_dada_check_helper_cores(config) < 0) {
+		return -1;
+	}
+
+	// Observation configuration
+
+	// long startPacket;
+	// long endPacket;
+	if (config->state & NETWORK_READY) {
+		if (config->startPacket < LFREPOCH) {
+			fprintf(stderr, "ERROR: Start packet is before 2008 (uninitialised? %ld).", config->startPacket);
+			return -1;
+		}
+
+		if (config->endPacket < LFREPOCH) {
+			fprintf(stderr, "ERROR: End packet is before 2008 (uninitialised? %ld).", config->endPacket);
+			return -1;
+		}
+	}
+
+	// int packetsPerIteration;
+	if (config->packetsPerIteration < 1) {
+		fprintf(stderr, "ERROR: Requested less than 1 packet per read operation (%d).\n", config->packetsPerIteration);
+		return -1;
+	}
+
+
+
+	// unsigned char obsClockBit;
+
+
+	// Ringbuffer working variables
+	// int sockfd;
+	if (config->state & NETWORK_READY) {
+		if (config->obsClockBit > 2) {
+			fprintf(stderr, "ERROR: obsClockBit does not appear to be correctly set (%d)\n", config->obsClockBit);
+		}
+
+		if (config->sockfd < 0) {
+			fprintf(stderr, "ERROR: state indicates network is ready, but socket is not set.\n");
+			return -1;
+		}
 	}
 
 
@@ -492,6 +1055,11 @@ int ilt_dada_config_setup(ilt_dada_config *config, int setup_io) {
 		return -1;
 	}
 
+	// Find the NIC's NUMA node before anything is allocated
+	if (ilt_dada_numa_resolve(config) < 0) {
+		return -1;
+	}
+
 	// Initialise the network
 	if (ilt_dada_initialise_port(config) < 0) {
 		return -1;
@@ -521,10 +1089,18 @@ int ilt_dada_config_setup(ilt_dada_config *config, int setup_io) {
  */
 int ilt_dada_check_network(ilt_dada_config *config, int flags) {
 
+	// The start time filter holds back every packet until the observation starts; let the next packet through for the checks
+	const int filtered = config->state & NETWORK_FILTERED;
+	ilt_dada_detach_time_filter(config);
+
 	// Read the first packet in the queue into the buffer (peek so it can be consumed later if we're late)
 	uint8_t buffer[MAX_UDP_LEN];
-	ssize_t recvreturn;
-	if ((recvreturn = recvfrom(config->sockfd, &buffer[0], MAX_UDP_LEN, MSG_PEEK | flags, NULL, NULL)) == -1) {
+	ssize_t recvreturn = recvfrom(config->sockfd, &buffer[0], MAX_UDP_LEN, MSG_PEEK | flags, NULL, NULL);
+	if (filtered) {
+		ilt_dada_attach_time_filter(config);
+	}
+
+	if (recvreturn == -1) {
 		fprintf(stderr, "ERROR: Unable to peek at first packet (errno %d, %s).", errno, strerror(errno));
 		if (errno == EAGAIN || errno == EWOULDBLOCK) {
 			fprintf(stderr, "ERROR: This was an indication that no packets were available to be consumed. Attempting to continue.\n");
@@ -654,6 +1230,299 @@ int ilt_dada_check_header(ilt_dada_config *config, uint8_t* buffer) {
 	return 0;
 }
 
+// Bits of the first header word (version + source bytes) that must be zero; padding0 (source bit 5), errorBit (source bit 6) and padding1 (source bits 10-15)
+#define ILTD_HEADER_SOURCE_MASK ((1u << 13) | (1u << 14) | (0x3fu << 18))
+
+/**
+ * @brief      Check a single CEP header without branching or logging, using
+ *             the same criteria as ilt_dada_check_header
+ *
+ * @param[in]  header  The packet header
+ *
+ * @return     1: valid, 0: corrupted
+ */
+static inline int ilt_dada_header_valid(const int8_t *header) {
+	uint32_t words[4];
+	memcpy(words, header, sizeof(words));
+
+	return ((words[0] & 0xff) == UDPCURVER)
+		& ((words[0] & ILTD_HEADER_SOURCE_MASK) == 0)
+		& (((words[1] >> 16) & 0xff) <= UDPMAXBEAM)
+		& ((words[1] >> 24) == UDPNTIMESLICE)
+		& (words[2] >= LFREPOCH)
+		& (words[3] <= RSPMAXSEQ);
+}
+
+/**
+ * @brief      Scalar implementation of ilt_dada_check_headers
+ *
+ * @param[in]  buffer      The batch of packets
+ * @param[in]  packets     The number of packets in the batch
+ * @param[in]  packetSize  The packet stride
+ * @param      badPackets  Zeroed bitmask of corrupted packets
+ *
+ * @return     The number of corrupted packets
+ */
+static int ilt_dada_check_headers_scalar(const int8_t *buffer, int packets, int packetSize, uint64_t *badPackets) {
+	int corrupted = 0;
+	for (int packetIdx = 0; packetIdx < packets; packetIdx++) {
+		if (!ilt_dada_header_valid(&(buffer[(long) packetIdx * packetSize]))) {
+			badPackets[packetIdx / 64] |= 1ul << (packetIdx % 64);
+			corrupted++;
+		}
+	}
+
+	return corrupted;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+/**
+ * @brief      AVX2 implementation of ilt_dada_check_headers; gathers the four
+ *             header words of 8 packets at a time
+ *
+ * @param[in]  buffer      The batch of packets
+ * @param[in]  packets     The number of packets in the batch
+ * @param[in]  packetSize  The packet stride
+ * @param      badPackets  Zeroed bitmask of corrupted packets
+ *
+ * @return     The number of corrupted packets
+ */
+__attribute__((target("avx2")))
+static int ilt_dada_check_headers_avx2(const int8_t *buffer, int packets, int packetSize, uint64_t *badPackets) {
+	const __m256i offsets = _mm256_mullo_epi32(_mm256_set1_epi32(packetSize), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+	const __m256i byteMask = _mm256_set1_epi32(0xff);
+	const __m256i version = _mm256_set1_epi32(UDPCURVER);
+	const __m256i sourceMask = _mm256_set1_epi32((int) ILTD_HEADER_SOURCE_MASK);
+	const __m256i maxBeams = _mm256_set1_epi32(UDPMAXBEAM);
+	const __m256i timeSlices = _mm256_set1_epi32(UDPNTIMESLICE);
+	const __m256i epoch = _mm256_set1_epi32((int) LFREPOCH);
+	const __m256i maxSequence = _mm256_set1_epi32(RSPMAXSEQ);
+	const __m256i zero = _mm256_setzero_si256();
+
+	int corrupted = 0, packetIdx = 0;
+	for (; packetIdx + 8 <= packets; packetIdx += 8) {
+		const int8_t *base = &(buffer[(long) packetIdx * packetSize]);
+		const __m256i sourceWord = _mm256_i32gather_epi32((const int*) base, offsets, 1);
+		const __m256i beamWord = _mm256_i32gather_epi32((const int*) (base + 4), offsets, 1);
+		const __m256i timestamp = _mm256_i32gather_epi32((const int*) (base + 8), offsets, 1);
+		const __m256i sequence = _mm256_i32gather_epi32((const int*) (base + 12), offsets, 1);
+
+		const __m256i beams = _mm256_and_si256(_mm256_srli_epi32(beamWord, 16), byteMask);
+		__m256i valid = _mm256_cmpeq_epi32(_mm256_and_si256(sourceWord, byteMask), version);
+		valid = _mm256_and_si256(valid, _mm256_cmpeq_epi32(_mm256_and_si256(sourceWord, sourceMask), zero));
+		valid = _mm256_and_si256(valid, _mm256_cmpeq_epi32(_mm256_min_epu32(beams, maxBeams), beams));
+		valid = _mm256_and_si256(valid, _mm256_cmpeq_epi32(_mm256_srli_epi32(beamWord, 24), timeSlices));
+		// No unsigned comparisons in AVX2, use min/max instead
+		valid = _mm256_and_si256(valid, _mm256_cmpeq_epi32(_mm256_max_epu32(timestamp, epoch), timestamp));
+		valid = _mm256_and_si256(valid, _mm256_cmpeq_epi32(_mm256_min_epu32(sequence, maxSequence), sequence));
+
+		const unsigned int corruptedBits = ~((unsigned int) _mm256_movemask_ps(_mm256_castsi256_ps(valid))) & 0xffu;
+		if (corruptedBits) {
+			badPackets[packetIdx / 64] |= (uint64_t) corruptedBits << (packetIdx % 64);
+			corrupted += __builtin_popcount(corruptedBits);
+		}
+	}
+
+	for (; packetIdx < packets; packetIdx++) {
+		if (!ilt_dada_header_valid(&(buffer[(long) packetIdx * packetSize]))) {
+			badPackets[packetIdx / 64] |= 1ul << (packetIdx % 64);
+			corrupted++;
+		}
+	}
+
+	return corrupted;
+}
+#endif
+
+/**
+ * @brief      Check the CEP headers of every packet in a batch (version, error
+ *             bit, padding, beamlet count, time slice count, timestamp and
+ *             sequence bounds), without stopping at the first failure
+ *
+ * @param[in]  buffer      The batch of packets
+ * @param[in]  packets     The number of packets in the batch
+ * @param[in]  packetSize  The packet stride
+ * @param      badPackets  Output bitmask of corrupted packets, at least
+ *                         ceil(packets / 64) elements
+ *
+ * @return     The number of corrupted packets
+ */
+int ilt_dada_check_headers(const int8_t *buffer, int packets, int packetSize, uint64_t *badPackets) {
+	memset(badPackets, 0, ((packets + 63) / 64) * sizeof(uint64_t));
+
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports("avx2")) {
+		return ilt_dada_check_headers_avx2(buffer, packets, packetSize, badPackets);
+	}
+#endif
+
+	return ilt_dada_check_headers_scalar(buffer, packets, packetSize, badPackets);
+}
+
+/**
+ * @brief      Self-check for the vectorised header validation: run both the
+ *             AVX2 and scalar implementations of ilt_dada_check_headers on the
+ *             same batch and compare their verdicts
+ *
+ * @param[in]  buffer      The batch of packets
+ * @param[in]  packets     The number of packets in the batch
+ * @param[in]  packetSize  The packet stride
+ * @param      corrupted   Output number of corrupted packets found by the
+ *                         scalar implementation (may be NULL)
+ *
+ * @return     The number of packets where the implementations disagree (0 if
+ *             AVX2 is not available), -1 on failure
+ */
+int ilt_dada_check_headers_compare(const int8_t *buffer, int packets, int packetSize, int *corrupted) {
+	const int words = (packets + 63) / 64;
+	uint64_t *scalarBad = calloc(2 * (size_t) (words ? words : 1), sizeof(uint64_t));
+	if (scalarBad == NULL) {
+		fprintf(stderr, "ERROR: Failed to allocate header check masks, exiting.\n");
+		return -1;
+	}
+	uint64_t *vectorBad = &(scalarBad[words ? words : 1]);
+
+	const int scalarCorrupted = ilt_dada_check_headers_scalar(buffer, packets, packetSize, scalarBad);
+	const int vectorCorrupted = ilt_dada_check_headers(buffer, packets, packetSize, vectorBad);
+
+	int mismatches = 0;
+	for (int word = 0; word < words; word++) {
+		mismatches += __builtin_popcountl(scalarBad[word] ^ vectorBad[word]);
+	}
+	if (!mismatches && scalarCorrupted != vectorCorrupted) {
+		fprintf(stderr, "ERROR: Header checks returned different counts with matching masks (scalar %d, dispatched %d).\n", scalarCorrupted, vectorCorrupted);
+		mismatches = abs(scalarCorrupted - vectorCorrupted);
+	}
+
+	if (corrupted != NULL) {
+		*corrupted = scalarCorrupted;
+	}
+
+	free(scalarBad);
+	return mismatches;
+}
+
+/**
+ * @brief      Build a valid CEP header for a given packet number, the inverse
+ *             of lofar_udp_time_beamformed_packno (used to generate test
+ *             data)
+ *
+ * @param      header        The output header (UDPHDRLEN bytes)
+ * @param[in]  packetNumber  The packet number
+ * @param[in]  clockBit      The clock bit (0: 160MHz, 1: 200MHz)
+ * @param[in]  bitMode       The bit mode field (0: 16-bit, 1: 8-bit, 2: 4-bit)
+ * @param[in]  beamlets      The number of beamlets in the packet
+ */
+void ilt_dada_packno_to_header(int8_t *header, long packetNumber, int clockBit, int bitMode, int beamlets) {
+	memset(header, 0, UDPHDRLEN);
+	header[0] = UDPCURVER;
+	lofar_source_bytes *source = (lofar_source_bytes*) &(header[1]);
+	source->clockBit = clockBit;
+	source->bitMode = bitMode;
+	header[6] = (int8_t) beamlets;
+	header[7] = UDPNTIMESLICE;
+
+	// Each packet holds UDPNTIMESLICE samples, each of which take 1024 clock cycles; seconds are rounded to the nearest sample
+	const long clockHz = clockBit ? 200000000l : 160000000l;
+	const long samples = packetNumber * UDPNTIMESLICE;
+	const uint32_t timestamp = (uint32_t) ((samples * 1024) / clockHz);
+	const uint32_t sequence = (uint32_t) (samples - ((long) timestamp * clockHz + 512) / 1024);
+	memcpy(&(header[8]), &timestamp, sizeof(uint32_t));
+	memcpy(&(header[12]), &sequence, sizeof(uint32_t));
+}
+
+/**
+ * @brief      xorshift64* random numbers; fast, and reproducible for a given
+ *             seed. Used for generated streams and test data, not for anything
+ *             that needs to be unpredictable.
+ *
+ * @param      state  The generator state (non-zero)
+ *
+ * @return     A random 64-bit value
+ */
+uint64_t ilt_dada_random(uint64_t *state) {
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545F4914F6CDD1Dull;
+}
+
+/**
+ * @brief      Uniform random numbers from ilt_dada_random
+ *
+ * @param      state  The generator state (non-zero)
+ *
+ * @return     A uniform random number in [0, 1)
+ */
+double ilt_dada_random_uniform(uint64_t *state) {
+	return (double) (ilt_dada_random(state) >> 11) * 0x1.0p-53;
+}
+
+/**
+ * @brief      Plan the packets sent for a window of a generated stream,
+ *             injecting packet loss (single packets or bursts), duplicated
+ *             packets (sent directly after the original) and re-ordered
+ *             packets (swapped with the following packet, never across the
+ *             end of the window)
+ *
+ * @param      faults       The fault injection configuration and counters
+ * @param[in]  firstSlot    The first slot (packet offset) of the window
+ * @param[in]  slots        The number of slots in the window
+ * @param[out] packetSlots  The slot of every packet to send, in send order
+ *                          (space for 2 * slots elements)
+ * @param[out] sendSlots    The slot every packet is sent in, used to pace it
+ *                          (space for 2 * slots elements)
+ *
+ * @return     The number of packets to send
+ */
+long ilt_dada_inject_faults(ilt_dada_fault_injector *faults, long firstSlot, long slots, long *packetSlots, long *sendSlots) {
+	long packets = 0;
+
+	for (long slot = firstSlot; slot < firstSlot + slots; slot++) {
+		if (faults->burstRemaining > 0) {
+			faults->burstRemaining--;
+			faults->lost++;
+			continue;
+		}
+
+		if (faults->burstRate > 0.0 && ilt_dada_random_uniform(&(faults->random)) < faults->burstRate) {
+			faults->burstRemaining = faults->burstLength - 1;
+			faults->bursts++;
+			faults->lost++;
+			continue;
+		}
+
+		if (faults->lossRate > 0.0 && ilt_dada_random_uniform(&(faults->random)) < faults->lossRate) {
+			faults->lost++;
+			continue;
+		}
+
+		// Swap with the following packet; it is sent in this slot, and this packet in the next
+		if (faults->reorderRate > 0.0 && slot + 1 < firstSlot + slots && ilt_dada_random_uniform(&(faults->random)) < faults->reorderRate) {
+			packetSlots[packets] = slot + 1;
+			sendSlots[packets++] = slot;
+			packetSlots[packets] = slot;
+			sendSlots[packets++] = slot + 1;
+			faults->reorders++;
+			slot++;
+			continue;
+		}
+
+		packetSlots[packets] = slot;
+		sendSlots[packets++] = slot;
+
+		if (faults->duplicateRate > 0.0 && ilt_dada_random_uniform(&(faults->random)) < faults->duplicateRate) {
+			packetSlots[packets] = slot;
+			sendSlots[packets++] = slot;
+			faults->duplicates++;
+		}
+	}
+
+	return packets;
+}
+
 /**
  * @brief      Connect to and destroy a ringbuffer on the given key
  *
@@ -716,6 +1585,11 @@ int ilt_dada_setup_ringbuffer(ilt_dada_config *config) {
 				return -1;
 			}
 		}
+		// Hugepages and NUMA placement must be requested before the blocks are first touched
+		if ((config->hugePages || config->numaNode >= 0) && ilt_dada_ringbuffer_advise(config) < 0) {
+			return -1;
+		}
+
 		// Mark the process as successful
 		config->state |= RINGBUFFER_READY;
 	}
@@ -740,6 +1614,11 @@ int ilt_dada_operate(ilt_dada_config *config) {
 		return -1;
 	}
 
+	// Keep everything this thread allocates on the NIC's node
+	if (config->numaNode >= 0 && ilt_dada_numa_set_thread(config->numaNode) < 0) {
+		return -1;
+	}
+
 	// Allocate the ringbuffer if it has not yet been allocated (lazy startup option).
 	if (!(config->state & RINGBUFFER_READY)) {
 		if (ilt_dada_setup_ringbuffer(config) < 0) {
@@ -754,28 +1633,37 @@ int ilt_dada_operate(ilt_dada_config *config) {
 	//timeout.tv_nsec = (int) ((config->portTimeout - ((int) config->portTimeout) ) * 1e9);
 
 	// Initialise a parameters struct for a new observation
-	static ilt_dada_operate_params params = { 	.msgvec = NULL, 
-												.iovecs = NULL, 
-												.timeout = NULL, 
-												.packetsSeen = 0,
-												.packetsLastSeen = 0,
-												.packetsExpected = 0,
-												.packetsLastExpected = 0,
-												.bytesWritten = 0
-											};
+	// Not static, multiple ports may be starting up at the same time in different threads
+	ilt_dada_operate_params params = ilt_dada_operate_params_default;
 	params.finalPacket = config->endPacket;
+	// Sequence-indexed blocks are aligned to the start of the observation
+	params.blockFirstPacket = config->startPacket;
 	*(config->params) = params;
 
+	ilt_dada_metrics_state(config, METRICS_WAITING);
+
 	VERBOSE(printf("Prepare\n"));
 	if (ilt_data_operate_prepare(config) < 0) {
+		ilt_dada_metrics_state(config, METRICS_FAILED);
 		return -1;
 	}
 
+	// Fault in the buffers during the start-up window rather than during the observation
+	if (config->prefault) {
+		ilt_dada_prefault(config);
+	}
+
 	VERBOSE(printf("Network\n"));
 	if (ilt_dada_check_network(config, 0) < 0) {
+		ilt_dada_metrics_state(config, METRICS_FAILED);
 		return -1;
 	}
 
+	// The start packet may have been set after the socket was initialised
+	if (!(config->state & NETWORK_FILTERED)) {
+		ilt_dada_attach_time_filter(config);
+	}
+
 	// Warn the user if we are starting late
 	if (config->currentPacket > config->startPacket) {
 		fprintf(stderr, "WARNING: We are already past the observation start time on port %d.\n", config->portNum);
@@ -784,20 +1672,58 @@ int ilt_dada_operate(ilt_dada_config *config) {
 	} else {
 		// Sleep until we're 2 second from the desired start time
 		int sleepTime = (config->startPacket - config->currentPacket) / (clock160MHzPacketRate * (1 - config->obsClockBit) + clock200MHzPacketRate * config->obsClockBit);
+
+		// Check that this thread is woken up quickly enough while we have time to spare
+		if (config->realtimePriority && sleepTime > (2 + ILTD_JITTER_TEST_SECONDS)) {
+			ilt_dada_jitter_test(config);
+			sleepTime -= ILTD_JITTER_TEST_SECONDS;
+		}
+
 		if (sleepTime > 2) {
 			ilt_dada_sleep_multilog(sleepTime, config->io->dadaWriter[0].multilog);
 		}
 	}
 
+	// Switch over to the requested capture backend now that we're about to start reading data
+	if (ilt_dada_capture_setup(config) < 0) {
+		ilt_dada_metrics_state(config, METRICS_FAILED);
+		return -1;
+	}
+
 	VERBOSE(printf("Loop\n"));
 	// Read new data from the port until the observation ends
-	if (ilt_dada_operate_loop(config) < 0) {
+	int loopReturn = ilt_dada_operate_loop(config);
+
+	// Release a partially filled zero-copy block so the readers see the end of the data
+	ilt_dada_operate_cleanup(config);
+	if (loopReturn < 0) {
+		ilt_dada_metrics_state(config, METRICS_FAILED);
 		return -1;
 	}
 
 	// Print debug information about the observing run
 	printf("Observation completed. Cleaning up. Final summary:\n");
-	ilt_dada_packet_comments(config->io->dadaWriter[0].multilog, config->portNum, config->currentPacket, config->startPacket, config->endPacket, config->params->packetsLastExpected, config->params->packetsLastSeen, config->params->packetsExpected, config->params->packetsSeen);
+	config->params->sequence.kernelDrops = ilt_dada_capture_drops(config);
+	ilt_dada_metrics_receive(config);
+	ilt_dada_metrics_commit(config);
+	ilt_dada_metrics_state(config, METRICS_FINISHED);
+	ilt_dada_latency_summary latencySummary = { 0 };
+	if (config->latencyStats) {
+		ilt_dada_latency_summarise(config->params->latency->total, &latencySummary);
+	}
+	ilt_dada_packet_comments(config->io->dadaWriter[0].multilog, config->portNum, config->currentPacket, config->startPacket, config->endPacket, config->params->packetsLastExpected, config->params->packetsLastSeen, config->params->packetsExpected, config->params->packetsSeen, &(config->params->sequence), config->latencyStats ? &latencySummary : NULL);
+	if (config->sequencePlacement) {
+		printf("Port %d: %ld late or duplicate packets were discarded while placing packets by sequence number.\n", config->portNum, config->params->packetsDiscarded);
+	}
+	if (config->params->packetsCorrupted) {
+		printf("Port %d: %ld packets had corrupted headers%s.\n", config->portNum, config->params->packetsCorrupted, config->sequencePlacement ? " and were not placed" : "");
+	}
+	if (config->params->groDiscarded) {
+		printf("Port %d: %ld coalesced datagrams or trailing segments were not the packet size and were discarded.\n", config->portNum, config->params->groDiscarded);
+	}
+#ifdef ILTD_PHASE_TIMING
+	ilt_dada_phase_report(config);
+#endif
 
 	// Clean exit
 	return 0;
@@ -805,147 +1731,427 @@ int ilt_dada_operate(ilt_dada_config *config) {
 
 
 
-/*
-	// https://man7.org/linux/man-pages/man2/recvmmsg.2.html
-       int recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen,
-                    int flags, struct timespec *timeout);
-*/
-
-
 /**
- * @brief      The main loop of the recorder; receive packets and copy them to a
- *             PSRDADA ringbuffer
+ * @brief      Pin the calling thread to a single CPU core
  *
- * @param      config  The recording configuration
+ * @param[in]  core  The core index (-1: do nothing)
  *
- * @return     0: Success, -1: Early Exit / Failure
+ * @return     0: success, -1: failure
  */
-int ilt_dada_operate_loop(ilt_dada_config *config) {
-	int readPackets, localLoops = 0;
-	long finalPacketOffset = (config->packetsPerIteration - 1) * config->packetSize;
-	long lastPacket;
-	ssize_t writeBytes, writtenBytes;
+int ilt_dada_pin_thread(int core) {
+	if (core < 0) {
+		return 0;
+	}
 
+	cpu_set_t cpuSet;
+	CPU_ZERO(&cpuSet);
+	CPU_SET(core, &cpuSet);
 
-	// If we're starting early or the buffer started filling early, consume data until we reach the starting packet
-	if (config->currentPacket > config->startPacket) {
-		// Past the start up time, begin the main loop immediately.
-		printf("Late start-up resulted in %ld packets to be missed, starting now.\n", config->currentPacket - config->startPacket);
+	int returnVal;
+	if ((returnVal = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuSet)) != 0) {
+		fprintf(stderr, "ERROR: Failed to pin thread to core %d (errno %d: %s).\n", core, returnVal, strerror(returnVal));
+		return -1;
+	}
 
-		// TODO: Make a decision, should thse be included in the stats or not?
-		//config->startPacket = config->currentPacket;
-	} else {
-		printf("Starting warm-up...\n");
-		while (config->currentPacket < config->startPacket) {
-			readPackets = recvmmsg(config->sockfd, config->params->msgvec, config->packetsPerIteration, config->recvflags, config->params->timeout);
-			lastPacket = lofar_udp_time_beamformed_packno(*((unsigned int *) &(config->params->packetBuffer[finalPacketOffset + 8])),
-			                                              *((unsigned int *) &(config->params->packetBuffer[finalPacketOffset + 12])),
-			                                              ((lofar_source_bytes *) &(config->params->packetBuffer[1]))->clockBit);
-
-			if (lastPacket >= (config->startPacket - config->packetsPerIteration)) {
-				// TODO: assumes no packets loss
-				writeBytes = readPackets * config->packetSize;
-				writtenBytes = lofar_udp_io_write(config->io, 0, config->params->packetBuffer, writeBytes);
-
-				if (writtenBytes < 0) {
-					fprintf(stderr, "ERROR Port %d: Failed to write data to ringbuffer %d, exiting.\n", config->portNum, config->io->outputDadaKeys[0]);
-				} else if (writtenBytes != writeBytes) {
-					fprintf(stderr, "WARNING Port %d: Tried to write %ld bytes to buffer but only wrote %ld.\n", config->portNum, writeBytes, writtenBytes);
-				}
+	return 0;
+}
 
-				config->params->bytesWritten += writtenBytes;
-				config->params->packetsSeen += readPackets;
-				config->params->packetsExpected += lastPacket - config->currentPacket;
-				config->params->packetsLastSeen += readPackets;
-				config->params->packetsLastExpected += lastPacket - config->currentPacket;
-			}
+/**
+ * @brief      Check that the requested helper cores do not include the capture
+ *             core of any port in real-time mode, as a real-time capture thread
+ *             will not give up its core to a normal thread
+ *
+ * @param[in]  config  The ilt_dada configuration struct
+ *
+ * @return     0: success, -1: failure
+ */
+int ilt_dada_check_helper_cores(const ilt_dada_config *config) {
+	if (!config->realtimePriority) {
+		return 0;
+	}
 
-			config->currentPacket = lastPacket;
+	for (int core = 0; core < CPU_SETSIZE; core++) {
+		if (CPU_ISSET(core, &(config->helperCores)) && (core == config->captureCore || CPU_ISSET(core, &(config->captureCores)))) {
+			fprintf(stderr, "ERROR: The helper cores of port %d include capture core %d, which cannot be shared in real-time mode.\n", config->portNum, core);
+			return -1;
 		}
-		printf("Warmup summary for port %d:\n", config->portNum);
-		#pragma omp task firstprivate(config)
-		ilt_dada_packet_comments(config->io->dadaWriter[0].multilog, config->portNum, config->currentPacket, config->startPacket, config->endPacket, config->params->packetsLastExpected, config->params->packetsLastSeen, config->params->packetsExpected, config->params->packetsSeen);
-
-		// Remove old stats before starting the observations
-		config->params->bytesWritten = 0;
-		config->params->packetsSeen = 0;
-		config->params->packetsExpected = 0;
-		config->params->packetsLastSeen = 0;
-		config->params->packetsLastExpected = 0;
 	}
 
-	// Create a locale variables for packets per iteration, so we can reduce the number for the final step
-	int packetsPerIteration = config->packetsPerIteration;
+	return 0;
+}
 
-	printf("Observation beginning...\n");
-	// While we still have data to record,
-	while (config->currentPacket < config->params->finalPacket) {
-		// Record the next N packets
-		readPackets = recvmmsg(config->sockfd, config->params->msgvec, packetsPerIteration, config->recvflags, config->params->timeout);
-		
+/**
+ * @brief      Get the cores the helper threads of a port (the pipelined writer
+ *             and the SO_REUSEPORT receive threads) may run on; the requested
+ *             helper cores, or the cores of the port's NUMA node (or every
+ *             core) other than the capture cores of every port
+ *
+ * @param[in]  config  The ilt_dada configuration struct
+ * @param      cores   The output core set
+ */
+void ilt_dada_helper_cores(const ilt_dada_config *config, cpu_set_t *cores) {
+	if (CPU_COUNT(&(config->helperCores))) {
+		*cores = config->helperCores;
+		return;
+	}
 
-		// Sanity check the amount that are read
-		if (readPackets < 0) {
-			fprintf(stderr, "ERROR: recvmmsg on port %d (errno %d: %s)\n", config->portNum, errno, strerror(errno));
-			return -1;
-		}
-		if (readPackets != packetsPerIteration) {
-			fprintf(stderr, "WARNING: recvmmsg on port %d received less packets than requested (expected,%d, recieved %d)\n", config->portNum, packetsPerIteration, readPackets);
-		}
+	int coreList[CPU_SETSIZE];
+	int numCores = config->numaNode >= 0 ? ilt_dada_numa_node_cores(config->numaNode, coreList, CPU_SETSIZE) : -1;
 
-		finalPacketOffset = (readPackets - 1) * config->packetSize;
+	if (numCores < 1) {
+		numCores = (int) sysconf(_SC_NPROCESSORS_CONF);
+		for (int core = 0; core < numCores && core < CPU_SETSIZE; core++) {
+			coreList[core] = core;
+		}
+	}
 
-		// Check the packets for errors if requested
-		if (config->checkParameters == CHECK_ALL_PACKETS) {
-			for (int packetIdx = 0; packetIdx < (readPackets - 1); packetIdx++) {
-				if (ilt_dada_check_header(config, (uint8_t*) &config->params->packetBuffer[packetIdx * config->packetSize]) < 0) {
-					fprintf(stderr, "ERROR: packet %d/%d port header data corrupted on port %d, exiting.\n\n", packetIdx, readPackets, config->portNum);
-					return -1;
-				}
-			}
-		} else if (config->checkParameters == CHECK_FIRST_LAST) {
-			int firstHeader = ilt_dada_check_header(config, (uint8_t*) &config->params->packetBuffer[0]);
-			int lastHeader = ilt_dada_check_header(config, (uint8_t*) &config->params->packetBuffer[finalPacketOffset]);
-			if (firstHeader < 0 || lastHeader < 0) {
-				fprintf(stderr, "ERROR: port first or late header data corrupted on port %d (%d / %d), exiting.\n\n", config->portNum, firstHeader, lastHeader);
-				return -1;
-			}
+	CPU_ZERO(cores);
+	for (int coreIdx = 0; coreIdx < numCores && coreIdx < CPU_SETSIZE; coreIdx++) {
+		if (coreList[coreIdx] != config->captureCore && !CPU_ISSET(coreList[coreIdx], &(config->captureCores))) {
+			CPU_SET(coreList[coreIdx], cores);
 		}
+	}
 
-		// Get the last packet number
-		lastPacket = lofar_udp_time_beamformed_packno(*((unsigned int*) &(config->params->packetBuffer[finalPacketOffset + 8])), *((unsigned int*) &(config->params->packetBuffer[finalPacketOffset + 12])), ((lofar_source_bytes*) &(config->params->packetBuffer[1]))->clockBit);
+	// Share the capture cores rather than leave the helpers with nowhere to run
+	if (!CPU_COUNT(cores)) {
+		for (int coreIdx = 0; coreIdx < numCores && coreIdx < CPU_SETSIZE; coreIdx++) {
+			CPU_SET(coreList[coreIdx], cores);
+		}
+	}
+}
+
+/**
+ * @brief      Move the calling thread to the SCHED_FIFO real-time scheduling
+ *             class, if requested, so it is not held up by normal processes
+ *             when packets arrive
+ *
+ * @param[in]  config  The ilt_dada configuration struct
+ */
+void ilt_dada_realtime_thread(const ilt_dada_config *config) {
+	if (!config->realtimePriority) {
+		return;
+	}
+
+	const struct sched_param param = { .sched_priority = config->realtimePriority };
+	int returnVal;
+	if ((returnVal = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)) != 0) {
+		fprintf(stderr, "WARNING: Failed to set real-time priority %d on port %d, continuing with normal scheduling (errno %d: %s). Raise the rtprio limit (ulimit -r) or grant CAP_SYS_NICE.\n", config->realtimePriority, config->portNum, returnVal, strerror(returnVal));
+	}
+}
+
+/**
+ * @brief      Record several ports in one process, with one capture thread per
+ *             port (pinned to the port's captureCore, if set). All ports are
+ *             expected to share the same start and end packets.
+ *
+ * @param      configs   The ilt_dada configuration structs, one per port
+ * @param[in]  numPorts  The number of ports
+ *
+ * @return     0: success, -1: failure on one or more ports
+ */
+int ilt_dada_operate_multi(ilt_dada_config **configs, int numPorts) {
+	if (numPorts < 1 || numPorts > MAX_NUM_PORTS) {
+		fprintf(stderr, "ERROR: Invalid number of ports requested (%d, limit %d), exiting.\n", numPorts, MAX_NUM_PORTS);
+		return -1;
+	}
+
+	for (int port = 1; port < numPorts; port++) {
+		if (configs[port]->startPacket != configs[0]->startPacket || configs[port]->endPacket != configs[0]->endPacket) {
+			fprintf(stderr, "ERROR: Port %d does not share the start/end time of port %d, exiting.\n", configs[port]->portNum, configs[0]->portNum);
+			return -1;
+		}
+	}
+
+	// Keep the helper threads of every port off the capture cores of every port
+	cpu_set_t captureCores;
+	CPU_ZERO(&captureCores);
+	for (int port = 0; port < numPorts; port++) {
+		if (configs[port]->captureCore >= 0) {
+			CPU_SET(configs[port]->captureCore, &captureCores);
+		}
+	}
+	for (int port = 0; port < numPorts; port++) {
+		configs[port]->captureCores = captureCores;
+		if (ilt_dada_check_helper_cores(configs[port]) < 0) {
+			return -1;
+		}
+	}
+
+	// Lock the process in memory before the capture threads start
+	for (int port = 0; port < numPorts; port++) {
+		if (configs[port]->realtimePriority) {
+			ilt_dada_lock_memory();
+			break;
+		}
+	}
+
+	// Every port needs its own thread; a port sharing a thread with another would never be read
+	int failures = 0;
+	omp_set_dynamic(0);
+	#pragma omp parallel num_threads(numPorts) reduction(+: failures)
+	{
+		if (omp_get_num_threads() != numPorts) {
+			#pragma omp single
+			fprintf(stderr, "ERROR: Only %d threads were available to record %d ports, exiting.\n", omp_get_num_threads(), numPorts);
+			failures += 1;
+		} else {
+			ilt_dada_config *config = configs[omp_get_thread_num()];
+
+			// Real-time scheduling is best-effort, the port is recorded with normal scheduling if it cannot be set
+			ilt_dada_realtime_thread(config);
+			if (ilt_dada_pin_thread(config->captureCore) < 0 || ilt_dada_operate(config) < 0) {
+				fprintf(stderr, "ERROR: Recording failed on port %d.\n", config->portNum);
+				failures += 1;
+			}
+		}
+	}
+
+	ilt_dada_operate_summary(configs, numPorts);
+
+	return failures ? -1 : 0;
+}
+
+/**
+ * @brief      Print a summary of the packet loss across all ports
+ *
+ * @param      configs   The ilt_dada configuration structs, one per port
+ * @param[in]  numPorts  The number of ports
+ */
+void ilt_dada_operate_summary(ilt_dada_config **configs, int numPorts) {
+	long totalSeen = 0, totalExpected = 0, totalBytes = 0;
+
+	printf("Summary across %d port(s):\n", numPorts);
+	printf("Port\t\tExpected\t\tSeen\t\t\tMissed\t\t\t%% Missed\n");
+	for (int port = 0; port < numPorts; port++) {
+		const ilt_dada_operate_params *params = configs[port]->params;
+		printf("%d\t\t%ld\t\t\t%ld\t\t\t%ld\t\t\t%.2f\n", configs[port]->portNum, params->packetsExpected, params->packetsSeen, params->packetsExpected - params->packetsSeen,
+		       100.0f * (float) (params->packetsExpected - params->packetsSeen) / (float) (params->packetsExpected));
+		totalSeen += params->packetsSeen;
+		totalExpected += params->packetsExpected;
+		totalBytes += params->bytesWritten;
+	}
+	printf("Total\t\t%ld\t\t\t%ld\t\t\t%ld\t\t\t%.2f\n", totalExpected, totalSeen, totalExpected - totalSeen, 100.0f * (float) (totalExpected - totalSeen) / (float) (totalExpected));
+	printf("%ld MB written to ringbuffers.\n\n", totalBytes >> 20);
+
+	printf("Port\t\tDuplicate\t\tLate\t\t\tLongest Gap\t\tKernel Drops\n");
+	for (int port = 0; port < numPorts; port++) {
+		const ilt_dada_sequence_stats *sequence = &(configs[port]->params->sequence);
+		printf("%d\t\t%ld\t\t\t%ld\t\t\t%ld\t\t\t%ld\n", configs[port]->portNum, sequence->duplicates, sequence->late, sequence->longestGap, sequence->kernelDrops - sequence->kernelDropsBase);
+	}
+	printf("\n");
+
+	// Combine the latency histograms from all of the ports that collected them
+	ilt_dada_latency *combined = NULL;
+	for (int port = 0; port < numPorts; port++) {
+		const ilt_dada_latency *latency = configs[port]->params->latency;
+		if (!configs[port]->latencyStats || latency == NULL) {
+			continue;
+		}
+		if (combined == NULL && (combined = ilt_dada_latency_init()) == NULL) {
+			break;
+		}
+		for (int type = 0; type < LATENCY_TYPES; type++) {
+			ilt_dada_histogram_merge(&(combined->total[type]), &(latency->total[type]));
+		}
+	}
+	if (combined != NULL) {
+		char latencyTable[2048];
+		ilt_dada_latency_summary latencySummary;
+		ilt_dada_latency_summarise(combined->total, &latencySummary);
+		ilt_dada_latency_comments(latencyTable, sizeof(latencyTable), &latencySummary);
+		printf("Latency across all ports:\n%s\n", latencyTable);
+		free(combined);
+	}
+}
+
+
+/*
+	// https://man7.org/linux/man-pages/man2/recvmmsg.2.html
+       int recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen,
+                    int flags, struct timespec *timeout);
+*/
+
+
+/**
+ * @brief      The main loop of the recorder; receive packets and copy them to a
+ *             PSRDADA ringbuffer
+ *
+ * @param      config  The recording configuration
+ *
+ * @return     0: Success, -1: Early Exit / Failure
+ */
+int ilt_dada_operate_loop(ilt_dada_config *config) {
+	int readPackets, localLoops = 0;
+	long finalPacketOffset;
+	long lastPacket;
+	ssize_t writtenBytes;
+	int8_t *buffer;
+
+
+	// If we're starting early or the buffer started filling early, consume data until we reach the starting packet
+	if (config->currentPacket > config->startPacket) {
+		// Past the start up time, begin the main loop immediately.
+		printf("Late start-up resulted in %ld packets to be missed, starting now.\n", config->currentPacket - config->startPacket);
+
+		// TODO: Make a decision, should thse be included in the stats or not?
+		//config->startPacket = config->currentPacket;
+	} else if (config->receiveSockets > 1) {
+		// Every receive thread discards the packets before the start from its own socket
+		config->currentPacket = config->startPacket - 1;
+	} else {
+		printf("Starting warm-up...\n");
+		// The socket filter normally drops every packet before the start, so this only discards the packets that were queued before
+		// 	it was attached (or everything before the start, if the filter is unavailable) before waiting for the start packet
+		const double packetRate = clock160MHzPacketRate * (1 - config->obsClockBit) + clock200MHzPacketRate * config->obsClockBit;
+		while (config->currentPacket < config->startPacket) {
+			// Batches that are not kept are overwritten by the next read (or left un-committed in the current block for zero-copy)
+			int packets = config->packetsPerIteration;
+			if ((buffer = ilt_dada_operate_batch_buffer(config, &packets)) == NULL) {
+				return -1;
+			}
+
+			readPackets = ilt_dada_receive_batch(config, config->params->msgvec, packets);
+			if (readPackets < 1) {
+				// Nothing arrives through the filter until the start time, so the socket may time out while we wait
+				if ((config->state & NETWORK_FILTERED) && (errno == EAGAIN || errno == EWOULDBLOCK) && time(NULL) < (time_t) (config->startPacket / packetRate + config->portTimeout)) {
+					continue;
+				}
+				fprintf(stderr, "ERROR: packet receive on port %d during warm-up (errno %d: %s)\n", config->portNum, errno, strerror(errno));
+				return -1;
+			}
+
+			finalPacketOffset = (readPackets - 1) * config->packetSize;
+			lastPacket = lofar_udp_time_beamformed_packno(*((unsigned int *) &(buffer[finalPacketOffset + 8])),
+			                                              *((unsigned int *) &(buffer[finalPacketOffset + 12])),
+			                                              ((lofar_source_bytes *) &(buffer[1]))->clockBit);
+
+			if (lastPacket >= config->startPacket) {
+				// Trim the packets before the start from the batch, so that the first packet kept is the start packet
+				readPackets = ilt_dada_operate_trim_batch(config, buffer, readPackets, config->startPacket);
+
+				writtenBytes = ilt_dada_operate_commit_batch(config, buffer, readPackets);
+
+				config->params->bytesWritten += writtenBytes;
+				config->params->packetsSeen += readPackets;
+				config->params->packetsExpected += lastPacket - config->startPacket + 1;
+				config->params->packetsLastSeen += readPackets;
+				config->params->packetsLastExpected += lastPacket - config->startPacket + 1;
+			}
+
+			config->currentPacket = lastPacket;
+		}
+		printf("Warmup summary for port %d:\n", config->portNum);
+		ilt_dada_packet_comments(config->io->dadaWriter[0].multilog, config->portNum, config->currentPacket, config->startPacket, config->endPacket, config->params->packetsLastExpected, config->params->packetsLastSeen, config->params->packetsExpected, config->params->packetsSeen, NULL, NULL);
+
+		// Remove old stats before starting the observations
+		config->params->bytesWritten = 0;
+		config->params->packetsSeen = 0;
+		config->params->packetsExpected = 0;
+		config->params->packetsLastSeen = 0;
+		config->params->packetsLastExpected = 0;
+	}
+
+	// Start exact packet accounting from the current packet
+	ilt_dada_sequence_start(config);
+	ilt_dada_metrics_state(config, METRICS_RECORDING);
+
+	// Merge the packets from the receive threads if the port is received through several sockets
+	if (config->receiveSockets > 1) {
+		return ilt_dada_operate_loop_reuseport(config);
+	}
+
+	// Hand over to the receive/write pipeline if requested
+	if (config->pipelineDepth) {
+		return ilt_dada_operate_loop_pipelined(config);
+	}
+
+	// Create a locale variables for packets per iteration, so we can reduce the number for the final step
+	int packetsPerIteration = config->packetsPerIteration;
+
+	// Time each batch was received, and the latest latency percentiles for the status messages
+	struct timespec received = { 0 };
+	ilt_dada_latency_summary latencySummary = { 0 };
+
+	printf("Observation beginning...\n");
+	// While we still have data to record,
+	while (config->currentPacket < config->params->finalPacket) {
+		ILTD_PHASE_START();
+
+		// Get the target for the next N packets (private buffer or ringbuffer block)
+		int packets = packetsPerIteration;
+		if ((buffer = ilt_dada_operate_batch_buffer(config, &packets)) == NULL) {
+			return -1;
+		}
+		ILTD_PHASE_LAP(config, PHASE_BLOCK);
+
+		// Record the next N packets
+		readPackets = ilt_dada_receive_batch(config, config->params->msgvec, packets);
+		if (config->latencyStats) {
+			clock_gettime(CLOCK_REALTIME, &received);
+		}
+		ILTD_PHASE_LAP(config, PHASE_RECEIVE);
+
+		// Sanity check the amount that are read
+		if (readPackets < 0) {
+			fprintf(stderr, "ERROR: packet receive on port %d (errno %d: %s)\n", config->portNum, errno, strerror(errno));
+			return -1;
+		}
+		// With UDP GRO, batches are routinely short by less than a full coalesced receive
+		if (readPackets != packets && !config->udpGro) {
+			fprintf(stderr, "WARNING: packet receive on port %d received less packets than requested (expected,%d, recieved %d)\n", config->portNum, packets, readPackets);
+		}
+
+		finalPacketOffset = (readPackets - 1) * config->packetSize;
+
+		// Check the packets for errors if requested
+		if (ilt_dada_operate_check_batch(config, buffer, readPackets) < 0) {
+			return -1;
+		}
+		ILTD_PHASE_LAP(config, PHASE_CHECK);
+
+		// Get the last packet number
+		lastPacket = lofar_udp_time_beamformed_packno(*((unsigned int*) &(buffer[finalPacketOffset + 8])), *((unsigned int*) &(buffer[finalPacketOffset + 12])), ((lofar_source_bytes*) &(buffer[1]))->clockBit);
 
 		// Calculate packet loss / misses / etc.
-		config->params->packetsSeen += readPackets;
-		config->params->packetsExpected += lastPacket - config->currentPacket;
-		config->params->packetsLastSeen += readPackets;
-		config->params->packetsLastExpected += lastPacket - config->currentPacket;
+		ilt_dada_sequence_account(config, buffer, readPackets);
+		ILTD_PHASE_LAP(config, PHASE_DECODE);
 
-		// Write the raw packets to the ringbuffer
-		writeBytes = readPackets * config->packetSize;
-		writtenBytes = lofar_udp_io_write(config->io, 0, &(config->params->packetBuffer[0]), writeBytes);
+		// Write the raw packets to the ringbuffer (or mark them as written in the current block)
+		writtenBytes = ilt_dada_operate_commit_batch(config, buffer, readPackets);
 
-		VERBOSE(printf("%ld, %ld, %ld\n", ipcio_tell(config->io->dadaWriter[0].hdu->data_block), ipcio_tell(config->io->dadaWriter[0].hdu->data_block) % config->packetSize, ipcio_tell(config->io->dadaWriter[0].hdu->data_block) / config->packetSize % 256));
+		VERBOSE(if (!config->zeroCopy) { printf("%ld, %ld, %ld\n", ipcio_tell(config->io->dadaWriter[0].hdu->data_block), ipcio_tell(config->io->dadaWriter[0].hdu->data_block) % config->packetSize, ipcio_tell(config->io->dadaWriter[0].hdu->data_block) / config->packetSize % 256); });
 
-		// Check that all the packets were written
-		if (writtenBytes < 0) {
-			fprintf(stderr, "ERROR Port %d: Failed to write data to ringbuffer %d, exiting.\n", config->portNum, config->io->outputDadaKeys[0]);
-		} else if (writtenBytes != writeBytes) {
-			fprintf(stderr, "WARNING Port %d: Tried to write %ld bytes to buffer but only wrote %ld.\n", config->portNum, writeBytes, writtenBytes);
+		if (writtenBytes < 0 && config->zeroCopy) {
+			return -1;
 		}
 		config->params->bytesWritten += writtenBytes;
+		ilt_dada_metrics_commit(config);
 
+		if (config->latencyStats) {
+			ilt_dada_latency_record_batch(config, buffer, config->params->rxTimestamps, readPackets, &received);
+		}
 
+		// Take the final drop count before the end is reached, the socket filter rejects the packets that follow
+		if (lastPacket >= config->params->finalPacket) {
+			config->params->sequence.kernelDrops = ilt_dada_capture_drops(config);
+		}
 		config->currentPacket = lastPacket;
+		ilt_dada_metrics_receive(config);
+		ILTD_PHASE_LAP(config, PHASE_WRITE);
 
 		localLoops++;
 		if (localLoops > config->writesPerStatusLog) {
 			localLoops = 0;
-			#pragma omp task firstprivate(config)
-			ilt_dada_packet_comments(config->io->dadaWriter[0].multilog, config->portNum, config->currentPacket, config->startPacket, config->endPacket, config->params->packetsLastExpected, config->params->packetsLastSeen, config->params->packetsExpected, config->params->packetsSeen);
+			if (config->latencyStats) {
+				ilt_dada_latency_interval(config->params->latency, &latencySummary);
+			}
+			config->params->sequence.kernelDrops = ilt_dada_capture_drops(config);
+			ilt_dada_packet_comments(config->io->dadaWriter[0].multilog, config->portNum, config->currentPacket, config->startPacket, config->endPacket, config->params->packetsLastExpected, config->params->packetsLastSeen, config->params->packetsExpected, config->params->packetsSeen, &(config->params->sequence), config->latencyStats ? &latencySummary : NULL);
 			config->params->packetsLastSeen = 0;
 			config->params->packetsLastExpected = 0;
+			ILTD_PHASE_LAP(config, PHASE_STATUS);
 		}
+		ILTD_PHASE_END(config);
 
 
 		/*  else if (config->currentPacket + packetsPerIteration  > config->params->finalPacket) {
@@ -962,6 +2168,303 @@ int ilt_dada_operate_loop(ilt_dada_config *config) {
 	return 0;
 }
 
+/**
+ * @brief      The receive side of the pipelined recorder; packets are received
+ *             into a pool of batches that are passed to a writer thread through
+ *             a lock-free queue, so that a stall while writing to the
+ *             ringbuffer does not stop the socket from being drained
+ *
+ * @param      config  The recording configuration
+ *
+ * @return     0: Success, -1: Early Exit / Failure
+ */
+int ilt_dada_operate_loop_pipelined(ilt_dada_config *config) {
+	ilt_dada_batch_queue *queue = config->params->queue;
+	int readPackets, localLoops = 0, spins = 0, returnVal = 0;
+	long lastPacket;
+	ilt_dada_batch *batch;
+	pthread_t writerThread;
+
+	if (queue == NULL) {
+		fprintf(stderr, "ERROR Port %d: Pipeline queue has not been allocated, exiting.\n", config->portNum);
+		return -1;
+	}
+
+	// The writer would otherwise inherit the capture core, and compete with (or, in real-time mode, be starved by) the receive loop
+	cpu_set_t writerCores;
+	pthread_attr_t writerAttr;
+	ilt_dada_helper_cores(config, &writerCores);
+	pthread_attr_init(&writerAttr);
+	pthread_attr_setaffinity_np(&writerAttr, sizeof(cpu_set_t), &writerCores);
+
+	returnVal = pthread_create(&writerThread, &writerAttr, ilt_dada_operate_pipeline_writer, (void*) config);
+	pthread_attr_destroy(&writerAttr);
+	if (returnVal != 0) {
+		fprintf(stderr, "ERROR Port %d: Failed to start ringbuffer writer thread (errno %d: %s), exiting.\n", config->portNum, returnVal, strerror(returnVal));
+		return -1;
+	}
+
+	printf("Observation beginning (pipelined, %zu batches)...\n", queue->depth);
+	while (config->currentPacket < config->params->finalPacket) {
+		// Wait for the writer to free a batch; the socket buffer absorbs data in the meantime
+		while ((batch = ilt_dada_queue_producer_slot(queue)) == NULL && !__atomic_load_n(&(queue->failed), __ATOMIC_ACQUIRE)) {
+			ilt_dada_queue_wait(&spins);
+		}
+		spins = 0;
+
+		if (__atomic_load_n(&(queue->failed), __ATOMIC_ACQUIRE)) {
+			returnVal = -1;
+			break;
+		}
+
+		readPackets = ilt_dada_receive_batch(config, batch->msgvec, config->packetsPerIteration);
+		if (config->latencyStats) {
+			clock_gettime(CLOCK_REALTIME, &(batch->received));
+		}
+
+		if (readPackets < 0) {
+			fprintf(stderr, "ERROR: packet receive on port %d (errno %d: %s)\n", config->portNum, errno, strerror(errno));
+			returnVal = -1;
+			break;
+		}
+		if (readPackets != config->packetsPerIteration && !config->udpGro) {
+			fprintf(stderr, "WARNING: packet receive on port %d received less packets than requested (expected,%d, recieved %d)\n", config->portNum, config->packetsPerIteration, readPackets);
+		}
+
+		// Get the last packet number
+		const long finalPacketOffset = (readPackets - 1) * config->packetSize;
+		lastPacket = lofar_udp_time_beamformed_packno(*((unsigned int*) &(batch->buffer[finalPacketOffset + 8])), *((unsigned int*) &(batch->buffer[finalPacketOffset + 12])), ((lofar_source_bytes*) &(batch->buffer[1]))->clockBit);
+
+		// Calculate packet loss / misses / etc.
+		ilt_dada_sequence_account(config, batch->buffer, readPackets);
+
+		// Hand the batch to the writer
+		batch->packets = readPackets;
+		ilt_dada_queue_push(queue);
+
+		// Take the final drop count before the end is reached, the socket filter rejects the packets that follow
+		if (lastPacket >= config->params->finalPacket) {
+			config->params->sequence.kernelDrops = ilt_dada_capture_drops(config);
+		}
+		config->currentPacket = lastPacket;
+		ilt_dada_metrics_receive(config);
+
+		localLoops++;
+		if (localLoops > config->writesPerStatusLog) {
+			localLoops = 0;
+			config->params->sequence.kernelDrops = ilt_dada_capture_drops(config);
+			// The latency histograms are owned by the writer thread, they are only reported at the end of the observation
+			ilt_dada_packet_comments(config->io->dadaWriter[0].multilog, config->portNum, config->currentPacket, config->startPacket, config->endPacket, config->params->packetsLastExpected, config->params->packetsLastSeen, config->params->packetsExpected, config->params->packetsSeen, &(config->params->sequence), NULL);
+			config->params->packetsLastSeen = 0;
+			config->params->packetsLastExpected = 0;
+		}
+	}
+
+	// Let the writer drain the queue, then wait for it to exit
+	__atomic_store_n(&(queue->finished), 1, __ATOMIC_RELEASE);
+	pthread_join(writerThread, NULL);
+
+	if (__atomic_load_n(&(queue->failed), __ATOMIC_ACQUIRE)) {
+		returnVal = -1;
+	}
+
+	printf("Port %d: pipeline queue high-water mark was %zu of %zu batches (~%.3lf seconds of data).\n", config->portNum, queue->highWaterMark, queue->depth,
+	       (double) (queue->highWaterMark * config->packetsPerIteration) / (clock160MHzPacketRate * (1 - config->obsClockBit) + clock200MHzPacketRate * config->obsClockBit));
+
+	return returnVal;
+}
+
+/**
+ * @brief      The write side of the pipelined recorder; check the packets in
+ *             each batch and copy them to the ringbuffer
+ *
+ * @param      configPtr  The recording configuration
+ *
+ * @return     NULL
+ */
+void* ilt_dada_operate_pipeline_writer(void *configPtr) {
+	ilt_dada_config *config = (ilt_dada_config*) configPtr;
+	ilt_dada_batch_queue *queue = config->params->queue;
+	ilt_dada_batch *batch;
+	int spins = 0;
+
+	while (1) {
+		if ((batch = ilt_dada_queue_consumer_slot(queue)) == NULL) {
+			// Only exit once the queue has been drained
+			if (__atomic_load_n(&(queue->finished), __ATOMIC_ACQUIRE) && ilt_dada_queue_consumer_slot(queue) == NULL) {
+				break;
+			}
+			ilt_dada_queue_wait(&spins);
+			continue;
+		}
+		spins = 0;
+
+		if (ilt_dada_operate_check_batch(config, batch->buffer, batch->packets) < 0) {
+			__atomic_store_n(&(queue->failed), 1, __ATOMIC_RELEASE);
+			break;
+		}
+
+		const long writtenBytes = ilt_dada_operate_commit_batch(config, batch->buffer, batch->packets);
+		if (writtenBytes > 0) {
+			config->params->bytesWritten += writtenBytes;
+		}
+		ilt_dada_metrics_commit(config);
+
+		if (config->latencyStats) {
+			ilt_dada_latency_record_batch(config, batch->buffer, &(config->params->rxTimestamps[batch->msgvec - config->params->msgvec]), batch->packets, &(batch->received));
+		}
+
+		ilt_dada_queue_pop(queue);
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief      Check the headers of a batch of packets, following the
+ *             checkParameters option. When all packets are checked, corrupted
+ *             packets are flagged in params->badPackets and counted, but only
+ *             cause a failure if they are the first or last packet of the batch.
+ *
+ * @param      config   The recording configuration
+ * @param      buffer   The batch of packets
+ * @param[in]  packets  The number of packets in the batch
+ *
+ * @return     0: Success, -1: Corrupted header
+ */
+int ilt_dada_operate_check_batch(ilt_dada_config *config, int8_t *buffer, int packets) {
+	if (config->checkParameters == CHECK_ALL_PACKETS && config->checkInitParameters) {
+		uint64_t *badPackets = config->params->badPackets;
+		const int corrupted = ilt_dada_check_headers(buffer, packets, config->packetSize, badPackets);
+
+		if (corrupted) {
+			// The first and last packets are used to track the observation, we can't continue without them
+			if ((badPackets[0] & 1) || (badPackets[(packets - 1) / 64] & (1ul << ((packets - 1) % 64)))) {
+				fprintf(stderr, "ERROR: port first or late header data corrupted on port %d (%d / %d), exiting.\n\n", config->portNum,
+				        ilt_dada_check_header(config, (uint8_t*) &buffer[0]), ilt_dada_check_header(config, (uint8_t*) &buffer[(packets - 1) * config->packetSize]));
+				return -1;
+			}
+
+			fprintf(stderr, "WARNING: %d/%d packets in the latest batch on port %d have corrupted headers.\n", corrupted, packets, config->portNum);
+			config->params->packetsCorrupted += corrupted;
+		}
+	} else if (config->checkParameters == CHECK_FIRST_LAST) {
+		int firstHeader = ilt_dada_check_header(config, (uint8_t*) &buffer[0]);
+		int lastHeader = ilt_dada_check_header(config, (uint8_t*) &buffer[(packets - 1) * config->packetSize]);
+		if (firstHeader < 0 || lastHeader < 0) {
+			fprintf(stderr, "ERROR: port first or late header data corrupted on port %d (%d / %d), exiting.\n\n", config->portNum, firstHeader, lastHeader);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief      Remove the packets before a given packet number from the start
+ *             of a batch, moving the remaining packets to the start of the
+ *             buffer
+ *
+ * @param      config       The recording configuration
+ * @param      buffer       The batch of packets
+ * @param[in]  packets      The number of packets in the batch
+ * @param[in]  firstPacket  The first packet number to keep
+ *
+ * @return     The number of packets remaining in the batch
+ */
+int ilt_dada_operate_trim_batch(ilt_dada_config *config, int8_t *buffer, int packets, long firstPacket) {
+	int trimmed = 0;
+	while (trimmed < packets && lofar_udp_time_beamformed_packno(*((unsigned int *) &(buffer[trimmed * config->packetSize + 8])),
+	                                                             *((unsigned int *) &(buffer[trimmed * config->packetSize + 12])),
+	                                                             ((lofar_source_bytes *) &(buffer[trimmed * config->packetSize + 1]))->clockBit) < firstPacket) {
+		trimmed++;
+	}
+
+	if (trimmed) {
+		memmove(buffer, &(buffer[trimmed * config->packetSize]), (size_t) (packets - trimmed) * config->packetSize);
+	}
+
+	return packets - trimmed;
+}
+
+/**
+ * @brief      Reset the exact packet accounting, treating every packet up to
+ *             and including the current packet as already accounted for
+ *
+ * @param      config  The recording configuration
+ */
+void ilt_dada_sequence_start(ilt_dada_config *config) {
+	ilt_dada_sequence_stats *sequence = &(config->params->sequence);
+	// Read the drop counter before the reset, recvmmsg capture only keeps it in the sequence stats
+	const long kernelDrops = ilt_dada_capture_drops(config);
+
+	*sequence = ilt_dada_operate_params_default.sequence;
+	sequence->highestPacket = config->currentPacket;
+	sequence->kernelDropsBase = sequence->kernelDrops = kernelDrops;
+	memset(config->params->sequenceWindow, 0, ILTD_SEQUENCE_WINDOW / 8);
+}
+
+/**
+ * @brief      Account for every packet in a batch; the packet number of each
+ *             packet is compared to the highest packet seen so far to find
+ *             gaps (lost packets), duplicates and late (re-ordered) packets.
+ *             Late packets fill in a previous gap and reduce the number of lost
+ *             packets, packets older than the tracking window are assumed to
+ *             be late rather than duplicated.
+ *
+ * @param      config   The recording configuration
+ * @param[in]  buffer   The batch of packets
+ * @param[in]  packets  The number of packets in the batch
+ */
+void ilt_dada_sequence_account(ilt_dada_config *config, const int8_t *buffer, int packets) {
+	ilt_dada_operate_params *params = config->params;
+	ilt_dada_sequence_stats *sequence = &(params->sequence);
+	uint64_t *window = params->sequenceWindow;
+	long seen = 0, expected = 0;
+
+	for (int packetIdx = 0; packetIdx < packets; packetIdx++) {
+		const int8_t *packet = &(buffer[(long) packetIdx * config->packetSize]);
+		const long packetNumber = lofar_udp_time_beamformed_packno(*((unsigned int*) &(packet[8])), *((unsigned int*) &(packet[12])), ((lofar_source_bytes*) &(packet[1]))->clockBit);
+		const long windowIdx = packetNumber % ILTD_SEQUENCE_WINDOW;
+		const uint64_t windowBit = 1ul << (windowIdx % 64);
+
+		if (packetNumber > sequence->highestPacket) {
+			const long gap = packetNumber - sequence->highestPacket - 1;
+			if (gap > sequence->longestGap) {
+				sequence->longestGap = gap;
+			}
+
+			// Forget the packets that are falling out of the window
+			if (gap >= ILTD_SEQUENCE_WINDOW) {
+				memset(window, 0, ILTD_SEQUENCE_WINDOW / 8);
+			} else {
+				for (long skipped = sequence->highestPacket + 1; skipped < packetNumber; skipped++) {
+					window[(skipped % ILTD_SEQUENCE_WINDOW) / 64] &= ~(1ul << (skipped % 64));
+				}
+			}
+
+			window[windowIdx / 64] |= windowBit;
+			expected += packetNumber - sequence->highestPacket;
+			sequence->highestPacket = packetNumber;
+			seen++;
+		} else if ((sequence->highestPacket - packetNumber) >= ILTD_SEQUENCE_WINDOW) {
+			sequence->late++;
+			seen++;
+		} else if (window[windowIdx / 64] & windowBit) {
+			sequence->duplicates++;
+		} else {
+			window[windowIdx / 64] |= windowBit;
+			sequence->late++;
+			seen++;
+		}
+	}
+
+	params->packetsSeen += seen;
+	params->packetsExpected += expected;
+	params->packetsLastSeen += seen;
+	params->packetsLastExpected += expected;
+}
+
 /**
  * @brief      Setup the memory and structures needed to receive packets via
  *             recvmmsg
@@ -972,10 +2475,20 @@ int ilt_dada_operate_loop(ilt_dada_config *config) {
  */
 int ilt_data_operate_prepare(ilt_dada_config *config) {
 
+	// The pipelined recorder and io_uring backend need a pool of batches, otherwise we only need one
+	// 	(with several receive sockets, every receive thread has its own pool instead)
+	const int pipelined = config->pipelineDepth && config->receiveSockets == 1;
+	int numBatches = pipelined ? config->pipelineDepth : 1;
+	if (config->captureBackend == CAPTURE_IO_URING) {
+		numBatches = ILTD_URING_BATCHES;
+	}
+	const long numPackets = (long) numBatches * config->packetsPerIteration;
+
 	// Allocate memory for buffers
-	config->params->packetBuffer = (int8_t*) calloc(config->packetsPerIteration, config->packetSize * sizeof(int8_t));
-	config->params->msgvec = (struct mmsghdr*) calloc(config->packetsPerIteration, sizeof(struct mmsghdr));
-	config->params->iovecs = (struct iovec*) calloc(config->packetsPerIteration, sizeof(struct iovec));
+	config->params->packetBufferSize = (size_t) numPackets * config->packetSize;
+	config->params->packetBuffer = ilt_dada_buffer_alloc(config->params->packetBufferSize, config->hugePages, config->numaNode, &(config->params->packetBufferMapped));
+	config->params->msgvec = (struct mmsghdr*) calloc(numPackets, sizeof(struct mmsghdr));
+	config->params->iovecs = (struct iovec*) calloc(numPackets, sizeof(struct iovec));
 
 	if (config->params->packetBuffer == NULL) {
 		fprintf(stderr, "ERROR: Failed to allocate buffer for packetBuffer on port %d (errno %d: %s).", config->portNum, errno, strerror(errno));
@@ -993,16 +2506,66 @@ int ilt_data_operate_prepare(ilt_dada_config *config) {
 		return -1;
 	}
 
+	if ((config->params->sequenceWindow = (uint64_t*) calloc(ILTD_SEQUENCE_WINDOW / 64, sizeof(uint64_t))) == NULL) {
+		fprintf(stderr, "ERROR: Failed to allocate buffer for sequenceWindow on port %d (errno %d: %s).", config->portNum, errno, strerror(errno));
+		return -1;
+	}
+
+	// Bitmask of corrupted packets in the batch being written
+	if (config->checkParameters == CHECK_ALL_PACKETS) {
+		if ((config->params->badPackets = (uint64_t*) calloc((config->packetsPerIteration + 63) / 64, sizeof(uint64_t))) == NULL) {
+			fprintf(stderr, "ERROR: Failed to allocate buffer for badPackets on port %d (errno %d: %s).", config->portNum, errno, strerror(errno));
+			return -1;
+		}
+	}
+
+	// Ancillary data is used to track kernel drops on the UDP socket, and to collect kernel receive timestamps if we want latency statistics
+	if (config->captureBackend == CAPTURE_RECVMMSG || config->latencyStats) {
+		if ((config->params->controlBuffer = (char*) calloc(numPackets, ILTD_CONTROL_LEN)) == NULL) {
+			fprintf(stderr, "ERROR: Failed to allocate buffer for controlBuffer on port %d (errno %d: %s).", config->portNum, errno, strerror(errno));
+			return -1;
+		}
+	}
+
+	// Coalesced receives need their own message headers, covering several packets each
+	if (config->udpGro) {
+		config->params->groMsgvec = (struct mmsghdr*) calloc(config->packetsPerIteration, sizeof(struct mmsghdr));
+		config->params->groIovecs = (struct iovec*) calloc(config->packetsPerIteration, sizeof(struct iovec));
+
+		if (config->params->groMsgvec == NULL || config->params->groIovecs == NULL) {
+			fprintf(stderr, "ERROR: Failed to allocate UDP GRO message buffers on port %d (errno %d: %s).", config->portNum, errno, strerror(errno));
+			return -1;
+		}
+	}
+
+	if (config->latencyStats) {
+		config->params->rxTimestamps = (struct timespec*) calloc(numPackets, sizeof(struct timespec));
+		config->params->latency = ilt_dada_latency_init();
+
+		if (config->params->rxTimestamps == NULL || config->params->latency == NULL) {
+			fprintf(stderr, "ERROR: Failed to allocate latency statistics buffers on port %d (errno %d: %s).", config->portNum, errno, strerror(errno));
+			return -1;
+		}
+	}
+
+#ifdef ILTD_PHASE_TIMING
+	if ((config->params->phases = ilt_dada_phase_init()) == NULL) {
+		fprintf(stderr, "ERROR: Failed to allocate phase timing histograms on port %d (errno %d: %s).", config->portNum, errno, strerror(errno));
+		return -1;
+	}
+#endif
+
 	// TODO: Investigate if it can be more efficient to set msg_iovlen / iov_len to higher values (haven't seen it used like that in any documentation)
-	for (int i = 0; i < config->packetsPerIteration; i++) {
+	for (long i = 0; i < numPackets; i++) {
 		// Don't target a specific receiver
 		config->params->msgvec[i].msg_hdr.msg_name = NULL;
 		// Point at the buffer for this packet
 		config->params->msgvec[i].msg_hdr.msg_iov = &(config->params->iovecs[i]);
 		// Only collect one packet
 		config->params->msgvec[i].msg_hdr.msg_iovlen = 1;
-		// Don't collect the UDP metadata
-		config->params->msgvec[i].msg_hdr.msg_control = NULL;
+		// Don't collect the UDP metadata, other than the kernel drop counter and receive timestamp
+		config->params->msgvec[i].msg_hdr.msg_control = config->params->controlBuffer != NULL ? &(config->params->controlBuffer[i * ILTD_CONTROL_LEN]) : NULL;
+		config->params->msgvec[i].msg_hdr.msg_controllen = config->params->controlBuffer != NULL ? ILTD_CONTROL_LEN : 0;
 		// Initialise the flag to 0
 		config->params->msgvec[i].msg_hdr.msg_flags = 0;
 
@@ -1012,9 +2575,427 @@ int ilt_data_operate_prepare(ilt_dada_config *config) {
 
 	}
 
+	if (pipelined) {
+		if ((config->params->queue = ilt_dada_queue_init(config->pipelineDepth)) == NULL) {
+			fprintf(stderr, "ERROR: Failed to allocate pipeline queue on port %d.\n", config->portNum);
+			return -1;
+		}
+
+		for (int batch = 0; batch < numBatches; batch++) {
+			config->params->queue->batches[batch].buffer = &(config->params->packetBuffer[(long) batch * config->packetsPerIteration * config->packetSize]);
+			config->params->queue->batches[batch].msgvec = &(config->params->msgvec[(long) batch * config->packetsPerIteration]);
+		}
+	}
+
+	// Give every receive socket its own thread and batch queue
+	if (config->receiveSockets > 1) {
+		return ilt_dada_receivers_setup(config);
+	}
+
 	return 0;
 }
 
+/**
+ * @brief      Get the location the next batch of packets should be received
+ *             into. For zero-copy capture, this is the next free packet slot in
+ *             the current ringbuffer block (a new block will be opened if
+ *             needed) and the iovecs are re-pointed at the block memory. For the
+ *             io_uring backend, this is the next batch of provided buffers the
+ *             kernel will fill.
+ *
+ * @param      config   The recording configuration
+ * @param      packets  The number of packets requested, reduced to the number
+ *                      of slots remaining in the block for zero-copy capture
+ *                      (or before the io_uring buffers wrap around)
+ *
+ * @return     ptr: Success, NULL: Failure
+ */
+int8_t* ilt_dada_operate_batch_buffer(ilt_dada_config *config, int *packets) {
+	if (config->captureBackend == CAPTURE_IO_URING) {
+		return ilt_dada_uring_batch_buffer(config, packets);
+	}
+
+	if (!config->zeroCopy) {
+		return config->params->packetBuffer;
+	}
+
+	if (config->params->blockBuffer == NULL) {
+		if (ilt_dada_operate_open_block(config) < 0) {
+			return NULL;
+		}
+	}
+
+	// Don't overrun the end of the block; the batch after this will start on a fresh block
+	const int remainingPackets = (int) ((config->params->blockSize - config->params->blockOffset) / config->packetSize);
+	if (*packets > remainingPackets) {
+		*packets = remainingPackets;
+	}
+
+	int8_t *buffer = &(config->params->blockBuffer[config->params->blockOffset]);
+	for (int i = 0; i < *packets; i++) {
+		config->params->iovecs[i].iov_base = (void*) &(buffer[i * config->packetSize]);
+		config->params->iovecs[i].iov_len = config->packetSize;
+	}
+
+	return buffer;
+}
+
+/**
+ * @brief      Pass a batch of received packets to the ringbuffer; either copy
+ *             them from the packet buffer (in arrival order or to their
+ *             sequence-indexed slots), or for zero-copy capture, advance
+ *             through the current block and mark it as filled once it is full
+ *
+ * @param      config   The recording configuration
+ * @param      buffer   The buffer returned by ilt_dada_operate_batch_buffer
+ * @param[in]  packets  The number of packets to commit
+ *
+ * @return     >=0: bytes written, <0: Failure
+ */
+long ilt_dada_operate_commit_batch(ilt_dada_config *config, int8_t *buffer, int packets) {
+	const long writeBytes = (long) packets * config->packetSize;
+
+	if (config->sequencePlacement) {
+		return ilt_dada_operate_place_batch(config, buffer, packets);
+	}
+
+	if (!config->zeroCopy) {
+		const long writtenBytes = lofar_udp_io_write(config->io, 0, buffer, writeBytes);
+
+		// Check that all the packets were written
+		if (writtenBytes < 0) {
+			fprintf(stderr, "ERROR Port %d: Failed to write data to ringbuffer %d, exiting.\n", config->portNum, config->io->outputDadaKeys[0]);
+		} else if (writtenBytes != writeBytes) {
+			fprintf(stderr, "WARNING Port %d: Tried to write %ld bytes to buffer but only wrote %ld.\n", config->portNum, writeBytes, writtenBytes);
+		}
+
+		return writtenBytes;
+	}
+
+	// The data is already in place, move the offset forward and release the block if there is no space for another packet
+	config->params->blockOffset += writeBytes;
+	if ((config->params->blockOffset + config->packetSize) > config->params->blockSize) {
+		if (ilt_dada_operate_close_block(config) < 0) {
+			return -1;
+		}
+	}
+
+	return writeBytes;
+}
+
+/**
+ * @brief      Open the next ringbuffer block for zero-copy capture
+ *
+ * @param      config  The recording configuration
+ *
+ * @return     0: Success, -1: Failure
+ */
+int ilt_dada_operate_open_block(ilt_dada_config *config) {
+	ipcio_t *ringbuffer = config->io->dadaWriter[0].hdu->data_block;
+
+	config->params->blockBuffer = (int8_t*) ipcio_open_block_write(ringbuffer, &(config->params->blockId));
+	if (config->params->blockBuffer == NULL) {
+		fprintf(stderr, "ERROR Port %d: Failed to open a block on ringbuffer %d for writing, exiting.\n", config->portNum, config->io->outputDadaKeys[0]);
+		return -1;
+	}
+
+	config->params->blockSize = (long) ipcbuf_get_bufsz((ipcbuf_t *) ringbuffer);
+	config->params->blockOffset = 0;
+
+	if (config->sequencePlacement) {
+		// Find the most packets that fit in the block alongside their mask and the trailer
+		long packetSlots = (8 * (config->params->blockSize - (long) sizeof(ilt_dada_block_trailer))) / (8 * config->packetSize + 1);
+		while (packetSlots > 0 && (packetSlots * config->packetSize + ilt_dada_placement_trailer_size(packetSlots)) > config->params->blockSize) {
+			packetSlots--;
+		}
+
+		if (packetSlots < 1) {
+			fprintf(stderr, "ERROR Port %d: Ringbuffer block size (%ld) is too small for sequence-indexed placement of %d byte packets, exiting.\n", config->portNum, config->params->blockSize, config->packetSize);
+			return -1;
+		}
+
+		config->params->blockSlots = packetSlots;
+		config->params->blockPresent = 0;
+		memset(&(config->params->blockBuffer[packetSlots * config->packetSize]), 0, (packetSlots + 7) / 8);
+
+	// PSRDADA treats a partially filled block as the end of the data stream, so every block must hold a whole number of packets
+	} else if (config->params->blockSize % config->packetSize) {
+		fprintf(stderr, "ERROR Port %d: Ringbuffer block size (%ld) is not a multiple of the packet size (%d), zero-copy capture is not possible, exiting.\n", config->portNum, config->params->blockSize, config->packetSize);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief      Mark the current block as filled with the data committed so far
+ *             and release it to the readers. Sequence-indexed blocks have their
+ *             missing packets filled and their trailer written first.
+ *
+ * @param      config  The recording configuration
+ *
+ * @return     0: Success, -1: Failure
+ */
+int ilt_dada_operate_close_block(ilt_dada_config *config) {
+	if (config->params->blockBuffer == NULL) {
+		return 0;
+	}
+
+	if (config->sequencePlacement) {
+		const uint8_t *mask = (uint8_t*) &(config->params->blockBuffer[config->params->blockSlots * config->packetSize]);
+		for (long slot = 0; slot < config->params->blockSlots; slot++) {
+			if (!(mask[slot / 8] & (1 << (slot % 8)))) {
+				memset(&(config->params->blockBuffer[slot * config->packetSize]), config->fillPattern, config->packetSize);
+			}
+		}
+
+		const ilt_dada_block_trailer trailer = {
+			.magic = ILTD_TRAILER_MAGIC,
+			.packetSize = config->packetSize,
+			.packetSlots = (int32_t) config->params->blockSlots,
+			.packetsPresent = (int32_t) config->params->blockPresent,
+			.firstPacket = config->params->blockFirstPacket
+		};
+		memcpy(&(config->params->blockBuffer[config->params->blockSize - sizeof(ilt_dada_block_trailer)]), &trailer, sizeof(ilt_dada_block_trailer));
+
+		// The next block follows on directly from this one
+		config->params->blockFirstPacket += config->params->blockSlots;
+		config->params->blockOffset = config->params->blockSize;
+	}
+
+	if (ipcio_close_block_write(config->io->dadaWriter[0].hdu->data_block, (uint64_t) config->params->blockOffset) < 0) {
+		fprintf(stderr, "ERROR Port %d: Failed to mark block %" PRIu64 " on ringbuffer %d as filled, exiting.\n", config->portNum, config->params->blockId, config->io->outputDadaKeys[0]);
+		config->params->blockBuffer = NULL;
+		return -1;
+	}
+
+	config->params->blockBuffer = NULL;
+	config->params->blockOffset = 0;
+
+	return 0;
+}
+
+/**
+ * @brief      Get the number of bytes needed at the end of a block for the
+ *             packet mask and trailer used by sequence-indexed placement
+ *
+ * @param[in]  packetSlots  The number of packets in the block
+ *
+ * @return     The number of bytes
+ */
+long ilt_dada_placement_trailer_size(long packetSlots) {
+	return (packetSlots + 7) / 8 + (long) sizeof(ilt_dada_block_trailer);
+}
+
+/**
+ * @brief      Copy each packet in a batch to the slot in the ringbuffer
+ *             determined by its packet number, rather than its arrival order.
+ *             Blocks are released once a packet for a later block arrives;
+ *             packets belonging to a released block, or slots that are already
+ *             filled, are discarded. A jump of more than the ringbuffer in
+ *             either direction restarts the block sequence from that packet.
+ *
+ * @param      config   The recording configuration
+ * @param      buffer   The batch of packets
+ * @param[in]  packets  The number of packets in the batch
+ *
+ * @return     >=0: bytes written, <0: Failure
+ */
+long ilt_dada_operate_place_batch(ilt_dada_config *config, int8_t *buffer, int packets) {
+	ilt_dada_operate_params *params = config->params;
+	long writtenBytes = 0;
+
+	for (int packetIdx = 0; packetIdx < packets; packetIdx++) {
+		// Don't place packets whose headers failed the batch checks
+		if (params->badPackets != NULL && (params->badPackets[packetIdx / 64] & (1ul << (packetIdx % 64)))) {
+			continue;
+		}
+
+		int8_t *packet = &(buffer[packetIdx * config->packetSize]);
+		const long packetNumber = lofar_udp_time_beamformed_packno(*((unsigned int*) &(packet[8])), *((unsigned int*) &(packet[12])), ((lofar_source_bytes*) &(packet[1]))->clockBit);
+
+		// Anchor the first block on the first packet if we were not given a start packet
+		if (params->blockFirstPacket < 0) {
+			params->blockFirstPacket = packetNumber;
+		}
+
+		if (params->blockBuffer == NULL && ilt_dada_operate_open_block(config) < 0) {
+			return -1;
+		}
+
+		long slot = packetNumber - params->blockFirstPacket;
+
+		if (slot < 0 || slot >= params->blockSlots) {
+			// If the jump would cycle through the entire ringbuffer, either way, the stream has restarted; start again from this packet
+			const long ringbufferPackets = (long) ipcbuf_get_nbufs((ipcbuf_t *) config->io->dadaWriter[0].hdu->data_block) * params->blockSlots;
+			if (slot < -ringbufferPackets || slot >= (params->blockSlots + ringbufferPackets)) {
+				fprintf(stderr, "WARNING Port %d: Packet %ld is %ld packets %s the current block, restarting the block sequence.\n", config->portNum, packetNumber, labs(slot), slot < 0 ? "before" : "beyond");
+				if (ilt_dada_operate_close_block(config) < 0) {
+					return -1;
+				}
+				params->blockFirstPacket = packetNumber;
+
+			// The packet belongs to a block that has already been released
+			} else if (slot < 0) {
+				params->packetsDiscarded++;
+				continue;
+			}
+
+			// The packet belongs to a later block (or the block sequence was restarted); release blocks until we reach it
+			while (packetNumber >= (params->blockFirstPacket + params->blockSlots)) {
+				if (ilt_dada_operate_close_block(config) < 0 || ilt_dada_operate_open_block(config) < 0) {
+					return -1;
+				}
+			}
+			if (params->blockBuffer == NULL && ilt_dada_operate_open_block(config) < 0) {
+				return -1;
+			}
+			slot = packetNumber - params->blockFirstPacket;
+		}
+
+		uint8_t *mask = (uint8_t*) &(params->blockBuffer[params->blockSlots * config->packetSize]);
+		if (mask[slot / 8] & (1 << (slot % 8))) {
+			params->packetsDiscarded++;
+			continue;
+		}
+
+		memcpy(&(params->blockBuffer[slot * config->packetSize]), packet, config->packetSize);
+		mask[slot / 8] |= (uint8_t) (1 << (slot % 8));
+		params->blockPresent++;
+		writtenBytes += config->packetSize;
+	}
+
+	return writtenBytes;
+}
+
+/**
+ * @brief      Release any resources held by the main loop at the end of an
+ *             observation (currently only a partially filled zero-copy or
+ *             sequence-indexed block)
+ *
+ * @param      config  The recording configuration
+ */
+void ilt_dada_operate_cleanup(ilt_dada_config *config) {
+	if (config->params != NULL) {
+		ilt_dada_operate_close_block(config);
+	}
+}
+
+/**
+ * @brief      Allocate a single-producer/single-consumer batch queue
+ *
+ * @param[in]  depth  The number of batches in the queue
+ *
+ * @return     ptr: Success, NULL: Failure
+ */
+ilt_dada_batch_queue* ilt_dada_queue_init(size_t depth) {
+	ilt_dada_batch_queue *queue = aligned_alloc(64, sizeof(ilt_dada_batch_queue));
+	if (queue == NULL) {
+		return NULL;
+	}
+	memset(queue, 0, sizeof(ilt_dada_batch_queue));
+
+	queue->depth = depth;
+	queue->batches = calloc(depth, sizeof(ilt_dada_batch));
+	if (queue->batches == NULL) {
+		FREE_NOT_NULL(queue);
+		return NULL;
+	}
+
+	return queue;
+}
+
+/**
+ * @brief      Get the next free batch for the producer to fill
+ *
+ * @param      queue  The queue
+ *
+ * @return     ptr: free batch, NULL: queue is full
+ */
+ilt_dada_batch* ilt_dada_queue_producer_slot(ilt_dada_batch_queue *queue) {
+	const size_t head = __atomic_load_n(&(queue->head), __ATOMIC_ACQUIRE);
+	if ((queue->tail - head) >= queue->depth) {
+		return NULL;
+	}
+
+	return &(queue->batches[queue->tail % queue->depth]);
+}
+
+/**
+ * @brief      Publish the batch returned by ilt_dada_queue_producer_slot to the
+ *             consumer
+ *
+ * @param      queue  The queue
+ */
+void ilt_dada_queue_push(ilt_dada_batch_queue *queue) {
+	const size_t tail = queue->tail + 1;
+	__atomic_store_n(&(queue->tail), tail, __ATOMIC_RELEASE);
+
+	// Only the producer updates the high-water mark, so it can be read at the end without synchronisation
+	const size_t used = tail - __atomic_load_n(&(queue->head), __ATOMIC_RELAXED);
+	if (used > queue->highWaterMark) {
+		queue->highWaterMark = used;
+	}
+}
+
+/**
+ * @brief      Get the oldest filled batch for the consumer
+ *
+ * @param      queue  The queue
+ *
+ * @return     ptr: filled batch, NULL: queue is empty
+ */
+ilt_dada_batch* ilt_dada_queue_consumer_slot(ilt_dada_batch_queue *queue) {
+	const size_t tail = __atomic_load_n(&(queue->tail), __ATOMIC_ACQUIRE);
+	if (tail == queue->head) {
+		return NULL;
+	}
+
+	return &(queue->batches[queue->head % queue->depth]);
+}
+
+/**
+ * @brief      Return the batch returned by ilt_dada_queue_consumer_slot to the
+ *             producer
+ *
+ * @param      queue  The queue
+ */
+void ilt_dada_queue_pop(ilt_dada_batch_queue *queue) {
+	__atomic_store_n(&(queue->head), queue->head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief      Back off while waiting on the other side of a queue; spin
+ *             briefly, then yield, then sleep so an idle thread doesn't hold a
+ *             core
+ *
+ * @param      spins  The number of times we have waited so far, reset by the
+ *                    caller once the queue state changes
+ */
+void ilt_dada_queue_wait(int *spins) {
+	(*spins)++;
+	if (*spins < 64) {
+		ILTD_CPU_RELAX();
+	} else if (*spins < 1024) {
+		sched_yield();
+	} else {
+		const struct timespec sleep = { 0, 50000 };
+		nanosleep(&sleep, NULL);
+	}
+}
+
+/**
+ * @brief      Free a batch queue (the batch buffers are owned by the caller)
+ *
+ * @param      queue  The queue
+ */
+void ilt_dada_queue_cleanup(ilt_dada_batch_queue *queue) {
+	if (queue != NULL) {
+		FREE_NOT_NULL(queue->batches);
+		free(queue);
+	}
+}
+
 /**
  * @brief      Log information on packet loss, total observed packets
  *
@@ -1027,11 +3008,12 @@ int ilt_data_operate_prepare(ilt_dada_config *config) {
  * @param[in]  packetsLastSeen      The packets last seen
  * @param[in]  packetsExpected      The packets expected
  * @param[in]  packetsSeen          The packets seen
- * @param      config  The recording configuration
+ * @param[in]  sequence             The exact packet accounting counters (or NULL)
+ * @param[in]  latency              The latency percentiles to report (or NULL)
  */
-void ilt_dada_packet_comments(multilog_t *mlog, int portNum, long currentPacket, long startPacket, long endPacket, long packetsLastExpected, long packetsLastSeen, long packetsExpected, long packetsSeen) {
+void ilt_dada_packet_comments(multilog_t *mlog, int portNum, long currentPacket, long startPacket, long endPacket, long packetsLastExpected, long packetsLastSeen, long packetsExpected, long packetsSeen, const ilt_dada_sequence_stats *sequence, const ilt_dada_latency_summary *latency) {
 	const size_t maxlen = 2047;
-	char messageBlock[6][maxlen + 1];
+	char messageBlock[8][maxlen + 1];
 
 	snprintf(messageBlock[0], maxlen,"Port %d\tObservation %.1f%% Complete\t\t\tCurrent Packet %ld\n", portNum, 100.0f * (float) (currentPacket - startPacket) / (float) (endPacket - startPacket), currentPacket);
 	snprintf(messageBlock[1], maxlen, "Packets\t\tExpected\t\tSeen\t\t\tMissed\n");
@@ -1039,7 +3021,15 @@ void ilt_dada_packet_comments(multilog_t *mlog, int portNum, long currentPacket,
 	snprintf(messageBlock[3], maxlen, "%% (Current)\t...\t\t\t%.1f\t\t\t%.1f\n", 100.0f * (float) (packetsLastSeen) / (float) (packetsLastExpected), 100.0f * (float) (packetsLastExpected - packetsLastSeen) / (float) (packetsLastExpected));
 	snprintf(messageBlock[4], maxlen, "N (Total)\t%ld\t\t\t%ld\t\t\t%ld\n", packetsExpected, packetsSeen, packetsExpected - packetsSeen);
 	snprintf(messageBlock[5], maxlen, "%% (Total)\t...\t\t\t%.1f\t\t\t%.1f\n", 100.0f * (float) (packetsSeen) / (float) (packetsExpected), 100.0f * (float) (packetsExpected - packetsSeen) / (float) (packetsExpected));
-	multilog(mlog, 6, "%s%s%s%s%s%s", messageBlock[0], messageBlock[1], messageBlock[2], messageBlock[3], messageBlock[4], messageBlock[5]);
+	messageBlock[6][0] = '\0';
+	if (sequence != NULL) {
+		snprintf(messageBlock[6], maxlen, "Duplicate\t%ld\tLate\t%ld\tLongest Gap\t%ld\tKernel Drops\t%ld\n", sequence->duplicates, sequence->late, sequence->longestGap, sequence->kernelDrops - sequence->kernelDropsBase);
+	}
+	messageBlock[7][0] = '\0';
+	if (latency != NULL) {
+		ilt_dada_latency_comments(messageBlock[7], maxlen, latency);
+	}
+	multilog(mlog, 6, "%s%s%s%s%s%s%s%s", messageBlock[0], messageBlock[1], messageBlock[2], messageBlock[3], messageBlock[4], messageBlock[5], messageBlock[6], messageBlock[7]);
 }
 
 
@@ -1056,10 +3046,10 @@ void ilt_dada_packet_comments(multilog_t *mlog, int portNum, long currentPacket,
 void ilt_dada_config_cleanup(ilt_dada_config *config) {
 
 	if (config->params != NULL) {
-		FREE_NOT_NULL(config->params->packetBuffer);
-		FREE_NOT_NULL(config->params->msgvec);
-		FREE_NOT_NULL(config->params->iovecs);
-		FREE_NOT_NULL(config->params->timeout);
+		ilt_dada_operate_cleanup(config);
+		ilt_dada_capture_cleanup(config);
+		ilt_dada_receivers_cleanup(config);
+		ilt_dada_operate_params_cleanup(config->params);
 		FREE_NOT_NULL(config->params);
 	}
 	lofar_udp_io_write_cleanup(config->io, 1);
@@ -1067,10 +3057,45 @@ void ilt_dada_config_cleanup(ilt_dada_config *config) {
 	// Close the socket if it was successfully created
 	if (config->sockfd != -1) {
 		shutdown(config->sockfd, SHUT_RDWR);
+		close(config->sockfd);
+	}
+
+	// Close the other SO_REUSEPORT sockets
+	if (config->state & NETWORK_READY) {
+		for (int socketIdx = 1; socketIdx < config->receiveSockets; socketIdx++) {
+			shutdown(config->receiveSockfds[socketIdx], SHUT_RDWR);
+			close(config->receiveSockfds[socketIdx]);
+		}
 	}
 
 	FREE_NOT_NULL(config);
 }
 
+/**
+ * @brief      Free the buffers allocated for the main loop by
+ *             ilt_data_operate_prepare (but not the struct itself)
+ *
+ * @param      params  The operations struct
+ */
+void ilt_dada_operate_params_cleanup(ilt_dada_operate_params *params) {
+	ilt_dada_buffer_free(params->packetBuffer, params->packetBufferMapped);
+	params->packetBuffer = NULL;
+	FREE_NOT_NULL(params->msgvec);
+	FREE_NOT_NULL(params->iovecs);
+	FREE_NOT_NULL(params->timeout);
+	FREE_NOT_NULL(params->sequenceWindow);
+	FREE_NOT_NULL(params->badPackets);
+	FREE_NOT_NULL(params->controlBuffer);
+	FREE_NOT_NULL(params->groMsgvec);
+	FREE_NOT_NULL(params->groIovecs);
+	FREE_NOT_NULL(params->rxTimestamps);
+	FREE_NOT_NULL(params->latency);
+#ifdef ILTD_PHASE_TIMING
+	FREE_NOT_NULL(params->phases);
+#endif
+	ilt_dada_queue_cleanup(params->queue);
+	params->queue = NULL;
+}
+
 // Remove diagnostic ignored "openmp-use-default-none"
 #pragma clang diagnostic pop
\ No newline at end of file
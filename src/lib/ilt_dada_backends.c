@@ -0,0 +1,930 @@
+#include "ilt_dada.h"
+
+#include <poll.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/sock_diag.h>
+
+#ifdef ILTD_HAVE_IO_URING
+#include <liburing.h>
+#endif
+
+// Capture backend references:
+// https://www.kernel.org/doc/html/latest/networking/packet_mmap.html
+// https://www.kernel.org/doc/html/latest/networking/filter.html
+// https://github.com/torvalds/linux/blob/master/tools/testing/selftests/net/psock_tpacket.c
+// https://man7.org/linux/man-pages/man3/io_uring_prep_recv_multishot.3.html
+// https://man7.org/linux/man-pages/man3/io_uring_setup_buf_ring.3.html
+
+// AF_PACKET ring configuration; 4MB blocks which are handed to us after at most 8ms, even if they are not full
+#define ILTD_PACKET_RING_BLOCK_SIZE (1 << 22)
+#define ILTD_PACKET_RING_FRAME_SIZE (1 << 14)
+#define ILTD_PACKET_RING_MIN_BLOCKS 4
+#define ILTD_PACKET_RING_BLOCK_TIMEOUT_MS 8
+
+// io_uring configuration; buffer IDs are 16-bit and the buffer ring is limited to 32768 entries
+#define ILTD_URING_QUEUE_DEPTH 8
+#define ILTD_URING_MAX_BUFFERS (1 << 15)
+#define ILTD_URING_BUFFER_GROUP 0
+
+/**
+ * @brief      Check if the end of the observation has been reached; the socket
+ *             filter then starts rejecting the packets that follow, which the
+ *             kernel counts as drops alongside the packets we failed to read
+ *
+ * @param      config  The recording configuration
+ *
+ * @return     1: Drops are no longer counted, 0: Otherwise
+ */
+static inline int ilt_dada_capture_drops_ended(const ilt_dada_config *config) {
+	return config->endPacket > config->startPacket && config->currentPacket >= config->endPacket;
+}
+
+/**
+ * @brief      Parse the ancillary data returned with a batch of packets; the
+ *             SO_RXQ_OVFL kernel drop counter is cumulative, so it only needs
+ *             to be read from the final packet, while the SO_TIMESTAMPNS kernel
+ *             receive timestamps are copied for every packet if requested
+ *
+ * @param      config    The recording configuration
+ * @param      msgvec    The message headers the packets were received with
+ * @param[in]  received  The number of packets received
+ */
+static void ilt_dada_receive_control(ilt_dada_config *config, struct mmsghdr *msgvec, int received) {
+	struct timespec *rxTimestamps = config->latencyStats ? &(config->params->rxTimestamps[msgvec - config->params->msgvec]) : NULL;
+
+	for (int i = config->latencyStats ? 0 : (received - 1); i < received; i++) {
+		if (rxTimestamps != NULL) {
+			rxTimestamps[i].tv_sec = 0;
+			rxTimestamps[i].tv_nsec = 0;
+		}
+
+		for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&(msgvec[i].msg_hdr)); cmsg != NULL; cmsg = CMSG_NXTHDR(&(msgvec[i].msg_hdr), cmsg)) {
+			if (cmsg->cmsg_level != SOL_SOCKET) {
+				continue;
+			}
+
+			if (cmsg->cmsg_type == SCM_TIMESTAMPNS && rxTimestamps != NULL) {
+				memcpy(&(rxTimestamps[i]), CMSG_DATA(cmsg), sizeof(struct timespec));
+			} else if (cmsg->cmsg_type == SO_RXQ_OVFL && !ilt_dada_capture_drops_ended(config)) {
+				uint32_t drops;
+				memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+				config->params->sequence.kernelDrops = drops;
+			}
+		}
+	}
+}
+
+/**
+ * @brief      Receive a batch of packets from a socket with UDP GRO enabled.
+ *             Each message covers several packet slots, so the kernel can
+ *             return a run of coalesced packets in one go; the packets are then
+ *             moved together and their message headers are filled as if they
+ *             had been received individually. Short coalesced receives leave
+ *             space at the end of the batch, which is topped up with any
+ *             packets already waiting on the socket. Messages with a segment
+ *             size other than the packet size are not CEP packets from this
+ *             observation and are discarded.
+ *
+ * @param      config   The recording configuration
+ * @param      msgvec   The message headers to receive packets into
+ * @param[in]  packets  The maximum number of packets to receive
+ *
+ * @return     >=0: number of packets received, -1: failure (errno is set)
+ */
+static int ilt_dada_gro_recv(ilt_dada_config *config, struct mmsghdr *msgvec, int packets) {
+	struct mmsghdr *groMsgvec = config->params->groMsgvec;
+	struct iovec *groIovecs = config->params->groIovecs;
+	int8_t *buffer = (int8_t*) msgvec[0].msg_hdr.msg_iov->iov_base;
+	const int packetSize = config->packetSize;
+
+	// Every message must be able to hold a full coalesced receive, or the rest of it is lost
+	int segments = ILTD_GRO_MAX_BYTES / packetSize;
+	segments = segments > ILTD_GRO_MAX_SEGMENTS ? ILTD_GRO_MAX_SEGMENTS : segments;
+	segments = segments > packets ? packets : segments;
+	segments = segments < 1 ? 1 : segments;
+
+	int kept = 0;
+	while ((packets - kept) >= segments) {
+		const int messages = (packets - kept) / segments;
+		for (int i = 0; i < messages; i++) {
+			const int slot = kept + i * segments;
+			groIovecs[i].iov_base = &(buffer[(long) slot * packetSize]);
+			groIovecs[i].iov_len = (size_t) segments * packetSize;
+			groMsgvec[i].msg_hdr.msg_iov = &(groIovecs[i]);
+			groMsgvec[i].msg_hdr.msg_iovlen = 1;
+			groMsgvec[i].msg_hdr.msg_control = msgvec[slot].msg_hdr.msg_control;
+			groMsgvec[i].msg_hdr.msg_controllen = ILTD_CONTROL_LEN;
+		}
+
+		// Wait for the first packets as usual, but only top up the batch with packets that have already arrived
+		int received;
+		if (kept == 0) {
+			received = config->busyPoll ? ilt_dada_busy_poll_recv(config, groMsgvec, messages) : recvmmsg(config->sockfd, groMsgvec, messages, config->recvflags, config->params->timeout);
+			if (received < 1) {
+				return received;
+			}
+		} else if ((received = recvmmsg(config->sockfd, groMsgvec, messages, config->recvflags | MSG_DONTWAIT, NULL)) < 1) {
+			break;
+		}
+		ilt_dada_receive_control(config, groMsgvec, received);
+
+		const int base = kept;
+		for (int i = 0; i < received; i++) {
+			struct msghdr *header = &(groMsgvec[i].msg_hdr);
+			const int length = (int) groMsgvec[i].msg_len;
+			int segmentSize = 0, segmentsReceived;
+
+			for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(header); cmsg != NULL; cmsg = CMSG_NXTHDR(header, cmsg)) {
+				if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+					memcpy(&segmentSize, CMSG_DATA(cmsg), sizeof(segmentSize));
+				}
+			}
+
+			if (segmentSize == 0) {
+				// A single datagram, treated exactly as it would be without GRO
+				segmentsReceived = 1;
+			} else if (segmentSize == packetSize) {
+				// A shorter final segment is not a CEP packet, drop it
+				segmentsReceived = length / packetSize;
+				if (length % packetSize) {
+					config->params->groDiscarded++;
+				}
+			} else {
+				if (config->params->groDiscarded == 0) {
+					fprintf(stderr, "WARNING: Received coalesced datagrams of %d bytes on port %d (expected %d), discarding them.\n", segmentSize, config->portNum, packetSize);
+				}
+				config->params->groDiscarded += (length + segmentSize - 1) / segmentSize;
+				continue;
+			}
+
+			if (header->msg_flags & MSG_TRUNC) {
+				fprintf(stderr, "WARNING: A coalesced receive on port %d was larger than %d bytes and has been truncated.\n", config->portNum, segments * packetSize);
+			}
+
+			// Close the gaps left by short coalesced receives
+			const int slot = base + i * segments;
+			if (kept != slot) {
+				memmove(&(buffer[(long) kept * packetSize]), &(buffer[(long) slot * packetSize]), (size_t) segmentsReceived * packetSize);
+			}
+			for (int packet = kept; packet < kept + segmentsReceived; packet++) {
+				msgvec[packet].msg_len = (unsigned int) (segmentSize == 0 ? length : packetSize);
+			}
+			kept += segmentsReceived;
+		}
+	}
+
+	return kept;
+}
+
+/**
+ * @brief      Receive a batch of packets using the configured capture backend.
+ *             Follows the recvmmsg conventions; the packet payloads are placed
+ *             in the first iovec of each mmsghdr and msg_len is set to their
+ *             length.
+ *
+ * @param      config   The recording configuration
+ * @param      msgvec   The message headers to receive packets into
+ * @param[in]  packets  The maximum number of packets to receive
+ *
+ * @return     >=0: number of packets received, -1: failure (errno is set)
+ */
+int ilt_dada_receive_batch(ilt_dada_config *config, struct mmsghdr *msgvec, int packets) {
+	switch (config->captureBackend) {
+		case CAPTURE_PACKET_MMAP:
+			return ilt_dada_packet_ring_recv(config, msgvec, packets);
+
+		case CAPTURE_IO_URING:
+			return ilt_dada_uring_recv(config, msgvec, packets);
+
+		case CAPTURE_RECVMMSG:
+		default:
+			break;
+	}
+
+	if (config->udpGro) {
+		return ilt_dada_gro_recv(config, msgvec, packets);
+	}
+
+	if (config->params->controlBuffer != NULL) {
+		// The kernel overwrites the control length with the amount of data it returned
+		for (int i = 0; i < packets; i++) {
+			msgvec[i].msg_hdr.msg_controllen = ILTD_CONTROL_LEN;
+		}
+	}
+
+	const int received = config->busyPoll ? ilt_dada_busy_poll_recv(config, msgvec, packets) : recvmmsg(config->sockfd, msgvec, packets, config->recvflags, config->params->timeout);
+
+	if (config->params->controlBuffer != NULL && received > 0) {
+		ilt_dada_receive_control(config, msgvec, received);
+	}
+
+	return received;
+}
+
+/**
+ * @brief      Prepare the configured capture backend, after the network has
+ *             been checked and before the first packets are read
+ *
+ * @param      config  The recording configuration
+ *
+ * @return     0: success, -1: failure
+ */
+int ilt_dada_capture_setup(ilt_dada_config *config) {
+	switch (config->captureBackend) {
+		case CAPTURE_PACKET_MMAP:
+			return ilt_dada_packet_ring_setup(config);
+
+		case CAPTURE_IO_URING:
+			return ilt_dada_uring_setup(config);
+
+		case CAPTURE_RECVMMSG:
+		default:
+			break;
+	}
+
+	// Ask the kernel to report its drop counter with each packet
+	const int enableDropCounter = 1;
+	if (setsockopt(config->sockfd, SOL_SOCKET, SO_RXQ_OVFL, &enableDropCounter, sizeof(enableDropCounter)) == -1) {
+		fprintf(stderr, "WARNING: Failed to enable kernel drop reporting on port %d (errno %d: %s).\n", config->portNum, errno, strerror(errno));
+	}
+
+	// Ask the kernel to timestamp each packet as it arrives
+	if (config->latencyStats) {
+		const int enableTimestamps = 1;
+		if (setsockopt(config->sockfd, SOL_SOCKET, SO_TIMESTAMPNS, &enableTimestamps, sizeof(enableTimestamps)) == -1) {
+			fprintf(stderr, "ERROR: Failed to enable receive timestamps on port %d (errno %d: %s).\n", config->portNum, errno, strerror(errno));
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief      Get the number of packets the kernel has dropped because we did
+ *             not read them quickly enough, since the socket was opened. The
+ *             count is frozen once the end of the observation is reached.
+ *
+ * @param      config  The recording configuration
+ *
+ * @return     The cumulative number of dropped packets
+ */
+long ilt_dada_capture_drops(ilt_dada_config *config) {
+	if (ilt_dada_capture_drops_ended(config)) {
+		return config->params->sequence.kernelDrops;
+	}
+
+	switch (config->captureBackend) {
+		case CAPTURE_PACKET_MMAP:
+			// Reading the statistics resets them; accumulate them in the ring struct
+			if (config->params->packetRing != NULL && config->params->packetRing->fd != -1) {
+				struct tpacket_stats_v3 stats;
+				socklen_t statsLen = sizeof(stats);
+				if (getsockopt(config->params->packetRing->fd, SOL_PACKET, PACKET_STATISTICS, &stats, &statsLen) == 0) {
+					config->params->packetRing->packetsTotal += stats.tp_packets;
+					config->params->packetRing->packetsDropped += stats.tp_drops;
+				}
+				return config->params->packetRing->packetsDropped;
+			}
+			return 0;
+
+		case CAPTURE_IO_URING: {
+			// Nothing is returned alongside the packets, ask the socket directly
+			uint32_t memInfo[SK_MEMINFO_VARS];
+			socklen_t memInfoLen = sizeof(memInfo);
+			if (getsockopt(config->sockfd, SOL_SOCKET, SO_MEMINFO, memInfo, &memInfoLen) == 0) {
+				return memInfo[SK_MEMINFO_DROPS];
+			}
+			return config->params->sequence.kernelDrops;
+		}
+
+		case CAPTURE_RECVMMSG:
+		default:
+			// Updated as packets are received
+			return config->params->sequence.kernelDrops;
+	}
+}
+
+/**
+ * @brief      Release any resources held by the capture backend
+ *
+ * @param      config  The recording configuration
+ */
+void ilt_dada_capture_cleanup(ilt_dada_config *config) {
+	ilt_dada_packet_ring_cleanup(config);
+	ilt_dada_uring_cleanup(config);
+}
+
+
+
+/**
+ * @brief      Get the time in seconds since a previous CLOCK_MONOTONIC time
+ *
+ * @param[in]  start  The previous time
+ *
+ * @return     Elapsed seconds
+ */
+static double ilt_dada_since(const struct timespec *start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ilt_dada_elapsed(start, &now);
+}
+
+/**
+ * @brief      Receive a batch of packets by repeatedly calling a non-blocking
+ *             recvmmsg, never sleeping while waiting for packets. Mimics the
+ *             blocking behaviour: returns once all packets are received, or no
+ *             packets have been received for portTimeout seconds.
+ *
+ * @param      config   The recording configuration
+ * @param      msgvec   The message headers to receive packets into
+ * @param[in]  packets  The maximum number of packets to receive
+ *
+ * @return     >=0: number of packets received, -1: failure (errno is set)
+ */
+int ilt_dada_busy_poll_recv(ilt_dada_config *config, struct mmsghdr *msgvec, int packets) {
+	const int flags = config->recvflags | MSG_DONTWAIT;
+	struct timespec lastPacket;
+	clock_gettime(CLOCK_MONOTONIC, &lastPacket);
+	int received = 0;
+
+	while (received < packets) {
+		const int readPackets = recvmmsg(config->sockfd, &(msgvec[received]), packets - received, flags, NULL);
+
+		if (readPackets > 0) {
+			received += readPackets;
+			clock_gettime(CLOCK_MONOTONIC, &lastPacket);
+			continue;
+		}
+
+		if (readPackets < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+			return received ? received : -1;
+		}
+
+		if (ilt_dada_since(&lastPacket) > config->portTimeout) {
+			if (received == 0) {
+				errno = EAGAIN;
+				return -1;
+			}
+			break;
+		}
+
+		ILTD_CPU_RELAX();
+	}
+
+	return received;
+}
+
+
+
+/**
+ * @brief      Setup an AF_PACKET TPACKET_V3 receive ring on the configured
+ *             interface, filtered down to IPv4 UDP packets for our port. The UDP
+ *             socket is kept open (so the kernel does not reply to every packet
+ *             with an ICMP port unreachable message), but is set to discard all
+ *             of its packets.
+ *
+ * @param      config  The recording configuration
+ *
+ * @return     0: success, -1: failure
+ */
+int ilt_dada_packet_ring_setup(ilt_dada_config *config) {
+	if (config->params->packetRing != NULL) {
+		return 0;
+	}
+
+	ilt_dada_packet_ring *ring = calloc(1, sizeof(ilt_dada_packet_ring));
+	if (ring == NULL) {
+		fprintf(stderr, "ERROR: Failed to allocate packet ring struct on port %d.\n", config->portNum);
+		return -1;
+	}
+	ring->fd = -1;
+	config->params->packetRing = ring;
+
+	const unsigned int interfaceIdx = if_nametoindex(config->interfaceName);
+	if (interfaceIdx == 0) {
+		fprintf(stderr, "ERROR: Failed to find interface %s for port %d (errno %d: %s).\n", config->interfaceName, config->portNum, errno, strerror(errno));
+		return -1;
+	}
+
+	// Cooked packet socket; frames start at the IP header
+	if ((ring->fd = socket(AF_PACKET, SOCK_DGRAM, htons(ETH_P_IP))) == -1) {
+		fprintf(stderr, "ERROR: Failed to build packet socket on port %d (errno %d: %s). This requires CAP_NET_RAW.\n", config->portNum, errno, strerror(errno));
+		return -1;
+	}
+
+	// Only accept non-fragmented IPv4 UDP packets destined for our port
+	struct sock_filter portFilterCode[] = {
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 0),                               // A = IP version / header length
+		BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0xf0),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x40, 0, 8),                     // IPv4?
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 9),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, 6),              // UDP?
+		BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 6),
+		BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x3fff, 4, 0),                  // Fragmented?
+		BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0),                              // X = IP header length
+		BPF_STMT(BPF_LD | BPF_H | BPF_IND, 2),                               // A = UDP destination port
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (unsigned int) config->portNum, 0, 1),
+		BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+		BPF_STMT(BPF_RET | BPF_K, 0)
+	};
+	const struct sock_fprog portFilter = { .len = sizeof(portFilterCode) / sizeof(portFilterCode[0]), .filter = portFilterCode };
+	if (setsockopt(ring->fd, SOL_SOCKET, SO_ATTACH_FILTER, &portFilter, sizeof(portFilter)) == -1) {
+		fprintf(stderr, "ERROR: Failed to attach port filter to packet socket on port %d (errno %d: %s).\n", config->portNum, errno, strerror(errno));
+		return -1;
+	}
+
+	const int version = TPACKET_V3;
+	if (setsockopt(ring->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1) {
+		fprintf(stderr, "ERROR: Failed to request TPACKET_V3 on port %d (errno %d: %s).\n", config->portNum, errno, strerror(errno));
+		return -1;
+	}
+
+	// Packets we send are not of interest (mostly relevant for testing on loopback); this is best effort, they are also checked for while reading
+	const int ignoreOutgoing = 1;
+	setsockopt(ring->fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &ignoreOutgoing, sizeof(ignoreOutgoing));
+
+	// Size the ring to match the requested socket buffer
+	ring->blockSize = ILTD_PACKET_RING_BLOCK_SIZE;
+	ring->blockNum = (unsigned int) (config->portBufferSize / ILTD_PACKET_RING_BLOCK_SIZE);
+	if (ring->blockNum < ILTD_PACKET_RING_MIN_BLOCKS) {
+		ring->blockNum = ILTD_PACKET_RING_MIN_BLOCKS;
+	}
+
+	struct tpacket_req3 request = {
+		.tp_block_size = ring->blockSize,
+		.tp_block_nr = ring->blockNum,
+		.tp_frame_size = ILTD_PACKET_RING_FRAME_SIZE,
+		.tp_frame_nr = (ring->blockSize / ILTD_PACKET_RING_FRAME_SIZE) * ring->blockNum,
+		.tp_retire_blk_tov = ILTD_PACKET_RING_BLOCK_TIMEOUT_MS,
+		.tp_sizeof_priv = 0,
+		.tp_feature_req_word = 0
+	};
+	if (setsockopt(ring->fd, SOL_PACKET, PACKET_RX_RING, &request, sizeof(request)) == -1) {
+		fprintf(stderr, "ERROR: Failed to allocate %u x %u byte packet ring on port %d (errno %d: %s).\n", ring->blockNum, ring->blockSize, config->portNum, errno, strerror(errno));
+		return -1;
+	}
+
+	ring->mapSize = (size_t) ring->blockSize * ring->blockNum;
+	ring->map = mmap(NULL, ring->mapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, 0);
+	if (ring->map == MAP_FAILED) {
+		ring->map = NULL;
+		fprintf(stderr, "ERROR: Failed to map packet ring on port %d (errno %d: %s).\n", config->portNum, errno, strerror(errno));
+		return -1;
+	}
+
+	const struct sockaddr_ll address = {
+		.sll_family = AF_PACKET,
+		.sll_protocol = htons(ETH_P_IP),
+		.sll_ifindex = (int) interfaceIdx
+	};
+	if (bind(ring->fd, (const struct sockaddr*) &address, sizeof(address)) == -1) {
+		fprintf(stderr, "ERROR: Failed to bind packet socket to interface %s on port %d (errno %d: %s).\n", config->interfaceName, config->portNum, errno, strerror(errno));
+		return -1;
+	}
+
+	// Nothing should be read from the UDP socket from here on, let the kernel throw away the packets
+	struct sock_filter dropAllCode[] = { BPF_STMT(BPF_RET | BPF_K, 0) };
+	const struct sock_fprog dropAll = { .len = 1, .filter = dropAllCode };
+	if (setsockopt(config->sockfd, SOL_SOCKET, SO_ATTACH_FILTER, &dropAll, sizeof(dropAll)) == -1) {
+		fprintf(stderr, "WARNING: Failed to set UDP socket on port %d to drop packets, it will overflow (errno %d: %s).\n", config->portNum, errno, strerror(errno));
+	}
+	// This replaces the start time filter, packets before the start are discarded while warming up instead
+	config->state &= ~NETWORK_FILTERED;
+
+	printf("Port %d: capturing packets on %s with a %u x %u MB TPACKET_V3 ring.\n", config->portNum, config->interfaceName, ring->blockNum, ring->blockSize >> 20);
+	return 0;
+}
+
+/**
+ * @brief      Copy the UDP payloads of the next packets in the AF_PACKET ring
+ *             to the given message headers, waiting for up to portTimeout
+ *             seconds for more data to arrive
+ *
+ * @param      config   The recording configuration
+ * @param      msgvec   The message headers to receive packets into
+ * @param[in]  packets  The maximum number of packets to receive
+ *
+ * @return     >=0: number of packets received, -1: failure (errno is set)
+ */
+int ilt_dada_packet_ring_recv(ilt_dada_config *config, struct mmsghdr *msgvec, int packets) {
+	ilt_dada_packet_ring *ring = config->params->packetRing;
+	const int timeoutMs = (int) (config->portTimeout * 1000);
+	struct timespec lastPacket;
+	int received = 0;
+
+	if (config->busyPoll) {
+		clock_gettime(CLOCK_MONOTONIC, &lastPacket);
+	}
+
+	while (received < packets) {
+		struct tpacket_block_desc *block = (struct tpacket_block_desc*) (ring->map + (size_t) ring->currentBlock * ring->blockSize);
+
+		if (!ring->blockOpen) {
+			// Wait for the kernel to hand over the next block
+			if (!(__atomic_load_n(&(block->hdr.bh1.block_status), __ATOMIC_ACQUIRE) & TP_STATUS_USER)) {
+				// Spin on the block status rather than sleeping in poll
+				if (config->busyPoll) {
+					if (ilt_dada_since(&lastPacket) > config->portTimeout) {
+						if (received == 0) {
+							errno = EAGAIN;
+							return -1;
+						}
+						return received;
+					}
+					ILTD_CPU_RELAX();
+					continue;
+				}
+
+				struct pollfd pollFd = { .fd = ring->fd, .events = POLLIN | POLLERR, .revents = 0 };
+				const int pollReturn = poll(&pollFd, 1, timeoutMs);
+
+				if (pollReturn == 0) {
+					if (received == 0) {
+						errno = EAGAIN;
+						return -1;
+					}
+					return received;
+				} else if (pollReturn < 0 && errno != EINTR) {
+					return received ? received : -1;
+				}
+				continue;
+			}
+
+			ring->blockOpen = 1;
+			if (config->busyPoll) {
+				clock_gettime(CLOCK_MONOTONIC, &lastPacket);
+			}
+			ring->framesRemaining = block->hdr.bh1.num_pkts;
+			ring->currentFrame = (uint8_t*) block + block->hdr.bh1.offset_to_first_pkt;
+		}
+
+		if (ring->framesRemaining == 0) {
+			// Return the block to the kernel and move on to the next one
+			__atomic_store_n(&(block->hdr.bh1.block_status), TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+			ring->blockOpen = 0;
+			ring->currentBlock = (ring->currentBlock + 1) % ring->blockNum;
+			continue;
+		}
+
+		const struct tpacket3_hdr *frame = (struct tpacket3_hdr*) ring->currentFrame;
+		const struct sockaddr_ll *linkAddress = (struct sockaddr_ll*) (ring->currentFrame + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+		const uint8_t *ipHeader = ring->currentFrame + frame->tp_net;
+		const unsigned int ipHeaderLength = (ipHeader[0] & 0x0f) * 4;
+
+		ring->currentFrame += frame->tp_next_offset;
+		ring->framesRemaining--;
+
+		// Re-check the packet in case the socket filter could not be applied
+		if (linkAddress->sll_pkttype == PACKET_OUTGOING || frame->tp_snaplen < (ipHeaderLength + 8) || (ipHeader[0] >> 4) != 4 || ipHeader[9] != IPPROTO_UDP) {
+			ring->packetsSkipped++;
+			continue;
+		}
+
+		const uint8_t *udpHeader = ipHeader + ipHeaderLength;
+		if (((udpHeader[2] << 8) | udpHeader[3]) != config->portNum) {
+			ring->packetsSkipped++;
+			continue;
+		}
+
+		// Copy the payload, truncated to the size of our buffer
+		size_t payloadLength = ((udpHeader[4] << 8) | udpHeader[5]) - 8;
+		if (payloadLength > (frame->tp_snaplen - ipHeaderLength - 8)) {
+			payloadLength = frame->tp_snaplen - ipHeaderLength - 8;
+		}
+		if (payloadLength > msgvec[received].msg_hdr.msg_iov[0].iov_len) {
+			payloadLength = msgvec[received].msg_hdr.msg_iov[0].iov_len;
+		}
+
+		memcpy(msgvec[received].msg_hdr.msg_iov[0].iov_base, udpHeader + 8, payloadLength);
+		msgvec[received].msg_len = (unsigned int) payloadLength;
+		if (config->latencyStats) {
+			struct timespec *rxTimestamp = &(config->params->rxTimestamps[&(msgvec[received]) - config->params->msgvec]);
+			rxTimestamp->tv_sec = frame->tp_sec;
+			rxTimestamp->tv_nsec = frame->tp_nsec;
+		}
+		received++;
+	}
+
+	return received;
+}
+
+/**
+ * @brief      Report the kernel statistics for, and release, the AF_PACKET ring
+ *
+ * @param      config  The recording configuration
+ */
+void ilt_dada_packet_ring_cleanup(ilt_dada_config *config) {
+	if (config->params == NULL || config->params->packetRing == NULL) {
+		return;
+	}
+
+	ilt_dada_packet_ring *ring = config->params->packetRing;
+	if (ring->fd != -1) {
+		ilt_dada_capture_drops(config);
+		printf("Port %d: packet ring received %ld packets, the kernel dropped %ld packets, %ld unrelated packets were skipped.\n", config->portNum, ring->packetsTotal, ring->packetsDropped, ring->packetsSkipped);
+	}
+
+	if (ring->map != NULL) {
+		munmap(ring->map, ring->mapSize);
+	}
+	if (ring->fd != -1) {
+		close(ring->fd);
+	}
+
+	FREE_NOT_NULL(config->params->packetRing);
+}
+
+
+
+#ifdef ILTD_HAVE_IO_URING
+struct ilt_dada_uring {
+	struct io_uring ring;
+	struct io_uring_buf_ring *bufferRing;
+	unsigned int ringEntries;
+	unsigned int buffers;
+	int armed;
+
+	// The kernel takes buffers from the ring in the order they were added, and we always return them in order,
+	// so packets land back-to-back in the packet buffer and a batch is a contiguous run of buffer IDs
+	unsigned int nextBuffer;
+	unsigned int returnBuffer;
+	unsigned int returnCount;
+
+	long resubmissions;
+	long bufferStalls;
+};
+
+/**
+ * @brief      Queue a multishot receive on the UDP socket, which takes its
+ *             buffers from our provided buffer ring
+ *
+ * @param      config  The recording configuration
+ *
+ * @return     0: success, -1: failure
+ */
+static int ilt_dada_uring_arm(ilt_dada_config *config) {
+	ilt_dada_uring *uring = config->params->uring;
+
+	struct io_uring_sqe *sqe = io_uring_get_sqe(&(uring->ring));
+	if (sqe == NULL) {
+		fprintf(stderr, "ERROR: Failed to get an io_uring submission entry on port %d.\n", config->portNum);
+		return -1;
+	}
+
+	io_uring_prep_recv_multishot(sqe, config->sockfd, NULL, 0, 0);
+	sqe->flags |= IOSQE_BUFFER_SELECT;
+	sqe->buf_group = ILTD_URING_BUFFER_GROUP;
+
+	const int submitReturn = io_uring_submit(&(uring->ring));
+	if (submitReturn < 1) {
+		fprintf(stderr, "ERROR: Failed to submit multishot receive on port %d (errno %d: %s).\n", config->portNum, -submitReturn, strerror(-submitReturn));
+		return -1;
+	}
+
+	uring->armed = 1;
+	return 0;
+}
+
+/**
+ * @brief      Setup an io_uring instance with a provided buffer ring laid over
+ *             the packet buffer, and start a multishot receive on the UDP
+ *             socket
+ *
+ * @param      config  The recording configuration
+ *
+ * @return     0: success, -1: failure
+ */
+int ilt_dada_uring_setup(ilt_dada_config *config) {
+	if (config->params->uring != NULL) {
+		return 0;
+	}
+
+	const long buffers = (long) ILTD_URING_BATCHES * config->packetsPerIteration;
+	if (buffers > ILTD_URING_MAX_BUFFERS) {
+		fprintf(stderr, "ERROR: io_uring capture supports at most %d packets per iteration (requested %d).\n", ILTD_URING_MAX_BUFFERS / ILTD_URING_BATCHES, config->packetsPerIteration);
+		return -1;
+	}
+
+	ilt_dada_uring *uring = calloc(1, sizeof(ilt_dada_uring));
+	if (uring == NULL) {
+		fprintf(stderr, "ERROR: Failed to allocate io_uring struct on port %d.\n", config->portNum);
+		return -1;
+	}
+	uring->ring.ring_fd = -1;
+	uring->buffers = (unsigned int) buffers;
+	config->params->uring = uring;
+
+	int setupReturn;
+	if ((setupReturn = io_uring_queue_init(ILTD_URING_QUEUE_DEPTH, &(uring->ring), 0)) < 0) {
+		uring->ring.ring_fd = -1;
+		fprintf(stderr, "ERROR: Failed to initialise io_uring on port %d (errno %d: %s).\n", config->portNum, -setupReturn, strerror(-setupReturn));
+		return -1;
+	}
+
+	// The ring size must be a power of 2, it does not need to be full
+	uring->ringEntries = 1;
+	while (uring->ringEntries < uring->buffers) {
+		uring->ringEntries <<= 1;
+	}
+
+	if ((uring->bufferRing = io_uring_setup_buf_ring(&(uring->ring), uring->ringEntries, ILTD_URING_BUFFER_GROUP, 0, &setupReturn)) == NULL) {
+		fprintf(stderr, "ERROR: Failed to register provided buffer ring on port %d (errno %d: %s). This requires Linux 5.19 or newer.\n", config->portNum, -setupReturn, strerror(-setupReturn));
+		return -1;
+	}
+
+	const int mask = io_uring_buf_ring_mask(uring->ringEntries);
+	for (unsigned int bid = 0; bid < uring->buffers; bid++) {
+		io_uring_buf_ring_add(uring->bufferRing, &(config->params->packetBuffer[(long) bid * config->packetSize]), config->packetSize, (unsigned short) bid, mask, (int) bid);
+	}
+	io_uring_buf_ring_advance(uring->bufferRing, (int) uring->buffers);
+
+	if (ilt_dada_uring_arm(config) < 0) {
+		return -1;
+	}
+
+	printf("Port %d: capturing packets with an io_uring multishot receive over %u packet buffers.\n", config->portNum, uring->buffers);
+	return 0;
+}
+
+/**
+ * @brief      Get the location of the next batch the kernel will receive into,
+ *             and limit the batch so that it does not wrap around the end of the
+ *             packet buffer
+ *
+ * @param      config   The recording configuration
+ * @param      packets  The number of packets requested, may be reduced
+ *
+ * @return     ptr: Success, NULL: Failure
+ */
+int8_t* ilt_dada_uring_batch_buffer(ilt_dada_config *config, int *packets) {
+	ilt_dada_uring *uring = config->params->uring;
+	if (uring == NULL) {
+		fprintf(stderr, "ERROR: io_uring capture has not been setup on port %d.\n", config->portNum);
+		return NULL;
+	}
+
+	const int remainingBuffers = (int) (uring->buffers - uring->nextBuffer);
+	if (*packets > remainingBuffers) {
+		*packets = remainingBuffers;
+	}
+
+	return &(config->params->packetBuffer[(long) uring->nextBuffer * config->packetSize]);
+}
+
+/**
+ * @brief      Collect the next completed receives from the io_uring. The
+ *             buffers of the previous batch are handed back to the kernel first,
+ *             as it has been written to the ringbuffer by the time we are called
+ *             again. The kernel keeps receiving into the remaining buffers while
+ *             the caller processes and writes out this batch.
+ *
+ * @param      config   The recording configuration
+ * @param      msgvec   The message headers to set the packet lengths in
+ * @param[in]  packets  The maximum number of packets to receive
+ *
+ * @return     >=0: number of packets received, -1: failure (errno is set)
+ */
+int ilt_dada_uring_recv(ilt_dada_config *config, struct mmsghdr *msgvec, int packets) {
+	ilt_dada_uring *uring = config->params->uring;
+
+	if (uring->returnCount) {
+		const int mask = io_uring_buf_ring_mask(uring->ringEntries);
+		for (unsigned int i = 0; i < uring->returnCount; i++) {
+			const unsigned int bid = uring->returnBuffer + i;
+			io_uring_buf_ring_add(uring->bufferRing, &(config->params->packetBuffer[(long) bid * config->packetSize]), config->packetSize, (unsigned short) bid, mask, (int) i);
+		}
+		io_uring_buf_ring_advance(uring->bufferRing, (int) uring->returnCount);
+		uring->returnCount = 0;
+	}
+
+	struct __kernel_timespec timeout = {
+		.tv_sec = (long long) config->portTimeout,
+		.tv_nsec = (long long) ((config->portTimeout - (long long) config->portTimeout) * 1e9)
+	};
+	const unsigned int firstBuffer = uring->nextBuffer;
+	int received = 0;
+
+	while (received < packets) {
+		// The multishot receive is ended when we run out of buffers, on errors, and periodically by the kernel after a successful receive
+		if (!uring->armed) {
+			if (ilt_dada_uring_arm(config) < 0) {
+				errno = EIO;
+				return -1;
+			}
+			uring->resubmissions++;
+		}
+
+		struct io_uring_cqe *cqe;
+		const int waitReturn = io_uring_wait_cqe_timeout(&(uring->ring), &cqe, &timeout);
+
+		if (waitReturn == -ETIME || waitReturn == -EINTR) {
+			if (received == 0) {
+				errno = waitReturn == -ETIME ? EAGAIN : EINTR;
+				received = -1;
+			}
+			break;
+		} else if (waitReturn < 0) {
+			errno = -waitReturn;
+			received = received ? received : -1;
+			break;
+		}
+
+		const int result = cqe->res;
+		const unsigned int flags = cqe->flags;
+		io_uring_cqe_seen(&(uring->ring), cqe);
+
+		if (!(flags & IORING_CQE_F_MORE)) {
+			uring->armed = 0;
+		}
+
+		if (result < 0 || !(flags & IORING_CQE_F_BUFFER)) {
+			if (result == -ENOBUFS) {
+				// Packets are kept in the socket buffer until we return some buffers
+				uring->bufferStalls++;
+			} else if (result < 0) {
+				fprintf(stderr, "WARNING: io_uring receive on port %d failed (errno %d: %s), re-submitting.\n", config->portNum, -result, strerror(-result));
+			}
+			if (received) {
+				break;
+			}
+			continue;
+		}
+
+		const unsigned int bid = flags >> IORING_CQE_BUFFER_SHIFT;
+		if (bid != uring->nextBuffer) {
+			fprintf(stderr, "ERROR: io_uring on port %d filled buffer %u, but buffer %u was expected.\n", config->portNum, bid, uring->nextBuffer);
+			errno = EIO;
+			return -1;
+		}
+
+		msgvec[received].msg_len = (unsigned int) result;
+		uring->nextBuffer = (uring->nextBuffer + 1) % uring->buffers;
+		received++;
+
+		// A batch cannot wrap around the end of the packet buffer
+		if (uring->nextBuffer == 0) {
+			break;
+		}
+	}
+
+	if (received > 0) {
+		uring->returnBuffer = firstBuffer;
+		uring->returnCount = (unsigned int) received;
+	}
+
+	return received;
+}
+
+/**
+ * @brief      Stop any outstanding receives and release the io_uring
+ *
+ * @param      config  The recording configuration
+ */
+void ilt_dada_uring_cleanup(ilt_dada_config *config) {
+	if (config->params == NULL || config->params->uring == NULL) {
+		return;
+	}
+
+	ilt_dada_uring *uring = config->params->uring;
+	if (uring->ring.ring_fd != -1) {
+		printf("Port %d: io_uring receive was re-submitted %ld times, and ran out of buffers %ld times.\n", config->portNum, uring->resubmissions, uring->bufferStalls);
+
+		if (uring->bufferRing != NULL) {
+			io_uring_free_buf_ring(&(uring->ring), uring->bufferRing, uring->ringEntries, ILTD_URING_BUFFER_GROUP);
+		}
+		// Exiting the ring cancels the multishot receive
+		io_uring_queue_exit(&(uring->ring));
+	}
+
+	FREE_NOT_NULL(config->params->uring);
+}
+
+#else // ILTD_HAVE_IO_URING
+
+int ilt_dada_uring_setup(ilt_dada_config *config) {
+	fprintf(stderr, "ERROR: ILTDada was compiled without liburing, the io_uring backend cannot be used on port %d.\n", config->portNum);
+	return -1;
+}
+
+int8_t* ilt_dada_uring_batch_buffer(ilt_dada_config *config, int *packets) {
+	(void) packets;
+	fprintf(stderr, "ERROR: ILTDada was compiled without liburing, the io_uring backend cannot be used on port %d.\n", config->portNum);
+	return NULL;
+}
+
+int ilt_dada_uring_recv(ilt_dada_config *config, struct mmsghdr *msgvec, int packets) {
+	(void) config; (void) msgvec; (void) packets;
+	errno = ENOSYS;
+	return -1;
+}
+
+void ilt_dada_uring_cleanup(ilt_dada_config *config) {
+	(void) config;
+}
+
+#endif // ILTD_HAVE_IO_URING
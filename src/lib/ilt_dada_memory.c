@@ -0,0 +1,356 @@
+#include "ilt_dada.h"
+
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+// Memory references:
+// https://www.kernel.org/doc/html/latest/admin-guide/mm/hugetlbpage.html
+// https://www.kernel.org/doc/html/latest/admin-guide/mm/transhuge.html
+// https://www.kernel.org/doc/html/latest/admin-guide/mm/numa_memory_policy.html
+
+// Older libc headers may not know about selecting the hugepage size (Linux 3.8+)
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+#define ILTD_THP_SHMEM_PATH "/sys/kernel/mm/transparent_hugepage/shmem_enabled"
+#define ILTD_NUMA_NODE_PATH "/sys/class/net/%s/device/numa_node"
+#define ILTD_NUMA_CPULIST_PATH "/sys/devices/system/node/node%d/cpulist"
+
+
+/**
+ * @brief      Allocate a zeroed buffer, backed by hugepages if requested
+ *
+ *             Explicit hugepages (MAP_HUGETLB) must be reserved by the
+ *             administrator (vm.nr_hugepages, or hugepages= at boot for 1GiB
+ *             pages); if none are available we fall back to an anonymous
+ *             mapping advised to use transparent hugepages.
+ *
+ * @param[in]  size        The buffer size
+ * @param[in]  hugePages   The hugepage size in MB (0: 4KiB pages, 2 or 1024)
+ * @param[in]  numaNode    The NUMA node to place the buffer on (-1: no placement)
+ * @param[out] mappedSize  The length of the mapping, 0 if the buffer was calloc'd
+ *
+ * @return     The buffer, or NULL on failure
+ */
+int8_t* ilt_dada_buffer_alloc(size_t size, int hugePages, int numaNode, size_t *mappedSize) {
+	*mappedSize = 0;
+	if (!hugePages && numaNode < 0) {
+		return (int8_t*) calloc(size, sizeof(int8_t));
+	}
+
+	const size_t pageSize = hugePages ? (size_t) hugePages << 20 : (size_t) sysconf(_SC_PAGESIZE);
+	const size_t length = ((size + pageSize - 1) / pageSize) * pageSize;
+	const int pageShift = hugePages == 1024 ? 30 : 21;
+
+	void *buffer = MAP_FAILED;
+	if (hugePages) {
+		buffer = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (pageShift << MAP_HUGE_SHIFT), -1, 0);
+		if (buffer == MAP_FAILED) {
+			fprintf(stderr, "WARNING: Failed to allocate %ld MB of %dMB hugepages (errno %d: %s), falling back to transparent hugepages. Are enough hugepages reserved?\n", (long) (length >> 20), hugePages, errno, strerror(errno));
+		}
+	}
+
+	if (buffer == MAP_FAILED) {
+		if ((buffer = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+			fprintf(stderr, "ERROR: Failed to map %ld MB for a buffer (errno %d: %s).\n", (long) (length >> 20), errno, strerror(errno));
+			return NULL;
+		}
+		if (hugePages) {
+			madvise(buffer, length, MADV_HUGEPAGE);
+		}
+	}
+
+	// The pages have not been touched yet, so they will all be allocated on the requested node
+	if (numaNode >= 0 && ilt_dada_numa_bind(buffer, length, numaNode) < 0) {
+		munmap(buffer, length);
+		return NULL;
+	}
+
+	*mappedSize = length;
+	return (int8_t*) buffer;
+}
+
+/**
+ * @brief      Free a buffer allocated by ilt_dada_buffer_alloc
+ *
+ * @param      buffer      The buffer
+ * @param[in]  mappedSize  The length of the mapping, 0 if the buffer was calloc'd
+ */
+void ilt_dada_buffer_free(int8_t *buffer, size_t mappedSize) {
+	if (buffer == NULL) {
+		return;
+	}
+
+	if (mappedSize) {
+		munmap(buffer, mappedSize);
+	} else {
+		free(buffer);
+	}
+}
+
+/**
+ * @brief      Apply the requested hugepage and NUMA placement to the
+ *             ringbuffer blocks
+ *
+ *             PSRDADA creates its blocks with shmget, which gives us no way
+ *             to request SHM_HUGETLB, so we rely on shmem transparent
+ *             hugepages instead. The NUMA policy is attached to the shared
+ *             memory itself, so it also applies to pages first touched by
+ *             readers. This must be called before the blocks are first
+ *             touched.
+ *
+ * @param      config  The configuration struct
+ *
+ * @return     0: success, -1: failure
+ */
+int ilt_dada_ringbuffer_advise(ilt_dada_config *config) {
+	ipcbuf_t *ringbuffer = (ipcbuf_t*) config->io->dadaWriter[0].hdu->data_block;
+	const uint64_t nbufs = ipcbuf_get_nbufs(ringbuffer);
+	const uint64_t bufsz = ipcbuf_get_bufsz(ringbuffer);
+
+	// The advice is silently ignored unless shmem THP is set to advise, within_size or always
+	char thpMode[128] = "";
+	FILE *thpFile = config->hugePages ? fopen(ILTD_THP_SHMEM_PATH, "r") : NULL;
+	if (thpFile != NULL) {
+		if (fgets(thpMode, sizeof(thpMode), thpFile) == NULL) {
+			thpMode[0] = '\0';
+		}
+		fclose(thpFile);
+	}
+	if (strstr(thpMode, "[never]") != NULL || strstr(thpMode, "[deny]") != NULL) {
+		fprintf(stderr, "WARNING: Shared memory transparent hugepages are disabled (%s), the ringbuffer on key %d will use 4KiB pages; write 'advise' to enable them.\n", ILTD_THP_SHMEM_PATH, config->io->outputDadaKeys[0]);
+	}
+
+	for (uint64_t block = 0; block < nbufs; block++) {
+		if (config->hugePages && madvise(ringbuffer->buffer[block], bufsz, MADV_HUGEPAGE) == -1) {
+			fprintf(stderr, "ERROR: Failed to advise hugepages for ringbuffer %d block %ld (errno %d: %s).\n", config->io->outputDadaKeys[0], (long) block, errno, strerror(errno));
+			return -1;
+		}
+
+		if (config->numaNode >= 0 && ilt_dada_numa_bind(ringbuffer->buffer[block], bufsz, config->numaNode) < 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief      Touch every page of a region so it is faulted in, and lock it in RAM
+ *
+ * @param      region  The region
+ * @param[in]  length  The length of the region
+ *
+ * @return     0: success, -1: failed to lock the region (it is still faulted in)
+ */
+static int ilt_dada_prefault_region(int8_t *region, size_t length) {
+	const long pageSize = sysconf(_SC_PAGESIZE);
+
+	// Write rather than read, a read of an untouched page only maps the shared zero page
+	volatile int8_t *pages = region;
+	for (size_t offset = 0; offset < length; offset += pageSize) {
+		pages[offset] = pages[offset];
+	}
+
+	return mlock(region, length) == -1 ? -1 : 0;
+}
+
+/**
+ * @brief      Fault in and lock the ringbuffer and capture buffers, so the first
+ *             pass through them during the observation does not take millions
+ *             of page faults
+ *
+ * @param      config  The configuration struct
+ */
+void ilt_dada_prefault(ilt_dada_config *config) {
+	ipcbuf_t *ringbuffer = (ipcbuf_t*) config->io->dadaWriter[0].hdu->data_block;
+	const uint64_t nbufs = ipcbuf_get_nbufs(ringbuffer);
+	const uint64_t bufsz = ipcbuf_get_bufsz(ringbuffer);
+	const size_t captureSize = config->params->packetBufferSize;
+	int lockErrno = 0;
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (uint64_t block = 0; block < nbufs; block++) {
+		if (ilt_dada_prefault_region((int8_t*) ringbuffer->buffer[block], bufsz) < 0) {
+			lockErrno = errno;
+		}
+	}
+
+	if (config->params->packetBuffer != NULL && ilt_dada_prefault_region(config->params->packetBuffer, captureSize) < 0) {
+		lockErrno = errno;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	const double elapsed = ilt_dada_elapsed(&start, &end);
+
+	printf("Prefaulted %ld MB of ringbuffer and %ld MB of capture buffers on port %d in %.3lf seconds.\n", (long) ((nbufs * bufsz) >> 20), (long) (captureSize >> 20), config->portNum, elapsed);
+	multilog(config->io->dadaWriter[0].multilog, 6, "Prefaulted %ld MB of ringbuffer and %ld MB of capture buffers on port %d in %.3lf seconds.\n", (long) ((nbufs * bufsz) >> 20), (long) (captureSize >> 20), config->portNum, elapsed);
+
+	if (lockErrno) {
+		fprintf(stderr, "WARNING: Failed to lock the buffers for port %d in RAM (errno %d: %s); they may be paged out again. Raise the memlock limit (ulimit -l) or grant CAP_IPC_LOCK.\n", config->portNum, lockErrno, strerror(lockErrno));
+	}
+}
+
+/**
+ * @brief      Lock the whole process in memory, so page reclaim cannot stall
+ *             the capture threads. Future mappings (e.g., the ringbuffer) are
+ *             only locked if the memlock limit allows it, as every later
+ *             allocation would otherwise fail once the limit is reached.
+ */
+void ilt_dada_lock_memory() {
+	struct rlimit memlock;
+	int flags = MCL_CURRENT;
+
+	if (geteuid() == 0 || (getrlimit(RLIMIT_MEMLOCK, &memlock) == 0 && memlock.rlim_cur == RLIM_INFINITY)) {
+		flags |= MCL_FUTURE;
+	} else {
+		fprintf(stderr, "WARNING: The memlock limit is not unlimited (ulimit -l), only the memory allocated so far will be locked; use -F to lock the buffers.\n");
+	}
+
+	if (mlockall(flags) == -1) {
+		fprintf(stderr, "WARNING: Failed to lock the process in RAM (errno %d: %s). Raise the memlock limit (ulimit -l) or grant CAP_IPC_LOCK.\n", errno, strerror(errno));
+		return;
+	}
+
+	printf("Locked the process in RAM%s.\n", (flags & MCL_FUTURE) ? ", including future allocations" : "");
+}
+
+/**
+ * @brief      Find the NUMA node a network interface is attached to
+ *
+ * @param[in]  interfaceName  The interface name
+ *
+ * @return     >=0: node, -1: unknown (virtual interface, or a single node machine)
+ */
+int ilt_dada_numa_interface_node(const char *interfaceName) {
+	char path[128];
+	int node = -1;
+
+	snprintf(path, sizeof(path), ILTD_NUMA_NODE_PATH, interfaceName);
+	FILE *nodeFile = fopen(path, "r");
+	if (nodeFile == NULL) {
+		return -1;
+	}
+
+	if (fscanf(nodeFile, "%d", &node) != 1) {
+		node = -1;
+	}
+	fclose(nodeFile);
+
+	return node;
+}
+
+/**
+ * @brief      List the CPU cores of a NUMA node
+ *
+ * @param[in]  node      The node
+ * @param      cores     The output array
+ * @param[in]  maxCores  The length of the output array
+ *
+ * @return     >=0: number of cores, -1: failure
+ */
+int ilt_dada_numa_node_cores(int node, int *cores, int maxCores) {
+	char path[128], cpuList[4096];
+
+	snprintf(path, sizeof(path), ILTD_NUMA_CPULIST_PATH, node);
+	FILE *cpuFile = fopen(path, "r");
+	if (cpuFile == NULL) {
+		return -1;
+	}
+	if (fgets(cpuList, sizeof(cpuList), cpuFile) == NULL) {
+		fclose(cpuFile);
+		return -1;
+	}
+	fclose(cpuFile);
+
+	// The list is made of comma separated ranges, e.g., 0-7,16-23
+	int numCores = 0, first, last, consumed;
+	const char *listPtr = cpuList;
+	while (sscanf(listPtr, "%d%n", &first, &consumed) == 1) {
+		listPtr += consumed;
+		last = first;
+		if (*listPtr == '-' && sscanf(listPtr + 1, "%d%n", &last, &consumed) == 1) {
+			listPtr += consumed + 1;
+		}
+
+		for (int core = first; core <= last && numCores < maxCores; core++) {
+			cores[numCores++] = core;
+		}
+
+		if (*listPtr != ',') {
+			break;
+		}
+		listPtr++;
+	}
+
+	return numCores;
+}
+
+/**
+ * @brief      Resolve a port's automatic NUMA placement to the node of its
+ *             interface
+ *
+ * @param      config  The configuration struct
+ *
+ * @return     0: success (placement may have been disabled), -1: failure
+ */
+int ilt_dada_numa_resolve(ilt_dada_config *config) {
+	if (config->numaNode != ILTD_NUMA_AUTO) {
+		return 0;
+	}
+
+	if ((config->numaNode = ilt_dada_numa_interface_node(config->interfaceName)) < 0) {
+		fprintf(stderr, "WARNING: Unable to determine the NUMA node of %s for port %d, buffers will be allocated by the default policy.\n", config->interfaceName, config->portNum);
+	}
+
+	return 0;
+}
+
+/**
+ * @brief      Prefer allocating a region's pages on the given NUMA node
+ *
+ *             MPOL_PREFERRED rather than MPOL_BIND, running out of memory on
+ *             the node should slow the recorder down rather than kill it.
+ *
+ * @param      addr    The page-aligned start of the region
+ * @param[in]  length  The length of the region
+ * @param[in]  node    The node
+ *
+ * @return     0: success, -1: failure
+ */
+int ilt_dada_numa_bind(void *addr, size_t length, int node) {
+	unsigned long nodeMask[ILTD_NUMA_MAX_NODES / (8 * sizeof(unsigned long))] = { 0 };
+	nodeMask[node / (8 * sizeof(unsigned long))] = 1ul << (node % (8 * sizeof(unsigned long)));
+
+	if (syscall(SYS_mbind, addr, length, MPOL_PREFERRED, nodeMask, ILTD_NUMA_MAX_NODES + 1, 0) == -1) {
+		fprintf(stderr, "ERROR: Failed to place %ld MB on NUMA node %d (errno %d: %s).\n", (long) (length >> 20), node, errno, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief      Prefer allocating memory for the calling thread (and the threads
+ *             it creates) on the given NUMA node
+ *
+ * @param[in]  node  The node
+ *
+ * @return     0: success, -1: failure
+ */
+int ilt_dada_numa_set_thread(int node) {
+	unsigned long nodeMask[ILTD_NUMA_MAX_NODES / (8 * sizeof(unsigned long))] = { 0 };
+	nodeMask[node / (8 * sizeof(unsigned long))] = 1ul << (node % (8 * sizeof(unsigned long)));
+
+	if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, nodeMask, ILTD_NUMA_MAX_NODES + 1) == -1) {
+		fprintf(stderr, "ERROR: Failed to set the memory policy for NUMA node %d (errno %d: %s).\n", node, errno, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,306 @@
+#include "ilt_dada.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Metrics references:
+// https://man7.org/linux/man-pages/man7/shm_overview.7.html
+// https://prometheus.io/docs/instrumenting/exposition_formats/
+
+// Single-writer updates; readers may see a slightly stale value, but never a torn one
+#define ILTD_METRIC_STORE(field, value) __atomic_store_n(&(field), (value), __ATOMIC_RELAXED)
+#define ILTD_METRIC_LOAD(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+#define ILTD_METRIC_ADD(field, value) ILTD_METRIC_STORE(field, ILTD_METRIC_LOAD(field) + (value))
+
+static const char *latencyStages[LATENCY_TYPES] = { "queueing", "write", "station" };
+
+
+/**
+ * @brief      Create (or replace) a metrics segment in shared memory
+ *
+ * @param[in]  name      The segment name (as given to shm_open, e.g., "/iltdada")
+ * @param[in]  numPorts  The number of ports that will be recorded
+ *
+ * @return     ptr: Success, NULL: Failure
+ */
+ilt_dada_metrics* ilt_dada_metrics_open(const char *name, int numPorts) {
+	if (numPorts < 1 || numPorts > ILTD_METRICS_MAX_PORTS) {
+		fprintf(stderr, "ERROR: Metrics segments support between 1 and %d ports (requested %d).\n", ILTD_METRICS_MAX_PORTS, numPorts);
+		return NULL;
+	}
+
+	const int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+	if (fd == -1) {
+		fprintf(stderr, "ERROR: Failed to open metrics segment %s (errno %d: %s).\n", name, errno, strerror(errno));
+		return NULL;
+	}
+
+	if (ftruncate(fd, sizeof(ilt_dada_metrics)) == -1) {
+		fprintf(stderr, "ERROR: Failed to size metrics segment %s (errno %d: %s).\n", name, errno, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	// Populate the pages now so that the capture threads never fault on them
+	ilt_dada_metrics *metrics = mmap(NULL, sizeof(ilt_dada_metrics), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+	close(fd);
+	if (metrics == MAP_FAILED) {
+		fprintf(stderr, "ERROR: Failed to map metrics segment %s (errno %d: %s).\n", name, errno, strerror(errno));
+		return NULL;
+	}
+
+	// Readers check the magic last, so invalidate it while the segment is reset
+	__atomic_store_n(&(metrics->magic), 0, __ATOMIC_RELEASE);
+	memset(((char*) metrics) + sizeof(metrics->magic), 0, sizeof(ilt_dada_metrics) - sizeof(metrics->magic));
+	metrics->version = ILTD_METRICS_VERSION;
+	metrics->numPorts = numPorts;
+	metrics->pid = (int32_t) getpid();
+	metrics->startTime = (int64_t) time(NULL);
+	for (int port = 0; port < ILTD_METRICS_MAX_PORTS; port++) {
+		metrics->ports[port].startPacket = -1;
+		metrics->ports[port].endPacket = -1;
+		metrics->ports[port].currentPacket = -1;
+	}
+	__atomic_store_n(&(metrics->magic), ILTD_METRICS_MAGIC, __ATOMIC_RELEASE);
+
+	return metrics;
+}
+
+/**
+ * @brief      Unmap and remove a metrics segment
+ *
+ * @param      metrics  The metrics segment
+ * @param[in]  name     The segment name
+ */
+void ilt_dada_metrics_close(ilt_dada_metrics *metrics, const char *name) {
+	if (metrics == NULL) {
+		return;
+	}
+
+	__atomic_store_n(&(metrics->magic), 0, __ATOMIC_RELEASE);
+	munmap(metrics, sizeof(ilt_dada_metrics));
+	shm_unlink(name);
+}
+
+/**
+ * @brief      Attach to an existing metrics segment, read-only
+ *
+ * @param[in]  name  The segment name
+ *
+ * @return     ptr: Success, NULL: Failure (errno is set)
+ */
+const ilt_dada_metrics* ilt_dada_metrics_attach(const char *name) {
+	const int fd = shm_open(name, O_RDONLY, 0);
+	if (fd == -1) {
+		return NULL;
+	}
+
+	struct stat segmentStat;
+	if (fstat(fd, &segmentStat) == -1 || segmentStat.st_size != (off_t) sizeof(ilt_dada_metrics)) {
+		close(fd);
+		errno = EPROTO;
+		return NULL;
+	}
+
+	const ilt_dada_metrics *metrics = mmap(NULL, sizeof(ilt_dada_metrics), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (metrics == MAP_FAILED) {
+		return NULL;
+	}
+
+	if (__atomic_load_n(&(metrics->magic), __ATOMIC_ACQUIRE) != ILTD_METRICS_MAGIC || metrics->version != ILTD_METRICS_VERSION) {
+		munmap((void*) metrics, sizeof(ilt_dada_metrics));
+		errno = EPROTO;
+		return NULL;
+	}
+
+	return metrics;
+}
+
+/**
+ * @brief      Detach from a metrics segment
+ *
+ * @param[in]  metrics  The metrics segment
+ */
+void ilt_dada_metrics_detach(const ilt_dada_metrics *metrics) {
+	if (metrics != NULL) {
+		munmap((void*) metrics, sizeof(ilt_dada_metrics));
+	}
+}
+
+
+
+/**
+ * @brief      Update the recording state of a port
+ *
+ * @param      config  The recording configuration
+ * @param[in]  state   The new state
+ */
+void ilt_dada_metrics_state(ilt_dada_config *config, metrics_states state) {
+	ilt_dada_port_metrics *metrics = config->metrics;
+	if (metrics == NULL) {
+		return;
+	}
+
+	ILTD_METRIC_STORE(metrics->portNum, config->portNum);
+	ILTD_METRIC_STORE(metrics->startPacket, config->startPacket);
+	ILTD_METRIC_STORE(metrics->endPacket, config->endPacket);
+	ILTD_METRIC_STORE(metrics->state, (int32_t) state);
+}
+
+/**
+ * @brief      Publish the receive-side counters after a batch has been
+ *             accounted for
+ *
+ * @param      config  The recording configuration
+ */
+void ilt_dada_metrics_receive(ilt_dada_config *config) {
+	ilt_dada_port_metrics *metrics = config->metrics;
+	if (metrics == NULL) {
+		return;
+	}
+
+	const ilt_dada_operate_params *params = config->params;
+	ILTD_METRIC_STORE(metrics->packetsSeen, params->packetsSeen);
+	ILTD_METRIC_STORE(metrics->packetsExpected, params->packetsExpected);
+	ILTD_METRIC_STORE(metrics->packetsDuplicate, params->sequence.duplicates);
+	ILTD_METRIC_STORE(metrics->packetsLate, params->sequence.late);
+	ILTD_METRIC_STORE(metrics->longestGap, params->sequence.longestGap);
+	ILTD_METRIC_STORE(metrics->kernelDrops, params->sequence.kernelDrops - params->sequence.kernelDropsBase);
+	ILTD_METRIC_STORE(metrics->currentPacket, config->currentPacket);
+	ILTD_METRIC_ADD(metrics->batches, 1);
+
+	if (params->queue != NULL) {
+		ILTD_METRIC_STORE(metrics->queueDepth, (int64_t) (__atomic_load_n(&(params->queue->tail), __ATOMIC_RELAXED) - __atomic_load_n(&(params->queue->head), __ATOMIC_RELAXED)));
+	}
+}
+
+/**
+ * @brief      Publish the write-side counters after a batch has been written to
+ *             the ringbuffer
+ *
+ * @param      config  The recording configuration
+ */
+void ilt_dada_metrics_commit(ilt_dada_config *config) {
+	ilt_dada_port_metrics *metrics = config->metrics;
+	if (metrics == NULL) {
+		return;
+	}
+
+	const ilt_dada_operate_params *params = config->params;
+	ILTD_METRIC_STORE(metrics->bytesWritten, params->bytesWritten);
+	ILTD_METRIC_STORE(metrics->packetsCorrupted, params->packetsCorrupted);
+	ILTD_METRIC_STORE(metrics->packetsDiscarded, params->packetsDiscarded);
+	ILTD_METRIC_STORE(metrics->groDiscarded, params->groDiscarded);
+}
+
+/**
+ * @brief      Record a latency measurement in the metrics histograms
+ *
+ * @param      metrics  The port metrics
+ * @param[in]  type     The latency type
+ * @param[in]  value    The latency in nanoseconds
+ */
+void ilt_dada_metrics_latency(ilt_dada_port_metrics *metrics, latency_types type, int64_t value) {
+	if (metrics == NULL || value < 0) {
+		return;
+	}
+
+	// Find the first power-of-two microsecond bound that holds the value
+	const uint64_t micros = ((uint64_t) value + 999) / 1000;
+	int bucket = micros > 1 ? (64 - __builtin_clzll(micros - 1)) : 0;
+	if (bucket > ILTD_METRICS_LATENCY_BUCKETS) {
+		bucket = ILTD_METRICS_LATENCY_BUCKETS;
+	}
+
+	ILTD_METRIC_ADD(metrics->latencyBuckets[type][bucket], 1);
+	ILTD_METRIC_ADD(metrics->latencySumNs[type], value);
+}
+
+
+
+/**
+ * @brief      Append a formatted string to a buffer, tracking the offset
+ */
+#define ILTD_PROM_PRINTF(...) do { \
+	if (offset < (long) maxlen) { \
+		const int printed = snprintf(&(output[offset]), maxlen - offset, __VA_ARGS__); \
+		offset += printed > 0 ? printed : 0; \
+	} \
+} while (0)
+
+/**
+ * @brief      Format the contents of a metrics segment in the Prometheus text
+ *             exposition format
+ *
+ * @param[in]  metrics  The metrics segment
+ * @param      output   The output buffer
+ * @param[in]  maxlen   The size of the output buffer
+ *
+ * @return     >=0: Length of the output, -1: Output truncated
+ */
+long ilt_dada_metrics_prometheus(const ilt_dada_metrics *metrics, char *output, size_t maxlen) {
+	long offset = 0;
+	const int numPorts = metrics->numPorts < ILTD_METRICS_MAX_PORTS ? metrics->numPorts : ILTD_METRICS_MAX_PORTS;
+
+	const struct {
+		const char *name;
+		const char *type;
+		const char *help;
+		size_t offset;
+	} scalars[] = {
+		{ "iltdada_state", "gauge", "Recorder state (0: idle, 1: waiting, 2: recording, 3: finished, -1: failed)", offsetof(ilt_dada_port_metrics, state) },
+		{ "iltdada_packets_received_total", "counter", "Unique packets received", offsetof(ilt_dada_port_metrics, packetsSeen) },
+		{ "iltdada_packets_expected_total", "counter", "Packets expected from the observed packet numbers", offsetof(ilt_dada_port_metrics, packetsExpected) },
+		{ "iltdada_packets_duplicate_total", "counter", "Duplicated packets received", offsetof(ilt_dada_port_metrics, packetsDuplicate) },
+		{ "iltdada_packets_late_total", "counter", "Packets received out of order", offsetof(ilt_dada_port_metrics, packetsLate) },
+		{ "iltdada_packets_corrupted_total", "counter", "Packets with corrupted headers", offsetof(ilt_dada_port_metrics, packetsCorrupted) },
+		{ "iltdada_packets_discarded_total", "counter", "Packets discarded while placing packets by sequence number", offsetof(ilt_dada_port_metrics, packetsDiscarded) },
+		{ "iltdada_gro_discarded_total", "counter", "Coalesced datagrams (or trailing segments) discarded because they are not the packet size", offsetof(ilt_dada_port_metrics, groDiscarded) },
+		{ "iltdada_kernel_drops_total", "counter", "Packets dropped by the kernel before the recorder could read them", offsetof(ilt_dada_port_metrics, kernelDrops) },
+		{ "iltdada_bytes_written_total", "counter", "Bytes written to the ringbuffer", offsetof(ilt_dada_port_metrics, bytesWritten) },
+		{ "iltdada_batches_total", "counter", "Batches of packets received", offsetof(ilt_dada_port_metrics, batches) },
+		{ "iltdada_start_packet", "gauge", "Packet number the observation starts at", offsetof(ilt_dada_port_metrics, startPacket) },
+		{ "iltdada_end_packet", "gauge", "Packet number the observation ends at", offsetof(ilt_dada_port_metrics, endPacket) },
+		{ "iltdada_current_packet", "gauge", "Packet number of the latest batch", offsetof(ilt_dada_port_metrics, currentPacket) },
+		{ "iltdada_longest_gap_packets", "gauge", "Longest run of missing packets", offsetof(ilt_dada_port_metrics, longestGap) },
+		{ "iltdada_queue_depth_batches", "gauge", "Batches waiting to be written in pipelined mode", offsetof(ilt_dada_port_metrics, queueDepth) },
+	};
+
+	for (size_t metric = 0; metric < sizeof(scalars) / sizeof(scalars[0]); metric++) {
+		ILTD_PROM_PRINTF("# HELP %s %s\n# TYPE %s %s\n", scalars[metric].name, scalars[metric].help, scalars[metric].name, scalars[metric].type);
+		for (int port = 0; port < numPorts; port++) {
+			const char *portMetrics = (const char*) &(metrics->ports[port]);
+			int64_t value;
+			if (scalars[metric].offset == offsetof(ilt_dada_port_metrics, state)) {
+				value = __atomic_load_n((const int32_t*) (portMetrics + scalars[metric].offset), __ATOMIC_RELAXED);
+			} else {
+				value = __atomic_load_n((const int64_t*) (portMetrics + scalars[metric].offset), __ATOMIC_RELAXED);
+			}
+			ILTD_PROM_PRINTF("%s{port=\"%d\"} %ld\n", scalars[metric].name, __atomic_load_n(&(metrics->ports[port].portNum), __ATOMIC_RELAXED), value);
+		}
+	}
+
+	ILTD_PROM_PRINTF("# HELP iltdada_latency_seconds Packet latency by stage\n# TYPE iltdada_latency_seconds histogram\n");
+	for (int port = 0; port < numPorts; port++) {
+		const ilt_dada_port_metrics *portMetrics = &(metrics->ports[port]);
+		const int portNum = __atomic_load_n(&(portMetrics->portNum), __ATOMIC_RELAXED);
+
+		for (int type = 0; type < LATENCY_TYPES; type++) {
+			int64_t cumulative = 0;
+			for (int bucket = 0; bucket <= ILTD_METRICS_LATENCY_BUCKETS; bucket++) {
+				cumulative += __atomic_load_n(&(portMetrics->latencyBuckets[type][bucket]), __ATOMIC_RELAXED);
+				if (bucket < ILTD_METRICS_LATENCY_BUCKETS) {
+					ILTD_PROM_PRINTF("iltdada_latency_seconds_bucket{port=\"%d\",stage=\"%s\",le=\"%.9g\"} %ld\n", portNum, latencyStages[type], (double) (1l << bucket) * 1e-6, cumulative);
+				} else {
+					ILTD_PROM_PRINTF("iltdada_latency_seconds_bucket{port=\"%d\",stage=\"%s\",le=\"+Inf\"} %ld\n", portNum, latencyStages[type], cumulative);
+				}
+			}
+			ILTD_PROM_PRINTF("iltdada_latency_seconds_sum{port=\"%d\",stage=\"%s\"} %.9f\n", portNum, latencyStages[type], (double) __atomic_load_n(&(portMetrics->latencySumNs[type]), __ATOMIC_RELAXED) * 1e-9);
+			ILTD_PROM_PRINTF("iltdada_latency_seconds_count{port=\"%d\",stage=\"%s\"} %ld\n", portNum, latencyStages[type], cumulative);
+		}
+	}
+
+	return offset < (long) maxlen ? offset : -1;
+}
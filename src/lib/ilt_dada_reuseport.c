@@ -0,0 +1,423 @@
+#include "ilt_dada.h"
+
+#include <limits.h>
+
+// Multi-socket capture references:
+// https://man7.org/linux/man-pages/man7/socket.7.html (SO_REUSEPORT, SO_ATTACH_REUSEPORT_CBPF)
+// https://github.com/torvalds/linux/blob/master/tools/testing/selftests/net/reuseport_bpf.c
+
+// A receive thread; it has its own copy of the port's configuration, pointing at its socket and its own batch pool and queue
+struct ilt_dada_receiver {
+	ilt_dada_config config;
+	ilt_dada_operate_params params;
+	pthread_t thread;
+	int started;
+
+	// Merge state, only touched by the writer
+	ilt_dada_batch *batch;
+	int offset;
+	int done;
+};
+
+
+/**
+ * @brief      Get the packet number of a packet in a buffer
+ *
+ * @param[in]  packet  The packet
+ *
+ * @return     The packet number
+ */
+static inline long ilt_dada_receiver_packno(const int8_t *packet) {
+	return lofar_udp_time_beamformed_packno(*((unsigned int*) &(packet[8])), *((unsigned int*) &(packet[12])), ((lofar_source_bytes*) &(packet[1]))->clockBit);
+}
+
+/**
+ * @brief      Attach a steering program to the SO_REUSEPORT group of a port,
+ *             so that runs of packetsPerIteration packets (by their sequence
+ *             number) are sent to each socket in turn. Each receive thread then
+ *             gets full batches of consecutive packets, rather than every N-th
+ *             packet, which keeps the merge cheap.
+ *
+ * @param      config  The ilt_dada configuration struct
+ *
+ * @return     0: success, -1: failure
+ */
+int ilt_dada_reuseport_steer(ilt_dada_config *config) {
+	// Reuseport programs see the UDP payload, unlike socket filters; return the index of the socket (in the order they were bound)
+	struct sock_filter code[16];
+	int idx = ilt_dada_filter_load_le32(code, 12);
+	code[idx++] = (struct sock_filter) BPF_STMT(BPF_ALU | BPF_DIV | BPF_K, (unsigned int) (UDPNTIMESLICE * config->packetsPerIteration));
+	code[idx++] = (struct sock_filter) BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, (unsigned int) config->receiveSockets);
+	code[idx++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_A, 0);
+
+	const struct sock_fprog steer = { .len = (unsigned short) idx, .filter = code };
+	if (setsockopt(config->receiveSockfds[0], SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &steer, sizeof(steer)) == -1) {
+		fprintf(stderr, "ERROR: Failed to attach the SO_REUSEPORT steering program on port %d (errno %d: %s).\n", config->portNum, errno, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief      Allocate a batch pool and queue for every receive socket of a
+ *             port, following the port's configuration
+ *
+ * @param      config  The ilt_dada configuration struct
+ *
+ * @return     0: success, -1: failure
+ */
+int ilt_dada_receivers_setup(ilt_dada_config *config) {
+	ilt_dada_receiver *receivers = calloc(config->receiveSockets, sizeof(ilt_dada_receiver));
+	if (receivers == NULL) {
+		fprintf(stderr, "ERROR: Failed to allocate receive thread structs on port %d.\n", config->portNum);
+		return -1;
+	}
+	config->params->receivers = receivers;
+
+	for (int receiverIdx = 0; receiverIdx < config->receiveSockets; receiverIdx++) {
+		ilt_dada_receiver *receiver = &(receivers[receiverIdx]);
+
+		// Every receiver reads a single socket through the pipelined path
+		receiver->config = *config;
+		receiver->config.sockfd = config->receiveSockfds[receiverIdx];
+		receiver->config.receiveSockets = 1;
+		receiver->config.metrics = NULL;
+		receiver->params = ilt_dada_operate_params_default;
+		receiver->params.finalPacket = config->params->finalPacket;
+		receiver->config.params = &(receiver->params);
+
+		if (ilt_data_operate_prepare(&(receiver->config)) < 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief      Free the batch pools and queues of the receive threads
+ *
+ * @param      config  The ilt_dada configuration struct
+ */
+void ilt_dada_receivers_cleanup(ilt_dada_config *config) {
+	if (config->params == NULL || config->params->receivers == NULL) {
+		return;
+	}
+
+	for (int receiverIdx = 0; receiverIdx < config->receiveSockets; receiverIdx++) {
+		ilt_dada_operate_params_cleanup(&(config->params->receivers[receiverIdx].params));
+	}
+	FREE_NOT_NULL(config->params->receivers);
+}
+
+/**
+ * @brief      Remove the packets flagged as corrupted by
+ *             ilt_dada_operate_check_batch from a batch
+ *
+ * @param      config   The receiver's configuration
+ * @param      buffer   The batch of packets
+ * @param[in]  packets  The number of packets in the batch
+ *
+ * @return     The number of packets remaining in the batch
+ */
+static int ilt_dada_receiver_compact(ilt_dada_config *config, int8_t *buffer, int packets) {
+	const uint64_t *badPackets = config->params->badPackets;
+	int kept = 0;
+
+	for (int packetIdx = 0; packetIdx < packets; packetIdx++) {
+		if (badPackets[packetIdx / 64] & (1ul << (packetIdx % 64))) {
+			continue;
+		}
+		if (kept != packetIdx) {
+			memmove(&(buffer[(long) kept * config->packetSize]), &(buffer[(long) packetIdx * config->packetSize]), config->packetSize);
+		}
+		kept++;
+	}
+
+	return kept;
+}
+
+/**
+ * @brief      A receive thread; read batches from one socket, discard packets
+ *             from before the start and packets with corrupted headers (which
+ *             cannot be merged), and pass the batches to the writer
+ *
+ * @param      receiverPtr  The receiver struct
+ *
+ * @return     NULL
+ */
+static void* ilt_dada_receiver_thread(void *receiverPtr) {
+	ilt_dada_receiver *receiver = (ilt_dada_receiver*) receiverPtr;
+	ilt_dada_config *config = &(receiver->config);
+	ilt_dada_batch_queue *queue = config->params->queue;
+	const double packetRate = clock160MHzPacketRate * (1 - config->obsClockBit) + clock200MHzPacketRate * config->obsClockBit;
+	ilt_dada_batch *batch;
+	int spins = 0;
+
+	if (config->numaNode >= 0) {
+		ilt_dada_numa_set_thread(config->numaNode);
+	}
+	ilt_dada_realtime_thread(config);
+
+	while (config->currentPacket < config->params->finalPacket) {
+		// Wait for the writer to free a batch
+		while ((batch = ilt_dada_queue_producer_slot(queue)) == NULL && !__atomic_load_n(&(queue->failed), __ATOMIC_ACQUIRE)) {
+			ilt_dada_queue_wait(&spins);
+		}
+		spins = 0;
+
+		if (__atomic_load_n(&(queue->failed), __ATOMIC_ACQUIRE)) {
+			break;
+		}
+
+		int readPackets = ilt_dada_receive_batch(config, batch->msgvec, config->packetsPerIteration);
+		if (readPackets < 1) {
+			// Nothing arrives through the start time filter until the start time, so the socket may time out while we wait
+			if ((config->state & NETWORK_FILTERED) && (errno == EAGAIN || errno == EWOULDBLOCK) && time(NULL) < (time_t) (config->startPacket / packetRate + config->portTimeout)) {
+				continue;
+			}
+			fprintf(stderr, "ERROR: packet receive on port %d, socket %ld (errno %d: %s)\n", config->portNum, receiver - config->params->receivers, errno, strerror(errno));
+			__atomic_store_n(&(queue->failed), 1, __ATOMIC_RELEASE);
+			break;
+		}
+
+		// Discard packets from before the start; these were queued before the start time filter was attached, or it is unavailable
+		const long lastPacket = ilt_dada_receiver_packno(&(batch->buffer[(long) (readPackets - 1) * config->packetSize]));
+		if (lastPacket < config->startPacket) {
+			continue;
+		}
+		if (config->currentPacket < config->startPacket) {
+			readPackets = ilt_dada_operate_trim_batch(config, batch->buffer, readPackets, config->startPacket);
+			// The drop counter includes the packets dropped by the start time filter, only count drops from here on
+			__atomic_store_n(&(config->params->sequence.kernelDropsBase), ilt_dada_capture_drops(config), __ATOMIC_RELAXED);
+		}
+
+		// Packets with corrupted headers can't be put in order, drop them here
+		const long corrupted = config->params->packetsCorrupted;
+		if (ilt_dada_operate_check_batch(config, batch->buffer, readPackets) < 0) {
+			__atomic_store_n(&(queue->failed), 1, __ATOMIC_RELEASE);
+			break;
+		}
+		if (config->params->packetsCorrupted != corrupted) {
+			readPackets = ilt_dada_receiver_compact(config, batch->buffer, readPackets);
+		}
+
+		batch->packets = readPackets;
+		ilt_dada_queue_push(queue);
+		if (lastPacket >= config->params->finalPacket) {
+			__atomic_store_n(&(config->params->sequence.kernelDrops), ilt_dada_capture_drops(config), __ATOMIC_RELAXED);
+		}
+		config->currentPacket = lastPacket;
+	}
+
+	__atomic_store_n(&(queue->finished), 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/**
+ * @brief      Sum the packets dropped by the kernel on every receive socket
+ *             since the start of the observation
+ *
+ * @param      config  The ilt_dada configuration struct
+ *
+ * @return     The number of dropped packets
+ */
+static long ilt_dada_receivers_drops(const ilt_dada_config *config) {
+	long kernelDrops = 0;
+
+	for (int receiverIdx = 0; receiverIdx < config->receiveSockets; receiverIdx++) {
+		const ilt_dada_sequence_stats *sequence = &(config->params->receivers[receiverIdx].params.sequence);
+		kernelDrops += __atomic_load_n(&(sequence->kernelDrops), __ATOMIC_RELAXED) - __atomic_load_n(&(sequence->kernelDropsBase), __ATOMIC_RELAXED);
+	}
+
+	return kernelDrops;
+}
+
+/**
+ * @brief      The main loop of the recorder when a port is received through
+ *             several SO_REUSEPORT sockets. Every socket is read by its own
+ *             receive thread, while this thread merges their batches back into
+ *             packet order and writes them to the ringbuffer. The packets at
+ *             the head of every queue are compared, and the run of packets from
+ *             the receiver with the earliest packet that come before the next
+ *             packet of every other receiver is written in one go.
+ *
+ * @param      config  The recording configuration
+ *
+ * @return     0: Success, -1: Early Exit / Failure
+ */
+int ilt_dada_operate_loop_reuseport(ilt_dada_config *config) {
+	ilt_dada_receiver *receivers = config->params->receivers;
+	const int numReceivers = config->receiveSockets;
+	int localLoops = 0, spins = 0, returnVal = 0;
+
+	if (receivers == NULL) {
+		fprintf(stderr, "ERROR Port %d: Receive threads have not been allocated, exiting.\n", config->portNum);
+		return -1;
+	}
+
+	// The receive threads inherit our pinning by default; let them use the helper cores instead
+	cpu_set_t receiverCores;
+	pthread_attr_t receiverAttr;
+	ilt_dada_helper_cores(config, &receiverCores);
+	pthread_attr_init(&receiverAttr);
+	pthread_attr_setaffinity_np(&receiverAttr, sizeof(cpu_set_t), &receiverCores);
+
+	for (int receiverIdx = 0; receiverIdx < numReceivers; receiverIdx++) {
+		ilt_dada_receiver *receiver = &(receivers[receiverIdx]);
+		receiver->config.currentPacket = config->currentPacket;
+		receiver->config.obsClockBit = config->obsClockBit;
+		receiver->config.packetSize = config->packetSize;
+		receiver->config.state = config->state;
+
+		if ((returnVal = pthread_create(&(receiver->thread), &receiverAttr, ilt_dada_receiver_thread, (void*) receiver)) != 0) {
+			fprintf(stderr, "ERROR Port %d: Failed to start receive thread %d (errno %d: %s), exiting.\n", config->portNum, receiverIdx, returnVal, strerror(returnVal));
+			returnVal = -1;
+			break;
+		}
+		receiver->started = 1;
+	}
+	pthread_attr_destroy(&receiverAttr);
+
+	if (returnVal == 0) {
+		printf("Observation beginning (%d receive sockets, %d batches each)...\n", numReceivers, config->pipelineDepth);
+	}
+
+	while (returnVal == 0) {
+		int waiting = 0, next = -1;
+		long nextPacket = LONG_MAX, competitor = LONG_MAX;
+
+		// Find the receiver with the earliest packet, and the earliest packet of every other receiver
+		for (int receiverIdx = 0; receiverIdx < numReceivers; receiverIdx++) {
+			ilt_dada_receiver *receiver = &(receivers[receiverIdx]);
+			ilt_dada_batch_queue *queue = receiver->params.queue;
+
+			if (__atomic_load_n(&(queue->failed), __ATOMIC_ACQUIRE)) {
+				returnVal = -1;
+				break;
+			}
+
+			if (receiver->done) {
+				continue;
+			}
+
+			if (receiver->batch == NULL) {
+				if ((receiver->batch = ilt_dada_queue_consumer_slot(queue)) == NULL) {
+					// Only stop merging a receiver once its queue has been drained
+					if (__atomic_load_n(&(queue->finished), __ATOMIC_ACQUIRE) && (receiver->batch = ilt_dada_queue_consumer_slot(queue)) == NULL) {
+						receiver->done = 1;
+					} else if (receiver->batch == NULL) {
+						// We can't tell which packet comes next until every receiver has given us a batch
+						waiting = 1;
+					}
+					if (receiver->batch == NULL) {
+						continue;
+					}
+				}
+				receiver->offset = 0;
+
+				// Every packet of the batch may have been dropped
+				if (receiver->batch->packets == 0) {
+					ilt_dada_queue_pop(queue);
+					receiver->batch = NULL;
+					waiting = 1;
+					continue;
+				}
+			}
+
+			const long packetNumber = ilt_dada_receiver_packno(&(receiver->batch->buffer[(long) receiver->offset * config->packetSize]));
+			if (packetNumber < nextPacket) {
+				competitor = nextPacket;
+				nextPacket = packetNumber;
+				next = receiverIdx;
+			} else if (packetNumber < competitor) {
+				competitor = packetNumber;
+			}
+		}
+
+		if (returnVal != 0) {
+			break;
+		}
+		if (waiting) {
+			ilt_dada_queue_wait(&spins);
+			continue;
+		}
+		spins = 0;
+
+		// Every receiver has finished
+		if (next == -1) {
+			break;
+		}
+
+		// Take every packet from this receiver up to the next packet from any other receiver
+		ilt_dada_receiver *receiver = &(receivers[next]);
+		ilt_dada_batch *batch = receiver->batch;
+		int8_t *buffer = &(batch->buffer[(long) receiver->offset * config->packetSize]);
+		long lastPacket = nextPacket;
+		int packets = 1;
+		while ((receiver->offset + packets) < batch->packets) {
+			const long packetNumber = ilt_dada_receiver_packno(&(buffer[(long) packets * config->packetSize]));
+			if (packetNumber >= competitor) {
+				break;
+			}
+			lastPacket = packetNumber;
+			packets++;
+		}
+
+		// Calculate packet loss / misses / etc. on the merged stream
+		ilt_dada_sequence_account(config, buffer, packets);
+
+		const long writtenBytes = ilt_dada_operate_commit_batch(config, buffer, packets);
+		if (writtenBytes > 0) {
+			config->params->bytesWritten += writtenBytes;
+		}
+		ilt_dada_metrics_commit(config);
+
+		if (lastPacket > config->currentPacket) {
+			config->currentPacket = lastPacket;
+		}
+		ilt_dada_metrics_receive(config);
+
+		receiver->offset += packets;
+		if (receiver->offset < batch->packets) {
+			continue;
+		}
+
+		// The batch has been merged, hand it back to the receiver
+		ilt_dada_queue_pop(receiver->params.queue);
+		receiver->batch = NULL;
+
+		localLoops++;
+		if (localLoops > config->writesPerStatusLog) {
+			localLoops = 0;
+			config->params->sequence.kernelDrops = config->params->sequence.kernelDropsBase + ilt_dada_receivers_drops(config);
+			ilt_dada_packet_comments(config->io->dadaWriter[0].multilog, config->portNum, config->currentPacket, config->startPacket, config->endPacket, config->params->packetsLastExpected, config->params->packetsLastSeen, config->params->packetsExpected, config->params->packetsSeen, &(config->params->sequence), NULL);
+			config->params->packetsLastSeen = 0;
+			config->params->packetsLastExpected = 0;
+		}
+	}
+
+	// Stop the receive threads if we are exiting early, then wait for them to exit
+	for (int receiverIdx = 0; receiverIdx < numReceivers; receiverIdx++) {
+		if (returnVal != 0) {
+			__atomic_store_n(&(receivers[receiverIdx].params.queue->failed), 1, __ATOMIC_RELEASE);
+		}
+	}
+
+	for (int receiverIdx = 0; receiverIdx < numReceivers; receiverIdx++) {
+		ilt_dada_receiver *receiver = &(receivers[receiverIdx]);
+		if (!receiver->started) {
+			continue;
+		}
+		pthread_join(receiver->thread, NULL);
+		receiver->started = 0;
+
+		config->params->packetsCorrupted += receiver->params.packetsCorrupted;
+		config->params->groDiscarded += receiver->params.groDiscarded;
+		printf("Port %d: socket %d queue high-water mark was %zu of %zu batches.\n", config->portNum, receiverIdx, receiver->params.queue->highWaterMark, receiver->params.queue->depth);
+	}
+	config->params->sequence.kernelDrops = config->params->sequence.kernelDropsBase + ilt_dada_receivers_drops(config);
+
+	return returnVal;
+}
@@ -0,0 +1,418 @@
+#include "ilt_dada.h"
+
+// Histogram layout follows the HdrHistogram idea of log-linear buckets
+// http://hdrhistogram.org/
+// Kernel timestamp references:
+// https://www.kernel.org/doc/html/latest/networking/timestamping.html
+
+#define ILTD_HIST_HALF_BUCKETS (1 << (ILTD_HIST_SUB_BITS - 1))
+
+static const char *latencyNames[LATENCY_TYPES] = { "Queueing\t", "Write\t\t", "Station\t\t" };
+
+
+/**
+ * @brief      Get the bucket a value should be recorded in
+ *
+ * @param[in]  value  The (non-negative) value
+ *
+ * @return     The bucket index
+ */
+static inline int ilt_dada_histogram_bucket(uint64_t value) {
+	if (value < (1 << ILTD_HIST_SUB_BITS)) {
+		return (int) value;
+	}
+
+	// Keep the top ILTD_HIST_SUB_BITS bits of the value
+	const int shift = (63 - __builtin_clzll(value)) - (ILTD_HIST_SUB_BITS - 1);
+	return shift * ILTD_HIST_HALF_BUCKETS + (int) (value >> shift);
+}
+
+/**
+ * @brief      Get the value at the middle of a bucket
+ *
+ * @param[in]  bucket  The bucket index
+ *
+ * @return     The representative value
+ */
+static inline int64_t ilt_dada_histogram_value(int bucket) {
+	if (bucket < (1 << ILTD_HIST_SUB_BITS)) {
+		return bucket;
+	}
+
+	const int shift = bucket / ILTD_HIST_HALF_BUCKETS - 1;
+	const int64_t top = bucket - shift * ILTD_HIST_HALF_BUCKETS;
+	return (top << shift) + ((1l << shift) >> 1);
+}
+
+/**
+ * @brief      Clear a histogram
+ *
+ * @param      histogram  The histogram
+ */
+void ilt_dada_histogram_reset(ilt_dada_histogram *histogram) {
+	memset(histogram, 0, sizeof(ilt_dada_histogram));
+	histogram->min = INT64_MAX;
+	histogram->max = INT64_MIN;
+}
+
+/**
+ * @brief      Record a value in a histogram. Negative values (typically caused
+ *             by clock offsets between two machines) are only counted.
+ *
+ * @param      histogram  The histogram
+ * @param[in]  value      The value, in nanoseconds
+ */
+void ilt_dada_histogram_record(ilt_dada_histogram *histogram, int64_t value) {
+	if (value < 0) {
+		histogram->negative++;
+		return;
+	}
+
+	histogram->counts[ilt_dada_histogram_bucket((uint64_t) value)]++;
+	histogram->total++;
+	if (value < histogram->min) {
+		histogram->min = value;
+	}
+	if (value > histogram->max) {
+		histogram->max = value;
+	}
+}
+
+/**
+ * @brief      Add the contents of one histogram to another
+ *
+ * @param      dest  The histogram to add to
+ * @param[in]  src   The histogram to add
+ */
+void ilt_dada_histogram_merge(ilt_dada_histogram *dest, const ilt_dada_histogram *src) {
+	for (int bucket = 0; bucket < ILTD_HIST_BUCKETS; bucket++) {
+		dest->counts[bucket] += src->counts[bucket];
+	}
+	dest->total += src->total;
+	dest->negative += src->negative;
+	if (src->min < dest->min) {
+		dest->min = src->min;
+	}
+	if (src->max > dest->max) {
+		dest->max = src->max;
+	}
+}
+
+/**
+ * @brief      Get the value at a given percentile of a histogram
+ *
+ * @param[in]  histogram   The histogram
+ * @param[in]  percentile  The percentile (0 - 100)
+ *
+ * @return     The value (to within the bucket precision), or 0 if the
+ *             histogram is empty
+ */
+int64_t ilt_dada_histogram_percentile(const ilt_dada_histogram *histogram, double percentile) {
+	if (histogram->total == 0) {
+		return 0;
+	}
+
+	int64_t target = (int64_t) ((percentile / 100.0) * (double) histogram->total + 0.5);
+	if (target < 1) {
+		target = 1;
+	}
+
+	int64_t seen = 0;
+	for (int bucket = 0; bucket < ILTD_HIST_BUCKETS; bucket++) {
+		seen += histogram->counts[bucket];
+		if (seen >= target) {
+			const int64_t value = ilt_dada_histogram_value(bucket);
+			// The extremes are known exactly
+			if (value > histogram->max) {
+				return histogram->max;
+			} else if (value < histogram->min) {
+				return histogram->min;
+			}
+			return value;
+		}
+	}
+
+	return histogram->max;
+}
+
+
+
+/**
+ * @brief      Allocate and initialise a set of latency histograms
+ *
+ * @return     ptr: Success, NULL: Failure
+ */
+ilt_dada_latency* ilt_dada_latency_init() {
+	ilt_dada_latency *latency = calloc(1, sizeof(ilt_dada_latency));
+	if (latency == NULL) {
+		return NULL;
+	}
+
+	for (int type = 0; type < LATENCY_TYPES; type++) {
+		ilt_dada_histogram_reset(&(latency->total[type]));
+		ilt_dada_histogram_reset(&(latency->interval[type]));
+	}
+
+	return latency;
+}
+
+/**
+ * @brief      Get the time between two timestamps in nanoseconds
+ *
+ * @param[in]  start  The start time
+ * @param[in]  end    The end time
+ *
+ * @return     Nanoseconds
+ */
+static inline int64_t ilt_dada_timespec_diff(const struct timespec *start, const struct timespec *end) {
+	return (int64_t) (end->tv_sec - start->tv_sec) * 1000000000l + (end->tv_nsec - start->tv_nsec);
+}
+
+/**
+ * @brief      Record the latencies for a batch of packets that has just been
+ *             written to the ringbuffer
+ *
+ * @param      config        The recording configuration
+ * @param[in]  buffer        The batch of packets
+ * @param[in]  rxTimestamps  The kernel receive timestamps of each packet (a
+ *                           zero timestamp marks a missing value)
+ * @param[in]  packets       The number of packets in the batch
+ * @param[in]  received      The time the batch was returned by the kernel
+ */
+void ilt_dada_latency_record_batch(ilt_dada_config *config, const int8_t *buffer, const struct timespec *rxTimestamps, int packets, const struct timespec *received) {
+	ilt_dada_latency *latency = config->params->latency;
+	struct timespec committed;
+	clock_gettime(CLOCK_REALTIME, &committed);
+
+	const int64_t writeDelay = ilt_dada_timespec_diff(received, &committed);
+	ilt_dada_histogram_record(&(latency->total[LATENCY_WRITE]), writeDelay);
+	ilt_dada_histogram_record(&(latency->interval[LATENCY_WRITE]), writeDelay);
+	ilt_dada_metrics_latency(config->metrics, LATENCY_WRITE, writeDelay);
+
+	const int64_t committedNs = (int64_t) committed.tv_sec * 1000000000l + committed.tv_nsec;
+	for (int packetIdx = 0; packetIdx < packets; packetIdx++) {
+		const int8_t *header = &(buffer[(long) packetIdx * config->packetSize]);
+
+		if (rxTimestamps[packetIdx].tv_sec != 0) {
+			const int64_t queueingDelay = ilt_dada_timespec_diff(&(rxTimestamps[packetIdx]), received);
+			ilt_dada_histogram_record(&(latency->total[LATENCY_QUEUEING]), queueingDelay);
+			ilt_dada_histogram_record(&(latency->interval[LATENCY_QUEUEING]), queueingDelay);
+			ilt_dada_metrics_latency(config->metrics, LATENCY_QUEUEING, queueingDelay);
+		}
+
+		// The packet can only be sent once its final time sample has been formed; each sample is 1024 clock cycles
+		const double clockHz = ((lofar_source_bytes*) &(header[1]))->clockBit ? 200e6 : 160e6;
+		const int64_t timestamp = *((const uint32_t*) &(header[8]));
+		const int64_t sequence = *((const uint32_t*) &(header[12]));
+		const int64_t packetEndNs = timestamp * 1000000000l + (int64_t) ((double) (sequence + UDPNTIMESLICE) * (1024.0 * 1e9 / clockHz));
+		ilt_dada_histogram_record(&(latency->total[LATENCY_STATION]), committedNs - packetEndNs);
+		ilt_dada_histogram_record(&(latency->interval[LATENCY_STATION]), committedNs - packetEndNs);
+		ilt_dada_metrics_latency(config->metrics, LATENCY_STATION, committedNs - packetEndNs);
+	}
+}
+
+/**
+ * @brief      Extract the percentiles from a set of latency histograms
+ *
+ * @param[in]  histograms  LATENCY_TYPES histograms
+ * @param      summary     The output summary
+ */
+void ilt_dada_latency_summarise(const ilt_dada_histogram *histograms, ilt_dada_latency_summary *summary) {
+	for (int type = 0; type < LATENCY_TYPES; type++) {
+		summary->count[type] = histograms[type].total;
+		summary->negative[type] = histograms[type].negative;
+		summary->p50[type] = ilt_dada_histogram_percentile(&(histograms[type]), 50.0);
+		summary->p99[type] = ilt_dada_histogram_percentile(&(histograms[type]), 99.0);
+		summary->p999[type] = ilt_dada_histogram_percentile(&(histograms[type]), 99.9);
+		summary->max[type] = histograms[type].total ? histograms[type].max : 0;
+	}
+}
+
+/**
+ * @brief      Summarise the latencies since the last call, then start a new
+ *             interval
+ *
+ * @param      latency  The latency histograms
+ * @param      summary  The output summary
+ */
+void ilt_dada_latency_interval(ilt_dada_latency *latency, ilt_dada_latency_summary *summary) {
+	ilt_dada_latency_summarise(latency->interval, summary);
+	for (int type = 0; type < LATENCY_TYPES; type++) {
+		ilt_dada_histogram_reset(&(latency->interval[type]));
+	}
+}
+
+/**
+ * @brief      Format a latency summary as a table (in microseconds)
+ *
+ * @param      output   The output string
+ * @param[in]  maxlen   The size of the output string
+ * @param[in]  summary  The latency summary
+ */
+void ilt_dada_latency_comments(char *output, size_t maxlen, const ilt_dada_latency_summary *summary) {
+	size_t offset = 0;
+	int written = snprintf(output, maxlen, "Latency (us)\tSamples\t\t\tp50\t\t\tp99\t\t\tp99.9\t\t\tMax\n");
+
+	for (int type = 0; type < LATENCY_TYPES && written > 0 && (offset += written) < maxlen; type++) {
+		written = snprintf(&(output[offset]), maxlen - offset, "%s%ld\t\t\t%.1f\t\t\t%.1f\t\t\t%.1f\t\t\t%.1f%s\n", latencyNames[type], summary->count[type],
+		                   (double) summary->p50[type] * 1e-3, (double) summary->p99[type] * 1e-3, (double) summary->p999[type] * 1e-3, (double) summary->max[type] * 1e-3,
+		                   summary->negative[type] ? "\t(negative values seen, check the host clock)" : "");
+	}
+}
+
+/**
+ * @brief      Measure how late the calling thread is woken up from a sleep, on
+ *             its current core and with its current scheduling policy, and
+ *             compare that to the time the socket buffer can hold packets for
+ *             while we are not reading it. Intended to be run on the capture
+ *             thread during the start-up window.
+ *
+ * @param      config  The recording configuration
+ *
+ * @return     0: the socket buffer can absorb the worst wake-up latency,
+ *             1: it cannot, -1: failure
+ */
+int ilt_dada_jitter_test(ilt_dada_config *config) {
+	ilt_dada_histogram wakeups;
+	ilt_dada_histogram_reset(&wakeups);
+
+	struct timespec target, woken;
+	if (clock_gettime(CLOCK_MONOTONIC, &target) == -1) {
+		fprintf(stderr, "ERROR: Failed to read the monotonic clock (errno %d: %s).\n", errno, strerror(errno));
+		return -1;
+	}
+
+	for (long sample = 0; sample < (ILTD_JITTER_TEST_SECONDS * 1000000000l) / ILTD_JITTER_PERIOD_NS; sample++) {
+		target.tv_nsec += ILTD_JITTER_PERIOD_NS;
+		if (target.tv_nsec >= 1000000000l) {
+			target.tv_sec += 1;
+			target.tv_nsec -= 1000000000l;
+		}
+
+		// Absolute sleeps, so the measurement does not drift with the latency
+		int returnVal;
+		while ((returnVal = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &target, NULL)) == EINTR);
+		if (returnVal != 0) {
+			fprintf(stderr, "ERROR: Failed to sleep during the wake-up latency test (errno %d: %s).\n", returnVal, strerror(returnVal));
+			return -1;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &woken);
+		ilt_dada_histogram_record(&wakeups, ilt_dada_timespec_diff(&target, &woken));
+	}
+
+	// The kernel doubles the requested buffer size to leave room for its own overheads, assume those take up half of it
+	int bufferSize = 0;
+	socklen_t bufferSizeLen = sizeof(bufferSize);
+	if (getsockopt(config->sockfd, SOL_SOCKET, SO_RCVBUF, &bufferSize, &bufferSizeLen) == -1) {
+		bufferSize = (int) config->portBufferSize * 2;
+	}
+	const double packetRate = clock160MHzPacketRate * (1 - config->obsClockBit) + clock200MHzPacketRate * config->obsClockBit;
+	const double absorbNs = (double) bufferSize / 2.0 * config->receiveSockets / config->packetSize / packetRate * 1e9;
+
+	printf("Port %d: wake-up latency over %ld samples (us): p50 %.1f, p99 %.1f, p99.9 %.1f, max %.1f; the socket buffer holds %.1f ms of packets.\n", config->portNum,
+	       wakeups.total, (double) ilt_dada_histogram_percentile(&wakeups, 50.0) * 1e-3, (double) ilt_dada_histogram_percentile(&wakeups, 99.0) * 1e-3,
+	       (double) ilt_dada_histogram_percentile(&wakeups, 99.9) * 1e-3, (double) wakeups.max * 1e-3, absorbNs * 1e-6);
+
+	if ((double) wakeups.max > absorbNs) {
+		fprintf(stderr, "WARNING: The worst wake-up latency on port %d (%.1f ms) is longer than its socket buffer can absorb (%.1f ms), packets may be dropped. Consider a larger buffer, an isolated capture core or a higher real-time priority.\n",
+		        config->portNum, (double) wakeups.max * 1e-6, absorbNs * 1e-6);
+		return 1;
+	}
+
+	return 0;
+}
+
+
+
+#ifdef ILTD_PHASE_TIMING
+static const char *phaseNames[PHASE_TYPES] = { "Block\t\t", "Receive\t\t", "Check\t\t", "Decode\t\t", "Write\t\t", "Status\t\t", "Iteration\t" };
+
+/**
+ * @brief      Allocate the phase timing histograms, and calibrate the tick
+ *             rate against the monotonic clock
+ *
+ * @return     ptr: Success, NULL: Failure
+ */
+ilt_dada_phase_timing* ilt_dada_phase_init() {
+	ilt_dada_phase_timing *phases = calloc(1, sizeof(ilt_dada_phase_timing));
+	if (phases == NULL) {
+		return NULL;
+	}
+
+	for (int phase = 0; phase < PHASE_TYPES; phase++) {
+		ilt_dada_histogram_reset(&(phases->histograms[phase]));
+	}
+
+	// 20ms is enough to pin the rate down to well under the histogram precision
+	struct timespec start, end, wait = { .tv_sec = 0, .tv_nsec = 20000000 };
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	const uint64_t startTicks = ilt_dada_phase_ticks();
+	nanosleep(&wait, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	const uint64_t endTicks = ilt_dada_phase_ticks();
+
+	phases->nsPerTick = (double) ilt_dada_timespec_diff(&start, &end) / (double) (endTicks - startTicks);
+
+	return phases;
+}
+
+/**
+ * @brief      Record the time since a mark against a phase
+ *
+ * @param      phases  The phase timing histograms
+ * @param[in]  phase   The phase
+ * @param[in]  start   The tick count at the start of the phase
+ *
+ * @return     The tick count at the end of the phase
+ */
+uint64_t ilt_dada_phase_record(ilt_dada_phase_timing *phases, phase_types phase, uint64_t start) {
+	const uint64_t now = ilt_dada_phase_ticks();
+	phases->totalTicks[phase] += now - start;
+	ilt_dada_histogram_record(&(phases->histograms[phase]), (int64_t) ((double) (now - start) * phases->nsPerTick));
+	return now;
+}
+
+/**
+ * @brief      Print the time spent in each phase of the operate loop, and how
+ *             much of the time available for each batch was used
+ *
+ * @param[in]  config  The recording configuration
+ */
+void ilt_dada_phase_report(const ilt_dada_config *config) {
+	const ilt_dada_phase_timing *phases = config->params->phases;
+	if (phases == NULL || phases->histograms[PHASE_BATCH].total == 0) {
+		return;
+	}
+
+	// The time it takes the station to send a batch of packets
+	const double packetRate = config->obsClockBit == 1 ? clock200MHzPacketRate : clock160MHzPacketRate;
+	const double budget = (double) config->packetsPerIteration / packetRate * 1e9;
+	const ilt_dada_histogram *iterations = &(phases->histograms[PHASE_BATCH]);
+
+	printf("Port %d phase timing over %ld iterations (budget of %.1f us per batch of %d packets):\n", config->portNum, iterations->total, budget * 1e-3, config->packetsPerIteration);
+	printf("Phase\t\tShare\t\tMean (us)\tp50 (us)\tp99 (us)\tp99.9 (us)\tMax (us)\n");
+	for (int phase = 0; phase < PHASE_TYPES; phase++) {
+		const ilt_dada_histogram *histogram = &(phases->histograms[phase]);
+		if (histogram->total == 0) {
+			continue;
+		}
+
+		// The iteration share is relative to the budget, everything else to the total iteration time
+		const double mean = (double) phases->totalTicks[phase] * phases->nsPerTick / (double) histogram->total;
+		const double share = phase == PHASE_BATCH ? 100.0 * mean / budget : 100.0 * (double) phases->totalTicks[phase] / (double) phases->totalTicks[PHASE_BATCH];
+		printf("%s%.2f%%\t\t%.1f\t\t%.1f\t\t%.1f\t\t%.1f\t\t%.1f\n", phaseNames[phase], share, mean * 1e-3,
+		       (double) ilt_dada_histogram_percentile(histogram, 50.0) * 1e-3, (double) ilt_dada_histogram_percentile(histogram, 99.0) * 1e-3,
+		       (double) ilt_dada_histogram_percentile(histogram, 99.9) * 1e-3, (double) histogram->max * 1e-3);
+	}
+
+	// Iterations that took longer than the station took to send the batch have to be made up by the socket buffer
+	long overBudget = 0;
+	for (int bucket = 0; bucket < ILTD_HIST_BUCKETS; bucket++) {
+		if ((double) ilt_dada_histogram_value(bucket) > budget) {
+			overBudget += iterations->counts[bucket];
+		}
+	}
+	printf("%ld iterations (%.3f%%) exceeded the budget.\n\n", overBudget, 100.0 * (double) overBudget / (double) iterations->total);
+}
+#endif
@@ -0,0 +1,948 @@
+// sendmmsg and RUSAGE_THREAD need the GNU Source define
+// This needs to be at the top or sendmmsg will not be found.
+#define _GNU_SOURCE 1
+
+// Standard includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// PSRDADA includes
+#include "ilt_dada.h"
+#include "lofar_cli_meta.h"
+
+// Loopback benchmark: a paced sender thread generates packets, the library records them into a ringbuffer on the main
+// thread, and a reader thread drains the ringbuffer. Every combination of the sweep options is run at increasing packet
+// rates, and the results are written as CSV so they can be compared between releases.
+
+#define BENCH_MAX_VALUES 16
+
+// Capture backend names, indexed by capture_backend_types, as in the ilt_dada -b option
+static const char *benchBackendNames[] = { "recvmmsg", "packet", "uring" };
+#define BENCH_SEND_BATCH 32
+#define BENCH_DEF_PORT 36130
+#define BENCH_CLOCK_BIT 1
+#define BENCH_VALIDATE_BATCH 203
+#define BENCH_VALIDATE_STRIDE 7824
+#define BENCH_FILL_PATTERN 0xa5
+
+// Fate of every packet in the fault window of the placement check
+#define BENCH_PACKET_LOST 0
+#define BENCH_PACKET_SENT 1
+#define BENCH_PACKET_LATE 2
+
+typedef struct bench_sender {
+	int port;
+	int core;
+	int packetSize;
+	int bitMode;
+	int beamlets;
+	double rate;
+	long firstPacket;
+
+	// Placement check only: faults are injected into whole batches between faultStart and faultEnd, and the fate of every
+	// 	packet in that window is recorded
+	ilt_dada_fault_injector *faults;
+	long faultStart;
+	long faultEnd;
+	int8_t *fates;
+
+	int stop;
+	int failed;
+	long sent;
+	double elapsed;
+} bench_sender;
+
+typedef struct bench_reader {
+	int key;
+	int core;
+
+	// Placement check only: every block is validated, and the packets placed between checkStart and checkEnd are recorded
+	int check;
+	int packetSize;
+	long checkStart;
+	long checkEnd;
+	int8_t *placed;
+	long nextPacket;
+	long errors;
+
+	int stop;
+	int failed;
+	long blocks;
+} bench_reader;
+
+void helpMessages() {
+	printf("ILTDada loopback benchmark (CLI v%s, lib %s)\n\n", ILTD_CLI_VERSION, ILTD_VERSION);
+
+	printf("Every combination of the -b, -n, -m, -s, -u and -d values is recorded at each rate in -R, until packets are lost.\n");
+	printf("Lists are comma separated.\n\n");
+
+	printf("-h				: Display this message\n");
+	printf("-o (str)		: Output CSV file (default: ilt_dada_bench.csv)\n");
+	printf("-p (int)		: Loopback UDP port (default: %d)\n", BENCH_DEF_PORT);
+	printf("-k (int)		: Ringbuffer key (default: %d)\n", BENCH_DEF_PORT);
+	printf("-c (int,int,int)	: CPU cores for the recorder, sender and ringbuffer reader (default: unpinned)\n");
+	printf("-t (float)		: Seconds recorded for every measurement (default: 5)\n");
+	printf("-b (str list)		: Capture backends, recvmmsg, packet or uring (default: recvmmsg)\n");
+	printf("-n (int list)		: Packets per iteration (default: 256)\n");
+	printf("-m (int list)		: Iterations per ringbuffer block (default: 64)\n");
+	printf("-s (int list)		: Socket buffer sizes in MB (default: 16)\n");
+	printf("-u (int list)		: Beamlets per packet (default: 122)\n");
+	printf("-d (int list)		: Bit modes, 4, 8 or 16 (default: 8)\n");
+	printf("-R (int list)		: Packet rates to test in ascending order, in packets per second (default: 12207,50000,100000,200000,400000,800000)\n");
+	printf("-L (float)		: Percentage of lost packets that counts as the onset of loss (default: 0.01)\n");
+	printf("-a				: Test every rate, rather than stopping at the onset of loss\n");
+	printf("-V (int)		: Compare the AVX2 and scalar header validation on this many random packets, then exit\n");
+	printf("-F (float,float,float)	: Check sequence placement and packet accounting with these loss, re-order and duplicate probabilities\n");
+	printf("\t\t\t  at the first -b, -n, -m, -s, -u, -d and -R values, then exit\n\n");
+}
+
+/**
+ * @brief      Parse a comma separated list of capture backend names
+ *
+ * @param[in]  inputStr   The input string
+ * @param      backends   The output backends
+ * @param[in]  maxValues  The maximum number of backends
+ *
+ * @return     >0: Number of backends, -1: Failure
+ */
+static int bench_parse_backends(const char *inputStr, capture_backend_types *backends, int maxValues) {
+	int numValues = 0;
+	const char *startPtr = inputStr;
+
+	while (1) {
+		if (numValues == maxValues) {
+			fprintf(stderr, "ERROR: Too many values provided in %s (limit %d).\n", inputStr, maxValues);
+			return -1;
+		}
+
+		const size_t length = strcspn(startPtr, ",");
+		int backend = CAPTURE_IO_URING;
+		while (backend >= 0 && (strlen(benchBackendNames[backend]) != length || strncmp(startPtr, benchBackendNames[backend], length) != 0)) {
+			backend--;
+		}
+		if (backend < 0) {
+			fprintf(stderr, "ERROR: Unknown capture backend %.*s in %s.\n", (int) length, startPtr, inputStr);
+			return -1;
+		}
+		backends[numValues++] = (capture_backend_types) backend;
+
+		if (startPtr[length] == '\0') {
+			return numValues;
+		}
+		startPtr += length + 1;
+	}
+}
+
+/**
+ * @brief      Send the next batch of packets for the placement check; batches
+ *             inside the fault window have faults injected, and the fate of
+ *             each of their packets is recorded. Every packet is sent, as
+ *             packets lost by the harness would not be accounted for.
+ *
+ * @param      sender       The sender configuration
+ * @param[in]  sockfd       The connected socket
+ * @param      msgvec       The message headers (2 * BENCH_SEND_BATCH)
+ * @param      buffer       The packet buffer (2 * BENCH_SEND_BATCH packets)
+ * @param      packetSlots  Scratch space for the packet numbers (2 * BENCH_SEND_BATCH)
+ * @param      sendSlots    Scratch space for the send slots (2 * BENCH_SEND_BATCH)
+ * @param[in]  nextPacket   The first packet of the batch
+ *
+ * @return     0: Success, -1: Failure
+ */
+static int bench_send_faults(bench_sender *sender, int sockfd, struct mmsghdr *msgvec, int8_t *buffer, long *packetSlots, long *sendSlots, long nextPacket) {
+	long packets = BENCH_SEND_BATCH;
+	if (nextPacket >= sender->faultStart && nextPacket + BENCH_SEND_BATCH <= sender->faultEnd) {
+		packets = ilt_dada_inject_faults(sender->faults, nextPacket, BENCH_SEND_BATCH, packetSlots, sendSlots);
+	} else {
+		for (int packetIdx = 0; packetIdx < BENCH_SEND_BATCH; packetIdx++) {
+			packetSlots[packetIdx] = nextPacket + packetIdx;
+		}
+	}
+
+	for (long packetIdx = 0; packetIdx < packets; packetIdx++) {
+		ilt_dada_packno_to_header(&(buffer[packetIdx * sender->packetSize]), packetSlots[packetIdx], BENCH_CLOCK_BIT, sender->bitMode, sender->beamlets);
+
+		// Anything not marked as sent was lost; duplicates do not change the fate of a packet
+		if (packetSlots[packetIdx] >= sender->faultStart && packetSlots[packetIdx] < sender->faultEnd) {
+			int8_t *fate = &(sender->fates[packetSlots[packetIdx] - sender->faultStart]);
+			if (*fate == BENCH_PACKET_LOST) {
+				*fate = (packetIdx > 0 && packetSlots[packetIdx] < packetSlots[packetIdx - 1]) ? BENCH_PACKET_LATE : BENCH_PACKET_SENT;
+			}
+		}
+	}
+
+	long queued = 0;
+	while (queued < packets && !__atomic_load_n(&(sender->stop), __ATOMIC_ACQUIRE)) {
+		const int sent = sendmmsg(sockfd, &(msgvec[queued]), (unsigned int) (packets - queued), 0);
+		if (sent < 0) {
+			if (errno == EAGAIN || errno == ENOBUFS || errno == ECONNREFUSED || errno == EINTR) {
+				continue;
+			}
+			fprintf(stderr, "ERROR: Benchmark sender failed (errno %d: %s).\n", errno, strerror(errno));
+			return -1;
+		}
+		queued += sent;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief      Send packets to the loopback port at a fixed rate until stopped;
+ *             each batch is sent at an absolute deadline, so a late batch does
+ *             not delay the following batches
+ *
+ * @param      senderPtr  The sender configuration
+ *
+ * @return     NULL
+ */
+void* bench_sender_thread(void *senderPtr) {
+	bench_sender *sender = (bench_sender*) senderPtr;
+
+	if (ilt_dada_pin_thread(sender->core) < 0) {
+		sender->failed = 1;
+		return NULL;
+	}
+
+	struct sockaddr_in address = { .sin_family = AF_INET, .sin_port = htons(sender->port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	const int sendBuffer = 64 * 1024 * 1024;
+
+	// Duplicates can double the packets in a batch
+	struct mmsghdr msgvec[2 * BENCH_SEND_BATCH];
+	struct iovec iovecs[2 * BENCH_SEND_BATCH];
+	long packetSlots[2 * BENCH_SEND_BATCH], sendSlots[2 * BENCH_SEND_BATCH];
+	int8_t *buffer = calloc(2 * BENCH_SEND_BATCH, sender->packetSize);
+	const int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (buffer == NULL || sockfd == -1 || connect(sockfd, (struct sockaddr*) &address, sizeof(address)) == -1) {
+		fprintf(stderr, "ERROR: Failed to set up the benchmark sender (errno %d: %s).\n", errno, strerror(errno));
+		sender->failed = 1;
+		if (sockfd != -1) {
+			close(sockfd);
+		}
+		FREE_NOT_NULL(buffer);
+		return NULL;
+	}
+	setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &sendBuffer, sizeof(sendBuffer));
+
+	// Any non-zero payload will do, the recorder never looks past the headers
+	memset(msgvec, 0, sizeof(msgvec));
+	for (int packetIdx = 0; packetIdx < 2 * BENCH_SEND_BATCH; packetIdx++) {
+		memset(&(buffer[(long) packetIdx * sender->packetSize + UDPHDRLEN]), 0x5a, sender->packetSize - UDPHDRLEN);
+		iovecs[packetIdx].iov_base = &(buffer[(long) packetIdx * sender->packetSize]);
+		iovecs[packetIdx].iov_len = sender->packetSize;
+		msgvec[packetIdx].msg_hdr.msg_iov = &(iovecs[packetIdx]);
+		msgvec[packetIdx].msg_hdr.msg_iovlen = 1;
+	}
+
+	struct timespec start, now;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	long nextPacket = sender->firstPacket;
+
+	while (!__atomic_load_n(&(sender->stop), __ATOMIC_ACQUIRE)) {
+		ilt_dada_pace(&start, (double) sender->sent / sender->rate);
+
+		if (sender->faults != NULL) {
+			if (bench_send_faults(sender, sockfd, msgvec, buffer, packetSlots, sendSlots, nextPacket) < 0) {
+				sender->failed = 1;
+				break;
+			}
+			nextPacket += BENCH_SEND_BATCH;
+			sender->sent += BENCH_SEND_BATCH;
+			continue;
+		}
+
+		for (int packetIdx = 0; packetIdx < BENCH_SEND_BATCH; packetIdx++) {
+			ilt_dada_packno_to_header(&(buffer[(long) packetIdx * sender->packetSize]), nextPacket + packetIdx, BENCH_CLOCK_BIT, sender->bitMode, sender->beamlets);
+		}
+
+		// Packets that could not be queued are sent again with the next batch
+		const int sent = sendmmsg(sockfd, msgvec, BENCH_SEND_BATCH, 0);
+		if (sent < 0) {
+			if (errno == EAGAIN || errno == ENOBUFS || errno == ECONNREFUSED || errno == EINTR) {
+				continue;
+			}
+			fprintf(stderr, "ERROR: Benchmark sender failed (errno %d: %s).\n", errno, strerror(errno));
+			sender->failed = 1;
+			break;
+		}
+		nextPacket += sent;
+		sender->sent += sent;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	sender->elapsed = ilt_dada_elapsed(&start, &now);
+
+	close(sockfd);
+	FREE_NOT_NULL(buffer);
+	return NULL;
+}
+
+/**
+ * @brief      Validate a sequence-indexed block for the placement check: the
+ *             trailer must describe the block and follow on from the previous
+ *             block, the mask must match the number of packets present, every
+ *             present slot must hold its own packet and every missing slot the
+ *             fill pattern
+ *
+ * @param      reader  The reader configuration
+ * @param[in]  block   The block
+ * @param[in]  bytes   The number of bytes in the block
+ */
+static void bench_check_block(bench_reader *reader, const int8_t *block, long bytes) {
+	ilt_dada_block_trailer trailer;
+	if (bytes < (long) sizeof(trailer)) {
+		fprintf(stderr, "ERROR: Block %ld is too small to hold a trailer (%ld bytes).\n", reader->blocks, bytes);
+		reader->errors++;
+		return;
+	}
+	memcpy(&trailer, &(block[bytes - (long) sizeof(trailer)]), sizeof(trailer));
+
+	if (trailer.magic != ILTD_TRAILER_MAGIC || trailer.packetSize != reader->packetSize || trailer.packetSlots < 1 ||
+		(long) trailer.packetSlots * trailer.packetSize + ilt_dada_placement_trailer_size(trailer.packetSlots) > bytes) {
+		fprintf(stderr, "ERROR: Block %ld has an invalid trailer (magic %x, %d byte packets, %d slots).\n", reader->blocks, trailer.magic, trailer.packetSize, trailer.packetSlots);
+		reader->errors++;
+		return;
+	}
+	if (reader->nextPacket >= 0 && trailer.firstPacket != reader->nextPacket) {
+		fprintf(stderr, "ERROR: Block %ld starts at packet %ld rather than %ld.\n", reader->blocks, (long) trailer.firstPacket, reader->nextPacket);
+		reader->errors++;
+	}
+	reader->nextPacket = trailer.firstPacket + trailer.packetSlots;
+
+	const uint8_t *mask = (const uint8_t*) &(block[(long) trailer.packetSlots * trailer.packetSize]);
+	long present = 0;
+	for (long slot = 0; slot < trailer.packetSlots; slot++) {
+		const int8_t *packet = &(block[slot * trailer.packetSize]);
+		const long packetNumber = trailer.firstPacket + slot;
+
+		if (mask[slot / 8] & (1 << (slot % 8))) {
+			present++;
+			const long received = lofar_udp_time_beamformed_packno(*((unsigned int*) &(packet[8])), *((unsigned int*) &(packet[12])), ((lofar_source_bytes*) &(packet[1]))->clockBit);
+			if (received != packetNumber) {
+				fprintf(stderr, "ERROR: Slot %ld of block %ld holds packet %ld rather than %ld.\n", slot, reader->blocks, received, packetNumber);
+				reader->errors++;
+			} else if (packetNumber >= reader->checkStart && packetNumber < reader->checkEnd) {
+				reader->placed[packetNumber - reader->checkStart] = 1;
+			}
+			continue;
+		}
+
+		for (int byteIdx = 0; byteIdx < trailer.packetSize; byteIdx++) {
+			if ((uint8_t) packet[byteIdx] != BENCH_FILL_PATTERN) {
+				fprintf(stderr, "ERROR: Missing slot %ld of block %ld was not filled.\n", slot, reader->blocks);
+				reader->errors++;
+				break;
+			}
+		}
+	}
+
+	if (present != trailer.packetsPresent) {
+		fprintf(stderr, "ERROR: Block %ld has %ld packets in its mask, but its trailer reports %d.\n", reader->blocks, present, trailer.packetsPresent);
+		reader->errors++;
+	}
+}
+
+/**
+ * @brief      Consume the ringbuffer as fast as possible until stopped; only
+ *             full blocks are requested so the thread never blocks in PSRDADA
+ *
+ * @param      readerPtr  The reader configuration
+ *
+ * @return     NULL
+ */
+void* bench_reader_thread(void *readerPtr) {
+	bench_reader *reader = (bench_reader*) readerPtr;
+
+	if (ilt_dada_pin_thread(reader->core) < 0) {
+		reader->failed = 1;
+		return NULL;
+	}
+
+	multilog_t *multilog = multilog_open("ilt_dada_bench", 0);
+	dada_hdu_t *hdu = dada_hdu_create(multilog);
+	dada_hdu_set_key(hdu, reader->key);
+	if (dada_hdu_connect(hdu) < 0 || dada_hdu_lock_read(hdu) < 0) {
+		fprintf(stderr, "ERROR: Benchmark reader failed to attach to ringbuffer %d.\n", reader->key);
+		reader->failed = 1;
+		dada_hdu_destroy(hdu);
+		multilog_close(multilog);
+		return NULL;
+	}
+
+	ipcbuf_t *dataBlock = (ipcbuf_t*) hdu->data_block;
+	uint64_t bytes;
+	// The placement check needs every block, including those released as the recorder stopped
+	while (!__atomic_load_n(&(reader->stop), __ATOMIC_ACQUIRE) || (reader->check && ipcbuf_get_nfull(dataBlock) > 0)) {
+		if (ipcbuf_get_nfull(dataBlock) == 0) {
+			usleep(50);
+			continue;
+		}
+
+		const int8_t *block = (const int8_t*) ipcbuf_get_next_read(dataBlock, &bytes);
+		if (block == NULL) {
+			break;
+		}
+		if (reader->check) {
+			bench_check_block(reader, block, (long) bytes);
+		}
+		if (ipcbuf_mark_cleared(dataBlock) < 0) {
+			break;
+		}
+		reader->blocks++;
+	}
+
+	dada_hdu_unlock_read(hdu);
+	dada_hdu_disconnect(hdu);
+	dada_hdu_destroy(hdu);
+	multilog_close(multilog);
+	return NULL;
+}
+
+/**
+ * @brief      Get the CPU time used by the calling thread
+ *
+ * @return     Seconds
+ */
+static double bench_thread_cpu() {
+	struct rusage usage;
+	getrusage(RUSAGE_THREAD, &usage);
+	return (double) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) + (double) (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+}
+
+/**
+ * @brief      Set up the recorder for a measurement, on the calling thread
+ *
+ * @return     ptr: Success, NULL: Failure
+ */
+static ilt_dada_config* bench_recorder(int port, int key, const int *cores, capture_backend_types backend, int packetsPerIteration, int batchesPerBlock, int socketBufferMB, int packetSize, int sequencePlacement) {
+	ilt_dada_config *config = ilt_dada_init();
+	if (config == NULL) {
+		return NULL;
+	}
+
+	config->portNum = port;
+	config->portTimeout = 5;
+	config->portBufferSize = (long) socketBufferMB * 1024 * 1024;
+	config->packetsPerIteration = packetsPerIteration;
+	config->packetSize = packetSize;
+	config->forceStartup = 1;
+	// The io_uring backend does not collect kernel receive timestamps, so it cannot provide latency statistics
+	config->captureBackend = backend;
+	config->latencyStats = backend != CAPTURE_IO_URING;
+	config->captureCore = cores[0];
+	config->writesPerStatusLog = INT_MAX;
+	config->io->numOutputs = 1;
+	config->io->outputDadaKeys[0] = key;
+	config->io->writeBufSize[0] = (long) batchesPerBlock * packetsPerIteration * packetSize;
+	config->io->dadaConfig.nbufs = 16;
+	config->io->dadaConfig.num_readers = 1;
+	config->io->progressWithExisting = 1;
+	config->sequencePlacement = sequencePlacement;
+	config->fillPattern = BENCH_FILL_PATTERN;
+	// Leave space for the packet mask and trailer at the end of every block, as the CLI does
+	if (sequencePlacement) {
+		config->io->writeBufSize[0] += ilt_dada_placement_trailer_size((long) batchesPerBlock * packetsPerIteration);
+	}
+
+	if (ilt_dada_config_setup(config, 1) < 0 || ilt_dada_pin_thread(config->captureCore) < 0) {
+		ilt_dada_config_cleanup(config);
+		return NULL;
+	}
+
+	return config;
+}
+
+/**
+ * @brief      Record one measurement and append the results to the output
+ *
+ * @return     >=0: Fraction of packets lost, -1: Failure
+ */
+double bench_measure(FILE *output, int port, int key, const int *cores, float seconds, capture_backend_types backend, int packetsPerIteration, int batchesPerBlock, int socketBufferMB, int beamlets, int bits, double rate) {
+	const int bitMode = bits == 16 ? 0 : (bits == 8 ? 1 : 2);
+	const int packetSize = UDPHDRLEN + beamlets * UDPNTIMESLICE * UDPNPOL * bits / 8;
+	double lossFraction = -1.0;
+
+	ilt_dada_config *config = bench_recorder(port, key, cores, backend, packetsPerIteration, batchesPerBlock, socketBufferMB, packetSize, 0);
+	if (config == NULL) {
+		return -1.0;
+	}
+
+	// Start from the current time; the packet numbers advance at the requested rate rather than the station rate
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	const long firstPacket = lofar_udp_time_beamformed_packno((unsigned int) now.tv_sec, 0, BENCH_CLOCK_BIT);
+	config->startPacket = firstPacket + 4l * packetsPerIteration;
+	config->endPacket = config->startPacket + (long) (rate * seconds);
+
+	bench_reader reader = { .key = key, .core = cores[2] };
+	bench_sender sender = { .port = port, .core = cores[1], .packetSize = packetSize, .bitMode = bitMode, .beamlets = beamlets, .rate = rate, .firstPacket = firstPacket };
+	pthread_t readerThread, senderThread;
+	if (pthread_create(&readerThread, NULL, bench_reader_thread, &reader) != 0) {
+		ilt_dada_config_cleanup(config);
+		return -1.0;
+	}
+	if (pthread_create(&senderThread, NULL, bench_sender_thread, &sender) != 0) {
+		__atomic_store_n(&(reader.stop), 1, __ATOMIC_RELEASE);
+		pthread_join(readerThread, NULL);
+		ilt_dada_config_cleanup(config);
+		return -1.0;
+	}
+
+	struct timespec start, end;
+	const double cpuStart = bench_thread_cpu();
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	const int operateReturn = ilt_dada_operate(config);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	const double cpuSeconds = bench_thread_cpu() - cpuStart;
+
+	__atomic_store_n(&(sender.stop), 1, __ATOMIC_RELEASE);
+	pthread_join(senderThread, NULL);
+	__atomic_store_n(&(reader.stop), 1, __ATOMIC_RELEASE);
+	pthread_join(readerThread, NULL);
+
+	const ilt_dada_operate_params *params = config->params;
+	const char *status = (operateReturn < 0) ? "failed" : ((sender.failed || reader.failed) ? "harness_failed" : "ok");
+	if (operateReturn == 0 && !sender.failed && !reader.failed && params->packetsExpected > 0) {
+		lossFraction = 1.0 - (double) params->packetsSeen / (double) params->packetsExpected;
+	}
+
+	ilt_dada_latency_summary latency = { 0 };
+	if (params->latency != NULL) {
+		ilt_dada_latency_summarise(params->latency->total, &latency);
+	}
+
+	fprintf(output, "%s,%s,%d,%d,%ld,%d,%d,%d,%.0f,%.0f,%ld,%ld,%.9f,%ld,%ld,%ld,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%ld,%.3f,%s\n",
+	        ILTD_VERSION, benchBackendNames[backend], packetsPerIteration, batchesPerBlock, config->portBufferSize, beamlets, bits, packetSize,
+	        rate, sender.elapsed > 0 ? (double) sender.sent / sender.elapsed : 0.0,
+	        params->packetsExpected, params->packetsSeen, lossFraction < 0 ? 1.0 : lossFraction,
+	        params->sequence.duplicates, params->sequence.late, params->sequence.kernelDrops - params->sequence.kernelDropsBase,
+	        params->packetsSeen ? cpuSeconds * 1e9 / (double) params->packetsSeen : 0.0,
+	        (double) latency.p50[LATENCY_WRITE] * 1e-3, (double) latency.p99[LATENCY_WRITE] * 1e-3, (double) latency.max[LATENCY_WRITE] * 1e-3,
+	        (double) latency.p99[LATENCY_QUEUEING] * 1e-3, (double) latency.max[LATENCY_QUEUEING] * 1e-3,
+	        reader.blocks, ilt_dada_elapsed(&start, &end), status);
+	fflush(output);
+
+	ilt_dada_config_cleanup(config);
+	return lossFraction;
+}
+
+/**
+ * @brief      Check sequence-indexed placement and the packet accounting
+ *             against a stream with injected faults; every lost, re-ordered
+ *             and duplicated packet must be counted by the recorder, and every
+ *             sent packet must be placed in its slot, other than re-ordered
+ *             packets that arrive after their block was released
+ *
+ * @param[in]  faultRates  The loss, re-order and duplicate probabilities
+ *
+ * @return     0: The counts match, 1: Mismatch or failure
+ */
+int bench_placement(int port, int key, const int *cores, float seconds, capture_backend_types backend, int packetsPerIteration, int batchesPerBlock, int socketBufferMB, int beamlets, int bits, double rate, const double *faultRates) {
+	const int bitMode = bits == 16 ? 0 : (bits == 8 ? 1 : 2);
+	const int packetSize = UDPHDRLEN + beamlets * UDPNTIMESLICE * UDPNPOL * bits / 8;
+
+	ilt_dada_config *config = bench_recorder(port, key, cores, backend, packetsPerIteration, batchesPerBlock, socketBufferMB, packetSize, 1);
+	if (config == NULL) {
+		return 1;
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	const long firstPacket = lofar_udp_time_beamformed_packno((unsigned int) now.tv_sec, 0, BENCH_CLOCK_BIT);
+	config->startPacket = firstPacket + 4l * packetsPerIteration;
+	config->endPacket = config->startPacket + (long) (rate * seconds);
+
+	// Faults start after the batch the recorder starts on, and stop early enough that the packets after the last fault
+	// 	reveal any losses at the end of the window
+	ilt_dada_fault_injector faults = { .lossRate = faultRates[0], .reorderRate = faultRates[1], .duplicateRate = faultRates[2], .burstLength = 1, .random = 0x9E3779B97F4A7C15ull };
+	const long faultStart = config->startPacket + packetsPerIteration, faultEnd = config->endPacket - packetsPerIteration - BENCH_SEND_BATCH;
+	if (faultEnd <= faultStart) {
+		fprintf(stderr, "ERROR: -t %.1f is too short to check placement at %.0f packets/s, exiting.\n", seconds, rate);
+		ilt_dada_config_cleanup(config);
+		return 1;
+	}
+	int8_t *fates = calloc(faultEnd - faultStart, sizeof(int8_t));
+	int8_t *placed = calloc(faultEnd - faultStart, sizeof(int8_t));
+	if (fates == NULL || placed == NULL) {
+		fprintf(stderr, "ERROR: Failed to allocate the placement check maps, exiting.\n");
+		FREE_NOT_NULL(fates);
+		FREE_NOT_NULL(placed);
+		ilt_dada_config_cleanup(config);
+		return 1;
+	}
+
+	bench_reader reader = { .key = key, .core = cores[2], .check = 1, .packetSize = packetSize, .checkStart = faultStart, .checkEnd = faultEnd, .placed = placed, .nextPacket = -1 };
+	bench_sender sender = { .port = port, .core = cores[1], .packetSize = packetSize, .bitMode = bitMode, .beamlets = beamlets, .rate = rate, .firstPacket = firstPacket,
+	                        .faults = &faults, .faultStart = faultStart, .faultEnd = faultEnd, .fates = fates };
+	pthread_t readerThread, senderThread;
+	int failed = 0;
+	if (pthread_create(&readerThread, NULL, bench_reader_thread, &reader) != 0) {
+		failed = 1;
+	} else if (pthread_create(&senderThread, NULL, bench_sender_thread, &sender) != 0) {
+		__atomic_store_n(&(reader.stop), 1, __ATOMIC_RELEASE);
+		pthread_join(readerThread, NULL);
+		failed = 1;
+	}
+	if (failed) {
+		free(fates);
+		free(placed);
+		ilt_dada_config_cleanup(config);
+		return 1;
+	}
+
+	printf("Checking placement of %ld packets at %.0f packets/s (%.4f loss, %.4f re-order, %.4f duplicate probabilities)...\n", config->endPacket - config->startPacket, rate, faultRates[0], faultRates[1], faultRates[2]);
+	const int operateReturn = ilt_dada_operate(config);
+
+	__atomic_store_n(&(sender.stop), 1, __ATOMIC_RELEASE);
+	pthread_join(senderThread, NULL);
+	__atomic_store_n(&(reader.stop), 1, __ATOMIC_RELEASE);
+	pthread_join(readerThread, NULL);
+
+	if (operateReturn < 0 || sender.failed || reader.failed) {
+		fprintf(stderr, "ERROR: The placement check failed to run (recorder %d, sender %d, reader %d).\n", operateReturn, sender.failed, reader.failed);
+		failed = 1;
+	}
+
+	// Compare the fate of every packet in the fault window to where it was placed
+	const int ran = !failed;
+	long lateDiscarded = 0, misplaced = 0;
+	for (long packetIdx = 0; ran && packetIdx < faultEnd - faultStart; packetIdx++) {
+		if (fates[packetIdx] == BENCH_PACKET_LATE && !placed[packetIdx]) {
+			lateDiscarded++;
+		} else if ((fates[packetIdx] == BENCH_PACKET_LOST) == placed[packetIdx]) {
+			if (misplaced++ < 16) {
+				fprintf(stderr, "ERROR: Packet %ld was %s, but %s.\n", faultStart + packetIdx, placed[packetIdx] ? "placed" : "sent", placed[packetIdx] ? "never sent" : "not placed");
+			}
+		}
+	}
+
+	const ilt_dada_operate_params *params = config->params;
+	const long kernelDrops = params->sequence.kernelDrops - params->sequence.kernelDropsBase;
+	const struct {
+		const char *name;
+		long expected, measured;
+	} checks[] = {
+		{ "kernel drops", 0, kernelDrops },
+		{ "corrupted packets", 0, params->packetsCorrupted },
+		{ "block errors", 0, reader.errors },
+		{ "misplaced packets", 0, misplaced },
+		{ "missing packets", faults.lost, params->packetsExpected - params->packetsSeen },
+		{ "late packets", faults.reorders, params->sequence.late },
+		{ "duplicate packets", faults.duplicates, params->sequence.duplicates },
+		{ "discarded packets", faults.duplicates + lateDiscarded, params->packetsDiscarded },
+	};
+	for (size_t checkIdx = 0; ran && checkIdx < sizeof(checks) / sizeof(checks[0]); checkIdx++) {
+		printf("%s: expected %ld, measured %ld\n", checks[checkIdx].name, checks[checkIdx].expected, checks[checkIdx].measured);
+		if (checks[checkIdx].expected != checks[checkIdx].measured) {
+			fprintf(stderr, "ERROR: Expected %ld %s, measured %ld.\n", checks[checkIdx].expected, checks[checkIdx].name, checks[checkIdx].measured);
+			failed = 1;
+		}
+	}
+	if (ran && kernelDrops) {
+		fprintf(stderr, "ERROR: Packets were dropped by the kernel, the check is inconclusive; try a lower -R rate or a larger -s buffer.\n");
+	}
+
+	printf("Placement check %s (%ld blocks, %ld re-ordered packets arrived after their block was released).\n", failed ? "FAILED" : "passed", reader.blocks, lateDiscarded);
+
+	free(fates);
+	free(placed);
+	ilt_dada_config_cleanup(config);
+	return failed;
+}
+
+/**
+ * @brief      Cross-check the AVX2 and scalar header validation; batches of
+ *             valid headers have random fields corrupted (including values at
+ *             either side of every bound) before both validators are run on them
+ *
+ * @param[in]  packets  The total number of packets to check
+ *
+ * @return     0: the validators agree, 1: mismatch or failure
+ */
+static int bench_validate(long packets) {
+	// Odd strides and batch sizes exercise unaligned gathers and the scalar tail after the last group of 8
+	const int strides[3] = { UDPHDRLEN, UDPHDRLEN + 1, BENCH_VALIDATE_STRIDE };
+	const uint32_t boundaries[4][4] = {
+		{ UDPMAXBEAM, UDPMAXBEAM + 1, 0x80, 0xff },                     // Beamlets (byte 6)
+		{ UDPNTIMESLICE - 1, UDPNTIMESLICE + 1, 0x00, 0xff },          // Time slices (byte 7)
+		{ LFREPOCH - 1, LFREPOCH, 0x80000000u, 0xffffffffu },          // Timestamp (word 2)
+		{ RSPMAXSEQ, RSPMAXSEQ + 1, 0x80000000u, 0xffffffffu },        // Sequence (word 3)
+	};
+
+	int8_t *buffer = calloc(BENCH_VALIDATE_BATCH, BENCH_VALIDATE_STRIDE);
+	if (buffer == NULL) {
+		fprintf(stderr, "ERROR: Failed to allocate header check buffer, exiting.\n");
+		return 1;
+	}
+
+	uint64_t state = 0x494c544461646131ull;
+	long checked = 0, corrupted = 0, mismatches = 0;
+	while (checked < packets) {
+		const int stride = strides[ilt_dada_random(&state) % 3];
+		int batch = 1 + (int) (ilt_dada_random(&state) % BENCH_VALIDATE_BATCH);
+		if (batch > packets - checked) {
+			batch = (int) (packets - checked);
+		}
+
+		for (int packetIdx = 0; packetIdx < batch; packetIdx++) {
+			int8_t *header = &(buffer[(long) packetIdx * stride]);
+			// Packet numbers after the LOFAR epoch at either clock (12208 packets/s covers the 200MHz rate)
+			const long packetNumber = (long) LFREPOCH * 12208l + (long) (ilt_dada_random(&state) % (1ul << 36));
+			ilt_dada_packno_to_header(header, packetNumber, (int) (ilt_dada_random(&state) % 2), (int) (ilt_dada_random(&state) % 3), 1 + (int) (ilt_dada_random(&state) % UDPMAXBEAM));
+
+			// Corrupt roughly half of the packets, some more than once
+			int corruptions = (int) (ilt_dada_random(&state) % 4) - 1;
+			for (; corruptions > 0; corruptions--) {
+				const uint64_t choice = ilt_dada_random(&state);
+				const int field = (int) ((choice >> 8) % 6);
+				const uint32_t boundary = field < 4 ? boundaries[field][(choice >> 16) % 4] : 0;
+				switch (field) {
+					case 0:
+						header[6] = (int8_t) boundary;
+						break;
+					case 1:
+						header[7] = (int8_t) boundary;
+						break;
+					case 2:
+					case 3:
+						memcpy(&(header[4 + 4 * field]), &boundary, sizeof(uint32_t));
+						break;
+					case 4:
+						// Any byte of the header
+						header[(choice >> 24) % UDPHDRLEN] = (int8_t) (choice >> 32);
+						break;
+					default:
+						// A single bit, covering the version, error and padding bits
+						header[(choice >> 24) % UDPHDRLEN] ^= (int8_t) (1 << ((choice >> 32) % 8));
+						break;
+				}
+			}
+		}
+
+		int batchCorrupted = 0;
+		const int batchMismatches = ilt_dada_check_headers_compare(buffer, batch, stride, &batchCorrupted);
+		if (batchMismatches < 0) {
+			free(buffer);
+			return 1;
+		}
+		if (batchMismatches) {
+			fprintf(stderr, "ERROR: Header validators disagree on %d of %d packets (stride %d, after %ld packets).\n", batchMismatches, batch, stride, checked);
+		}
+		mismatches += batchMismatches;
+		corrupted += batchCorrupted;
+		checked += batch;
+	}
+
+	free(buffer);
+	printf("Checked %ld packets (%ld corrupted), %ld mismatches between the AVX2 and scalar header validation.\n", checked, corrupted, mismatches);
+	return mismatches ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+	int inputOpt, allRates = 0, port = BENCH_DEF_PORT, key = BENCH_DEF_PORT;
+	float seconds = 5.0f, lossThreshold = 0.01f;
+	long validatePackets = 0;
+	double faultRates[3] = { -1.0, -1.0, -1.0 };
+	char outputFile[DEF_STR_LEN] = "ilt_dada_bench.csv";
+	char *endPtr = NULL;
+
+	int cores[3] = { -1, -1, -1 }, numCores;
+	capture_backend_types backends[BENCH_MAX_VALUES] = { CAPTURE_RECVMMSG };
+	int numBackends = 1;
+	int packetsPerIteration[BENCH_MAX_VALUES] = { 256 }, numPacketsPerIteration = 1;
+	int batchesPerBlock[BENCH_MAX_VALUES] = { 64 }, numBatchesPerBlock = 1;
+	int socketBuffers[BENCH_MAX_VALUES] = { 16 }, numSocketBuffers = 1;
+	int beamlets[BENCH_MAX_VALUES] = { 122 }, numBeamlets = 1;
+	int bitModes[BENCH_MAX_VALUES] = { 8 }, numBitModes = 1;
+	int rates[BENCH_MAX_VALUES] = { 12207, 50000, 100000, 200000, 400000, 800000 }, numRates = 6;
+
+	while ((inputOpt = getopt(argc, argv, "ho:p:k:c:t:b:n:m:s:u:d:R:L:aV:F:")) != -1) {
+		int parsed = 1;
+		switch (inputOpt) {
+			case 'o':
+				strncpy(outputFile, optarg, DEF_STR_LEN - 1);
+				break;
+
+			case 'p':
+				port = internal_strtoi(optarg, &endPtr);
+				if (checkOpt(inputOpt, optarg, endPtr)) { return 1; }
+				break;
+
+			case 'k':
+				key = internal_strtoi(optarg, &endPtr);
+				if (checkOpt(inputOpt, optarg, endPtr)) { return 1; }
+				break;
+
+			case 'c':
+				numCores = ilt_dada_parse_list(optarg, cores, 3);
+				parsed = numCores == 3;
+				break;
+
+			case 't':
+				seconds = strtof(optarg, &endPtr);
+				if (checkOpt(inputOpt, optarg, endPtr)) { return 1; }
+				break;
+
+			case 'b':
+				parsed = (numBackends = bench_parse_backends(optarg, backends, BENCH_MAX_VALUES)) > 0;
+				break;
+
+			case 'n':
+				parsed = (numPacketsPerIteration = ilt_dada_parse_list(optarg, packetsPerIteration, BENCH_MAX_VALUES)) > 0;
+				break;
+
+			case 'm':
+				parsed = (numBatchesPerBlock = ilt_dada_parse_list(optarg, batchesPerBlock, BENCH_MAX_VALUES)) > 0;
+				break;
+
+			case 's':
+				parsed = (numSocketBuffers = ilt_dada_parse_list(optarg, socketBuffers, BENCH_MAX_VALUES)) > 0;
+				break;
+
+			case 'u':
+				parsed = (numBeamlets = ilt_dada_parse_list(optarg, beamlets, BENCH_MAX_VALUES)) > 0;
+				break;
+
+			case 'd':
+				parsed = (numBitModes = ilt_dada_parse_list(optarg, bitModes, BENCH_MAX_VALUES)) > 0;
+				break;
+
+			case 'R':
+				parsed = (numRates = ilt_dada_parse_list(optarg, rates, BENCH_MAX_VALUES)) > 0;
+				break;
+
+			case 'L':
+				lossThreshold = strtof(optarg, &endPtr);
+				if (checkOpt(inputOpt, optarg, endPtr)) { return 1; }
+				break;
+
+			case 'a':
+				allRates = 1;
+				break;
+
+			case 'V':
+				validatePackets = strtol(optarg, &endPtr, 10);
+				if (checkOpt(inputOpt, optarg, endPtr)) { return 1; }
+				parsed = validatePackets > 0;
+				break;
+
+			case 'F':
+				parsed = sscanf(optarg, "%lf,%lf,%lf", &(faultRates[0]), &(faultRates[1]), &(faultRates[2])) == 3;
+				for (int idx = 0; parsed && idx < 3; idx++) {
+					parsed = faultRates[idx] >= 0.0 && faultRates[idx] <= 1.0;
+				}
+				break;
+
+			case 'h':
+				helpMessages();
+				return 0;
+
+			default:
+				helpMessages();
+				return 1;
+		}
+
+		if (!parsed) {
+			fprintf(stderr, "ERROR: Failed to parse -%c %s, exiting.\n", inputOpt, optarg);
+			return 1;
+		}
+	}
+
+	for (int idx = 0; idx < numBitModes; idx++) {
+		if (bitModes[idx] != 4 && bitModes[idx] != 8 && bitModes[idx] != 16) {
+			fprintf(stderr, "ERROR: Bit modes must be 4, 8 or 16 (%d), exiting.\n", bitModes[idx]);
+			return 1;
+		}
+	}
+	for (int idx = 0; idx < numBeamlets; idx++) {
+		if (beamlets[idx] < 1 || beamlets[idx] > UDPMAXBEAM) {
+			fprintf(stderr, "ERROR: Beamlets must be between 1 and %d (%d), exiting.\n", UDPMAXBEAM, beamlets[idx]);
+			return 1;
+		}
+	}
+	for (int idx = 0; idx < numRates; idx++) {
+		if (rates[idx] < 1) {
+			fprintf(stderr, "ERROR: Packet rates must be positive (%d), exiting.\n", rates[idx]);
+			return 1;
+		}
+		// The onset of loss is the first lossy rate, so the rates must be tested from the lowest up
+		if (idx > 0 && rates[idx] <= rates[idx - 1]) {
+			fprintf(stderr, "ERROR: Packet rates must be in ascending order (%d after %d), exiting.\n", rates[idx], rates[idx - 1]);
+			return 1;
+		}
+	}
+
+#ifndef ILTD_HAVE_IO_URING
+	for (int idx = 0; idx < numBackends; idx++) {
+		if (backends[idx] == CAPTURE_IO_URING) {
+			fprintf(stderr, "ERROR: The uring capture backend requires ILTDada to be built with liburing, exiting.\n");
+			return 1;
+		}
+	}
+#endif
+
+	if (validatePackets) {
+		return bench_validate(validatePackets);
+	}
+
+	if (faultRates[0] >= 0.0) {
+		return bench_placement(port, key, cores, seconds, backends[0], packetsPerIteration[0], batchesPerBlock[0], socketBuffers[0], beamlets[0], bitModes[0], rates[0], faultRates);
+	}
+
+	FILE *output = fopen(outputFile, "w");
+	if (output == NULL) {
+		fprintf(stderr, "ERROR: Failed to open %s (errno %d: %s), exiting.\n", outputFile, errno, strerror(errno));
+		return 1;
+	}
+	fprintf(output, "version,capture_backend,packets_per_iteration,iterations_per_block,socket_buffer_bytes,beamlets,bit_mode,packet_size,"
+	                "target_pps,sent_pps,packets_expected,packets_seen,loss_fraction,duplicates,late,kernel_drops,cpu_ns_per_packet,"
+	                "write_p50_us,write_p99_us,write_max_us,queueing_p99_us,queueing_max_us,blocks_read,wall_seconds,status\n");
+
+	int failures = 0;
+	for (int bIdx = 0; bIdx < numBackends; bIdx++) {
+		for (int nIdx = 0; nIdx < numPacketsPerIteration; nIdx++) {
+			for (int mIdx = 0; mIdx < numBatchesPerBlock; mIdx++) {
+				for (int sIdx = 0; sIdx < numSocketBuffers; sIdx++) {
+					for (int uIdx = 0; uIdx < numBeamlets; uIdx++) {
+						for (int dIdx = 0; dIdx < numBitModes; dIdx++) {
+							int onset = -1;
+							for (int rIdx = 0; rIdx < numRates; rIdx++) {
+								printf("Benchmarking %s -n %d -m %d, %d MB socket buffer, %d beamlets, %d-bit at %d packets/s...\n", benchBackendNames[backends[bIdx]], packetsPerIteration[nIdx], batchesPerBlock[mIdx], socketBuffers[sIdx], beamlets[uIdx], bitModes[dIdx], rates[rIdx]);
+								const double loss = bench_measure(output, port, key, cores, seconds, backends[bIdx], packetsPerIteration[nIdx], batchesPerBlock[mIdx], socketBuffers[sIdx], beamlets[uIdx], bitModes[dIdx], rates[rIdx]);
+								if (loss < 0) {
+									failures++;
+								}
+
+								if (loss < 0 || 100.0 * loss > lossThreshold) {
+									if (onset < 0) {
+										onset = rates[rIdx];
+									}
+									if (!allRates) {
+										break;
+									}
+								}
+							}
+
+							if (onset > 0) {
+								printf("Loss onset for %s -n %d -m %d, %d MB socket buffer, %d beamlets, %d-bit: %d packets/s\n\n", benchBackendNames[backends[bIdx]], packetsPerIteration[nIdx], batchesPerBlock[mIdx], socketBuffers[sIdx], beamlets[uIdx], bitModes[dIdx], onset);
+							} else {
+								printf("No loss for %s -n %d -m %d, %d MB socket buffer, %d beamlets, %d-bit up to %d packets/s\n\n", benchBackendNames[backends[bIdx]], packetsPerIteration[nIdx], batchesPerBlock[mIdx], socketBuffers[sIdx], beamlets[uIdx], bitModes[dIdx], rates[numRates - 1]);
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+
+	fclose(output);
+	printf("Results written to %s.\n", outputFile);
+
+	return failures ? 1 : 0;
+}
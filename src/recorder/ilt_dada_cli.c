@@ -14,18 +14,36 @@ void iltd_helpMessages() {
 
 	printf("-h      :   Display this message\n\n");
 
-	printf("-p (int):   UDP port to monitor (default: %d)\n", DEF_PORT);
-	printf("-k (int):   Output PSRDADA Ringbuffer key (default: %d)\n\n", DEF_PORT);
+	printf("-p (int):   UDP port(s) to monitor, comma separated (default: %d)\n", DEF_PORT);
+	printf("-k (int):   Output PSRDADA Ringbuffer key(s), comma separated (default: %d, +10 for each additional port)\n", DEF_PORT);
+	printf("-c (int):   CPU core(s) to pin each port's capture thread to, comma separated (default: unpinned)\n");
+	printf("-A (int):   CPU cores for the helper threads (pipelined writer, -R receive threads), comma separated (default: the port's NUMA node or every core, other than the capture cores)\n");
+	printf("-Y (int):   Real-time mode; run the capture threads with SCHED_FIFO priority N, lock the process in memory and test the wake-up latency before the observation (default: 0, disabled)\n\n");
 
 	printf("-n (int):   Number of packets per network operation (default: %d)\n", DEF_PACKETS_PER_READ_OP);
 	printf("-m (int):   Number of packets blocks per segment of the ringbuffer (default: %d)\n", DEF_NUM_BUFFERS);
 	printf("-s (float): Target ringbuffer length in seconds (determines number of segments in the ringbuffer, default: %f)\n", DEF_BUFFER_TIME);
 	printf("-l (int):   Number of packet writes per logging status to console (default: %d)\n", DEF_ITERS_PER_CONSOLE_WRITE_OP);
+	printf("-x (int):   Packet header checks, 0 (none), 1 (every packet) or 2 (first and last packet of each batch) (default: 2)\n");
+	printf("-L      :   Collect kernel receive timestamps and report latency percentiles with the status messages (default: false)\n");
 	printf("-z (float): Network timeout length in seconds (must be greater than 2, default: 30)\n");
+	printf("-b (str):   Packet capture backend, 'recvmmsg' (UDP socket), 'packet' (AF_PACKET TPACKET_V3 ring, requires -i) or 'uring' (io_uring multishot receive) (default: recvmmsg)\n");
+	printf("-i (str):   Network interface(s) the packets arrive on, comma separated per port (e.g., eth0; one interface is used for every port)\n");
+	printf("-N (str):   NUMA node(s) to place each port's buffers and capture thread on, 'auto' (the node of the port's -i interface) or comma separated nodes (default: no placement)\n");
+	printf("-D      :   Bind each port's socket to its -i interface (default: false)\n");
+	printf("-B (int):   Busy-poll the socket for up to N microseconds per read and spin instead of sleeping while waiting for packets, best used with -c (default: 0, disabled)\n");
+	printf("-G      :   Enable UDP GRO, letting the kernel coalesce runs of packets into a single receive (default: false)\n");
+	printf("-M (str):   Publish live recording metrics in the named POSIX shared memory segment (e.g., /iltdada), read by ilt_dada_metrics_exporter (default: disabled)\n");
 
 	printf("-r (int):   Number of read clients (default: 1)\n");
 	printf("-e (int):   Allocate the ringbuffer immediately for a given packet size (default: false, recommended: 7824)\n");
-	printf("-f      :   Force allocate the ringbuffer (remove existing ringbuffer on given key) (default: false)\n\n");
+	printf("-f      :   Force allocate the ringbuffer (remove existing ringbuffer on given key) (default: false)\n");
+	printf("-Z      :   Zero-copy capture, receive packets directly into the ringbuffer blocks (default: false)\n");
+	printf("-P (int):   Place packets in the ringbuffer by their sequence number, filling missing packets with the given byte value and appending a loss mask to every block (default: disabled)\n");
+	printf("-q (int):   Pipelined capture, receive packets in one thread and write them in another, through a queue of N batches (default: 0, disabled)\n");
+	printf("-R (int):   Receive each port through N SO_REUSEPORT sockets, each drained by its own thread and merged in packet order (requires -q, default: 1)\n");
+	printf("-H (int):   Back the capture buffers with 2 or 1024 MB hugepages, and advise transparent hugepages for the ringbuffer (default: 0, disabled)\n");
+	printf("-F      :   Prefault and lock the ringbuffer and capture buffers in memory during the start-up window (default: false)\n\n");
 
 	printf("-S (str):   ISOT Start Time (YYYY-MM-DDTHH:MM:SS, default '')\n");
 	printf("-T (str):   ISOT End time (YYYY-MM-DDTHH:MM:SS, default '')\n");
@@ -62,10 +80,19 @@ int main(int argc, char  *argv[]) {
 	int bufferMul = DEF_NUM_BUFFERS, packetSizeCopy = -1, minStartup = 60, ignoreTimeCheck = 0;
 	float targetSeconds = DEF_BUFFER_TIME, obsSeconds = DEF_OBS_LENGTH;
 	char startTime[DEF_STR_LEN] = "", endTime[DEF_STR_LEN] = "";
+	char metricsName[DEF_STR_LEN] = "";
+	ilt_dada_metrics *metrics = NULL;
 
 	char *endPtr = NULL, flagged = 0;
 
-	while ((inputOpt = getopt(argc, argv, "hp:k:n:m:s:r:l:z:e:fS:T:t:C")) != -1) {
+	int numPorts = 1, numKeys = 0, numCores = 0;
+	int portNums[MAX_NUM_PORTS] = { DEF_PORT }, dadaKeys[MAX_NUM_PORTS] = { DEF_PORT }, captureCores[MAX_NUM_PORTS];
+	int numInterfaces = 0, numNodes = 0, numaNodes[MAX_NUM_PORTS] = { -1 };
+	int numHelperCores, helperCores[CPU_SETSIZE];
+	char interfaces[MAX_NUM_PORTS][IF_NAMESIZE] = { "" };
+	ilt_dada_config *cfgs[MAX_NUM_PORTS] = { NULL };
+
+	while ((inputOpt = getopt(argc, argv, "hp:k:c:A:Y:n:m:s:r:l:z:b:i:N:DB:GM:Lx:e:fZq:R:P:H:FS:T:t:w:C")) != -1) {
 		switch (inputOpt) {
 
 			case 'h':
@@ -74,12 +101,32 @@ int main(int argc, char  *argv[]) {
 				break;
 
 			case 'p':
-				cfg->portNum = internal_strtoi(optarg, &endPtr);
-				if (checkOpt(inputOpt, optarg, endPtr)) { flagged = 1; }
+				if ((numPorts = ilt_dada_parse_list(optarg, portNums, MAX_NUM_PORTS)) < 1) { flagged = 1; }
 				break;
 
 			case 'k':
-				cfg->io->outputDadaKeys[0] = internal_strtoi(optarg, &endPtr);
+				if ((numKeys = ilt_dada_parse_list(optarg, dadaKeys, MAX_NUM_PORTS)) < 1) { flagged = 1; }
+				break;
+
+			case 'c':
+				if ((numCores = ilt_dada_parse_list(optarg, captureCores, MAX_NUM_PORTS)) < 1) { flagged = 1; }
+				break;
+
+			case 'A':
+				if ((numHelperCores = ilt_dada_parse_list(optarg, helperCores, CPU_SETSIZE)) < 1) { flagged = 1; }
+				CPU_ZERO(&(cfg->helperCores));
+				for (int coreIdx = 0; coreIdx < numHelperCores; coreIdx++) {
+					if (helperCores[coreIdx] < 0 || helperCores[coreIdx] >= CPU_SETSIZE) {
+						fprintf(stderr, "ERROR: Helper core %d is outside of the supported range (limit %d).\n", helperCores[coreIdx], CPU_SETSIZE);
+						flagged = 1;
+						break;
+					}
+					CPU_SET(helperCores[coreIdx], &(cfg->helperCores));
+				}
+				break;
+
+			case 'Y':
+				cfg->realtimePriority = internal_strtoi(optarg, &endPtr);
 				if (checkOpt(inputOpt, optarg, endPtr)) { flagged = 1; }
 				break;
 
@@ -109,11 +156,77 @@ int main(int argc, char  *argv[]) {
 				if (checkOpt(inputOpt, optarg, endPtr)) { flagged = 1; }
 				break;
 
+			case 'x':
+				cfg->checkParameters = internal_strtoi(optarg, &endPtr);
+				if (checkOpt(inputOpt, optarg, endPtr)) { flagged = 1; }
+				break;
+
+			case 'L':
+				cfg->latencyStats = 1;
+				break;
+
 			case 'z':
 				cfg->portTimeout = strtof(optarg, &endPtr);
 				if (checkOpt(inputOpt, optarg, endPtr)) { flagged = 1; }
 				break;
 
+			case 'b':
+				if (strcmp(optarg, "recvmmsg") == 0) {
+					cfg->captureBackend = CAPTURE_RECVMMSG;
+				} else if (strcmp(optarg, "packet") == 0) {
+					cfg->captureBackend = CAPTURE_PACKET_MMAP;
+				} else if (strcmp(optarg, "uring") == 0) {
+					cfg->captureBackend = CAPTURE_IO_URING;
+				} else {
+					fprintf(stderr, "ERROR: Unknown capture backend %s.\n", optarg);
+					flagged = 1;
+				}
+				break;
+
+			case 'B':
+				cfg->busyPoll = internal_strtoi(optarg, &endPtr);
+				if (checkOpt(inputOpt, optarg, endPtr)) { flagged = 1; }
+				break;
+
+			case 'G':
+				cfg->udpGro = 1;
+				break;
+
+			case 'M':
+				if (strlen(optarg) >= DEF_STR_LEN || optarg[0] != '/') {
+					fprintf(stderr, "ERROR: Metrics segment name %s must start with '/' and be shorter than %d characters.\n", optarg, DEF_STR_LEN);
+					flagged = 1;
+				} else {
+					strcpy(metricsName, optarg);
+				}
+				break;
+
+			case 'i':
+				numInterfaces = 0;
+				for (char *interface = strtok(optarg, ","); interface != NULL; interface = strtok(NULL, ",")) {
+					if (strlen(interface) >= IF_NAMESIZE || numInterfaces == MAX_NUM_PORTS) {
+						fprintf(stderr, "ERROR: Interface name %s is too long, or too many interfaces were provided.\n", interface);
+						flagged = 1;
+						break;
+					}
+					strcpy(interfaces[numInterfaces++], interface);
+				}
+				if (numInterfaces < 1) { flagged = 1; }
+				break;
+
+			case 'N':
+				if (strcmp(optarg, "auto") == 0) {
+					numNodes = 1;
+					numaNodes[0] = ILTD_NUMA_AUTO;
+				} else if ((numNodes = ilt_dada_parse_list(optarg, numaNodes, MAX_NUM_PORTS)) < 1) {
+					flagged = 1;
+				}
+				break;
+
+			case 'D':
+				cfg->bindDevice = 1;
+				break;
+
 			case 'e':
 				cfg->packetSize = internal_strtoi(optarg, &endPtr);
 				if (checkOpt(inputOpt, optarg, endPtr)) { flagged = 1; }
@@ -125,6 +238,35 @@ int main(int argc, char  *argv[]) {
 				cfg->io->progressWithExisting = 1;
 				break;
 
+			case 'Z':
+				cfg->zeroCopy = 1;
+				break;
+
+			case 'P':
+				cfg->sequencePlacement = 1;
+				cfg->fillPattern = internal_strtoi(optarg, &endPtr);
+				if (checkOpt(inputOpt, optarg, endPtr)) { flagged = 1; }
+				break;
+
+			case 'q':
+				cfg->pipelineDepth = internal_strtoi(optarg, &endPtr);
+				if (checkOpt(inputOpt, optarg, endPtr)) { flagged = 1; }
+				break;
+
+			case 'R':
+				cfg->receiveSockets = internal_strtoi(optarg, &endPtr);
+				if (checkOpt(inputOpt, optarg, endPtr)) { flagged = 1; }
+				break;
+
+			case 'H':
+				cfg->hugePages = internal_strtoi(optarg, &endPtr);
+				if (checkOpt(inputOpt, optarg, endPtr)) { flagged = 1; }
+				break;
+
+			case 'F':
+				cfg->prefault = 1;
+				break;
+
 			case 'S':
 				strcpy(startTime, optarg);
 				break;
@@ -164,10 +306,37 @@ int main(int argc, char  *argv[]) {
 		return 1;
 	}
 
+	if (numKeys > 1 && numKeys != numPorts) {
+		fprintf(stderr, "ERROR: Number of ringbuffer keys (%d) does not match the number of ports (%d), exiting.\n", numKeys, numPorts);
+		ilt_dada_config_cleanup(cfg);
+		return 1;
+	}
+
+	if (numCores && numCores != numPorts) {
+		fprintf(stderr, "ERROR: Number of capture cores (%d) does not match the number of ports (%d), exiting.\n", numCores, numPorts);
+		ilt_dada_config_cleanup(cfg);
+		return 1;
+	}
+
+	if ((numInterfaces > 1 && numInterfaces != numPorts) || (numNodes > 1 && numNodes != numPorts)) {
+		fprintf(stderr, "ERROR: Number of interfaces (%d) or NUMA nodes (%d) does not match the number of ports (%d), exiting.\n", numInterfaces, numNodes, numPorts);
+		ilt_dada_config_cleanup(cfg);
+		return 1;
+	}
+
+	// Follow the I-LOFAR convention of offsetting the ringbuffer keys by 10 if we weren't given a key for every port
+	for (int port = (numKeys > 1 ? numKeys : 1); port < numPorts; port++) {
+		dadaKeys[port] = dadaKeys[0] + 10 * port;
+	}
+
 
 
 
 	cfg->io->writeBufSize[0] = bufferMul * cfg->packetsPerIteration * cfg->packetSize;
+	// Leave space for the packet mask and trailer at the end of every block
+	if (cfg->sequencePlacement) {
+		cfg->io->writeBufSize[0] += ilt_dada_placement_trailer_size(bufferMul * cfg->packetsPerIteration);
+	}
 
 	// TODO: float packetRate = ();
 	float packetRate = 12207.0f;
@@ -179,8 +348,29 @@ int main(int argc, char  *argv[]) {
 	cfg->io->dadaConfig.nbufs = targetSeconds * packetRate / (cfg->packetsPerIteration * bufferMul);
 
 
+	// Build a configuration for every port from the parsed options; the capture cores of every port are checked against the helper cores
+	cfgs[0] = cfg;
+	CPU_ZERO(&(cfg->captureCores));
+	for (int port = 0; port < numCores; port++) {
+		if (captureCores[port] >= 0 && captureCores[port] < CPU_SETSIZE) {
+			CPU_SET(captureCores[port], &(cfg->captureCores));
+		}
+	}
+	for (int port = 0; port < numPorts; port++) {
+		if (port != 0 && (cfgs[port] = ilt_dada_config_copy(cfg)) == NULL) {
+			ilt_dada_cli_cleanup(cfgs, numPorts);
+			return 1;
+		}
+
+		cfgs[port]->portNum = portNums[port];
+		cfgs[port]->io->outputDadaKeys[0] = dadaKeys[port];
+		cfgs[port]->captureCore = numCores ? captureCores[port] : -1;
+		strcpy(cfgs[port]->interfaceName, interfaces[numInterfaces > 1 ? port : 0]);
+		cfgs[port]->numaNode = numaNodes[numNodes > 1 ? port : 0];
+	}
+
 	if (ilt_dada_cli_check_times(startTime, endTime, obsSeconds, ignoreTimeCheck, minStartup) < 0) {
-		ilt_dada_config_cleanup(cfg);
+		ilt_dada_cli_cleanup(cfgs, numPorts);
 		return 1;
 	}
 
@@ -190,45 +380,85 @@ int main(int argc, char  *argv[]) {
 	}
 	printf(".\n");
 
-	if (ilt_dada_config_setup(cfg, cfg->packetSize != -1) < 0) {
-		ilt_dada_config_cleanup(cfg);
-		return 1;
-	}
-
-	// TODO: Rework / add clock bit flag so we can test this before we enter a sleep state
-	// Convert the start time to a packet
-	// Fallback to 200MHz clock (bit = 1) if bit is not set.
-	cfg->startPacket = lofar_udp_time_get_packet_from_isot(startTime, cfg->obsClockBit > 2 ? 1 : cfg->obsClockBit);
+	for (int port = 0; port < numPorts; port++) {
+		// TODO: Rework / add clock bit flag so we can test this before we enter a sleep state
+		// Convert the start time to a packet before the socket is opened, so packets before the start can be filtered out by the kernel
+		// Fallback to 200MHz clock (bit = 1) if bit is not set.
+		cfgs[port]->startPacket = lofar_udp_time_get_packet_from_isot(startTime, cfgs[port]->obsClockBit > 2 ? 1 : cfgs[port]->obsClockBit);
 
-	if (strcmp(endTime, "") != 0) {
-		cfg->endPacket = lofar_udp_time_get_packet_from_isot(endTime, cfg->obsClockBit > 2 ? 1 : cfg->obsClockBit);
+		if (strcmp(endTime, "") != 0) {
+			cfgs[port]->endPacket = lofar_udp_time_get_packet_from_isot(endTime, cfgs[port]->obsClockBit > 2 ? 1 : cfgs[port]->obsClockBit);
 
-	}
+		}
 
+		if (ilt_dada_config_setup(cfgs[port], cfgs[port]->packetSize != -1) < 0) {
+			ilt_dada_cli_cleanup(cfgs, numPorts);
+			return 1;
+		}
 
+		// Without explicit cores, pin the capture thread to a core local to the port's NUMA node
+		if (!numCores && cfgs[port]->numaNode >= 0) {
+			cfgs[port]->captureCore = ilt_dada_cli_numa_core(cfgs, port);
+		}
+		printf("Port %d placement: interface %s, NUMA node %d, capture core %d, socket %s.\n", cfgs[port]->portNum, strnlen(cfgs[port]->interfaceName, IF_NAMESIZE) ? cfgs[port]->interfaceName : "(any)", cfgs[port]->numaNode, cfgs[port]->captureCore, cfgs[port]->bindDevice ? "bound to the interface" : "unbound");
 
+		if (cfgs[port]->packetSize != packetSizeCopy && packetSizeCopy != -1) {
+			fprintf(stderr, "ERROR: Provided packet length differs from observed packet length on port %d (%d vs %d), this may cause issues. Attempting to continue...\n", cfgs[port]->portNum, packetSizeCopy, cfgs[port]->packetSize);
+		}
 
-	if (cfg->packetSize != packetSizeCopy && packetSizeCopy != -1) {
-		fprintf(stderr, "ERROR: Provided packet length differs from observed packet length (%d vs %d), this may cause issues. Attempting to continue...\n", packetSizeCopy, cfg->packetSize);
+		printf("Preparing ILTDada to record data from port %d, consuming %d packets per iteration", cfgs[port]->portNum, cfgs[port]->packetsPerIteration);
+		if (cfgs[port]->captureCore != -1) {
+			printf(" on core %d", cfgs[port]->captureCore);
+		}
+		printf(".\n");
+		printf("Ringbuffer on key %d (ptr %x) will require %ld MB (%ld GB) of memory to hold ~%.1f seconds of data in %" PRIu64 " buffers.\n", cfgs[port]->io->outputDadaKeys[0], cfgs[port]->io->outputDadaKeys[0], cfgs[port]->io->writeBufSize[0] * cfgs[port]->io->dadaConfig.nbufs >> 20, cfgs[port]->io->writeBufSize[0] * cfgs[port]->io->dadaConfig.nbufs >> 30, (bufferMul * cfgs[port]->packetsPerIteration * cfgs[port]->io->dadaConfig.nbufs) / packetRate, cfgs[port]->io->dadaConfig.nbufs);
 	}
+	printf("Start/End packets will be %ld and %ld.\n\n", cfgs[0]->startPacket, cfgs[0]->endPacket);
 
-	printf("Preparing ILTDada to record data from port %d, consuming %d packets per iteration.\n", cfg->portNum, cfg->packetsPerIteration);
-	printf("Ringbuffer on key %d (ptr %x) will require %ld MB (%ld GB) of memory to hold ~%.1f seconds of data in %" PRIu64 " buffers.\n", cfg->io->outputDadaKeys[0], cfg->io->outputDadaKeys[0], cfg->io->writeBufSize[0] * cfg->io->dadaConfig.nbufs >> 20, cfg->io->writeBufSize[0] * cfg->io->dadaConfig.nbufs >> 30, (bufferMul * cfg->packetsPerIteration * cfg->io->dadaConfig.nbufs) / packetRate, cfg->io->dadaConfig.nbufs);
-	printf("Start/End packets will be %ld and %ld.\n\n", cfg->startPacket, cfg->endPacket);
+	// Give every port a slot in the metrics segment
+	if (strcmp(metricsName, "") != 0) {
+		if ((metrics = ilt_dada_metrics_open(metricsName, numPorts)) == NULL) {
+			ilt_dada_cli_cleanup(cfgs, numPorts);
+			return 1;
+		}
+
+		for (int port = 0; port < numPorts; port++) {
+			cfgs[port]->metrics = &(metrics->ports[port]);
+			ilt_dada_metrics_state(cfgs[port], METRICS_IDLE);
+		}
+		printf("Publishing metrics in shared memory segment %s.\n", metricsName);
+	}
 
 	printf("Preparing to start recording...\n");
-	if (ilt_dada_operate(cfg) < 0) {
+	if (ilt_dada_operate_multi(cfgs, numPorts) < 0) {
 		printf("Exiting.\n");
-		ilt_dada_config_cleanup(cfg);
+		ilt_dada_metrics_close(metrics, metricsName);
+		ilt_dada_cli_cleanup(cfgs, numPorts);
 		return 1;
 	}
 
 	printf("Observation finished, cleaning up.\n");
-	ilt_dada_config_cleanup(cfg);
+	ilt_dada_metrics_close(metrics, metricsName);
+	ilt_dada_cli_cleanup(cfgs, numPorts);
 
 	return 0;
 }
 
+/**
+ * @brief      Cleanup the configuration structs for every port
+ *
+ * @param      cfgs      The configuration structs
+ * @param[in]  numPorts  The number of ports
+ */
+void ilt_dada_cli_cleanup(ilt_dada_config **cfgs, int numPorts) {
+	for (int port = 0; port < numPorts; port++) {
+		if (cfgs[port] != NULL) {
+			ilt_dada_config_cleanup(cfgs[port]);
+			cfgs[port] = NULL;
+		}
+	}
+}
+
 /**
  * @brief      { function_description }
  *
@@ -314,3 +544,32 @@ int ilt_dada_cli_check_times(char *startTime, char *endTime, double obsSeconds,
 
 	return 0;
 }
+
+/**
+ * @brief      Pick a capture core on a port's NUMA node that no earlier port
+ *             is using, preferring the end of the node's core list to stay
+ *             clear of the housekeeping work usually placed on its first
+ *             cores
+ *
+ * @param      cfgs  The port configurations
+ * @param[in]  port  The port index
+ *
+ * @return     >=0: core, -1: no core available (unpinned)
+ */
+int ilt_dada_cli_numa_core(ilt_dada_config **cfgs, int port) {
+	int cores[CPU_SETSIZE];
+	const int numCores = ilt_dada_numa_node_cores(cfgs[port]->numaNode, cores, CPU_SETSIZE);
+
+	for (int coreIdx = numCores - 1; coreIdx >= 0; coreIdx--) {
+		int used = 0;
+		for (int prior = 0; prior < port; prior++) {
+			used |= cfgs[prior]->captureCore == cores[coreIdx];
+		}
+		if (!used) {
+			return cores[coreIdx];
+		}
+	}
+
+	fprintf(stderr, "WARNING: No free cores found on NUMA node %d for port %d, the capture thread will not be pinned.\n", cfgs[port]->numaNode, cfgs[port]->portNum);
+	return -1;
+}
@@ -14,6 +14,8 @@ extern "C" {
 int main(int argc, char  *argv[]);
 time_t unixTimeFromString(const char *inputStr);
 int ilt_dada_cli_check_times(char *startTime, char *endTime, double obsSeconds, int ignoreTimeCheck, int minStartup);
+int ilt_dada_cli_numa_core(ilt_dada_config **cfgs, int port);
+void ilt_dada_cli_cleanup(ilt_dada_config **cfgs, int numPorts);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,1008 @@
+// O_DIRECT and fcntl flags need the GNU Source define
+// This needs to be at the top or O_DIRECT will not be found.
+#define _GNU_SOURCE 1
+
+// Standard includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <aio.h>
+#include <sys/stat.h>
+
+#undef _GNU_SOURCE
+
+// PSRDADA includes
+#include "ilt_dada.h"
+#include "lofar_cli_meta.h"
+
+#include <zstd.h>
+
+#ifdef ILTD_HAVE_IO_URING
+#include <liburing.h>
+#endif
+
+// Disk writer references:
+// https://man7.org/linux/man-pages/man2/open.2.html (O_DIRECT)
+// https://man7.org/linux/man-pages/man7/aio.7.html
+// https://unixism.net/loti/tutorial/fixed_buffers.html
+// https://github.com/facebook/zstd/blob/dev/doc/zstd_compression_format.md#skippable-frames
+// https://github.com/facebook/zstd/blob/dev/contrib/seekable_format/zstd_seekable_compression_format.md
+
+// Offsets, lengths and buffer addresses of O_DIRECT writes must be aligned to the logical block size of the disk;
+// 4096 covers both 512 byte and 4KiB sector disks
+#define D2D_DIRECT_ALIGN 4096
+#define D2D_MAX_STRIPES 16
+#define D2D_PATH_LEN (2 * DEF_STR_LEN + 16)
+#define D2D_POLL_USEC 1000
+
+// Compressed blocks are padded to the O_DIRECT alignment with zstd skippable frames, so the output remains a valid
+// zstd stream, and the seek table of the zstd seekable format is appended to every output file. The padding frames are
+// listed in the seek table as their own entries, with no decompressed data.
+#define D2D_SKIPPABLE_MAGIC 0x184D2A50u
+#define D2D_SKIPPABLE_HEADER 8
+#define D2D_SEEKTABLE_MAGIC 0x184D2A5Eu
+#define D2D_SEEKABLE_MAGIC 0x8F92EAB1u
+#define D2D_SEEKTABLE_FOOTER 9
+
+typedef enum {
+	SLOT_FREE,
+	SLOT_FILLED, // Copied from the ringbuffer, waiting to be compressed
+	SLOT_COMPRESSED, // Ready to be written
+	SLOT_WRITING
+} d2d_slot_state;
+
+// A ringbuffer block copied out of the ringbuffer, being compressed and/or written to disk
+typedef struct d2d_slot {
+	int8_t *buffer;
+	int8_t *compressed;
+	size_t bytes;
+	d2d_slot_state state;
+
+	// The data to write, and the space it takes up in the output (excluding O_DIRECT padding of raw blocks)
+	int8_t *output;
+	size_t length;
+	size_t fileBytes;
+	// The length of the compressed frame, without the padding frame
+	size_t frameLength;
+
+	size_t written;
+	int stripe;
+	off_t offset;
+	int inFlight;
+#ifndef ILTD_HAVE_IO_URING
+	struct aiocb cb;
+#endif
+} d2d_slot;
+
+typedef struct d2d_writer {
+	int numStripes;
+	int fds[D2D_MAX_STRIPES];
+	char files[D2D_MAX_STRIPES][D2D_PATH_LEN];
+	size_t stripeBytes[D2D_MAX_STRIPES];
+	size_t headerLength;
+	int direct;
+
+	int depth;
+	d2d_slot *slots;
+	long nextWrite;
+#ifdef ILTD_HAVE_IO_URING
+	struct io_uring ring;
+	int ringReady;
+#endif
+
+	// Compression
+	int compress;
+	int level;
+	size_t compressedCapacity;
+	uint32_t *seekTable[D2D_MAX_STRIPES];
+	long seekEntries[D2D_MAX_STRIPES];
+	long seekCapacity[D2D_MAX_STRIPES];
+
+	// Compression worker pool; blocks are handed over in order, numFilled counts the blocks handed over and
+	// nextCompress the blocks taken by a worker
+	int numWorkers;
+	int workersStarted;
+	pthread_t workers[MAX_NUM_PORTS * 4];
+	pthread_mutex_t mutex;
+	pthread_cond_t filled;
+	pthread_cond_t compressed;
+	long numFilled;
+	long nextCompress;
+	int stop;
+	int failed;
+
+	size_t diskBytes;
+} d2d_writer;
+
+static volatile sig_atomic_t d2dRunning = 1;
+
+static void d2dStop(int signal) {
+	(void) signal;
+	d2dRunning = 0;
+}
+
+void helpMessages() {
+	printf("ILTDada dada2disk (CLI v%s, lib %s)\n\n", ILTD_CLI_VERSION, ILTD_VERSION);
+
+	printf("-h				: Display this message\n");
+	printf("-k (int)		: Input PSRDADA ringbuffer key (default: %d)\n", DEF_PORT);
+	printf("-d (str)		: Output directories, comma separated; ringbuffer blocks are striped across them in turn (default: .)\n");
+	printf("-o (str)		: Output file name, '.dada' is appended, and the stripe index when striping (default: iltdada_<key>)\n");
+	printf("-q (int)		: Number of ringbuffer blocks being written at once (default: 8)\n");
+	printf("-B				: Use buffered writes rather than O_DIRECT\n");
+	printf("-z (int)		: Compress every ringbuffer block with zstd at the given level, negative levels are faster (default: disabled)\n");
+	printf("-j (int)		: Number of compression threads (default: 4)\n");
+	printf("-l (float)		: Seconds between status reports (default: 10)\n\n");
+}
+
+/**
+ * @brief      Round a length up to the O_DIRECT alignment
+ */
+static size_t d2d_align(size_t length) {
+	return ((length + D2D_DIRECT_ALIGN - 1) / D2D_DIRECT_ALIGN) * D2D_DIRECT_ALIGN;
+}
+
+/**
+ * @brief      Compress a block into a single zstd frame, padded to the O_DIRECT
+ *             alignment with a skippable frame if needed
+ *
+ * @param      cctx      The compression context
+ * @param[in]  level     The compression level
+ * @param[in]  direct    Pad the frame for O_DIRECT
+ * @param[in]  src       The block
+ * @param[in]  bytes     The block size
+ * @param      dst       The output buffer
+ * @param[in]  capacity  The size of the output buffer
+ * @param[out] frame     The frame length, without the padding
+ *
+ * @return     >0: The padded frame length, 0: Failure
+ */
+static size_t d2d_compress(ZSTD_CCtx *cctx, int level, int direct, const int8_t *src, size_t bytes, int8_t *dst, size_t capacity, size_t *frame) {
+	size_t length = ZSTD_compressCCtx(cctx, dst, capacity - D2D_DIRECT_ALIGN, src, bytes, level);
+	if (ZSTD_isError(length)) {
+		fprintf(stderr, "ERROR: Failed to compress a %ld byte block (%s).\n", (long) bytes, ZSTD_getErrorName(length));
+		return 0;
+	}
+	*frame = length;
+
+	if (direct) {
+		// A skippable frame has an 8 byte header, so small gaps are extended by another alignment
+		size_t padding = d2d_align(length) - length;
+		if (padding && padding < D2D_SKIPPABLE_HEADER) {
+			padding += D2D_DIRECT_ALIGN;
+		}
+
+		if (padding) {
+			const uint32_t skippable[2] = { D2D_SKIPPABLE_MAGIC, (uint32_t) (padding - D2D_SKIPPABLE_HEADER) };
+			memcpy(&(dst[length]), skippable, D2D_SKIPPABLE_HEADER);
+			memset(&(dst[length + D2D_SKIPPABLE_HEADER]), 0, padding - D2D_SKIPPABLE_HEADER);
+			length += padding;
+		}
+	}
+
+	return length;
+}
+
+/**
+ * @brief      Add a frame, and the skippable frame padding it (if any), to a
+ *             stripe's seek table
+ *
+ * @param      writer        The writer
+ * @param[in]  stripe        The stripe
+ * @param[in]  length        The compressed frame length, including padding
+ * @param[in]  frame         The compressed frame length, excluding padding
+ * @param[in]  decompressed  The decompressed frame length
+ *
+ * @return     0: Success, -1: Failure
+ */
+static int d2d_seek_add(d2d_writer *writer, int stripe, size_t length, size_t frame, size_t decompressed) {
+	if (writer->seekEntries[stripe] + 2 > writer->seekCapacity[stripe]) {
+		const long capacity = writer->seekCapacity[stripe] ? 2 * writer->seekCapacity[stripe] : 1024;
+		uint32_t *table = (uint32_t*) realloc(writer->seekTable[stripe], capacity * 2 * sizeof(uint32_t));
+		if (table == NULL) {
+			fprintf(stderr, "ERROR: Failed to grow the seek table of %s.\n", writer->files[stripe]);
+			return -1;
+		}
+		writer->seekTable[stripe] = table;
+		writer->seekCapacity[stripe] = capacity;
+	}
+
+	writer->seekTable[stripe][2 * writer->seekEntries[stripe]] = (uint32_t) frame;
+	writer->seekTable[stripe][2 * writer->seekEntries[stripe] + 1] = (uint32_t) decompressed;
+	writer->seekEntries[stripe]++;
+
+	if (length > frame) {
+		writer->seekTable[stripe][2 * writer->seekEntries[stripe]] = (uint32_t) (length - frame);
+		writer->seekTable[stripe][2 * writer->seekEntries[stripe] + 1] = 0;
+		writer->seekEntries[stripe]++;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief      Append the seek table to a stripe's output file, after the final
+ *             block
+ *
+ * @param      writer  The writer
+ * @param[in]  stripe  The stripe
+ *
+ * @return     The length of the seek table, or -1 on failure
+ */
+static long d2d_seek_write(d2d_writer *writer, int stripe) {
+	const long entries = writer->seekEntries[stripe];
+	const size_t tableLength = D2D_SKIPPABLE_HEADER + entries * 2 * sizeof(uint32_t) + D2D_SEEKTABLE_FOOTER;
+	uint8_t *table = (uint8_t*) calloc(tableLength, sizeof(uint8_t));
+	if (table == NULL) {
+		fprintf(stderr, "ERROR: Failed to allocate the seek table of %s.\n", writer->files[stripe]);
+		return -1;
+	}
+
+	const uint32_t frameHeader[2] = { D2D_SEEKTABLE_MAGIC, (uint32_t) (tableLength - D2D_SKIPPABLE_HEADER) };
+	const uint32_t numFrames = (uint32_t) entries, seekableMagic = D2D_SEEKABLE_MAGIC;
+	memcpy(table, frameHeader, D2D_SKIPPABLE_HEADER);
+	memcpy(&(table[D2D_SKIPPABLE_HEADER]), writer->seekTable[stripe], entries * 2 * sizeof(uint32_t));
+	memcpy(&(table[tableLength - D2D_SEEKTABLE_FOOTER]), &numFrames, sizeof(uint32_t));
+	// Seek_Table_Descriptor: no checksums
+	table[tableLength - D2D_SEEKTABLE_FOOTER + 4] = 0;
+	memcpy(&(table[tableLength - sizeof(uint32_t)]), &seekableMagic, sizeof(uint32_t));
+
+	// The table is not aligned, write it through the page cache
+	const int fd = writer->fds[stripe];
+	const off_t offset = (off_t) (writer->headerLength + writer->stripeBytes[stripe]);
+	if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT) == -1 || pwrite(fd, table, tableLength, offset) != (ssize_t) tableLength) {
+		fprintf(stderr, "ERROR: Failed to write the seek table to %s (errno %d: %s).\n", writer->files[stripe], errno, strerror(errno));
+		free(table);
+		return -1;
+	}
+
+	free(table);
+	return (long) tableLength;
+}
+
+/**
+ * @brief      Open an output file for every stripe, and write the observation
+ *             header to the start of each
+ *
+ * @param      writer       The writer
+ * @param[in]  directories  The output directories, comma separated
+ * @param[in]  name         The output file name
+ * @param[in]  header       The DADA header
+ * @param[in]  headerSize   The DADA header size
+ *
+ * @return     0: Success, -1: Failure
+ */
+int d2d_open_outputs(d2d_writer *writer, char *directories, const char *name, const char *header, size_t headerSize) {
+	const char *stripeDirectories[D2D_MAX_STRIPES];
+	for (char *directory = strtok(directories, ","); directory != NULL; directory = strtok(NULL, ",")) {
+		if (writer->numStripes == D2D_MAX_STRIPES) {
+			fprintf(stderr, "ERROR: Too many output directories provided (limit %d).\n", D2D_MAX_STRIPES);
+			return -1;
+		}
+		stripeDirectories[writer->numStripes++] = directory;
+	}
+
+	if (writer->numStripes == 0) {
+		fprintf(stderr, "ERROR: No output directories provided.\n");
+		return -1;
+	}
+
+	// The header keeps the first block aligned, so pad it to the alignment (the DADA header is normally 4096 bytes)
+	const size_t headerCapacity = d2d_align(ZSTD_compressBound(headerSize)) + D2D_DIRECT_ALIGN;
+	writer->headerLength = writer->direct ? d2d_align(headerSize) : headerSize;
+	int8_t *headerBuffer = (int8_t*) aligned_alloc(D2D_DIRECT_ALIGN, headerCapacity);
+	if (headerBuffer == NULL) {
+		fprintf(stderr, "ERROR: Failed to allocate header buffer.\n");
+		return -1;
+	}
+	memset(headerBuffer, 0, headerCapacity);
+	memcpy(headerBuffer, header, headerSize);
+
+	// When compressing, the header is the first frame of every file
+	size_t headerFrame = 0;
+	if (writer->compress) {
+		ZSTD_CCtx *cctx = ZSTD_createCCtx();
+		writer->headerLength = cctx != NULL ? d2d_compress(cctx, writer->level, writer->direct, (const int8_t*) header, headerSize, headerBuffer, headerCapacity, &headerFrame) : 0;
+		ZSTD_freeCCtx(cctx);
+
+		if (writer->headerLength == 0) {
+			fprintf(stderr, "ERROR: Failed to compress the header.\n");
+			free(headerBuffer);
+			return -1;
+		}
+	}
+
+	for (int stripe = 0; stripe < writer->numStripes; stripe++) {
+		char *file = writer->files[stripe];
+		const char *extension = writer->compress ? "dada.zst" : "dada";
+		if (writer->numStripes > 1) {
+			snprintf(file, D2D_PATH_LEN, "%s/%s.%d.%s", stripeDirectories[stripe], name, stripe, extension);
+		} else {
+			snprintf(file, D2D_PATH_LEN, "%s/%s.%s", stripeDirectories[stripe], name, extension);
+		}
+
+		if ((writer->fds[stripe] = open(file, O_WRONLY | O_CREAT | O_TRUNC | (writer->direct ? O_DIRECT : 0), 0644)) == -1) {
+			fprintf(stderr, "ERROR: Failed to open %s%s (errno %d: %s).\n", file, writer->direct ? " with O_DIRECT (use -B on file systems that do not support it)" : "", errno, strerror(errno));
+			free(headerBuffer);
+			return -1;
+		}
+
+		if (pwrite(writer->fds[stripe], headerBuffer, writer->headerLength, 0) != (ssize_t) writer->headerLength) {
+			fprintf(stderr, "ERROR: Failed to write the header to %s (errno %d: %s).\n", file, errno, strerror(errno));
+			free(headerBuffer);
+			return -1;
+		}
+		if (writer->compress && d2d_seek_add(writer, stripe, writer->headerLength, headerFrame, headerSize) < 0) {
+			free(headerBuffer);
+			return -1;
+		}
+		printf("Writing stripe %d to %s.\n", stripe, file);
+	}
+
+	free(headerBuffer);
+	return 0;
+}
+
+/**
+ * @brief      Queue the (remaining) contents of a slot to be written
+ *
+ * @param      writer  The writer
+ * @param      slot    The slot
+ *
+ * @return     0: Success, -1: Failure
+ */
+int d2d_submit(d2d_writer *writer, d2d_slot *slot) {
+	const int fd = writer->fds[slot->stripe];
+	slot->inFlight = 1;
+
+#ifdef ILTD_HAVE_IO_URING
+	struct io_uring_sqe *sqe = io_uring_get_sqe(&(writer->ring));
+	if (sqe == NULL) {
+		fprintf(stderr, "ERROR: io_uring submission queue is full.\n");
+		return -1;
+	}
+	io_uring_prep_write(sqe, fd, &(slot->output[slot->written]), slot->length - slot->written, slot->offset + slot->written);
+	io_uring_sqe_set_data64(sqe, (uint64_t) (slot - writer->slots));
+
+	int returnVal;
+	if ((returnVal = io_uring_submit(&(writer->ring))) < 0) {
+		fprintf(stderr, "ERROR: Failed to submit write to %s (errno %d: %s).\n", writer->files[slot->stripe], -returnVal, strerror(-returnVal));
+		return -1;
+	}
+#else
+	memset(&(slot->cb), 0, sizeof(struct aiocb));
+	slot->cb.aio_fildes = fd;
+	slot->cb.aio_buf = &(slot->output[slot->written]);
+	slot->cb.aio_nbytes = slot->length - slot->written;
+	slot->cb.aio_offset = slot->offset + slot->written;
+
+	if (aio_write(&(slot->cb)) == -1) {
+		fprintf(stderr, "ERROR: Failed to submit write to %s (errno %d: %s).\n", writer->files[slot->stripe], errno, strerror(errno));
+		return -1;
+	}
+#endif
+
+	return 0;
+}
+
+/**
+ * @brief      Account for a finished write, resubmitting the remainder of a
+ *             short write
+ *
+ * @param      writer  The writer
+ * @param      slot    The slot
+ * @param[in]  result  The number of bytes written, or -errno
+ *
+ * @return     0: Success, -1: Failure
+ */
+static int d2d_complete(d2d_writer *writer, d2d_slot *slot, long result) {
+	slot->inFlight = 0;
+	if (result <= 0) {
+		fprintf(stderr, "ERROR: Failed to write %ld bytes to %s (errno %d: %s).\n", (long) (slot->length - slot->written), writer->files[slot->stripe], (int) -result, result ? strerror((int) -result) : "no space left?");
+		return -1;
+	}
+
+	slot->written += result;
+	if (slot->written < slot->length) {
+		return d2d_submit(writer, slot);
+	}
+
+	return 0;
+}
+
+/**
+ * @brief      Wait for a slot to finish writing
+ *
+ * @param      writer  The writer
+ * @param      slot    The slot
+ *
+ * @return     0: Success, -1: Failure
+ */
+int d2d_wait(d2d_writer *writer, d2d_slot *slot) {
+	while (slot->inFlight) {
+#ifdef ILTD_HAVE_IO_URING
+		// Completions may arrive for any slot, account for them all until this one has finished
+		struct io_uring_cqe *cqe;
+		int returnVal;
+		if ((returnVal = io_uring_wait_cqe(&(writer->ring), &cqe)) < 0) {
+			if (returnVal == -EINTR) {
+				continue;
+			}
+			fprintf(stderr, "ERROR: Failed to wait for a write to complete (errno %d: %s).\n", -returnVal, strerror(-returnVal));
+			return -1;
+		}
+		d2d_slot *completed = &(writer->slots[io_uring_cqe_get_data64(cqe)]);
+		const long result = cqe->res;
+		io_uring_cqe_seen(&(writer->ring), cqe);
+
+		if (d2d_complete(writer, completed, result) < 0) {
+			return -1;
+		}
+#else
+		const struct aiocb *list[1] = { &(slot->cb) };
+		if (aio_suspend(list, 1, NULL) == -1 && errno != EINTR) {
+			fprintf(stderr, "ERROR: Failed to wait for a write to complete (errno %d: %s).\n", errno, strerror(errno));
+			return -1;
+		}
+
+		const int error = aio_error(&(slot->cb));
+		if (error == EINPROGRESS) {
+			continue;
+		}
+
+		const long result = error ? -error : (long) aio_return(&(slot->cb));
+		if (d2d_complete(writer, slot, result) < 0) {
+			return -1;
+		}
+#endif
+	}
+
+	return 0;
+}
+
+/**
+ * @brief      Compress blocks as they are handed over, until stopped
+ *
+ * @param      writerPtr  The writer
+ *
+ * @return     NULL
+ */
+void* d2d_compress_worker(void *writerPtr) {
+	d2d_writer *writer = (d2d_writer*) writerPtr;
+	ZSTD_CCtx *cctx = ZSTD_createCCtx();
+
+	pthread_mutex_lock(&(writer->mutex));
+	if (cctx == NULL) {
+		fprintf(stderr, "ERROR: Failed to create a compression context.\n");
+		writer->failed = 1;
+		pthread_cond_broadcast(&(writer->compressed));
+	}
+
+	while (cctx != NULL) {
+		while (!writer->stop && writer->nextCompress == writer->numFilled) {
+			pthread_cond_wait(&(writer->filled), &(writer->mutex));
+		}
+		if (writer->nextCompress == writer->numFilled) {
+			break;
+		}
+
+		d2d_slot *slot = &(writer->slots[writer->nextCompress % writer->depth]);
+		writer->nextCompress++;
+		pthread_mutex_unlock(&(writer->mutex));
+
+		size_t frame = 0;
+		const size_t length = d2d_compress(cctx, writer->level, writer->direct, slot->buffer, slot->bytes, slot->compressed, writer->compressedCapacity, &frame);
+
+		pthread_mutex_lock(&(writer->mutex));
+		writer->failed |= (length == 0);
+		slot->output = slot->compressed;
+		slot->length = length;
+		slot->fileBytes = length;
+		slot->frameLength = frame;
+		slot->state = SLOT_COMPRESSED;
+		pthread_cond_broadcast(&(writer->compressed));
+	}
+	pthread_mutex_unlock(&(writer->mutex));
+
+	ZSTD_freeCCtx(cctx);
+	return NULL;
+}
+
+/**
+ * @brief      Submit the writes of every block that is ready, in block order,
+ *             so that each stripe is written sequentially
+ *
+ * @param      writer  The writer
+ *
+ * @return     0: Success, -1: Failure
+ */
+int d2d_queue_writes(d2d_writer *writer) {
+	for (;;) {
+		d2d_slot *slot = &(writer->slots[writer->nextWrite % writer->depth]);
+
+		pthread_mutex_lock(&(writer->mutex));
+		const int failed = writer->failed;
+		const int ready = writer->nextWrite < writer->numFilled && slot->state == SLOT_COMPRESSED;
+		if (ready) {
+			slot->state = SLOT_WRITING;
+		}
+		pthread_mutex_unlock(&(writer->mutex));
+
+		if (failed) {
+			return -1;
+		}
+		if (!ready) {
+			return 0;
+		}
+
+		slot->written = 0;
+		slot->stripe = (int) (writer->nextWrite % writer->numStripes);
+		slot->offset = (off_t) (writer->headerLength + writer->stripeBytes[slot->stripe]);
+		writer->stripeBytes[slot->stripe] += slot->fileBytes;
+		writer->diskBytes += slot->fileBytes;
+
+		if ((writer->compress && d2d_seek_add(writer, slot->stripe, slot->length, slot->frameLength, slot->bytes) < 0) || d2d_submit(writer, slot) < 0) {
+			return -1;
+		}
+		writer->nextWrite++;
+	}
+}
+
+/**
+ * @brief      Wait for the block in a slot to be compressed and written, so
+ *             that the slot can be reused
+ *
+ * @param      writer  The writer
+ * @param      slot    The slot
+ *
+ * @return     0: Success, -1: Failure
+ */
+int d2d_reclaim(d2d_writer *writer, d2d_slot *slot) {
+	for (;;) {
+		if (d2d_queue_writes(writer) < 0) {
+			return -1;
+		}
+
+		// Blocks are written in order, so wait until the oldest unwritten block has been compressed
+		pthread_mutex_lock(&(writer->mutex));
+		const int pending = slot->state == SLOT_FILLED || slot->state == SLOT_COMPRESSED;
+		const d2d_slot *oldest = &(writer->slots[writer->nextWrite % writer->depth]);
+		if (pending && !writer->failed && writer->nextWrite < writer->numFilled && oldest->state == SLOT_FILLED) {
+			pthread_cond_wait(&(writer->compressed), &(writer->mutex));
+		}
+		const int failed = writer->failed;
+		pthread_mutex_unlock(&(writer->mutex));
+
+		if (failed) {
+			return -1;
+		}
+		if (!pending) {
+			break;
+		}
+	}
+
+	if (d2d_wait(writer, slot) < 0) {
+		return -1;
+	}
+	slot->state = SLOT_FREE;
+
+	return 0;
+}
+
+/**
+ * @brief      Hand a block copied into a slot (or still in the ringbuffer)
+ *             over to be compressed (or directly to be written)
+ *
+ * @param      writer  The writer
+ * @param      slot    The slot
+ * @param[in]  data    The block, either the slot buffer or the ringbuffer block
+ * @param[in]  bytes   The block size
+ */
+void d2d_hand_over(d2d_writer *writer, d2d_slot *slot, int8_t *data, size_t bytes) {
+	slot->bytes = bytes;
+
+	pthread_mutex_lock(&(writer->mutex));
+	if (writer->compress) {
+		slot->state = SLOT_FILLED;
+		pthread_cond_signal(&(writer->filled));
+	} else {
+		// A short final block is padded to the alignment, and trimmed once everything has been written
+		// (a ringbuffer block is a whole number of alignments long, and must not be modified)
+		slot->output = data;
+		slot->length = writer->direct ? d2d_align(bytes) : bytes;
+		slot->fileBytes = bytes;
+		if (data == slot->buffer) {
+			memset(&(slot->buffer[bytes]), 0, slot->length - bytes);
+		}
+		slot->state = SLOT_COMPRESSED;
+	}
+	writer->numFilled++;
+	pthread_mutex_unlock(&(writer->mutex));
+}
+
+/**
+ * @brief      Wait for every outstanding block to be written, then trim the
+ *             alignment padding from the end of each output file (or append
+ *             the seek table)
+ *
+ * @param      writer  The writer
+ *
+ * @return     0: Success, -1: Failure
+ */
+int d2d_finish(d2d_writer *writer) {
+	int returnVal = 0;
+	for (long block = writer->numFilled > writer->depth ? writer->numFilled - writer->depth : 0; block < writer->numFilled; block++) {
+		if (d2d_reclaim(writer, &(writer->slots[block % writer->depth])) < 0) {
+			returnVal = -1;
+			break;
+		}
+	}
+
+	for (int stripe = 0; stripe < writer->numStripes; stripe++) {
+		if (writer->fds[stripe] == -1) {
+			continue;
+		}
+
+		long tableLength = 0;
+		if (writer->compress && !returnVal && (tableLength = d2d_seek_write(writer, stripe)) < 0) {
+			returnVal = -1;
+			tableLength = 0;
+		}
+
+		if (ftruncate(writer->fds[stripe], (off_t) (writer->headerLength + writer->stripeBytes[stripe] + tableLength)) == -1 || fdatasync(writer->fds[stripe]) == -1) {
+			fprintf(stderr, "ERROR: Failed to finalise %s (errno %d: %s).\n", writer->files[stripe], errno, strerror(errno));
+			returnVal = -1;
+		}
+		close(writer->fds[stripe]);
+		writer->fds[stripe] = -1;
+	}
+
+	return returnVal;
+}
+
+/**
+ * @brief      Allocate the aligned staging buffers and the asynchronous I/O
+ *             state
+ *
+ * @param      writer     The writer
+ * @param[in]  blockSize  The ringbuffer block size
+ *
+ * @return     0: Success, -1: Failure
+ */
+int d2d_writer_setup(d2d_writer *writer, size_t blockSize) {
+	if ((writer->slots = (d2d_slot*) calloc(writer->depth, sizeof(d2d_slot))) == NULL) {
+		fprintf(stderr, "ERROR: Failed to allocate write slots.\n");
+		return -1;
+	}
+
+	// Room for a block that does not compress, and its padding
+	writer->compressedCapacity = d2d_align(ZSTD_compressBound(blockSize)) + D2D_DIRECT_ALIGN;
+	for (int slot = 0; slot < writer->depth; slot++) {
+		if ((writer->slots[slot].buffer = (int8_t*) aligned_alloc(D2D_DIRECT_ALIGN, d2d_align(blockSize))) == NULL ||
+			(writer->compress && (writer->slots[slot].compressed = (int8_t*) aligned_alloc(D2D_DIRECT_ALIGN, writer->compressedCapacity)) == NULL)) {
+			fprintf(stderr, "ERROR: Failed to allocate %d staging buffers of %ld MB.\n", writer->depth, (long) (d2d_align(blockSize) >> 20));
+			return -1;
+		}
+	}
+
+	if (writer->compress) {
+		for (; writer->workersStarted < writer->numWorkers; writer->workersStarted++) {
+			if (pthread_create(&(writer->workers[writer->workersStarted]), NULL, d2d_compress_worker, writer) != 0) {
+				fprintf(stderr, "ERROR: Failed to start compression thread %d.\n", writer->workersStarted);
+				return -1;
+			}
+		}
+	}
+
+#ifdef ILTD_HAVE_IO_URING
+	int returnVal;
+	if ((returnVal = io_uring_queue_init(writer->depth, &(writer->ring), 0)) < 0) {
+		fprintf(stderr, "ERROR: Failed to initialise io_uring (errno %d: %s).\n", -returnVal, strerror(-returnVal));
+		return -1;
+	}
+	writer->ringReady = 1;
+#endif
+
+	return 0;
+}
+
+/**
+ * @brief      Release the writer's buffers
+ *
+ * @param      writer  The writer
+ */
+void d2d_writer_cleanup(d2d_writer *writer) {
+	pthread_mutex_lock(&(writer->mutex));
+	writer->stop = 1;
+	pthread_cond_broadcast(&(writer->filled));
+	pthread_mutex_unlock(&(writer->mutex));
+	for (int worker = 0; worker < writer->workersStarted; worker++) {
+		pthread_join(writer->workers[worker], NULL);
+	}
+
+	if (writer->slots != NULL) {
+#ifdef ILTD_HAVE_IO_URING
+		if (writer->ringReady) {
+			io_uring_queue_exit(&(writer->ring));
+		}
+#endif
+		for (int slot = 0; slot < writer->depth; slot++) {
+			free(writer->slots[slot].buffer);
+			free(writer->slots[slot].compressed);
+		}
+		free(writer->slots);
+	}
+
+	for (int stripe = 0; stripe < writer->numStripes; stripe++) {
+		if (writer->fds[stripe] != -1) {
+			close(writer->fds[stripe]);
+		}
+		free(writer->seekTable[stripe]);
+	}
+
+	pthread_mutex_destroy(&(writer->mutex));
+	pthread_cond_destroy(&(writer->filled));
+	pthread_cond_destroy(&(writer->compressed));
+}
+
+int main(int argc, char *argv[]) {
+
+	int inputOpt, key = DEF_PORT, returnVal = 0;
+	char directories[DEF_STR_LEN] = ".", name[DEF_STR_LEN] = "";
+	float reportSeconds = 10.0f;
+	char *endPtr = NULL;
+
+	d2d_writer writer = {
+		.direct = 1,
+		.depth = 8,
+		.numWorkers = 4,
+		.mutex = PTHREAD_MUTEX_INITIALIZER,
+		.filled = PTHREAD_COND_INITIALIZER,
+		.compressed = PTHREAD_COND_INITIALIZER
+	};
+	memset(writer.fds, -1, sizeof(writer.fds));
+
+	if (argc == 1) {
+		helpMessages();
+		return 1;
+	}
+
+	while ((inputOpt = getopt(argc, argv, "hk:d:o:q:Bz:j:l:")) != -1) {
+		switch (inputOpt) {
+
+			case 'h':
+				helpMessages();
+				return 0;
+
+			case 'k':
+				key = internal_strtoi(optarg, &endPtr);
+				if (checkOpt(inputOpt, optarg, endPtr)) { return 1; }
+				break;
+
+			case 'd':
+				strncpy(directories, optarg, DEF_STR_LEN - 1);
+				break;
+
+			case 'o':
+				strncpy(name, optarg, DEF_STR_LEN - 1);
+				break;
+
+			case 'q':
+				writer.depth = internal_strtoi(optarg, &endPtr);
+				if (checkOpt(inputOpt, optarg, endPtr)) { return 1; }
+				break;
+
+			case 'B':
+				writer.direct = 0;
+				break;
+
+			case 'z':
+				writer.compress = 1;
+				writer.level = internal_strtoi(optarg, &endPtr);
+				if (checkOpt(inputOpt, optarg, endPtr)) { return 1; }
+				break;
+
+			case 'j':
+				writer.numWorkers = internal_strtoi(optarg, &endPtr);
+				if (checkOpt(inputOpt, optarg, endPtr)) { return 1; }
+				break;
+
+			case 'l':
+				reportSeconds = strtof(optarg, &endPtr);
+				if (checkOpt(inputOpt, optarg, endPtr)) { return 1; }
+				break;
+
+			default:
+				fprintf(stderr, "ERROR: Unknown flag %c, exiting.\n", inputOpt);
+				return 1;
+		}
+	}
+
+	if (writer.depth < 1 || reportSeconds <= 0.0f) {
+		fprintf(stderr, "ERROR: The number of writes in flight (%d) and the report interval (%f) must be positive, exiting.\n", writer.depth, reportSeconds);
+		return 1;
+	}
+
+	if (writer.compress && (writer.level < ZSTD_minCLevel() || writer.level > ZSTD_maxCLevel() || writer.numWorkers < 1 || writer.numWorkers > MAX_NUM_PORTS * 4)) {
+		fprintf(stderr, "ERROR: Compression level (%d) must be between %d and %d, and the number of compression threads (%d) between 1 and %d, exiting.\n", writer.level, ZSTD_minCLevel(), ZSTD_maxCLevel(), writer.numWorkers, MAX_NUM_PORTS * 4);
+		return 1;
+	}
+
+	if (strcmp(name, "") == 0) {
+		snprintf(name, DEF_STR_LEN, "iltdada_%d", key);
+	}
+
+	signal(SIGINT, d2dStop);
+	signal(SIGTERM, d2dStop);
+
+
+	multilog_t *multilog = multilog_open("ilt_dada_dada2disk", 0);
+	multilog_add(multilog, stderr);
+	dada_hdu_t *hdu = dada_hdu_create(multilog);
+	dada_hdu_set_key(hdu, key);
+	if (dada_hdu_connect(hdu) < 0 || dada_hdu_lock_read(hdu) < 0) {
+		fprintf(stderr, "ERROR: Failed to attach to ringbuffer %d, exiting.\n", key);
+		dada_hdu_destroy(hdu);
+		multilog_close(multilog);
+		return 1;
+	}
+
+	ipcbuf_t *dataBlock = (ipcbuf_t*) hdu->data_block;
+	const size_t blockSize = ipcbuf_get_bufsz(dataBlock);
+	const uint64_t numBlocks = ipcbuf_get_nbufs(dataBlock);
+
+	// O_DIRECT needs every block to start on an aligned offset
+	if (writer.direct && blockSize % D2D_DIRECT_ALIGN) {
+		fprintf(stderr, "WARNING: Ringbuffer block size (%ld) is not a multiple of %d bytes, falling back to buffered writes.\n", (long) blockSize, D2D_DIRECT_ALIGN);
+		writer.direct = 0;
+	}
+
+	// The seek table stores 32-bit frame sizes
+	if (writer.compress && blockSize > UINT32_MAX / 2) {
+		fprintf(stderr, "ERROR: Ringbuffer blocks of %ld MB are too large to compress, exiting.\n", (long) (blockSize >> 20));
+		dada_hdu_unlock_read(hdu);
+		dada_hdu_disconnect(hdu);
+		dada_hdu_destroy(hdu);
+		multilog_close(multilog);
+		return 1;
+	}
+
+	// Wait for the recorder to provide the observation header
+	uint64_t headerSize = 0;
+	char *header = ipcbuf_get_next_read(hdu->header_block, &headerSize);
+	if (header == NULL || headerSize == 0) {
+		fprintf(stderr, "ERROR: Failed to read the header from ringbuffer %d, exiting.\n", key);
+		returnVal = 1;
+	} else if (d2d_writer_setup(&writer, blockSize) < 0 || d2d_open_outputs(&writer, directories, name, header, ipcbuf_get_bufsz(hdu->header_block)) < 0) {
+		returnVal = 1;
+	}
+	if (header != NULL) {
+		ipcbuf_mark_cleared(hdu->header_block);
+	}
+
+	if (!returnVal) {
+		printf("Writing ringbuffer %d (%ld x %ld MB blocks) across %d stripe(s), %d blocks in flight, %s writes.\n", key, (long) numBlocks, (long) (blockSize >> 20), writer.numStripes, writer.depth, writer.direct ? "O_DIRECT" : "buffered");
+		if (writer.compress) {
+			printf("Compressing every block with zstd level %d on %d threads.\n", writer.level, writer.numWorkers);
+		}
+	}
+
+	struct timespec start, lastReport, now;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	lastReport = start;
+	long blocks = 0;
+	// With a single block in flight and no compression there is no overlap to gain from a staging buffer, so each
+	// block is written straight from the ringbuffer and only released once the write completes
+	const int inPlace = writer.depth == 1 && !writer.compress;
+	size_t bytesWritten = 0, lastBytes = 0, lastDiskBytes = 0;
+	uint64_t backlog, maxBacklog = 0;
+
+	while (!returnVal && d2dRunning && !ipcbuf_eod(dataBlock)) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		backlog = ipcbuf_get_nfull(dataBlock);
+		maxBacklog = backlog > maxBacklog ? backlog : maxBacklog;
+
+		if (ilt_dada_elapsed(&lastReport, &now) > reportSeconds) {
+			const double interval = ilt_dada_elapsed(&lastReport, &now);
+			printf("Wrote %ld MB at %.1lf MB/s (%.1lf MB/s sustained), %ld/%ld blocks (%ld MB) behind the recorder (peak %ld).\n", (long) (bytesWritten >> 20), (double) (bytesWritten - lastBytes) / interval / 1e6, (double) bytesWritten / ilt_dada_elapsed(&start, &now) / 1e6,
+			       (long) backlog, (long) numBlocks, (long) ((backlog * blockSize) >> 20), (long) maxBacklog);
+			if (writer.compress && writer.diskBytes > lastDiskBytes) {
+				printf("Compressed to %ld MB on disk at %.1lf MB/s, ratio %.3lf (%.3lf overall).\n", (long) (writer.diskBytes >> 20), (double) (writer.diskBytes - lastDiskBytes) / interval / 1e6,
+				       (double) (bytesWritten - lastBytes) / (double) (writer.diskBytes - lastDiskBytes), (double) bytesWritten / (double) writer.diskBytes);
+			}
+			lastReport = now;
+			lastBytes = bytesWritten;
+			lastDiskBytes = writer.diskBytes;
+		}
+
+		// Poll, rather than block, so that we can be interrupted
+		if (backlog == 0) {
+			if (d2d_queue_writes(&writer) < 0) {
+				returnVal = 1;
+				break;
+			}
+			usleep(D2D_POLL_USEC);
+			continue;
+		}
+
+		// Free up the slot that was used depth blocks ago
+		d2d_slot *slot = &(writer.slots[blocks % writer.depth]);
+		if (d2d_reclaim(&writer, slot) < 0) {
+			returnVal = 1;
+			break;
+		}
+
+		uint64_t bytes = 0;
+		char *block = ipcbuf_get_next_read(dataBlock, &bytes);
+		if (block == NULL) {
+			fprintf(stderr, "ERROR: Failed to read block %ld from ringbuffer %d.\n", blocks, key);
+			returnVal = 1;
+			break;
+		}
+
+		if (inPlace && bytes && ((uintptr_t) block % D2D_DIRECT_ALIGN) == 0) {
+			d2d_hand_over(&writer, slot, (int8_t*) block, bytes);
+			if (d2d_queue_writes(&writer) < 0 || d2d_reclaim(&writer, slot) < 0) {
+				returnVal = 1;
+				break;
+			}
+			if (ipcbuf_mark_cleared(dataBlock) < 0) {
+				fprintf(stderr, "ERROR: Failed to mark block %ld of ringbuffer %d as read.\n", blocks, key);
+				returnVal = 1;
+				break;
+			}
+
+			bytesWritten += bytes;
+			blocks++;
+			continue;
+		}
+
+		// Only one block can be open for reading at a time, so copy it out and release it before the write, allowing
+		// several blocks to be written at once without holding up the recorder
+		memcpy(slot->buffer, block, bytes);
+		if (ipcbuf_mark_cleared(dataBlock) < 0) {
+			fprintf(stderr, "ERROR: Failed to mark block %ld of ringbuffer %d as read.\n", blocks, key);
+			returnVal = 1;
+			break;
+		}
+
+		if (bytes == 0) {
+			continue;
+		}
+
+		d2d_hand_over(&writer, slot, slot->buffer, bytes);
+		if (d2d_queue_writes(&writer) < 0) {
+			returnVal = 1;
+			break;
+		}
+
+		bytesWritten += bytes;
+		blocks++;
+	}
+
+	if (writer.slots != NULL && d2d_finish(&writer) < 0) {
+		returnVal = 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	printf("Wrote %ld blocks (%ld MB) in %.1lf seconds, %.1lf MB/s sustained; at most %ld/%ld blocks were waiting to be written.\n", blocks, (long) (bytesWritten >> 20), ilt_dada_elapsed(&start, &now), (double) bytesWritten / ilt_dada_elapsed(&start, &now) / 1e6, (long) maxBacklog, (long) numBlocks);
+	if (writer.compress && writer.diskBytes) {
+		printf("Compressed %ld MB to %ld MB, ratio %.3lf.\n", (long) (bytesWritten >> 20), (long) (writer.diskBytes >> 20), (double) bytesWritten / (double) writer.diskBytes);
+	}
+	if (maxBacklog == numBlocks) {
+		fprintf(stderr, "WARNING: The ringbuffer was full during the recording, the recorder may have been blocked by the disks.\n");
+	}
+
+	d2d_writer_cleanup(&writer);
+	dada_hdu_unlock_read(hdu);
+	dada_hdu_disconnect(hdu);
+	dada_hdu_destroy(hdu);
+	multilog_close(multilog);
+
+	return returnVal;
+}
@@ -0,0 +1,608 @@
+// O_DIRECT needs the GNU Source define
+// This needs to be at the top or O_DIRECT will not be found.
+#define _GNU_SOURCE 1
+
+// Standard includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#undef _GNU_SOURCE
+
+// PSRDADA includes
+#include "ilt_dada.h"
+#include "lofar_cli_meta.h"
+
+// The dumper is a ringbuffer reader that does not release blocks until the recorder needs the space, so the ringbuffer
+// always holds the most recent history (-s seconds for the recorder). When triggered, the blocks covering the requested
+// window are copied out of the ringbuffer and written to disk in chunks, so a slow disk never holds a block the recorder needs.
+
+#define DUMP_DIRECT_ALIGN 4096
+#define DUMP_CHUNK_SIZE (4 * 1024 * 1024) // Must be a multiple of DUMP_DIRECT_ALIGN
+#define DUMP_POLL_MSEC 1
+#define DUMP_TRIGGER_LEN 256
+
+typedef struct dump_state {
+	ipcbuf_t *dataBlock;
+	uint64_t numBlocks;
+	size_t blockSize;
+
+	// Blocks [released, released + held) are full and kept as history
+	uint64_t released;
+	uint64_t held;
+
+	int clockBit;
+	int packetSize;
+
+	// The active dump
+	int active;
+	int fd;
+	char file[2 * DEF_STR_LEN + 32];
+	long triggerPacket;
+	long startPacket;
+	long endPacket;
+	uint64_t nextBlock;
+	// The block being written, copied out of the ringbuffer
+	int8_t *stage;
+	int staged;
+	size_t stageOffset;
+	long stageLastPacket;
+	long blocksWritten;
+	long blocksLost;
+	struct timespec started;
+} dump_state;
+
+static volatile sig_atomic_t dumpRunning = 1;
+static volatile sig_atomic_t dumpSignalled = 0;
+
+static void dumpStop(int signal) {
+	(void) signal;
+	dumpRunning = 0;
+}
+
+static void dumpTrigger(int signal) {
+	(void) signal;
+	dumpSignalled = 1;
+}
+
+void helpMessages() {
+	printf("ILTDada transient dumper (CLI v%s, lib %s)\n\n", ILTD_CLI_VERSION, ILTD_VERSION);
+
+	printf("-h				: Display this message\n");
+	printf("-k (int)		: Input PSRDADA ringbuffer key, the recorder must be started with a reader for the dumper (default: %d)\n", DEF_PORT);
+	printf("-d (str)		: Output directory (default: .)\n");
+	printf("-o (str)		: Output file name prefix, the trigger packet number and '.dada' are appended (default: iltdada_<key>_dump)\n");
+	printf("-u (str)		: Trigger socket (UNIX datagram) path (default: /tmp/iltdada_<key>.trigger)\n");
+	printf("-b (float)		: Seconds of data to dump before the trigger time (default: 5)\n");
+	printf("-a (float)		: Seconds of data to dump after the trigger time (default: 5)\n");
+	printf("-f (int)		: Number of ringbuffer blocks to keep free for the recorder (default: 2)\n");
+	printf("-t (float)		: Release the history if no new blocks arrive for this many seconds (default: 60)\n");
+	printf("-B				: Use buffered writes rather than O_DIRECT\n\n");
+
+	printf("Send '<time> [before] [after]' to the trigger socket to dump data, where time is a Unix time, an ISOT (YYYY-MM-DDTHH:MM:SS) or 'now', or send SIGUSR1 to dump around the current time.\n\n");
+}
+
+/**
+ * @brief      Get the packet rate of the observation
+ */
+static double dump_packet_rate(const dump_state *state) {
+	return state->clockBit ? clock200MHzPacketRate : clock160MHzPacketRate;
+}
+
+/**
+ * @brief      Get the packet number of the first (or last) packet in a held
+ *             ringbuffer block
+ *
+ * @param      state  The dumper state
+ * @param[in]  block  The block index
+ * @param[in]  last   Search from the end of the block
+ *
+ * @return     >=0: packet number, -1: no valid packets
+ */
+long dump_block_packet(dump_state *state, uint64_t block, int last) {
+	const uint8_t *data = (uint8_t*) state->dataBlock->buffer[block % state->numBlocks];
+
+	// Sequence-indexed blocks describe their own packet range in the trailer, and their missing slots hold the fill
+	// pattern, so only read headers from the slots the loss mask marks as received
+	ilt_dada_block_trailer trailer;
+	memcpy(&trailer, &(data[state->blockSize - sizeof(ilt_dada_block_trailer)]), sizeof(ilt_dada_block_trailer));
+	if (trailer.magic == ILTD_TRAILER_MAGIC && trailer.packetSize > UDPHDRLEN && trailer.packetSlots > 0
+		&& (long) trailer.packetSlots * trailer.packetSize + ilt_dada_placement_trailer_size(trailer.packetSlots) <= (long) state->blockSize) {
+		if (trailer.packetsPresent <= 0) {
+			return -1;
+		}
+
+		if (state->packetSize <= 0) {
+			const uint8_t *mask = &(data[(long) trailer.packetSlots * trailer.packetSize]);
+			for (long slot = 0; slot < trailer.packetSlots; slot++) {
+				if (mask[slot / 8] & (1 << (slot % 8))) {
+					state->clockBit = ((lofar_source_bytes*) &(data[slot * trailer.packetSize + 1]))->clockBit;
+					state->packetSize = trailer.packetSize;
+					break;
+				}
+			}
+		}
+
+		return last ? trailer.firstPacket + trailer.packetSlots - 1 : trailer.firstPacket;
+	}
+
+	// Otherwise every packet in the block was received
+	if (data[0] != UDPCURVER) {
+		return -1;
+	}
+
+	// The packet size is fixed by the first valid header we find
+	if (state->packetSize <= 0) {
+		const lofar_source_bytes *source = (lofar_source_bytes*) &(data[1]);
+		state->clockBit = source->clockBit;
+		state->packetSize = (int) (UDPHDRLEN + data[6] * data[7] * ((float) UDPNPOL / (source->bitMode ? source->bitMode : 0.5)));
+	}
+
+	const long packets = (long) (state->blockSize / state->packetSize);
+	const uint8_t *packet = &(data[(last ? packets - 1 : 0) * state->packetSize]);
+	return lofar_udp_time_beamformed_packno(*((unsigned int*) &(packet[8])), *((unsigned int*) &(packet[12])), ((lofar_source_bytes*) &(packet[1]))->clockBit);
+}
+
+/**
+ * @brief      Release the oldest block of history back to the recorder
+ *
+ * @param      state  The dumper state
+ *
+ * @return     0: Success, 1: End of data, -1: Failure
+ */
+int dump_release(dump_state *state) {
+	uint64_t bytes;
+	if (ipcbuf_get_next_read(state->dataBlock, &bytes) == NULL || ipcbuf_mark_cleared(state->dataBlock) < 0) {
+		fprintf(stderr, "ERROR: Failed to release ringbuffer block %ld.\n", (long) state->released);
+		return -1;
+	}
+
+	// The recording has priority over the dump, any blocks it has not reached yet are lost
+	if (state->active && state->nextBlock == state->released) {
+		state->nextBlock++;
+		state->blocksLost++;
+	}
+	state->released++;
+	state->held--;
+
+	return ipcbuf_eod(state->dataBlock) ? 1 : 0;
+}
+
+/**
+ * @brief      Start a dump of the blocks covering a time window
+ *
+ * @param      state      The dumper state
+ * @param[in]  trigger    The trigger message
+ * @param[in]  directory  The output directory
+ * @param[in]  name       The output file name prefix
+ * @param[in]  header     The observation header
+ * @param[in]  headerSize The header size
+ * @param[in]  before     Default seconds before the trigger
+ * @param[in]  after      Default seconds after the trigger
+ * @param[in]  direct     Use O_DIRECT
+ *
+ * @return     0: Success (or trigger ignored), -1: Failure
+ */
+int dump_start(dump_state *state, const char *trigger, const char *directory, const char *name, const int8_t *header, size_t headerSize, double before, double after, int direct) {
+	char timeStr[DUMP_TRIGGER_LEN] = "";
+	const int numParsed = sscanf(trigger, "%255s %lf %lf", timeStr, &before, &after);
+	if (numParsed < 1 || before < 0.0 || after < 0.0) {
+		fprintf(stderr, "WARNING: Ignoring malformed trigger '%s'.\n", trigger);
+		return 0;
+	}
+
+	if (state->held == 0 || dump_block_packet(state, state->released, 0) < 0) {
+		fprintf(stderr, "WARNING: Ignoring trigger '%s', no data has been recorded yet.\n", trigger);
+		return 0;
+	}
+
+	// Convert the trigger time to a packet number
+	long triggerPacket;
+	char *endPtr;
+	const double unixTime = strtod(timeStr, &endPtr);
+	if (strcmp(timeStr, "now") == 0) {
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		triggerPacket = (long) (((double) now.tv_sec + (double) now.tv_nsec * 1e-9) * dump_packet_rate(state));
+	} else if (*endPtr == '\0') {
+		triggerPacket = (long) (unixTime * dump_packet_rate(state));
+	} else {
+		triggerPacket = lofar_udp_time_get_packet_from_isot(timeStr, state->clockBit);
+	}
+	if (triggerPacket <= 0) {
+		fprintf(stderr, "WARNING: Ignoring trigger '%s', unable to parse the trigger time.\n", trigger);
+		return 0;
+	}
+
+	const long startPacket = triggerPacket - (long) (before * dump_packet_rate(state));
+	const long endPacket = triggerPacket + (long) (after * dump_packet_rate(state));
+
+	// Overlapping triggers extend the active dump
+	if (state->active) {
+		if (startPacket <= state->endPacket) {
+			state->endPacket = endPacket > state->endPacket ? endPacket : state->endPacket;
+			printf("Trigger at packet %ld extends the active dump to packet %ld.\n", triggerPacket, state->endPacket);
+		} else {
+			fprintf(stderr, "WARNING: Ignoring trigger at packet %ld, a dump is already in progress.\n", triggerPacket);
+		}
+		return 0;
+	}
+
+	// Find the block containing the start of the window, or the oldest block if the window starts before our history
+	uint64_t firstBlock = state->released;
+	for (uint64_t block = state->released; block < state->released + state->held; block++) {
+		const long blockPacket = dump_block_packet(state, block, 0);
+		if (blockPacket >= 0 && blockPacket <= startPacket) {
+			firstBlock = block;
+		}
+	}
+
+	const long historyStart = dump_block_packet(state, firstBlock, 0);
+	if (historyStart > startPacket) {
+		fprintf(stderr, "WARNING: Requested data from packet %ld, but the ringbuffer only holds data from packet %ld (%.1lf seconds are missing).\n", startPacket, historyStart, (double) (historyStart - startPacket) / dump_packet_rate(state));
+	}
+
+	snprintf(state->file, sizeof(state->file), "%s/%s_%ld.dada", directory, name, triggerPacket);
+	if ((state->fd = open(state->file, O_WRONLY | O_CREAT | O_TRUNC | (direct ? O_DIRECT : 0), 0644)) == -1) {
+		fprintf(stderr, "ERROR: Failed to open %s%s (errno %d: %s).\n", state->file, direct ? " with O_DIRECT (use -B on file systems that do not support it)" : "", errno, strerror(errno));
+		return -1;
+	}
+
+	const size_t headerLength = direct ? ((headerSize + DUMP_DIRECT_ALIGN - 1) / DUMP_DIRECT_ALIGN) * DUMP_DIRECT_ALIGN : headerSize;
+	if (write(state->fd, header, headerLength) != (ssize_t) headerLength) {
+		fprintf(stderr, "ERROR: Failed to write the header to %s (errno %d: %s).\n", state->file, errno, strerror(errno));
+		close(state->fd);
+		return -1;
+	}
+
+	state->active = 1;
+	state->triggerPacket = triggerPacket;
+	state->startPacket = startPacket;
+	state->endPacket = endPacket;
+	state->nextBlock = firstBlock;
+	state->blocksWritten = 0;
+	state->blocksLost = 0;
+	state->staged = 0;
+	clock_gettime(CLOCK_MONOTONIC, &(state->started));
+
+	printf("Triggered at packet %ld, dumping packets %ld to %ld (%.1lf seconds) to %s.\n", triggerPacket, startPacket, endPacket, (double) (endPacket - startPacket) / dump_packet_rate(state), state->file);
+	return 0;
+}
+
+/**
+ * @brief      Finish the active dump
+ *
+ * @param      state  The dumper state
+ *
+ * @return     0: Success, -1: Failure
+ */
+int dump_finish(dump_state *state) {
+	int returnVal = 0;
+
+	// Flush the rest of a partially written block
+	if (state->staged) {
+		const size_t remaining = state->blockSize - state->stageOffset;
+		if (write(state->fd, &(state->stage[state->stageOffset]), remaining) != (ssize_t) remaining) {
+			fprintf(stderr, "ERROR: Failed to write block %ld to %s (errno %d: %s).\n", (long) state->nextBlock - 1, state->file, errno, strerror(errno));
+			returnVal = -1;
+		} else {
+			state->blocksWritten++;
+		}
+		state->staged = 0;
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	if (fdatasync(state->fd) == -1) {
+		fprintf(stderr, "ERROR: Failed to flush %s (errno %d: %s).\n", state->file, errno, strerror(errno));
+		returnVal = -1;
+	}
+	close(state->fd);
+	state->active = 0;
+
+	const double seconds = ilt_dada_elapsed(&(state->started), &now);
+	printf("Dumped %ld blocks (%ld MB) to %s in %.2lf seconds (%.1lf MB/s).\n", state->blocksWritten, (long) ((state->blocksWritten * state->blockSize) >> 20), state->file, seconds, (double) (state->blocksWritten * state->blockSize) / seconds / 1e6);
+	if (state->blocksLost) {
+		fprintf(stderr, "WARNING: %ld blocks of the dump were released to the recorder before they could be written, the disk cannot keep up; increase -f or the ringbuffer size.\n", state->blocksLost);
+	}
+
+	return returnVal;
+}
+
+/**
+ * @brief      Write the next chunk of the active dump, copying the next block
+ *             out of the ringbuffer first if it has been recorded
+ *
+ * @param      state  The dumper state
+ *
+ * @return     0: Success, -1: Failure
+ */
+int dump_write_next(dump_state *state) {
+	// The copy is a fraction of the time taken by the write, and means the block never has to wait on the disk before it
+	// can be released to the recorder
+	if (!state->staged) {
+		if (state->nextBlock >= state->released + state->held) {
+			return 0;
+		}
+
+		memcpy(state->stage, state->dataBlock->buffer[state->nextBlock % state->numBlocks], state->blockSize);
+		state->stageLastPacket = dump_block_packet(state, state->nextBlock, 1);
+		state->stageOffset = 0;
+		state->staged = 1;
+		state->nextBlock++;
+	}
+
+	const size_t chunk = (state->blockSize - state->stageOffset) < DUMP_CHUNK_SIZE ? (state->blockSize - state->stageOffset) : DUMP_CHUNK_SIZE;
+	if (write(state->fd, &(state->stage[state->stageOffset]), chunk) != (ssize_t) chunk) {
+		fprintf(stderr, "ERROR: Failed to write block %ld to %s (errno %d: %s).\n", (long) state->nextBlock - 1, state->file, errno, strerror(errno));
+		close(state->fd);
+		state->active = 0;
+		state->staged = 0;
+		return -1;
+	}
+
+	state->stageOffset += chunk;
+	if (state->stageOffset < state->blockSize) {
+		return 0;
+	}
+
+	state->staged = 0;
+	state->blocksWritten++;
+	if (state->stageLastPacket >= state->endPacket) {
+		return dump_finish(state);
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+
+	int inputOpt, key = DEF_PORT, freeBlocks = 2, direct = 1, returnVal = 0;
+	char directory[DEF_STR_LEN] = ".", name[DEF_STR_LEN] = "", socketPath[DEF_STR_LEN] = "";
+	double before = 5.0, after = 5.0, idleSeconds = 60.0;
+	char *endPtr = NULL;
+
+	if (argc == 1) {
+		helpMessages();
+		return 1;
+	}
+
+	while ((inputOpt = getopt(argc, argv, "hk:d:o:u:b:a:f:t:B")) != -1) {
+		switch (inputOpt) {
+
+			case 'h':
+				helpMessages();
+				return 0;
+
+			case 'k':
+				key = internal_strtoi(optarg, &endPtr);
+				if (checkOpt(inputOpt, optarg, endPtr)) { return 1; }
+				break;
+
+			case 'd':
+				strncpy(directory, optarg, DEF_STR_LEN - 1);
+				break;
+
+			case 'o':
+				strncpy(name, optarg, DEF_STR_LEN - 1);
+				break;
+
+			case 'u':
+				strncpy(socketPath, optarg, DEF_STR_LEN - 1);
+				break;
+
+			case 'b':
+				before = strtod(optarg, &endPtr);
+				if (checkOpt(inputOpt, optarg, endPtr)) { return 1; }
+				break;
+
+			case 'a':
+				after = strtod(optarg, &endPtr);
+				if (checkOpt(inputOpt, optarg, endPtr)) { return 1; }
+				break;
+
+			case 'f':
+				freeBlocks = internal_strtoi(optarg, &endPtr);
+				if (checkOpt(inputOpt, optarg, endPtr)) { return 1; }
+				break;
+
+			case 't':
+				idleSeconds = strtod(optarg, &endPtr);
+				if (checkOpt(inputOpt, optarg, endPtr)) { return 1; }
+				break;
+
+			case 'B':
+				direct = 0;
+				break;
+
+			default:
+				fprintf(stderr, "ERROR: Unknown flag %c, exiting.\n", inputOpt);
+				return 1;
+		}
+	}
+
+	if (before < 0.0 || after < 0.0 || freeBlocks < 1 || idleSeconds <= 0.0) {
+		fprintf(stderr, "ERROR: Dump window (%lf, %lf), free blocks (%d) and idle time (%lf) must be positive, exiting.\n", before, after, freeBlocks, idleSeconds);
+		return 1;
+	}
+
+	if (strcmp(name, "") == 0) {
+		snprintf(name, DEF_STR_LEN, "iltdada_%d_dump", key);
+	}
+	if (strcmp(socketPath, "") == 0) {
+		snprintf(socketPath, DEF_STR_LEN, "/tmp/iltdada_%d.trigger", key);
+	}
+
+	struct sockaddr_un address = { .sun_family = AF_UNIX };
+	if (strlen(socketPath) >= sizeof(address.sun_path)) {
+		fprintf(stderr, "ERROR: Trigger socket path %s is too long, exiting.\n", socketPath);
+		return 1;
+	}
+	strcpy(address.sun_path, socketPath);
+
+	const int triggerFd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	unlink(socketPath);
+	if (triggerFd == -1 || bind(triggerFd, (struct sockaddr*) &address, sizeof(address)) == -1) {
+		fprintf(stderr, "ERROR: Failed to open trigger socket %s (errno %d: %s), exiting.\n", socketPath, errno, strerror(errno));
+		if (triggerFd != -1) {
+			close(triggerFd);
+		}
+		return 1;
+	}
+
+	signal(SIGINT, dumpStop);
+	signal(SIGTERM, dumpStop);
+	signal(SIGUSR1, dumpTrigger);
+
+
+	multilog_t *multilog = multilog_open("ilt_dada_dump", 0);
+	multilog_add(multilog, stderr);
+	dada_hdu_t *hdu = dada_hdu_create(multilog);
+	dada_hdu_set_key(hdu, key);
+	if (dada_hdu_connect(hdu) < 0 || dada_hdu_lock_read(hdu) < 0) {
+		fprintf(stderr, "ERROR: Failed to attach to ringbuffer %d, exiting.\n", key);
+		dada_hdu_destroy(hdu);
+		multilog_close(multilog);
+		close(triggerFd);
+		unlink(socketPath);
+		return 1;
+	}
+
+	dump_state state = {
+		.dataBlock = (ipcbuf_t*) hdu->data_block,
+		.fd = -1
+	};
+	state.numBlocks = ipcbuf_get_nbufs(state.dataBlock);
+	state.blockSize = ipcbuf_get_bufsz(state.dataBlock);
+	state.released = ipcbuf_get_read_count(state.dataBlock);
+
+	if (direct && state.blockSize % DUMP_DIRECT_ALIGN) {
+		fprintf(stderr, "WARNING: Ringbuffer block size (%ld) is not a multiple of %d bytes, falling back to buffered writes.\n", (long) state.blockSize, DUMP_DIRECT_ALIGN);
+		direct = 0;
+	}
+
+	if (freeBlocks >= (int) state.numBlocks) {
+		fprintf(stderr, "ERROR: Cannot keep %d of the %ld ringbuffer blocks free, exiting.\n", freeBlocks, (long) state.numBlocks);
+		returnVal = 1;
+	}
+
+	// Staging buffer for the block being written, aligned for O_DIRECT
+	state.stage = (int8_t*) aligned_alloc(DUMP_DIRECT_ALIGN, ((state.blockSize + DUMP_DIRECT_ALIGN - 1) / DUMP_DIRECT_ALIGN) * DUMP_DIRECT_ALIGN);
+	if (state.stage == NULL) {
+		fprintf(stderr, "ERROR: Failed to allocate a %ld byte staging buffer, exiting.\n", (long) state.blockSize);
+		returnVal = 1;
+	}
+
+	// Keep a copy of the observation header for every dump, padded for O_DIRECT
+	const size_t headerSize = ipcbuf_get_bufsz(hdu->header_block);
+	int8_t *header = (int8_t*) aligned_alloc(DUMP_DIRECT_ALIGN, ((headerSize + DUMP_DIRECT_ALIGN - 1) / DUMP_DIRECT_ALIGN) * DUMP_DIRECT_ALIGN);
+	uint64_t headerBytes = 0;
+	char *headerBlock = returnVal ? NULL : ipcbuf_get_next_read(hdu->header_block, &headerBytes);
+	if (header == NULL || headerBlock == NULL) {
+		fprintf(stderr, "ERROR: Failed to read the header from ringbuffer %d, exiting.\n", key);
+		returnVal = 1;
+	} else {
+		memset(header, 0, ((headerSize + DUMP_DIRECT_ALIGN - 1) / DUMP_DIRECT_ALIGN) * DUMP_DIRECT_ALIGN);
+		memcpy(header, headerBlock, headerSize);
+		ipcbuf_mark_cleared(hdu->header_block);
+	}
+
+	if (!returnVal) {
+		printf("Holding up to %ld of %ld x %ld MB blocks of history from ringbuffer %d, waiting for triggers on %s.\n", (long) (state.numBlocks - freeBlocks), (long) state.numBlocks, (long) (state.blockSize >> 20), key, socketPath);
+	}
+
+	struct timespec lastBlock, now;
+	clock_gettime(CLOCK_MONOTONIC, &lastBlock);
+	char trigger[DUMP_TRIGGER_LEN];
+	int eod = 0;
+
+	while (!returnVal && dumpRunning && !eod) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		const uint64_t held = ipcbuf_get_nfull(state.dataBlock);
+		if (held != state.held) {
+			if (held > state.held) {
+				lastBlock = now;
+			}
+			state.held = held;
+		}
+
+		// Give the recorder space before doing anything else
+		while (!eod && state.held > state.numBlocks - freeBlocks) {
+			if ((eod = dump_release(&state)) < 0) {
+				returnVal = 1;
+			}
+		}
+
+		// Release the history once the recording stops, so we can see the end of the data
+		if (state.active && !state.staged && state.nextBlock >= state.released + state.held && ilt_dada_elapsed(&lastBlock, &now) > idleSeconds) {
+			fprintf(stderr, "WARNING: No data for %.0lf seconds, finishing the dump early.\n", idleSeconds);
+			if (dump_finish(&state) < 0) {
+				returnVal = 1;
+				break;
+			}
+		}
+		if (!state.active && state.held && ilt_dada_elapsed(&lastBlock, &now) > idleSeconds) {
+			printf("No data for %.0lf seconds, releasing %ld blocks of history.\n", idleSeconds, (long) state.held);
+			while (!eod && state.held) {
+				if ((eod = dump_release(&state)) < 0) {
+					returnVal = 1;
+				}
+			}
+		}
+		if (returnVal || eod) {
+			break;
+		}
+
+		// Check for triggers; a signal and a datagram arriving together are two separate triggers
+		const ssize_t triggerLen = recv(triggerFd, trigger, DUMP_TRIGGER_LEN - 1, 0);
+		if (triggerLen > 0) {
+			trigger[triggerLen] = '\0';
+			if (dump_start(&state, trigger, directory, name, header, headerSize, before, after, direct) < 0) {
+				returnVal = 1;
+				break;
+			}
+		}
+		if (dumpSignalled) {
+			dumpSignalled = 0;
+			if (dump_start(&state, "now", directory, name, header, headerSize, before, after, direct) < 0) {
+				returnVal = 1;
+				break;
+			}
+		}
+
+		// Write one chunk per iteration, so the release check above runs between every write
+		if (state.active && (state.staged || state.nextBlock < state.released + state.held)) {
+			if (dump_write_next(&state) < 0) {
+				returnVal = 1;
+			}
+			continue;
+		}
+
+		struct pollfd pollFd = { .fd = triggerFd, .events = POLLIN };
+		poll(&pollFd, 1, DUMP_POLL_MSEC);
+	}
+
+	// Keep whatever has been dumped
+	if (state.active && dump_finish(&state) < 0) {
+		returnVal = 1;
+	}
+
+	free(header);
+	free(state.stage);
+	close(triggerFd);
+	unlink(socketPath);
+	dada_hdu_unlock_read(hdu);
+	dada_hdu_disconnect(hdu);
+	dada_hdu_destroy(hdu);
+	multilog_close(multilog);
+
+	return returnVal;
+}
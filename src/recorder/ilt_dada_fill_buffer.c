@@ -8,14 +8,95 @@
 #include <limits.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <math.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/errqueue.h>
 
 #undef _GNU_SOURCE
 
 // PSRDADA includes
 #include "ilt_dada.h"
 
+// Packet size of input files without a readable header
 #define PACKET_SIZE (UDPHDRLEN + UDPNPOL * UDPNTIMESLICE * 122)
 
+// Delay between spawning the sending threads and the first burst, so every port starts on the same deadline
+#define FILL_START_DELAY 0.01
+// Number of packet payloads in the pool that noise is copied from
+#define FILL_NOISE_PACKETS 64
+
+typedef enum {
+	PATTERN_NONE, // Replay input files
+	PATTERN_ZEROS,
+	PATTERN_COUNTER, // Payload bytes count up continuously across packets
+	PATTERN_NOISE, // Gaussian noise
+	PATTERN_TONE // A complex tone on every beamlet and polarisation
+} fill_pattern;
+
+// Synthetic packet source, shared by every port
+typedef struct fill_generator {
+	fill_pattern pattern;
+	double toneFrequency; // Cycles per sample
+	int clockBit;
+	int bitMode;
+	int beamlets;
+	long startPacket;
+
+	// Fault injection probabilities, copied to every port
+	ilt_dada_fault_injector faults;
+	unsigned long seed;
+
+	int8_t *noise;
+} fill_generator;
+
+typedef struct fill_port {
+	int port;
+	int portNum;
+	FILE *input;
+	int packetSize;
+	int packetsPerIteration;
+	int burst;
+	long totalPackets;
+	double rate;
+	struct timespec start;
+
+	// UDP output
+	const char *hostIP;
+	int sendBufferSize;
+
+	int zeroCopy;
+
+	// Ringbuffer output, owned by the port so that the sending threads never share a writer
+	lofar_udp_io_write_config *io;
+
+	// Synthetic input, used instead of the input file when set
+	const fill_generator *generator;
+	uint64_t random;
+	ilt_dada_fault_injector faults;
+
+	int failed;
+	long slots;
+	long sent;
+	long refused;
+	long zeroCopySends;
+	long zeroCopyCompleted;
+	long zeroCopyCopied;
+	double elapsed;
+	ilt_dada_histogram lateness;
+} fill_port;
+
+static volatile sig_atomic_t fillRunning = 1;
+
+static void fillStop(int signal) {
+	(void) signal;
+	fillRunning = 0;
+}
+
 void helpMessages() {
 	printf("ILTDada fillbuffer (CLI v%s, lib %s)\n\n", ILTD_CLI_VERSION, ILTD_VERSION);
 
@@ -24,51 +105,609 @@ void helpMessages() {
 	printf("-u (int,int)	: Target port and offset between ports (default, e.g., %d,1)\n\t\tIf this option is set to 0, data will be written directly to the ringbuffer set by '-k'\n", DEF_PORT);
 	printf("-H (str)		: Target machine IP (e.g., localhost, my.server.com)\n");
 	printf("-i (str)		: Input raw data file\n");
-	printf("-p (int)		: Packets loaded and sent per operation (default: 1024)\n");
+	printf("-g (str)		: Generate synthetic packets rather than reading -i, with a payload of zeros, counter, noise or tone[:cycles per sample] (default tone frequency: 0.01)\n");
+	printf("-p (int)		: Packets read ahead at a time (default: 1024)\n");
+	printf("-b (int)		: Packets sent per burst, the pacing granularity (default: 16)\n");
 	printf("-n (int)		: Number of target ports (default: 1)\n");
-	printf("-t (int)		: Total number of pakcets to loadand send (default: entire input)\n");
-	printf("-w (int)		: Time in milliseconds to wait between starting operations (default: 1) (upper limit on throughput, may not be reached if disks / CPU are too slow)\n\n");
+	printf("-t (int)		: Total number of packets to load and send per port (default: entire input)\n");
+	printf("-r (float)		: Replay speed as a multiple of the station packet rate (default: 1, real-time)\n");
+	printf("-Z				: Send with MSG_ZEROCOPY (UDP only, needs Linux 4.14+, only avoids copies on real NICs)\n");
+	printf("-c (int)		: Clock used to determine the packet rate, 0 (160MHz) or 1 (200MHz) (default: read from the input, 1 with -g)\n");
+	printf("-w (int)		: Deprecated, ignored; use -r to set the replay speed\n\n");
+
+	printf("Synthetic packet options (-g)\n");
+	printf("-d (int)		: Bit mode, 4, 8 or 16 (default: 8)\n");
+	printf("-l (int)		: Beamlets per packet (default: 122 in 8-bit mode, 244 in 4-bit mode, 61 in 16-bit mode)\n");
+	printf("-s (str)		: Time of the first packet, as an ISOT (default: now)\n");
+	printf("-L (float)		: Probability of dropping each packet (default: 0)\n");
+	printf("-B (float,int)	: Probability of starting a burst of lost packets at each packet, and the burst length (default: 0,64)\n");
+	printf("-D (float)		: Probability of duplicating each packet (default: 0)\n");
+	printf("-O (float)		: Probability of swapping each packet with the next one (default: 0)\n");
+	printf("-S (int)		: Seed for the fault injection and noise (default: 1)\n\n");
+}
+
+/**
+ * @brief      Open a UDP socket connected to the target port
+ *
+ * @param[in]  hostIP          The target host
+ * @param[in]  portNum         The target port
+ * @param[in]  sendBufferSize  The requested socket send buffer size
+ *
+ * @return     >=0: socket, -1: failure
+ */
+int fill_connect(const char *hostIP, int portNum, int sendBufferSize) {
+	const struct addrinfo addressInfo = {
+		.ai_family = AF_UNSPEC,
+		.ai_socktype = SOCK_DGRAM,
+		.ai_protocol = IPPROTO_UDP
+	};
+	struct addrinfo *serverInfo;
+	char portNumStr[16];
+	int status, sockfd;
+
+	snprintf(portNumStr, sizeof(portNumStr), "%d", portNum);
+	if ((status = getaddrinfo(hostIP, portNumStr, &addressInfo, &serverInfo)) != 0) {
+		fprintf(stderr, "ERROR: Failed to get address info for %s:%d (%d: %s).\n", hostIP, portNum, status, gai_strerror(status));
+		return -1;
+	}
+
+	if ((sockfd = socket(serverInfo->ai_family, serverInfo->ai_socktype, serverInfo->ai_protocol)) == -1 ||
+		connect(sockfd, serverInfo->ai_addr, serverInfo->ai_addrlen) == -1) {
+		fprintf(stderr, "ERROR: Unable to connect to remote host %s:%d (errno %d, %s)\n", hostIP, portNum, errno, strerror(errno));
+		if (sockfd != -1) {
+			close(sockfd);
+		}
+		freeaddrinfo(serverInfo);
+		return -1;
+	}
+	freeaddrinfo(serverInfo);
+
+	// Not fatal, the default buffer only limits the size of the bursts we can queue
+	if (setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &sendBufferSize, sizeof(sendBufferSize)) == -1) {
+		fprintf(stderr, "WARNING: Failed to set the send buffer size on port %d (errno %d, %s)\n", portNum, errno, strerror(errno));
+	}
+
+	return sockfd;
+}
+
+/**
+ * @brief      Get the size of a packet for the given bit mode and beamlets
+ */
+static int fill_packet_size(int bitMode, int beamlets) {
+	return UDPHDRLEN + (UDPNPOL * UDPNTIMESLICE * beamlets * bitMode) / 8;
+}
+
+/**
+ * @brief      Write a sample at the given index of a payload, saturating it to the bit mode
+ *
+ * @param      payload   The payload
+ * @param[in]  valueIdx  The index of the (real or imaginary) sample
+ * @param[in]  bitMode   The bit mode (4, 8 or 16)
+ * @param[in]  value     The sample value
+ */
+static void fill_write_sample(int8_t *payload, long valueIdx, int bitMode, long value) {
+	const long limit = 1l << (bitMode - 1);
+	value = value < -limit ? -limit : (value > limit - 1 ? limit - 1 : value);
+
+	if (bitMode == 16) {
+		const int16_t sample = (int16_t) value;
+		memcpy(&(payload[valueIdx * 2]), &sample, sizeof(int16_t));
+	} else if (bitMode == 8) {
+		payload[valueIdx] = (int8_t) value;
+	} else {
+		// Two samples per byte, lowest nibble first
+		uint8_t *byte = (uint8_t*) &(payload[valueIdx / 2]);
+		*byte = (valueIdx % 2) ? (uint8_t) ((*byte & 0x0f) | ((value & 0x0f) << 4)) : (uint8_t) ((*byte & 0xf0) | (value & 0x0f));
+	}
+}
+
+/**
+ * @brief      Fill the noise pool, Gaussian samples with a standard deviation of
+ *             a quarter of the bit mode's range
+ *
+ * @param      generator  The generator
+ *
+ * @return     0: Success, -1: Failure
+ */
+int fill_generate_noise(fill_generator *generator) {
+	const long payloadBytes = fill_packet_size(generator->bitMode, generator->beamlets) - UDPHDRLEN;
+	const long values = FILL_NOISE_PACKETS * payloadBytes * 8 / generator->bitMode;
+	const double sigma = (double) (1l << (generator->bitMode - 1)) / 4.0;
+	uint64_t state = generator->seed;
+
+	if ((generator->noise = calloc(FILL_NOISE_PACKETS, payloadBytes)) == NULL) {
+		return -1;
+	}
+
+	// Box-Muller transform, two samples at a time
+	for (long valueIdx = 0; valueIdx < values; valueIdx += 2) {
+		const double radius = sigma * sqrt(-2.0 * log(1.0 - ilt_dada_random_uniform(&state)));
+		const double angle = 2.0 * M_PI * ilt_dada_random_uniform(&state);
+		fill_write_sample(generator->noise, valueIdx, generator->bitMode, lround(radius * cos(angle)));
+		fill_write_sample(generator->noise, valueIdx + 1, generator->bitMode, lround(radius * sin(angle)));
+	}
+
+	return 0;
+}
+
+/**
+ * @brief      Generate a packet with a valid header and the requested payload
+ *
+ * @param      generator     The generator
+ * @param      packet        The output packet
+ * @param[in]  packetSize    The size of the packet
+ * @param[in]  packetNumber  The packet number
+ * @param      state         The random state of the port
+ */
+void fill_generate_packet(const fill_generator *generator, int8_t *packet, int packetSize, long packetNumber, uint64_t *state) {
+	const long payloadBytes = packetSize - UDPHDRLEN;
+	int8_t *payload = &(packet[UDPHDRLEN]);
+
+	ilt_dada_packno_to_header(packet, packetNumber, generator->clockBit, generator->bitMode == 16 ? 0 : (generator->bitMode == 8 ? 1 : 2), generator->beamlets);
+
+	switch (generator->pattern) {
+		case PATTERN_COUNTER:
+			for (long byteIdx = 0; byteIdx < payloadBytes; byteIdx++) {
+				payload[byteIdx] = (int8_t) (packetNumber * payloadBytes + byteIdx);
+			}
+			break;
+
+		case PATTERN_NOISE: {
+			// A random, 8-byte aligned, window of the pool, so every bit mode stays sample aligned
+			const long offset = (long) (ilt_dada_random_uniform(state) * (double) ((FILL_NOISE_PACKETS - 1) * payloadBytes)) & ~7l;
+			memcpy(payload, &(generator->noise[offset]), payloadBytes);
+			break;
+		}
+
+		case PATTERN_TONE: {
+			// Payloads are ordered [beamlet][time slice][Xr, Xi, Yr, Yi], every beamlet carries the same tone
+			memset(payload, 0, payloadBytes);
+			const double amplitude = (double) (1l << (generator->bitMode - 1)) / 4.0;
+			for (int slice = 0; slice < UDPNTIMESLICE; slice++) {
+				// Phase is relative to the first packet, absolute sample counts lose too much precision as doubles
+				const double phase = 2.0 * M_PI * generator->toneFrequency * (double) ((packetNumber - generator->startPacket) * UDPNTIMESLICE + slice);
+				const long real = lround(amplitude * cos(phase)), imag = lround(amplitude * sin(phase));
+				for (int beamlet = 0; beamlet < generator->beamlets; beamlet++) {
+					const long valueIdx = ((long) beamlet * UDPNTIMESLICE + slice) * UDPNPOL;
+					fill_write_sample(payload, valueIdx, generator->bitMode, real);
+					fill_write_sample(payload, valueIdx + 1, generator->bitMode, imag);
+					fill_write_sample(payload, valueIdx + 2, generator->bitMode, real);
+					fill_write_sample(payload, valueIdx + 3, generator->bitMode, imag);
+				}
+			}
+			break;
+		}
+
+		default:
+			memset(payload, 0, payloadBytes);
+			break;
+	}
+}
+
+/**
+ * @brief      Generate the packets for a window of the stream, injecting the
+ *             requested faults
+ *
+ * @param      port         The port
+ * @param      buffer       The output buffer (space for 2 * slots packets)
+ * @param      packetSlots  Scratch space for the slot of every generated packet (2 * slots elements)
+ * @param      slotIdx      The output slot of every generated packet, used to pace it
+ * @param[in]  firstSlot    The first slot of the window
+ * @param[in]  slots        The number of slots in the window
+ *
+ * @return     The number of packets generated
+ */
+long fill_generate_window(fill_port *port, int8_t *buffer, long *packetSlots, long *slotIdx, long firstSlot, long slots) {
+	const fill_generator *generator = port->generator;
+	const long packets = ilt_dada_inject_faults(&(port->faults), firstSlot, slots, packetSlots, slotIdx);
+
+	for (long packetIdx = 0; packetIdx < packets; packetIdx++) {
+		// Duplicates are sent directly after the original
+		if (packetIdx > 0 && packetSlots[packetIdx] == packetSlots[packetIdx - 1]) {
+			memcpy(&(buffer[packetIdx * port->packetSize]), &(buffer[(packetIdx - 1) * port->packetSize]), port->packetSize);
+			continue;
+		}
+		fill_generate_packet(generator, &(buffer[packetIdx * port->packetSize]), port->packetSize, generator->startPacket + packetSlots[packetIdx], &(port->random));
+	}
+
+	return packets;
+}
+
+/**
+ * @brief      Map a port's input file for zero-copy replay
+ *
+ * @param      input       The input file
+ * @param[in]  packetSize  The size of the input packets
+ * @param[out] mapping     The mapping
+ * @param[out] packets     The number of complete packets in the mapping
+ * @param[out] size        The length of the mapping
+ *
+ * @return     0: Success, -1: The input cannot be mapped (not a regular file, or mmap failed)
+ */
+int fill_map_input(FILE *input, int packetSize, int8_t **mapping, long *packets, size_t *size) {
+	struct stat fileStat;
+	const int fd = fileno(input);
+
+	if (fstat(fd, &fileStat) == -1 || !S_ISREG(fileStat.st_mode) || fileStat.st_size < packetSize) {
+		return -1;
+	}
+
+	void *map = mmap(NULL, fileStat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		return -1;
+	}
+
+	// Hints only, replay still works if the kernel ignores them
+	madvise(map, fileStat.st_size, MADV_SEQUENTIAL);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	*mapping = (int8_t*) map;
+	*packets = fileStat.st_size / packetSize;
+	*size = fileStat.st_size;
+	return 0;
+}
+
+/**
+ * @brief      Advise the kernel of our progress through a mapped input: the next
+ *             window is read ahead, and the previous window is released so long
+ *             replays do not grow our resident set
+ *
+ * @param      mapping        The mapping
+ * @param[in]  packetSize     The size of the input packets
+ * @param[in]  mappedPackets  The number of packets in the mapping
+ * @param[in]  windowStart    The first packet of the current window
+ * @param[in]  windowPackets  The number of packets per window
+ */
+void fill_advise_window(int8_t *mapping, int packetSize, long mappedPackets, long windowStart, long windowPackets) {
+	const long pageSize = sysconf(_SC_PAGESIZE);
+	const long currentOffset = (windowStart * packetSize) & ~(pageSize - 1);
+
+	if (windowStart + windowPackets < mappedPackets) {
+		const long nextOffset = ((windowStart + windowPackets) * packetSize) & ~(pageSize - 1);
+		const long nextEnd = (windowStart + 2 * windowPackets < mappedPackets ? windowStart + 2 * windowPackets : mappedPackets) * packetSize;
+		madvise(&(mapping[nextOffset]), nextEnd - nextOffset, MADV_WILLNEED);
+	}
+
+	if (windowStart >= windowPackets) {
+		const long previousOffset = ((windowStart - windowPackets) * packetSize) & ~(pageSize - 1);
+		if (currentOffset > previousOffset) {
+			madvise(&(mapping[previousOffset]), currentOffset - previousOffset, MADV_DONTNEED);
+		}
+	}
+}
+
+/**
+ * @brief      Reap MSG_ZEROCOPY completion notifications from a socket's error queue
+ *
+ * @param      port    The port
+ * @param[in]  sockfd  The socket
+ */
+void fill_reap_zerocopy(fill_port *port, int sockfd) {
+	char control[CMSG_SPACE(sizeof(struct sock_extended_err)) * 4];
+	struct msghdr msg = { 0 };
+
+	while (1) {
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(sockfd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+			return;
+		}
+
+		for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (!((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) || (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))) {
+				continue;
+			}
+
+			const struct sock_extended_err *error = (const struct sock_extended_err*) CMSG_DATA(cmsg);
+			if (error->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+				continue;
+			}
+
+			// Notifications cover an inclusive range of send calls
+			const long completed = (long) error->ee_data - (long) error->ee_info + 1;
+			port->zeroCopyCompleted += completed;
+			if (error->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+				port->zeroCopyCopied += completed;
+			}
+		}
+	}
+}
+
+/**
+ * @brief      Send bursts of packets from a port's input at the target rate;
+ *             every burst has an absolute deadline from the shared start time,
+ *             so a late burst never delays the following bursts
+ *
+ *             Regular files are memory mapped and sent (or written to the
+ *             ringbuffer) directly from the mapping, other inputs are read
+ *             through a buffer. Synthetic packets are generated a window at
+ *             a time, and keep the pacing of the stream they were generated
+ *             from, so lost packets leave gaps.
+ *
+ * @param      portPtr  The port configuration
+ *
+ * @return     NULL
+ */
+void* fill_port_thread(void *portPtr) {
+	fill_port *port = (fill_port*) portPtr;
+	const long readSize = (long) port->packetsPerIteration * port->packetSize;
+
+	int8_t *mapping = NULL, *buffer = NULL;
+	long *slotIdx = NULL, *packetSlots = NULL;
+	long mappedPackets = 0;
+	size_t mappingSize = 0;
+	if (port->generator != NULL) {
+		// Duplicates can double the packets in a window
+		buffer = calloc(2 * port->packetsPerIteration, port->packetSize);
+		slotIdx = calloc(2 * port->packetsPerIteration, sizeof(long));
+		packetSlots = calloc(2 * port->packetsPerIteration, sizeof(long));
+	} else if (fill_map_input(port->input, port->packetSize, &mapping, &mappedPackets, &mappingSize) < 0) {
+		printf("Port %d: input cannot be memory mapped, falling back to reads.\n", port->port);
+		mapping = NULL;
+		buffer = calloc(port->packetsPerIteration, port->packetSize);
+	}
+
+	struct mmsghdr *msgvec = calloc(port->burst, sizeof(struct mmsghdr));
+	struct iovec *iovecs = calloc(port->burst, sizeof(struct iovec));
+	if ((mapping == NULL && buffer == NULL) || (port->generator != NULL && (slotIdx == NULL || packetSlots == NULL)) || msgvec == NULL || iovecs == NULL) {
+		fprintf(stderr, "ERROR: Failed to allocate buffers on port %d, exiting.\n", port->port);
+		port->failed = 1;
+		FREE_NOT_NULL(buffer);
+		FREE_NOT_NULL(slotIdx);
+		FREE_NOT_NULL(packetSlots);
+		FREE_NOT_NULL(msgvec);
+		FREE_NOT_NULL(iovecs);
+		return NULL;
+	}
+
+	for (int packetIdx = 0; packetIdx < port->burst; packetIdx++) {
+		iovecs[packetIdx].iov_len = port->packetSize;
+		msgvec[packetIdx].msg_hdr.msg_iov = &(iovecs[packetIdx]);
+		msgvec[packetIdx].msg_hdr.msg_iovlen = 1;
+	}
+
+	int sockfd = -1, sendFlags = 0;
+	if (port->io == NULL && (sockfd = fill_connect(port->hostIP, port->portNum, port->sendBufferSize)) < 0) {
+		port->failed = 1;
+	}
+
+	if (sockfd != -1 && port->zeroCopy) {
+		const int enable = 1;
+		if (setsockopt(sockfd, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)) == -1) {
+			fprintf(stderr, "WARNING Port %d: Failed to enable zero-copy sends, falling back to copying (errno %d, %s)\n", port->port, errno, strerror(errno));
+		} else {
+			sendFlags = MSG_ZEROCOPY;
+		}
+	}
+
+	struct timespec now;
+	long slot = 0, processed = 0;
+	while (!port->failed && slot < port->totalPackets && fillRunning) {
+		const long windowSlot = slot;
+		int8_t *window;
+		long packets;
+		if (port->generator != NULL) {
+			const long slots = (port->totalPackets - slot) < port->packetsPerIteration ? (port->totalPackets - slot) : port->packetsPerIteration;
+			window = buffer;
+			packets = fill_generate_window(port, buffer, packetSlots, slotIdx, slot, slots);
+			slot += slots;
+		} else {
+			if (mapping != NULL) {
+				window = &(mapping[slot * port->packetSize]);
+				packets = (mappedPackets - slot) < port->packetsPerIteration ? (mappedPackets - slot) : port->packetsPerIteration;
+				fill_advise_window(mapping, port->packetSize, mappedPackets, slot, port->packetsPerIteration);
+			} else {
+				window = buffer;
+				packets = (long) (fread(buffer, sizeof(int8_t), readSize, port->input) / port->packetSize);
+			}
+
+			if (packets < 1) {
+				break;
+			}
+			if (slot + packets > port->totalPackets) {
+				packets = port->totalPackets - slot;
+			}
+			slot += packets;
+		}
+
+		for (long packetIdx = 0; packetIdx < packets; ) {
+			int burst = (packets - packetIdx) < port->burst ? (int) (packets - packetIdx) : port->burst;
+			int8_t *burstStart = &(window[packetIdx * port->packetSize]);
+
+			// Synthetic bursts end at gaps in the stream, so lost packets are not sent early
+			const long burstSlot = slotIdx != NULL ? slotIdx[packetIdx] : windowSlot + packetIdx;
+			if (slotIdx != NULL) {
+				for (int msgIdx = 1; msgIdx < burst; msgIdx++) {
+					if (slotIdx[packetIdx + msgIdx] > burstSlot + msgIdx) {
+						burst = msgIdx;
+						break;
+					}
+				}
+			}
+
+			const int64_t lateness = (int64_t) (ilt_dada_pace(&(port->start), (double) burstSlot / port->rate) * 1e9);
+
+			int written;
+			if (port->io != NULL) {
+				const long writtenBytes = lofar_udp_io_write(port->io, 0, burstStart, (long) burst * port->packetSize);
+				written = writtenBytes == (long) burst * port->packetSize ? burst : -1;
+			} else {
+				for (int msgIdx = 0; msgIdx < burst; msgIdx++) {
+					iovecs[msgIdx].iov_base = &(burstStart[(long) msgIdx * port->packetSize]);
+				}
+
+				written = sendmmsg(sockfd, msgvec, burst, sendFlags);
+				if (sendFlags) {
+					if (written > 0) {
+						port->zeroCopySends += written;
+					}
+					// Completions hold socket memory until they are reaped, which would eventually stall sends with ENOBUFS
+					fill_reap_zerocopy(port, sockfd);
+				}
+
+				// Retry when the socket is full, a partial send is finished by the next burst
+				if (written < 0 && (errno == EAGAIN || errno == ENOBUFS || errno == EINTR)) {
+					continue;
+				}
+				// Nothing is listening on the target port, the burst is lost but we keep the stream going
+				if (written < 0 && errno == ECONNREFUSED) {
+					if (port->refused == 0) {
+						fprintf(stderr, "WARNING Port %d: Target refused packets, is there no listener on the other side of your UDP port?\n", port->port);
+					}
+					port->refused += burst;
+					written = burst;
+				}
+			}
+
+			if (written < 0) {
+				fprintf(stderr, "ERROR Port %d: Failed to send/write data (errno %d: %s), exiting.\n", port->port, errno, strerror(errno));
+				port->failed = 1;
+				break;
+			}
+
+			// Retried bursts are only counted once
+			ilt_dada_histogram_record(&(port->lateness), lateness);
+			packetIdx += written;
+			processed += written;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	port->elapsed = ilt_dada_elapsed(&(port->start), &now);
+	port->slots = slot;
+	port->sent = processed - port->refused;
+
+	if (sockfd != -1) {
+		// The kernel may still reference the mapping for in-flight zero-copy sends
+		for (int attempt = 0; sendFlags && port->zeroCopyCompleted < port->zeroCopySends && attempt < 100; attempt++) {
+			struct pollfd pollErrors = { .fd = sockfd, .events = 0 };
+			poll(&pollErrors, 1, 10);
+			fill_reap_zerocopy(port, sockfd);
+		}
+		close(sockfd);
+	}
+	if (mapping != NULL) {
+		munmap(mapping, mappingSize);
+	}
+	FREE_NOT_NULL(buffer);
+	FREE_NOT_NULL(slotIdx);
+	FREE_NOT_NULL(packetSlots);
+	free(msgvec);
+	free(iovecs);
+	return NULL;
+}
+
+/**
+ * @brief      Read the clock bit and packet size from the first packet of an input file
+ *
+ * @param      input       The input file, rewound afterwards
+ * @param[out] clockBit    The clock bit
+ * @param[out] packetSize  The packet size
+ *
+ * @return     0: Success, -1: failure
+ */
+int fill_read_header(FILE *input, int *clockBit, int *packetSize) {
+	int8_t header[UDPHDRLEN];
+	const size_t readBytes = fread(header, sizeof(int8_t), UDPHDRLEN, input);
+	rewind(input);
+
+	if (readBytes != UDPHDRLEN || header[0] != UDPCURVER) {
+		return -1;
+	}
+
+	const lofar_source_bytes *source = (lofar_source_bytes*) &(header[1]);
+	*clockBit = source->clockBit;
+	*packetSize = fill_packet_size(source->bitMode == 0 ? 16 : (source->bitMode == 1 ? 8 : 4), (uint8_t) header[6]);
+	return 0;
+}
+
+/**
+ * @brief      Parse a payload pattern, with an optional tone frequency
+ *
+ * @param[in]  inputStr   The input string
+ * @param      generator  The generator
+ *
+ * @return     0: Success, -1: Failure
+ */
+int fill_parse_pattern(const char *inputStr, fill_generator *generator) {
+	const char *patterns[] = { "", "zeros", "counter", "noise", "tone" };
+	const size_t nameLen = strcspn(inputStr, ":");
+
+	for (int pattern = PATTERN_ZEROS; pattern <= PATTERN_TONE; pattern++) {
+		if (strlen(patterns[pattern]) == nameLen && strncmp(inputStr, patterns[pattern], nameLen) == 0) {
+			generator->pattern = (fill_pattern) pattern;
+			if (inputStr[nameLen] == ':') {
+				char *endPtr;
+				generator->toneFrequency = strtod(&(inputStr[nameLen + 1]), &endPtr);
+				return (pattern == PATTERN_TONE && *endPtr == '\0') ? 0 : -1;
+			}
+			return 0;
+		}
+	}
+
+	return -1;
 }
 
 int main(int argc, char *argv[]) {
 
-	int inputOpt, packets = 1, waitTime = 1;
-	char inputFile[DEF_STR_LEN] = "", workingName[DEF_STR_LEN] = "", hostIP[DEF_STR_LEN] = "127.0.0.1";
-	long totalPackets = LONG_MAX, packetCount = 0, writtenBytes;
+	int inputOpt, packets = 1, burst = 16, clockBit = -1, zeroCopy = 0, packetSize = PACKET_SIZE;
+	char inputFile[DEF_STR_LEN] = "", workingName[DEF_STR_LEN] = "", hostIP[DEF_STR_LEN] = "127.0.0.1", startTime[DEF_STR_LEN] = "";
+	long totalPackets = LONG_MAX;
 	int numPorts = 1;
-	int offset = 10, fullReads = 1, portOffset = 1;
+	int offset = 10, portOffset = 1, returnVal = 0;
+	double speed = 1.0;
+
+	fill_generator generator = {
+		.pattern = PATTERN_NONE,
+		.toneFrequency = 0.01,
+		.bitMode = 8,
+		.beamlets = -1,
+		.faults = { .burstLength = 64 },
+		.seed = 1
+	};
 
-	FILE *inputFiles[MAX_NUM_PORTS];
+	fill_port ports[MAX_NUM_PORTS];
+	pthread_t threads[MAX_NUM_PORTS];
+	memset(ports, 0, sizeof(ports));
 
-	ilt_dada_config *config[MAX_NUM_PORTS];
-	config[0] = ilt_dada_init();
+	ilt_dada_config *config = ilt_dada_init();
 
 
-	config[0]->portNum = DEF_PORT;
-	config[0]->packetsPerIteration = 1024;
-	config[0]->io->outputDadaKeys[0] = DEF_PORT;
-	config[0]->recvflags = -1;
+	config->portNum = DEF_PORT;
+	config->packetsPerIteration = 1024;
+	config->io->outputDadaKeys[0] = DEF_PORT;
 
-	while((inputOpt = getopt(argc, argv, "u:H:i:p:n:k:t:w:h")) != -1) {
+	while((inputOpt = getopt(argc, argv, "u:H:i:g:p:b:n:k:t:r:c:d:l:s:L:B:D:O:S:Zw:h")) != -1) {
 		switch(inputOpt) {
 
 			case 'u':
-				sscanf(optarg, "%d,%d", &(config[0]->portNum), &portOffset);
-				if (config[0]->portNum == 0) {
+				sscanf(optarg, "%d,%d", &(config->portNum), &portOffset);
+				if (config->portNum == 0) {
 					packets = 0;
 				}
 				break;
 
 			case 'H':
-				strcpy(&(hostIP[0]), optarg);
+				strncpy(hostIP, optarg, DEF_STR_LEN - 1);
 				break;
-			
+
 			case 'i':
-				strcpy(inputFile, optarg);
+				strncpy(inputFile, optarg, DEF_STR_LEN - 1);
+				break;
+
+			case 'g':
+				if (fill_parse_pattern(optarg, &generator) < 0) {
+					fprintf(stderr, "ERROR: Unknown payload pattern %s, exiting.\n", optarg);
+					return 1;
+				}
 				break;
 
 			case 'p':
-				config[0]->packetsPerIteration = atoi(optarg);
+				config->packetsPerIteration = atoi(optarg);
+				break;
+
+			case 'b':
+				burst = atoi(optarg);
 				break;
 
 			case 'n':
@@ -81,15 +720,59 @@ int main(int argc, char *argv[]) {
 				break;
 
 			case 'k':
-				sscanf(optarg, "%d,%d", &(config[0]->io->outputDadaKeys[0]), &offset);
+				sscanf(optarg, "%d,%d", &(config->io->outputDadaKeys[0]), &offset);
 				break;
 
 			case 't':
 				totalPackets = atol(optarg);
 				break;
 
+			case 'r':
+				speed = atof(optarg);
+				break;
+
+			case 'c':
+				clockBit = atoi(optarg);
+				break;
+
+			case 'd':
+				generator.bitMode = atoi(optarg);
+				break;
+
+			case 'l':
+				generator.beamlets = atoi(optarg);
+				break;
+
+			case 's':
+				strncpy(startTime, optarg, DEF_STR_LEN - 1);
+				break;
+
+			case 'L':
+				generator.faults.lossRate = atof(optarg);
+				break;
+
+			case 'B':
+				sscanf(optarg, "%lf,%d", &(generator.faults.burstRate), &(generator.faults.burstLength));
+				break;
+
+			case 'D':
+				generator.faults.duplicateRate = atof(optarg);
+				break;
+
+			case 'O':
+				generator.faults.reorderRate = atof(optarg);
+				break;
+
+			case 'S':
+				generator.seed = strtoul(optarg, NULL, 10);
+				break;
+
+			case 'Z':
+				zeroCopy = 1;
+				break;
+
 			case 'w':
-				waitTime = atoi(optarg);
+				fprintf(stderr, "WARNING: -w is deprecated and ignored, sending is paced to the station packet rate (scaled by -r).\n");
 				break;
 
 			case 'h':
@@ -102,155 +785,197 @@ int main(int argc, char *argv[]) {
 		}
 	}
 
-	printf("Preparing to load data from %d file(s) following format %s, with %d packets per iteration.\n", numPorts, inputFile, config[0]->packetsPerIteration);
-
-	if (packets) {
-		printf("We will be using UDP packets to copy the data starting on host/port %s:%d with an offset of 1. \n", hostIP, config[0]->portNum);
-	} else {
-		printf("We will be copying the data into the ringbuffers starting at %d (%x) with an offset of %d by copying data directly to the ringbuffer.\n\n", config[0]->io->outputDadaKeys[0], config[0]->io->outputDadaKeys[0], offset);
+	if (config->packetsPerIteration < 1 || burst < 1 || numPorts < 1 || speed <= 0.0) {
+		fprintf(stderr, "ERROR: Packets per read (%d), packets per burst (%d), ports (%d) and replay speed (%lf) must be positive, exiting.\n", config->packetsPerIteration, burst, numPorts, speed);
+		return 1;
 	}
 
+	if (clockBit > 1) {
+		fprintf(stderr, "ERROR: Clock bit must be 0 or 1 (%d), exiting.\n", clockBit);
+		return 1;
+	}
 
-	config[0]->portBufferSize = 4 * PACKET_SIZE * config[0]->packetsPerIteration;
-	config[0]->io->numOutputs = numPorts;
-	for (int port = 0; port < numPorts; port++) {
-		if (port != 0) {
-			config[port] = ilt_dada_init();
+	if (generator.pattern != PATTERN_NONE) {
+		if (generator.bitMode != 4 && generator.bitMode != 8 && generator.bitMode != 16) {
+			fprintf(stderr, "ERROR: Bit mode must be 4, 8 or 16 (%d), exiting.\n", generator.bitMode);
+			return 1;
 		}
-		config[port]->portNum = config[0]->portNum + port * portOffset;
-
-		config[port]->packetsPerIteration = config[0]->packetsPerIteration;
-		config[port]->portBufferSize = config[0]->portBufferSize;
-		config[port]->recvflags = config[0]->recvflags;
-
 
-		if (packets == 0) {
-			config[0]->io->readerType = DADA_ACTIVE;
-			config[0]->io->dadaConfig.nbufs = 32;
-			config[0]->io->writeBufSize[port] = 4 * PACKET_SIZE * config[0]->packetsPerIteration;
-			config[0]->io->outputDadaKeys[port] = config[0]->io->outputDadaKeys[0] + offset * port;
+		if (generator.beamlets < 0) {
+			generator.beamlets = 122 * 8 / generator.bitMode;
 		}
-	}
-	if (packets == 0) {
-		// Initialise the ringbuffer, exit on failure
-		if (lofar_udp_io_write_setup(config[0]->io, 0) < 0) {
+		packetSize = fill_packet_size(generator.bitMode, generator.beamlets);
+		if (generator.beamlets < 1 || generator.beamlets > UINT8_MAX || packetSize > MAX_UDP_LEN) {
+			fprintf(stderr, "ERROR: %d beamlets do not fit in a %d-bit packet (maximum %d bytes), exiting.\n", generator.beamlets, generator.bitMode, MAX_UDP_LEN);
 			return 1;
 		}
-	}
 
-	struct addrinfo *serverInfo;
+		const ilt_dada_fault_injector *faults = &(generator.faults);
+		if (faults->lossRate < 0.0 || faults->lossRate > 1.0 || faults->burstRate < 0.0 || faults->burstRate > 1.0 ||
+			faults->duplicateRate < 0.0 || faults->duplicateRate > 1.0 || faults->reorderRate < 0.0 || faults->reorderRate > 1.0 || faults->burstLength < 1) {
+			fprintf(stderr, "ERROR: Fault probabilities must be between 0 and 1, and bursts at least 1 packet long, exiting.\n");
+			return 1;
+		}
 
-	if (packets == 1) {
-		printf("Initialisng networking components...\n");
-		for (int port = 0; port < numPorts; port++) {
+		if (generator.seed == 0) {
+			fprintf(stderr, "ERROR: The random seed must be non-zero, exiting.\n");
+			return 1;
+		}
 
-			if (ilt_dada_initialise_port(config[port]) < 0) {
+		generator.clockBit = clockBit < 0 ? 1 : clockBit;
+		clockBit = generator.clockBit;
+		if (strcmp(startTime, "") != 0) {
+			generator.startPacket = lofar_udp_time_get_packet_from_isot(startTime, generator.clockBit);
+			if (generator.startPacket < 1) {
+				fprintf(stderr, "ERROR: Failed to parse start time %s, exiting.\n", startTime);
 				return 1;
 			}
+		} else {
+			generator.startPacket = lofar_udp_time_beamformed_packno((unsigned int) time(NULL), 0, generator.clockBit);
 		}
 
-		const struct addrinfo addressInfo = {
-			.ai_family = AF_UNSPEC,
-			.ai_socktype = SOCK_DGRAM,
-			.ai_flags = IPPROTO_UDP
-		};
-
-		// Convert the port to a string for getaddrinfo
-		char portNumStr[16];
-		sprintf(portNumStr, "%d", config[0]->portNum);
-
-		// Struct to collect the results from getaddrinfo
-		int status;
-
-		// Populate the remaining parts of addressInfo
-		if ((status = getaddrinfo(hostIP, portNumStr, &addressInfo, &serverInfo)) < 0) {
-			fprintf(stderr, "ERROR: Failed to get address info on port %d (errno %d: %s).", config[0]->portNum, status, gai_strerror(status));
+		if (generator.pattern == PATTERN_NOISE && fill_generate_noise(&generator) < 0) {
+			fprintf(stderr, "ERROR: Failed to allocate the noise pool, exiting.\n");
 			return 1;
 		}
 
+		printf("Preparing to generate %d-bit packets with %d beamlets (%d bytes) on %d port(s), starting at packet %ld.\n", generator.bitMode, generator.beamlets, packetSize, numPorts, generator.startPacket);
+	} else {
+		printf("Preparing to load data from %d file(s) following format %s, with %d packets per read.\n", numPorts, inputFile, config->packetsPerIteration);
 	}
 
+	if (packets) {
+		printf("We will be using UDP packets to copy the data starting on host/port %s:%d with an offset of %d.\n", hostIP, config->portNum, portOffset);
+	} else {
+		printf("We will be copying the data into the ringbuffers starting at %d (%x) with an offset of %d by copying data directly to the ringbuffer.\n\n", config->io->outputDadaKeys[0], config->io->outputDadaKeys[0], offset);
+	}
 
-	for (int port = 0; port < numPorts; port++) {
+	for (int port = 0; port < numPorts && generator.pattern == PATTERN_NONE; port++) {
 		sprintf(workingName, inputFile, port);
 
 		printf("Opening file at %s...\n", workingName);
-		inputFiles[port] = fopen(workingName, "r");
-		if (inputFiles[port] == NULL) {
+		ports[port].input = fopen(workingName, "r");
+		if (ports[port].input == NULL) {
 			fprintf(stderr, "Input file at %s does not exist, exiting.\n", workingName);
+			for (int openedPort = 0; openedPort < port; openedPort++) {
+				fclose(ports[openedPort].input);
+			}
 			return 1;
 		}
+	}
 
-		
-		if (packets == 0) {
-			printf("Allocating %ld MB for %d %d byte packets on port %d\n", (long) config[0]->packetsPerIteration * PACKET_SIZE >> 20, config[0]->packetsPerIteration, PACKET_SIZE, port);
-			config[port]->params->packetBuffer = calloc(config[0]->packetsPerIteration * PACKET_SIZE, sizeof(int8_t));
-
-			if (config[port]->params->packetBuffer == NULL) {
-				fprintf(stderr, "ERROR: Failed to allocate data on port %d, exiting.\n", port);
-				return 1;
-			}
-
-		} else {
-			if (ilt_data_operate_prepare(config[port]) < 0) {
-				return 1;
-			}
-
-			if (connect(config[port]->sockfd, serverInfo->ai_addr, sizeof(struct sockaddr)) == -1) {
-				fprintf(stderr, "ERROR: Unable to connect to remote host %s:%d (errno %d, %s)\n", hostIP, config[port]->portNum, errno, strerror(errno));
-				return 1;
-			}
-
+	if (generator.pattern == PATTERN_NONE) {
+		int inputClockBit;
+		if (fill_read_header(ports[0].input, &inputClockBit, &packetSize) < 0) {
+			fprintf(stderr, "WARNING: Unable to read the header of the input, assuming 200MHz clock and %d byte packets.\n", PACKET_SIZE);
+			inputClockBit = 1;
+			packetSize = PACKET_SIZE;
 		}
+		clockBit = clockBit < 0 ? inputClockBit : clockBit;
 	}
+	const double rate = speed * (clockBit ? clock200MHzPacketRate : clock160MHzPacketRate);
+	printf("Sending at %.1lf packets per second per port (%.2lfx real-time for the %dMHz clock), in bursts of %d packets.\n", rate, speed, clockBit ? 200 : 160, burst);
+
+	// Every port writes to its ringbuffer from its own thread, so give each one a separate writer
+	for (int port = 0; port < numPorts && packets == 0 && returnVal == 0; port++) {
+		if ((ports[port].io = lofar_udp_io_write_alloc()) == NULL) {
+			fprintf(stderr, "ERROR: Failed to allocate the ringbuffer writer for port %d, exiting.\n", port);
+			returnVal = 1;
+			break;
+		}
 
+		ports[port].io->readerType = DADA_ACTIVE;
+		ports[port].io->dadaConfig = config->io->dadaConfig;
+		ports[port].io->dadaConfig.nbufs = 32;
+		ports[port].io->numOutputs = 1;
+		ports[port].io->writeBufSize[0] = 4 * packetSize * config->packetsPerIteration;
+		ports[port].io->outputDadaKeys[0] = config->io->outputDadaKeys[0] + offset * port;
 
+		// Initialise the ringbuffer, exit on failure
+		if (lofar_udp_io_write_setup(ports[port].io, 0) < 0) {
+			returnVal = 1;
+		}
+	}
 
-	while (packetCount < totalPackets && fullReads) {
-		for (int port = 0; port < numPorts; port++) {
-			const size_t readBytes = fread(&(config[port]->params->packetBuffer[0]), sizeof(char),
-			                       config[port]->packetsPerIteration * PACKET_SIZE, inputFiles[port]);
-
-			if (packets == 0) {
-				writtenBytes = lofar_udp_io_write(config[0]->io, port, (int8_t*) config[port]->params->packetBuffer, readBytes);
-			} else {
-				writtenBytes = sendmmsg(config[port]->sockfd, config[port]->params->msgvec, config[port]->packetsPerIteration, 0);
-				// sendmmg returns number of packets, multiply by packet length to get bytes
-				writtenBytes *= PACKET_SIZE;
-			}
-
-			if (writtenBytes < 0) {
-				fprintf(stderr, "ERROR: Failed to write data, exiting.\n");
-				break;
-			}
+	signal(SIGINT, fillStop);
+	signal(SIGTERM, fillStop);
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	start = ilt_dada_time_offset(&start, FILL_START_DELAY);
+
+	int launched = 0;
+	for (int port = 0; port < numPorts && returnVal == 0; port++) {
+		ports[port].port = port;
+		ports[port].portNum = config->portNum + port * portOffset;
+		ports[port].packetSize = packetSize;
+		ports[port].packetsPerIteration = config->packetsPerIteration;
+		ports[port].burst = burst;
+		ports[port].totalPackets = totalPackets;
+		ports[port].rate = rate;
+		ports[port].start = start;
+		ports[port].hostIP = hostIP;
+		ports[port].zeroCopy = zeroCopy;
+		ports[port].sendBufferSize = 4 * packetSize * config->packetsPerIteration;
+		if (generator.pattern != PATTERN_NONE) {
+			ports[port].generator = &generator;
+			ports[port].random = (generator.seed + port) * 0x9E3779B97F4A7C15ull;
+			// Faults are drawn from their own stream, so they do not depend on the payload pattern
+			ports[port].faults = generator.faults;
+			ports[port].faults.random = ports[port].random ^ 0xD1B54A32D192ED03ull;
+		}
+		ilt_dada_histogram_reset(&(ports[port].lateness));
 
-			if (readBytes != (size_t) (config[port]->packetsPerIteration * PACKET_SIZE)) {
-				fullReads = 0;
-				printf("Read less data than expected (%ld, %ld), likely reached EOF, finishing up.\n", readBytes, (long) config[port]->packetsPerIteration * PACKET_SIZE);
-			}
+		if (pthread_create(&(threads[port]), NULL, fill_port_thread, &(ports[port])) != 0) {
+			fprintf(stderr, "ERROR: Failed to start the sending thread for port %d, exiting.\n", port);
+			returnVal = 1;
+			break;
+		}
+		launched++;
+	}
 
+	for (int port = 0; port < launched; port++) {
+		pthread_join(threads[port], NULL);
+	}
 
-			if (writtenBytes != (long) readBytes) {
-				fprintf(stderr, "WARNING Port %d: Tried to send/write %ld bytes to buffer but only wrote %ld (errno: %d, %s).\n", port, readBytes, writtenBytes, errno, strerror(errno));
-				if (packets && writtenBytes == PACKET_SIZE) {
-					fprintf(stderr, "Is there no listener on the other side of your UDP port?\n");
-				}
-			} else {
-				printf("Port %d: sent/wrote %d packets to buffer.\n", port, config[port]->packetsPerIteration);
-			}
+	if (launched) {
+		printf("\nPort\tPackets\t\tRate (pkt/s)\tTarget (%%)\tLateness p50 / p99 / p99.9 / max (us)\n");
+	}
+	for (int port = 0; port < launched; port++) {
+		const fill_port *result = &(ports[port]);
+		const double achieved = result->elapsed > 0.0 ? (double) result->slots / result->elapsed : 0.0;
+
+		printf("%d\t%ld\t%.1lf\t\t%.2lf\t\t%.1lf / %.1lf / %.1lf / %.1lf\n", port, result->sent, achieved, 100.0 * achieved / rate,
+		       (double) ilt_dada_histogram_percentile(&(result->lateness), 50.0) * 1e-3,
+		       (double) ilt_dada_histogram_percentile(&(result->lateness), 99.0) * 1e-3,
+		       (double) ilt_dada_histogram_percentile(&(result->lateness), 99.9) * 1e-3,
+		       (double) result->lateness.max * 1e-3);
+		if (result->generator != NULL) {
+			printf("\tPort %d: injected %ld lost packets (%ld bursts), %ld duplicates and %ld reorders over %ld packets.\n", port, result->faults.lost, result->faults.bursts,
+			       result->faults.duplicates, result->faults.reorders, result->slots);
+		}
+		if (result->refused) {
+			printf("\tPort %d: %ld packets were refused by the target.\n", port, result->refused);
+		}
+		if (result->zeroCopySends) {
+			printf("\tPort %d: %ld zero-copy sends, %ld fell back to copying (always the case for loopback targets).\n", port, result->zeroCopySends, result->zeroCopyCopied);
+		}
+		if (result->failed) {
+			returnVal = 1;
 		}
-		printf("\n\n");
-		usleep(1000 * waitTime);
 	}
 
 
+	for (int port = 0; port < numPorts && generator.pattern == PATTERN_NONE; port++) {
+		fclose(ports[port].input);
+	}
 	for (int port = 0; port < numPorts; port++) {
-		printf("Freeing memory/closing file for port %d\n", port);
-
-		ilt_dada_config_cleanup(config[port]);
-		fclose(inputFiles[port]);
+		if (ports[port].io != NULL) {
+			lofar_udp_io_write_cleanup(ports[port].io, 1);
+		}
 	}
+	FREE_NOT_NULL(generator.noise);
+	ilt_dada_config_cleanup(config);
 
-	cleanup_initialise_port(serverInfo, -1);
-
+	return returnVal;
 }
@@ -0,0 +1,300 @@
+// Standard includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+
+// PSRDADA includes
+#include "ilt_dada.h"
+#include "lofar_cli_meta.h"
+
+// Metrics exporter references:
+// https://prometheus.io/docs/instrumenting/exposition_formats/
+// https://prometheus.io/docs/guides/node-exporter/#textfile-collector
+
+// The output buffer is sized from the number of ports in the segment; every port needs ~8.5kB at most (with 20 digit counters)
+#define EXPORTER_HEADER_LEN (4 * 1024)
+#define EXPORTER_PORT_LEN (16 * 1024)
+#define EXPORTER_UNAVAILABLE -1
+#define EXPORTER_TRUNCATED -2
+
+static volatile sig_atomic_t exporterRunning = 1;
+
+static void exporterStop(int signal) {
+	(void) signal;
+	exporterRunning = 0;
+}
+
+void helpMessages() {
+	printf("ILTDada metrics exporter (CLI v%s, lib %s)\n\n", ILTD_CLI_VERSION, ILTD_VERSION);
+
+	printf("-h				: Display this message\n");
+	printf("-M (str)		: Metrics shared memory segment, as passed to ilt_dada -M (e.g., /iltdada)\n");
+	printf("-1				: Print the metrics to stdout once, then exit\n");
+	printf("-o (str)		: Write the metrics to a file (atomically replaced on every update, e.g., for the node_exporter textfile collector)\n");
+	printf("-P (int)		: Serve the metrics over HTTP on the given TCP port (e.g., 9130)\n");
+	printf("-i (float)		: Seconds between file updates (default: 5)\n\n");
+}
+
+/**
+ * @brief      Format the current metrics, (re)attaching to the segment as needed,
+ *             and growing the output buffer to fit the segment's ports
+ *
+ * @param[in]  name     The segment name
+ * @param      metrics  The attached segment (updated)
+ * @param      output   The output buffer (updated)
+ * @param      maxlen   The size of the output buffer (updated)
+ *
+ * @return     >=0: Length of the output, EXPORTER_UNAVAILABLE: Segment not
+ *             available, EXPORTER_TRUNCATED: Output truncated
+ */
+long exporterFormat(const char *name, const ilt_dada_metrics **metrics, char **output, size_t *maxlen) {
+	// The recorder invalidates the magic when it exits; drop the mapping and look for a new segment
+	if (*metrics != NULL && __atomic_load_n(&((*metrics)->magic), __ATOMIC_ACQUIRE) != ILTD_METRICS_MAGIC) {
+		ilt_dada_metrics_detach(*metrics);
+		*metrics = NULL;
+	}
+
+	if (*metrics == NULL && (*metrics = ilt_dada_metrics_attach(name)) == NULL) {
+		return EXPORTER_UNAVAILABLE;
+	}
+
+	const int numPorts = (*metrics)->numPorts < ILTD_METRICS_MAX_PORTS ? (*metrics)->numPorts : ILTD_METRICS_MAX_PORTS;
+	const size_t required = EXPORTER_HEADER_LEN + (size_t) numPorts * EXPORTER_PORT_LEN;
+	if (*maxlen < required) {
+		char *resized = realloc(*output, required);
+		if (resized == NULL) {
+			fprintf(stderr, "ERROR: Failed to allocate %zu byte output buffer for %d ports.\n", required, numPorts);
+			return EXPORTER_TRUNCATED;
+		}
+		*output = resized;
+		*maxlen = required;
+	}
+
+	const long length = ilt_dada_metrics_prometheus(*metrics, *output, *maxlen);
+	if (length < 0) {
+		fprintf(stderr, "ERROR: Metrics for %d ports did not fit in the %zu byte output buffer.\n", numPorts, *maxlen);
+		return EXPORTER_TRUNCATED;
+	}
+
+	return length;
+}
+
+/**
+ * @brief      Write the metrics to a file, via a temporary file so readers never
+ *             see a partial update
+ *
+ * @param[in]  outputFile  The output file
+ * @param[in]  output      The metrics text
+ * @param[in]  length      The length of the metrics text
+ *
+ * @return     0: Success, -1: Failure
+ */
+int exporterWriteFile(const char *outputFile, const char *output, long length) {
+	char tmpFile[DEF_STR_LEN + 8];
+	snprintf(tmpFile, sizeof(tmpFile), "%s.tmp", outputFile);
+
+	FILE *file = fopen(tmpFile, "w");
+	if (file == NULL) {
+		fprintf(stderr, "ERROR: Failed to open %s (errno %d: %s).\n", tmpFile, errno, strerror(errno));
+		return -1;
+	}
+
+	// Always close the file, even if the write failed
+	const size_t written = fwrite(output, sizeof(char), length, file);
+	const int writeErrno = errno;
+	if (fclose(file) != 0 || written != (size_t) length) {
+		const int errorNum = written != (size_t) length ? writeErrno : errno;
+		fprintf(stderr, "ERROR: Failed to write %s (errno %d: %s).\n", tmpFile, errorNum, strerror(errorNum));
+		return -1;
+	}
+
+	if (rename(tmpFile, outputFile) == -1) {
+		fprintf(stderr, "ERROR: Failed to replace %s (errno %d: %s).\n", outputFile, errno, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief      Answer a single HTTP request with the current metrics; every
+ *             path is treated as /metrics
+ *
+ * @param[in]  clientfd  The client socket
+ * @param[in]  output    The metrics text
+ * @param[in]  length    The length of the metrics text, or the exporterFormat
+ *                       error
+ */
+void exporterRespond(int clientfd, const char *output, long length) {
+	char request[1024], header[256];
+
+	// Wait for (and discard) the request; scrapers always send one before reading
+	struct timeval timeout = { .tv_sec = 1, .tv_usec = 0 };
+	setsockopt(clientfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	if (recv(clientfd, request, sizeof(request), 0) < 0) {
+		return;
+	}
+
+	int headerLen;
+	if (length >= 0) {
+		headerLen = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %ld\r\nConnection: close\r\n\r\n", length);
+	} else if (length == EXPORTER_TRUNCATED) {
+		output = "Metrics output truncated\n";
+		length = (long) strlen(output);
+		headerLen = snprintf(header, sizeof(header), "HTTP/1.0 500 Internal Server Error\r\nContent-Type: text/plain\r\nContent-Length: %ld\r\nConnection: close\r\n\r\n", length);
+	} else {
+		output = "Metrics segment not available\n";
+		length = (long) strlen(output);
+		headerLen = snprintf(header, sizeof(header), "HTTP/1.0 503 Service Unavailable\r\nContent-Type: text/plain\r\nContent-Length: %ld\r\nConnection: close\r\n\r\n", length);
+	}
+
+	if (send(clientfd, header, headerLen, MSG_NOSIGNAL) == headerLen) {
+		send(clientfd, output, length, MSG_NOSIGNAL);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	int inputOpt, once = 0, httpPort = -1;
+	float interval = 5.0f;
+	char metricsName[DEF_STR_LEN] = "", outputFile[DEF_STR_LEN] = "";
+	char *endPtr = NULL;
+
+	while ((inputOpt = getopt(argc, argv, "hM:1o:P:i:")) != -1) {
+		switch (inputOpt) {
+			case 'M':
+				strncpy(metricsName, optarg, DEF_STR_LEN - 1);
+				break;
+
+			case '1':
+				once = 1;
+				break;
+
+			case 'o':
+				strncpy(outputFile, optarg, DEF_STR_LEN - 1);
+				break;
+
+			case 'P':
+				httpPort = internal_strtoi(optarg, &endPtr);
+				if (checkOpt(inputOpt, optarg, endPtr)) { return 1; }
+				break;
+
+			case 'i':
+				interval = strtof(optarg, &endPtr);
+				if (checkOpt(inputOpt, optarg, endPtr)) { return 1; }
+				break;
+
+			case 'h':
+				helpMessages();
+				return 0;
+
+			default:
+				helpMessages();
+				return 1;
+		}
+	}
+
+	if (strcmp(metricsName, "") == 0) {
+		fprintf(stderr, "ERROR: A metrics segment must be provided (-M), exiting.\n");
+		return 1;
+	}
+
+	if (!once && strcmp(outputFile, "") == 0 && httpPort < 0) {
+		fprintf(stderr, "ERROR: No output requested (-1, -o or -P), exiting.\n");
+		return 1;
+	}
+
+	if (interval <= 0.0f) {
+		fprintf(stderr, "ERROR: Update interval must be positive (%f), exiting.\n", interval);
+		return 1;
+	}
+
+	// Allocated once the number of ports is known
+	char *output = NULL;
+	size_t outputLen = 0;
+	const ilt_dada_metrics *metrics = NULL;
+	long length;
+
+	if (once) {
+		if ((length = exporterFormat(metricsName, &metrics, &output, &outputLen)) < 0) {
+			if (length == EXPORTER_UNAVAILABLE) {
+				fprintf(stderr, "ERROR: Failed to read metrics segment %s (errno %d: %s).\n", metricsName, errno, strerror(errno));
+			}
+			ilt_dada_metrics_detach(metrics);
+			free(output);
+			return 1;
+		}
+		fwrite(output, sizeof(char), length, stdout);
+		ilt_dada_metrics_detach(metrics);
+		free(output);
+		return 0;
+	}
+
+	signal(SIGINT, exporterStop);
+	signal(SIGTERM, exporterStop);
+
+	int listenfd = -1;
+	if (httpPort >= 0) {
+		struct sockaddr_in address = { .sin_family = AF_INET, .sin_port = htons(httpPort), .sin_addr.s_addr = htonl(INADDR_ANY) };
+		const int enable = 1;
+		if ((listenfd = socket(AF_INET, SOCK_STREAM, 0)) == -1 ||
+			setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) == -1 ||
+			bind(listenfd, (struct sockaddr*) &address, sizeof(address)) == -1 ||
+			listen(listenfd, 8) == -1) {
+			fprintf(stderr, "ERROR: Failed to listen on port %d (errno %d: %s), exiting.\n", httpPort, errno, strerror(errno));
+			if (listenfd != -1) {
+				close(listenfd);
+			}
+			free(output);
+			return 1;
+		}
+		printf("Serving metrics from %s on port %d.\n", metricsName, httpPort);
+	}
+
+	struct timespec lastWrite = { 0 }, now;
+	while (exporterRunning) {
+		// Update the file on the requested interval
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		const double sinceWrite = (double) (now.tv_sec - lastWrite.tv_sec) + (double) (now.tv_nsec - lastWrite.tv_nsec) * 1e-9;
+		if (strcmp(outputFile, "") != 0 && sinceWrite >= interval) {
+			lastWrite = now;
+			if ((length = exporterFormat(metricsName, &metrics, &output, &outputLen)) >= 0) {
+				exporterWriteFile(outputFile, output, length);
+			}
+		}
+
+		if (listenfd == -1) {
+			ilt_dada_sleep(interval, 0);
+			continue;
+		}
+
+		// Wait for a scrape, or the next file update
+		fd_set readfds;
+		FD_ZERO(&readfds);
+		FD_SET(listenfd, &readfds);
+		struct timeval timeout = { .tv_sec = (long) interval, .tv_usec = (long) ((interval - (long) interval) * 1e6) };
+		if (select(listenfd + 1, &readfds, NULL, NULL, &timeout) < 1) {
+			continue;
+		}
+
+		const int clientfd = accept(listenfd, NULL, NULL);
+		if (clientfd == -1) {
+			continue;
+		}
+		length = exporterFormat(metricsName, &metrics, &output, &outputLen);
+		exporterRespond(clientfd, output, length);
+		close(clientfd);
+	}
+
+	if (listenfd != -1) {
+		close(listenfd);
+	}
+	ilt_dada_metrics_detach(metrics);
+	free(output);
+
+	return 0;
+}